@@ -1,6 +1,8 @@
 #define NOMINMAX
 
+#include <winsock2.h>  // Before windows.h, which would pull in the old winsock.h
 #include <windows.h>
+#include <afunix.h>
 #include <commctrl.h>
 #include <iostream>
 #include <string>
@@ -8,17 +10,35 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <regex>
 #include <algorithm>
 #include <filesystem>
 #include <chrono>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <optional>
+#include <cmath>
+#include <charconv>
 #include <functional>
 #include <psapi.h>
+#include <winioctl.h>
+#include <aclapi.h>
+#include <sddl.h>
 #include <fstream>
 #include <deque>
+#include <list>
+#include <sstream>
+#include <string_view>
+#include <cstdarg>
+#include <random>
 #pragma comment(lib, "psapi.lib")
+#pragma comment(lib, "shell32.lib")
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "advapi32.lib")
 
 // DirectX and ImGui includes
 #include <d3d11.h>
@@ -57,31 +77,377 @@ std::string wstring_to_string(const std::wstring& wstr) {
     return strTo;
 }
 
-class FastSearch {
+// Search instrumentation. Build with FASTSEARCH_NO_INSTRUMENTATION defined to compile it out entirely.
+#ifndef FASTSEARCH_NO_INSTRUMENTATION
+#define FASTSEARCH_INSTRUMENTATION 1
+#else
+#define FASTSEARCH_INSTRUMENTATION 0
+#endif
+
+enum class SearchPhase {
+    DirOpen,
+    DirEnumerate,
+    Match,
+    QueuePush,
+    QueuePop,
+    LockWait,
+    ResultAppend,
+    Count
+};
+
+const char* searchPhaseName(SearchPhase phase) {
+    static const char* names[] = {
+        "DirOpen", "DirEnumerate", "Match",
+        "QueuePush", "QueuePop", "LockWait", "ResultAppend"
+    };
+    return names[static_cast<size_t>(phase)];
+}
+
+// A timed span on one worker thread, exported as a Chrome trace "complete" event
+struct TraceSpan {
+    const char* name;
+    int64_t startNs;     // Relative to the search start
+    int64_t durationNs;
+    std::string detail;  // Directory path for slow directories, empty otherwise
+};
+
+// Counters for a single worker; padded so that workers never share a cache line
+struct alignas(64) ThreadStats {
+    static constexpr size_t PHASE_COUNT = static_cast<size_t>(SearchPhase::Count);
+    static constexpr size_t MAX_SPANS = 200000;
+
+    uint64_t phaseNanos[PHASE_COUNT] = {};
+    uint64_t phaseCalls[PHASE_COUNT] = {};
+    uint64_t directories = 0;
+    uint64_t files = 0;
+    uint64_t matches = 0;
+    uint64_t errors = 0;
+    uint64_t droppedSpans = 0;
+    std::vector<TraceSpan> spans;
+
+    void addPhase(SearchPhase phase, int64_t nanos) {
+        phaseNanos[static_cast<size_t>(phase)] += nanos;
+        phaseCalls[static_cast<size_t>(phase)]++;
+    }
+
+    void addSpan(const char* name, int64_t startNs, int64_t durationNs, std::string detail = {}) {
+        if (spans.size() >= MAX_SPANS) {
+            droppedSpans++;
+            return;
+        }
+        spans.push_back({ name, startNs, durationNs, std::move(detail) });
+    }
+};
+
+// Escape a UTF-8 string for use inside a JSON string literal
+std::string jsonEscape(const std::string& str) {
+    std::string out;
+    out.reserve(str.size() + 2);
+    for (unsigned char c : str) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char buffer[8];
+                snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                out += buffer;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    return out;
+}
+
+// Per-search statistics: one ThreadStats per worker, merged only when exported
+class SearchStats {
 private:
-    std::mutex mtx;
-    std::condition_variable cv;
-    std::queue<std::filesystem::path> workQueue;
-    std::vector<std::thread> threads;
-    std::atomic<bool>& searchInProgress;
-    std::atomic<int> activeThreads;
-    std::atomic<size_t> filesProcessed{ 0 };
-    std::atomic<size_t> matchesFound{ 0 };
-    std::string searchPattern;
+    std::vector<std::unique_ptr<ThreadStats>> threads;
+    std::chrono::steady_clock::time_point origin;
+    std::chrono::steady_clock::time_point finish;
+    mutable std::mutex eventMutex;
+    std::vector<std::string> events;  // Controller decisions and other notable events, in order
+
+public:
+    void reset(size_t threadCount, std::chrono::steady_clock::time_point start) {
+        threads.clear();
+        for (size_t i = 0; i < threadCount; ++i) {
+            threads.push_back(std::make_unique<ThreadStats>());
+        }
+        origin = start;
+        finish = start;
+        std::lock_guard<std::mutex> lock(eventMutex);
+        events.clear();
+    }
+
+    void markFinished() { finish = std::chrono::steady_clock::now(); }
+
+    void addEvent(std::string event) {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        events.push_back(std::move(event));
+    }
+
+    std::vector<std::string> getEvents() const {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        return events;
+    }
+
+    ThreadStats& forThread(size_t index) { return *threads[index]; }
+    size_t threadCount() const { return threads.size(); }
+    std::chrono::steady_clock::time_point getOrigin() const { return origin; }
+    std::chrono::steady_clock::time_point getFinish() const { return finish; }
+
+    int64_t sinceOrigin(std::chrono::steady_clock::time_point t) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin).count();
+    }
+
+    ThreadStats totals() const {
+        ThreadStats total;
+        for (const auto& t : threads) {
+            for (size_t p = 0; p < ThreadStats::PHASE_COUNT; ++p) {
+                total.phaseNanos[p] += t->phaseNanos[p];
+                total.phaseCalls[p] += t->phaseCalls[p];
+            }
+            total.directories += t->directories;
+            total.files += t->files;
+            total.matches += t->matches;
+            total.errors += t->errors;
+            total.droppedSpans += t->droppedSpans;
+        }
+        return total;
+    }
+
+    std::string toJson() const {
+        auto writeCounters = [](std::ostringstream& out, const ThreadStats& t) {
+            out << "\"directories\":" << t.directories
+                << ",\"files\":" << t.files
+                << ",\"matches\":" << t.matches
+                << ",\"errors\":" << t.errors
+                << ",\"phases\":{";
+            for (size_t p = 0; p < ThreadStats::PHASE_COUNT; ++p) {
+                if (p > 0) out << ",";
+                out << "\"" << searchPhaseName(static_cast<SearchPhase>(p)) << "\":{\"calls\":"
+                    << t.phaseCalls[p] << ",\"ns\":" << t.phaseNanos[p] << "}";
+            }
+            out << "}";
+        };
+
+        std::ostringstream out;
+        out << "{\"instrumented\":" << (FASTSEARCH_INSTRUMENTATION ? "true" : "false")
+            << ",\"elapsedNs\":" << sinceOrigin(finish)
+            << ",\"totals\":{";
+        writeCounters(out, totals());
+        out << "},\"threads\":[";
+        for (size_t i = 0; i < threads.size(); ++i) {
+            if (i > 0) out << ",";
+            out << "{\"index\":" << i << ",";
+            writeCounters(out, *threads[i]);
+            out << ",\"spans\":" << threads[i]->spans.size()
+                << ",\"droppedSpans\":" << threads[i]->droppedSpans << "}";
+        }
+        out << "],\"events\":[";
+        std::vector<std::string> eventsCopy = getEvents();
+        for (size_t i = 0; i < eventsCopy.size(); ++i) {
+            if (i > 0) out << ",";
+            out << "\"" << jsonEscape(eventsCopy[i]) << "\"";
+        }
+        out << "]}";
+        return out.str();
+    }
+
+    // Chrome trace-event format, viewable in chrome://tracing or Perfetto
+    std::string toChromeTrace() const {
+        std::ostringstream out;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        for (size_t i = 0; i < threads.size(); ++i) {
+            if (!first) out << ",";
+            first = false;
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+                << ",\"args\":{\"name\":\"worker " << i << "\"}}";
+            for (const auto& span : threads[i]->spans) {
+                out << ",{\"name\":\"" << span.name << "\",\"cat\":\"search\",\"ph\":\"X\",\"pid\":1,\"tid\":" << i
+                    << ",\"ts\":" << span.startNs / 1000.0
+                    << ",\"dur\":" << span.durationNs / 1000.0;
+                if (!span.detail.empty()) {
+                    out << ",\"args\":{\"path\":\"" << jsonEscape(span.detail) << "\"}";
+                }
+                out << "}";
+            }
+        }
+        out << "]}";
+        return out.str();
+    }
+};
+
+// Accumulates the time spent in a scope into one phase of a worker's stats
+class ScopedPhase {
+private:
+    ThreadStats& stats;
+    SearchPhase phase;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    ScopedPhase(ThreadStats& stats, SearchPhase phase)
+        : stats(stats), phase(phase), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedPhase() {
+        stats.addPhase(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+};
+
+#define FS_CONCAT_INNER(a, b) a##b
+#define FS_CONCAT(a, b) FS_CONCAT_INNER(a, b)
+#if FASTSEARCH_INSTRUMENTATION
+    #define FS_PHASE(stats, phase) ScopedPhase FS_CONCAT(scopedPhase_, __LINE__)(stats, phase)
+    #define FS_COUNT(stats, counter) (++(stats).counter)
+    #define FS_NOW() std::chrono::steady_clock::now()
+#else
+    #define FS_PHASE(stats, phase) ((void)0)
+    #define FS_COUNT(stats, counter) ((void)0)
+    #define FS_NOW() std::chrono::steady_clock::time_point()
+#endif
+
+// Unicode simple case folding (CaseFolding.txt statuses C and S) for the BMP.
+// Each range maps first..last, every `stride` code points, by adding `delta`.
+struct CaseFoldRange {
+    uint16_t first;
+    uint16_t last;
+    int32_t delta;
+    uint8_t stride;
+};
+
+static const CaseFoldRange CASE_FOLD_RANGES[] = {
+    // Latin
+    { 0x0041, 0x005A, 32, 1 }, { 0x00B5, 0x00B5, 775, 1 }, { 0x00C0, 0x00D6, 32, 1 }, { 0x00D8, 0x00DE, 32, 1 },
+    { 0x0100, 0x012E, 1, 2 }, { 0x0132, 0x0136, 1, 2 }, { 0x0139, 0x0147, 1, 2 }, { 0x014A, 0x0176, 1, 2 },
+    { 0x0178, 0x0178, -121, 1 }, { 0x0179, 0x017D, 1, 2 }, { 0x017F, 0x017F, -268, 1 },
+    { 0x0181, 0x0181, 210, 1 }, { 0x0182, 0x0184, 1, 2 }, { 0x0186, 0x0186, 206, 1 }, { 0x0187, 0x0187, 1, 1 },
+    { 0x0189, 0x018A, 205, 1 }, { 0x018B, 0x018B, 1, 1 }, { 0x018E, 0x018E, 79, 1 }, { 0x018F, 0x018F, 202, 1 },
+    { 0x0190, 0x0190, 203, 1 }, { 0x0191, 0x0191, 1, 1 }, { 0x0193, 0x0193, 205, 1 }, { 0x0194, 0x0194, 207, 1 },
+    { 0x0196, 0x0196, 211, 1 }, { 0x0197, 0x0197, 209, 1 }, { 0x0198, 0x0198, 1, 1 }, { 0x019C, 0x019C, 211, 1 },
+    { 0x019D, 0x019D, 213, 1 }, { 0x019F, 0x019F, 214, 1 }, { 0x01A0, 0x01A4, 1, 2 }, { 0x01A6, 0x01A6, 218, 1 },
+    { 0x01A7, 0x01A7, 1, 1 }, { 0x01A9, 0x01A9, 218, 1 }, { 0x01AC, 0x01AC, 1, 1 }, { 0x01AE, 0x01AE, 218, 1 },
+    { 0x01AF, 0x01AF, 1, 1 }, { 0x01B1, 0x01B2, 217, 1 }, { 0x01B3, 0x01B5, 1, 2 }, { 0x01B7, 0x01B7, 219, 1 },
+    { 0x01B8, 0x01B8, 1, 1 }, { 0x01BC, 0x01BC, 1, 1 }, { 0x01C4, 0x01C4, 2, 1 }, { 0x01C5, 0x01C5, 1, 1 },
+    { 0x01C7, 0x01C7, 2, 1 }, { 0x01C8, 0x01C8, 1, 1 }, { 0x01CA, 0x01CA, 2, 1 }, { 0x01CB, 0x01DB, 1, 2 },
+    { 0x01DE, 0x01EE, 1, 2 }, { 0x01F1, 0x01F1, 2, 1 }, { 0x01F2, 0x01F4, 1, 2 }, { 0x01F6, 0x01F6, -97, 1 },
+    { 0x01F7, 0x01F7, -56, 1 }, { 0x01F8, 0x021E, 1, 2 }, { 0x0220, 0x0220, -130, 1 }, { 0x0222, 0x0232, 1, 2 },
+    { 0x023A, 0x023A, 10795, 1 }, { 0x023B, 0x023B, 1, 1 }, { 0x023D, 0x023D, -163, 1 }, { 0x023E, 0x023E, 10792, 1 },
+    { 0x0241, 0x0241, 1, 1 }, { 0x0243, 0x0243, -195, 1 }, { 0x0244, 0x0244, 69, 1 }, { 0x0245, 0x0245, 71, 1 },
+    { 0x0246, 0x024E, 1, 2 },
+    // Greek and Coptic
+    { 0x0345, 0x0345, 116, 1 }, { 0x0370, 0x0372, 1, 2 }, { 0x0376, 0x0376, 1, 1 }, { 0x037F, 0x037F, 116, 1 },
+    { 0x0386, 0x0386, 38, 1 }, { 0x0388, 0x038A, 37, 1 }, { 0x038C, 0x038C, 64, 1 }, { 0x038E, 0x038F, 63, 1 },
+    { 0x0391, 0x03A1, 32, 1 }, { 0x03A3, 0x03AB, 32, 1 }, { 0x03C2, 0x03C2, 1, 1 }, { 0x03CF, 0x03CF, 8, 1 },
+    { 0x03D0, 0x03D0, -30, 1 }, { 0x03D1, 0x03D1, -25, 1 }, { 0x03D5, 0x03D5, -15, 1 }, { 0x03D6, 0x03D6, -22, 1 },
+    { 0x03D8, 0x03EE, 1, 2 }, { 0x03F0, 0x03F0, -54, 1 }, { 0x03F1, 0x03F1, -48, 1 }, { 0x03F4, 0x03F4, -60, 1 },
+    { 0x03F5, 0x03F5, -64, 1 }, { 0x03F7, 0x03F7, 1, 1 }, { 0x03F9, 0x03F9, -7, 1 }, { 0x03FA, 0x03FA, 1, 1 },
+    { 0x03FD, 0x03FF, -130, 1 },
+    // Cyrillic and Armenian
+    { 0x0400, 0x040F, 80, 1 }, { 0x0410, 0x042F, 32, 1 }, { 0x0460, 0x0480, 1, 2 }, { 0x048A, 0x04BE, 1, 2 },
+    { 0x04C0, 0x04C0, 15, 1 }, { 0x04C1, 0x04CD, 1, 2 }, { 0x04D0, 0x052E, 1, 2 }, { 0x0531, 0x0556, 48, 1 },
+    // Georgian, Cherokee, Cyrillic Extended-C
+    { 0x10A0, 0x10C5, 7264, 1 }, { 0x10C7, 0x10C7, 7264, 1 }, { 0x10CD, 0x10CD, 7264, 1 },
+    { 0x13F8, 0x13FD, -8, 1 }, { 0x1C80, 0x1C80, -6222, 1 }, { 0x1C81, 0x1C81, -6221, 1 },
+    { 0x1C82, 0x1C82, -6212, 1 }, { 0x1C83, 0x1C84, -6210, 1 }, { 0x1C85, 0x1C85, -6211, 1 },
+    { 0x1C86, 0x1C86, -6204, 1 }, { 0x1C87, 0x1C87, -6180, 1 }, { 0x1C88, 0x1C88, 35267, 1 },
+    { 0x1C90, 0x1CBA, -3008, 1 }, { 0x1CBD, 0x1CBF, -3008, 1 },
+    // Latin Extended Additional
+    { 0x1E00, 0x1E94, 1, 2 }, { 0x1E9B, 0x1E9B, -58, 1 }, { 0x1E9E, 0x1E9E, -7615, 1 }, { 0x1EA0, 0x1EFE, 1, 2 },
+    // Greek Extended
+    { 0x1F08, 0x1F0F, -8, 1 }, { 0x1F18, 0x1F1D, -8, 1 }, { 0x1F28, 0x1F2F, -8, 1 }, { 0x1F38, 0x1F3F, -8, 1 },
+    { 0x1F48, 0x1F4D, -8, 1 }, { 0x1F59, 0x1F5F, -8, 2 }, { 0x1F68, 0x1F6F, -8, 1 }, { 0x1F88, 0x1F8F, -8, 1 },
+    { 0x1F98, 0x1F9F, -8, 1 }, { 0x1FA8, 0x1FAF, -8, 1 }, { 0x1FB8, 0x1FB9, -8, 1 }, { 0x1FBA, 0x1FBB, -74, 1 },
+    { 0x1FBC, 0x1FBC, -9, 1 }, { 0x1FBE, 0x1FBE, -7173, 1 }, { 0x1FC8, 0x1FCB, -86, 1 }, { 0x1FCC, 0x1FCC, -9, 1 },
+    { 0x1FD8, 0x1FD9, -8, 1 }, { 0x1FDA, 0x1FDB, -100, 1 }, { 0x1FE8, 0x1FE9, -8, 1 }, { 0x1FEA, 0x1FEB, -112, 1 },
+    { 0x1FEC, 0x1FEC, -7, 1 }, { 0x1FF8, 0x1FF9, -128, 1 }, { 0x1FFA, 0x1FFB, -126, 1 }, { 0x1FFC, 0x1FFC, -9, 1 },
+    // Letterlike symbols, number forms, enclosed alphanumerics
+    { 0x2126, 0x2126, -7517, 1 }, { 0x212A, 0x212A, -8383, 1 }, { 0x212B, 0x212B, -8262, 1 }, { 0x2132, 0x2132, 28, 1 },
+    { 0x2160, 0x216F, 16, 1 }, { 0x2183, 0x2183, 1, 1 }, { 0x24B6, 0x24CF, 26, 1 },
+    // Glagolitic, Latin Extended-C, Coptic
+    { 0x2C00, 0x2C2F, 48, 1 }, { 0x2C60, 0x2C60, 1, 1 }, { 0x2C62, 0x2C62, -10743, 1 }, { 0x2C63, 0x2C63, -3814, 1 },
+    { 0x2C64, 0x2C64, -10727, 1 }, { 0x2C67, 0x2C6B, 1, 2 }, { 0x2C6D, 0x2C6D, -10780, 1 }, { 0x2C6E, 0x2C6E, -10749, 1 },
+    { 0x2C6F, 0x2C6F, -10783, 1 }, { 0x2C70, 0x2C70, -10782, 1 }, { 0x2C72, 0x2C72, 1, 1 }, { 0x2C75, 0x2C75, 1, 1 },
+    { 0x2C7E, 0x2C7F, -10815, 1 }, { 0x2C80, 0x2CE2, 1, 2 }, { 0x2CEB, 0x2CED, 1, 2 }, { 0x2CF2, 0x2CF2, 1, 1 },
+    // Cyrillic Extended-B, Latin Extended-D
+    { 0xA640, 0xA66C, 1, 2 }, { 0xA680, 0xA69A, 1, 2 }, { 0xA722, 0xA72E, 1, 2 }, { 0xA732, 0xA76E, 1, 2 },
+    { 0xA779, 0xA77B, 1, 2 }, { 0xA77D, 0xA77D, -35332, 1 }, { 0xA77E, 0xA786, 1, 2 }, { 0xA78B, 0xA78B, 1, 1 },
+    { 0xA78D, 0xA78D, -42280, 1 }, { 0xA790, 0xA792, 1, 2 }, { 0xA796, 0xA7A8, 1, 2 }, { 0xA7AA, 0xA7AA, -42308, 1 },
+    { 0xA7AB, 0xA7AB, -42319, 1 }, { 0xA7AC, 0xA7AC, -42315, 1 }, { 0xA7AD, 0xA7AD, -42305, 1 },
+    { 0xA7AE, 0xA7AE, -42308, 1 }, { 0xA7B0, 0xA7B0, -42258, 1 }, { 0xA7B1, 0xA7B1, -42282, 1 },
+    { 0xA7B2, 0xA7B2, -42261, 1 }, { 0xA7B3, 0xA7B3, 928, 1 }, { 0xA7B4, 0xA7C2, 1, 2 }, { 0xA7C4, 0xA7C4, -48, 1 },
+    { 0xA7C5, 0xA7C5, -42307, 1 }, { 0xA7C6, 0xA7C6, -35384, 1 }, { 0xA7C7, 0xA7C9, 1, 2 }, { 0xA7D0, 0xA7D0, 1, 1 },
+    { 0xA7D6, 0xA7D8, 1, 2 }, { 0xA7F5, 0xA7F5, 1, 1 },
+    // Cherokee Supplement folds to the Cherokee block, fullwidth Latin
+    { 0xAB70, 0xABBF, -38864, 1 }, { 0xFF21, 0xFF3A, 32, 1 },
+};
+
+// 64K-entry lookup built once from CASE_FOLD_RANGES. Surrogates map to themselves,
+// so supplementary-plane letters are compared exactly.
+const uint16_t* caseFoldTable() {
+    static const std::vector<uint16_t> table = [] {
+        std::vector<uint16_t> t(0x10000);
+        for (uint32_t c = 0; c < 0x10000; ++c) {
+            t[c] = static_cast<uint16_t>(c);
+        }
+        for (const auto& range : CASE_FOLD_RANGES) {
+            for (uint32_t c = range.first; c <= range.last; c += range.stride) {
+                t[c] = static_cast<uint16_t>(static_cast<int32_t>(c) + range.delta);
+            }
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+// Fold one UTF-16 code unit; ASCII never touches the table
+inline wchar_t foldCase(wchar_t c, const uint16_t* table) {
+    if (c < 0x80) {
+        return (c >= L'A' && c <= L'Z') ? static_cast<wchar_t>(c | 0x20) : c;
+    }
+    return static_cast<wchar_t>(table[static_cast<uint16_t>(c)]);
+}
+
+std::wstring foldCaseString(std::wstring_view str) {
+    const uint16_t* table = caseFoldTable();
+    std::wstring out(str);
+    for (auto& c : out) {
+        c = foldCase(c, table);
+    }
+    return out;
+}
+
+// The final component of a native path, without allocating
+std::wstring_view fileNameView(std::wstring_view path) {
+    size_t pos = path.find_last_of(L"\\/");
+    return pos == std::wstring_view::npos ? path : path.substr(pos + 1);
+}
+
+// Search pattern compiled once per search and matched directly against native
+// (UTF-16) names, so no entry is converted or allocated while matching. Both plain patterns
+// and regexes ignore case through the fold table; a regex sees the folded name.
+class NameMatcher {
+private:
+    std::wstring pattern;   // Case-folded when matching case-insensitively
+    std::vector<int> lps;
+    std::wregex regex;
     bool caseSensitive;
     bool useRegex;
-    bool shouldStop{ false };
-    std::vector<std::wstring> results;
-    std::chrono::steady_clock::time_point startTime;
-    std::chrono::steady_clock::time_point lastUpdateTime;
-    static constexpr auto UPDATE_INTERVAL = std::chrono::milliseconds(16); // ~60 FPS
+    bool valid = true;
+    const uint16_t* foldTable;
 
     // KMP algorithm helper functions
-    std::vector<int> computeLPSArray(const std::string& pattern) {
+    static std::vector<int> computeLPSArray(const std::wstring& pattern) {
         int len = 0;
         std::vector<int> lps(pattern.length(), 0);
-        int i = 1;
-        
+        size_t i = 1;
+
         while (i < pattern.length()) {
             if (pattern[i] == pattern[len]) {
                 len++;
@@ -99,465 +465,9607 @@ private:
         return lps;
     }
 
-    bool kmpSearch(const std::string& text, const std::string& pattern) {
-        if (pattern.empty()) return false;
-        
-        std::string textToSearch = text;
-        std::string patternToSearch = pattern;
-        
-        if (!caseSensitive) {
-            std::transform(textToSearch.begin(), textToSearch.end(), textToSearch.begin(), ::tolower);
-            std::transform(patternToSearch.begin(), patternToSearch.end(), patternToSearch.begin(), ::tolower);
-        }
-        
-        std::vector<int> lps = computeLPSArray(patternToSearch);
-        int i = 0; // index for text
-        int j = 0; // index for pattern
-        
-        while (i < textToSearch.length()) {
-            if (patternToSearch[j] == textToSearch[i]) {
+    template <bool Fold>
+    bool kmpSearch(std::wstring_view text) const {
+        const size_t n = text.length();
+        const size_t m = pattern.length();
+        if (m == 0 || n < m) return false;
+
+        size_t i = 0; // index for text
+        size_t j = 0; // index for pattern
+        while (i < n) {
+            wchar_t c = Fold ? foldCase(text[i], foldTable) : text[i];
+            if (pattern[j] == c) {
                 j++;
                 i++;
-            }
-            
-            if (j == patternToSearch.length()) {
-                return true;
-            } else if (i < textToSearch.length() && patternToSearch[j] != textToSearch[i]) {
-                if (j != 0) {
-                    j = lps[j - 1];
-                } else {
-                    i++;
-                }
+                if (j == m) return true;
+            } else if (j != 0) {
+                j = lps[j - 1];
+            } else {
+                i++;
             }
         }
         return false;
     }
 
-    bool matchesPattern(const std::string& filename) {
+    template <bool Fold>
+    uint32_t kmpAdvance(uint32_t j, std::wstring_view text) const {
+        const size_t m = pattern.length();
+        for (wchar_t raw : text) {
+            wchar_t c = Fold ? foldCase(raw, foldTable) : raw;
+            while (j != 0 && pattern[j] != c) {
+                j = lps[j - 1];
+            }
+            if (pattern[j] == c && ++j == m) return MATCHED;
+        }
+        return j;
+    }
+
+    // Folds a regex's own characters and keeps each escaped one as written, so \D, \S or
+    // \W keep their meaning
+    static std::wstring foldRegex(const std::wstring& pattern) {
+        const uint16_t* table = caseFoldTable();
+        std::wstring out(pattern);
+        for (size_t i = 0; i < out.size(); ++i) {
+            if (out[i] == L'\\') {
+                ++i;
+            } else {
+                out[i] = foldCase(out[i], table);
+            }
+        }
+        return out;
+    }
+
+public:
+    // A path can be matched a piece at a time: advance() carries the KMP state across
+    // pieces, so a child continues from its parent's state and scans only its own name.
+    // MATCHED is final, since every path below one that contains the pattern does too.
+    static constexpr uint32_t MATCHED = UINT32_MAX;
+
+    NameMatcher(const std::string& utf8Pattern, bool caseSensitive, bool useRegex)
+        : caseSensitive(caseSensitive), useRegex(useRegex), foldTable(caseFoldTable()) {
+        std::wstring wide = string_to_wstring(utf8Pattern);
         if (useRegex) {
             try {
-                std::regex pattern(searchPattern,
-                    caseSensitive ? std::regex::ECMAScript : std::regex::ECMAScript | std::regex::icase);
-                return std::regex_search(filename, pattern);
+                regex.assign(caseSensitive ? wide : foldRegex(wide), std::regex::ECMAScript);
             }
             catch (const std::regex_error&) {
-                return false;
+                valid = false;
             }
         } else {
-            return kmpSearch(filename, searchPattern);
+            pattern = caseSensitive ? wide : foldCaseString(wide);
+            lps = computeLPSArray(pattern);
         }
     }
 
-    void searchWorker() {
-        const auto YIELD_INTERVAL = std::chrono::milliseconds(1);
-        auto lastYield = std::chrono::steady_clock::now();
-        
-        while (!shouldStop) {
-            std::filesystem::path currentPath;
-            {
-                std::unique_lock<std::mutex> lock(mtx);
-                if (workQueue.empty()) {
-                    if (--activeThreads == 0) {
-                        searchInProgress.store(false);
-                    }
-                    break;
-                }
-                currentPath = workQueue.front();
-                workQueue.pop();
+    bool matches(std::wstring_view text) const {
+        if (!valid) return false;
+        if (useRegex) {
+            if (caseSensitive) return std::regex_search(text.begin(), text.end(), regex);
+            thread_local std::wstring folded;
+            folded.assign(text.begin(), text.end());
+            for (auto& c : folded) {
+                c = foldCase(c, foldTable);
             }
+            return std::regex_search(folded.cbegin(), folded.cend(), regex);
+        }
+        return caseSensitive ? kmpSearch<false>(text) : kmpSearch<true>(text);
+    }
 
-            try {
-                for (const auto& entry : std::filesystem::directory_iterator(currentPath)) {
-                    if (!searchInProgress.load()) break;
-
-                    // Periodically yield to reduce CPU usage
-                    auto now = std::chrono::steady_clock::now();
-                    if (now - lastYield > YIELD_INTERVAL) {
-                        std::this_thread::yield();
-                        lastYield = now;
-                    }
+    // The state after text, starting from state (0 for an empty path). Regexes have no
+    // resumable state and never reach MATCHED.
+    uint32_t advance(uint32_t state, std::wstring_view text) const {
+        if (state == MATCHED || !valid || useRegex || pattern.empty()) return state;
+        return caseSensitive ? kmpAdvance<false>(state, text) : kmpAdvance<true>(state, text);
+    }
 
-                    if (entry.is_directory()) {
-                        std::lock_guard<std::mutex> lock(mtx);
-                        workQueue.push(entry.path());
-                    } else {
-                        std::string filename = wstring_to_string(entry.path().filename().wstring());
-                        bool matches = false;
+    bool isRegex() const { return useRegex; }
+    bool isValid() const { return valid; }
+};
 
-                        // First try to match the filename
-                        if (matchesPattern(filename)) {
-                            matches = true;
-                        }
-                        // If no match and not using regex, try to match against the full path
-                        else if (!useRegex) {
-                            std::string fullPath = wstring_to_string(entry.path().wstring());
-                            if (matchesPattern(fullPath)) {
-                                matches = true;
-                            }
-                        }
+// Interned file names: every distinct name is stored once in a UTF-16 blob and referred
+// to by a dense 32-bit ID. Not thread-safe; callers serialize intern().
+class NameTable {
+private:
+    std::vector<wchar_t> blob;
+    std::vector<uint32_t> offsets{ 0 };  // Name i is blob[offsets[i], offsets[i + 1])
+    std::vector<uint32_t> slots;         // Open-addressed hash of ID + 1; 0 marks an empty slot
 
-                        if (matches) {
-                            ++matchesFound;
-                            std::lock_guard<std::mutex> lock(mtx);
-                            results.push_back(entry.path().wstring());
-                        }
-                        ++filesProcessed;
-                    }
-                }
-            }
-            catch (const std::exception&) {
-                // Skip inaccessible directories
+    static uint64_t hashName(std::wstring_view name) {
+        uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+        for (wchar_t c : name) {
+            hash = (hash ^ static_cast<uint16_t>(c)) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    void rehash(size_t slotCount) {
+        slots.assign(slotCount, 0);
+        for (uint32_t id = 0; id < size(); ++id) {
+            size_t slot = hashName(name(id)) & (slotCount - 1);
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & (slotCount - 1);
             }
+            slots[slot] = id + 1;
         }
     }
 
 public:
-    FastSearch(const std::string& pattern, bool caseSensitive, bool useRegex, std::atomic<bool>& searchInProgress)
-        : searchPattern(pattern), caseSensitive(caseSensitive), useRegex(useRegex),
-        searchInProgress(searchInProgress), activeThreads(0) {}
+    uint32_t intern(std::wstring_view text) {
+        // Keep the load factor at or below one half
+        if ((size() + 1) * 2 > slots.size()) {
+            rehash(std::max<size_t>(1024, slots.size() * 2));
+        }
+        size_t mask = slots.size() - 1;
+        size_t slot = hashName(text) & mask;
+        while (slots[slot] != 0) {
+            uint32_t id = slots[slot] - 1;
+            if (name(id) == text) return id;
+            slot = (slot + 1) & mask;
+        }
+        uint32_t id = static_cast<uint32_t>(size());
+        blob.insert(blob.end(), text.begin(), text.end());
+        offsets.push_back(static_cast<uint32_t>(blob.size()));
+        slots[slot] = id + 1;
+        return id;
+    }
 
-    ~FastSearch() {
-        shouldStop = true;
-        cv.notify_all();
-        waitForCompletion();
+    std::wstring_view name(uint32_t id) const {
+        return std::wstring_view(blob.data() + offsets[id], offsets[id + 1] - offsets[id]);
     }
 
-    void search(const std::wstring& startPath) {
-        waitForCompletion();
-        
-        shouldStop = false;
-        startTime = std::chrono::steady_clock::now();
-        lastUpdateTime = startTime;
-        filesProcessed = 0;
-        matchesFound = 0;
-        results.clear();
+    size_t size() const { return offsets.size() - 1; }
+
+    size_t memoryBytes() const {
+        return blob.capacity() * sizeof(wchar_t) + offsets.capacity() * sizeof(uint32_t) +
+            slots.capacity() * sizeof(uint32_t);
+    }
+};
 
-        unsigned int threadCount = std::thread::hardware_concurrency();
-        if (threadCount == 0) threadCount = 4;
+// Trigram index over a NameTable. Each gram is three case-folded UTF-16 units; its posting
+// list holds the ascending IDs of the names containing it, delta and LEB128 varint encoded.
+// A query's candidates are the intersection of its grams' lists; they are a superset of
+// the real matches, so the caller still verifies each with NameMatcher.
+class TrigramIndex {
+private:
+    std::vector<uint64_t> grams;         // Sorted, three units packed into the low 48 bits
+    std::vector<uint32_t> postingStart;  // Byte offset of each gram's list in postings, plus an end entry
+    std::vector<uint32_t> postingCount;
+    std::vector<uint8_t> postings;
+    size_t indexedNames = 0;
 
-        workQueue.push(startPath);
-        activeThreads.store(threadCount);
+    static uint64_t packGram(const wchar_t* units) {
+        return (static_cast<uint64_t>(static_cast<uint16_t>(units[0])) << 32) |
+            (static_cast<uint64_t>(static_cast<uint16_t>(units[1])) << 16) |
+            static_cast<uint64_t>(static_cast<uint16_t>(units[2]));
+    }
 
-        for (unsigned int i = 0; i < threadCount; ++i) {
-            threads.emplace_back(&FastSearch::searchWorker, this);
+    static void appendVarint(std::vector<uint8_t>& out, uint32_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
         }
+        out.push_back(static_cast<uint8_t>(value));
     }
 
-    void waitForCompletion() {
-        for (auto& thread : threads) {
-            if (thread.joinable()) {
-                thread.join();
-            }
+    static uint32_t readVarint(const uint8_t*& p) {
+        uint32_t value = 0;
+        int shift = 0;
+        while (*p & 0x80) {
+            value |= static_cast<uint32_t>(*p++ & 0x7F) << shift;
+            shift += 7;
         }
-        threads.clear();
+        value |= static_cast<uint32_t>(*p++) << shift;
+        return value;
     }
 
-    // Getters for UI
-    size_t getFilesProcessed() const { return filesProcessed; }
-    size_t getMatchesFound() const { return matchesFound; }
-    bool isSearching() const { return searchInProgress; }
-    const std::vector<std::wstring>& getResults() const { return results; }
-    std::chrono::steady_clock::time_point getStartTime() const { return startTime; }
-    size_t getQueueSize() const {
-        std::lock_guard<std::mutex> lock(const_cast<std::mutex&>(mtx));
-        return workQueue.size();
+    // Index of a gram in grams, or -1 if no name contains it
+    ptrdiff_t findGram(uint64_t gram) const {
+        auto it = std::lower_bound(grams.begin(), grams.end(), gram);
+        return (it != grams.end() && *it == gram) ? it - grams.begin() : -1;
     }
-};
 
-// Performance monitoring class
-class PerformanceMonitor {
-private:
-    static const size_t MAX_SAMPLES = 100;
-    static const size_t SMOOTHING_WINDOW = 3;  // Number of samples to average
-    std::vector<float> cpuHistory;
-    std::vector<float> ramHistory;
-    HANDLE processHandle;
-    ULARGE_INTEGER lastCPU, lastSysCPU, lastUserCPU;
-    int numProcessors;
-    std::chrono::steady_clock::time_point lastUpdate;
+public:
+    void build(const NameTable& names) {
+        const uint16_t* table = caseFoldTable();
+        std::unordered_map<uint64_t, std::vector<uint32_t>> lists;
+        std::vector<uint64_t> nameGrams;
+        std::wstring folded;
+        for (uint32_t id = 0; id < names.size(); ++id) {
+            std::wstring_view name = names.name(id);
+            folded.assign(name.begin(), name.end());
+            for (auto& c : folded) {
+                c = foldCase(c, table);
+            }
+            nameGrams.clear();
+            for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+                nameGrams.push_back(packGram(folded.data() + i));
+            }
+            std::sort(nameGrams.begin(), nameGrams.end());
+            nameGrams.erase(std::unique(nameGrams.begin(), nameGrams.end()), nameGrams.end());
+            // IDs arrive in ascending order, so every list stays sorted
+            for (uint64_t gram : nameGrams) {
+                lists[gram].push_back(id);
+            }
+        }
 
-    void InitCPUMonitor() {
-        SYSTEM_INFO sysInfo;
-        FILETIME ftime, fsys, fuser;
+        grams.clear();
+        grams.reserve(lists.size());
+        for (const auto& [gram, ids] : lists) {
+            grams.push_back(gram);
+        }
+        std::sort(grams.begin(), grams.end());
 
-        GetSystemInfo(&sysInfo);
-        numProcessors = sysInfo.dwNumberOfProcessors;
+        postings.clear();
+        postingStart.assign(1, 0);
+        postingCount.clear();
+        for (uint64_t gram : grams) {
+            const auto& ids = lists[gram];
+            uint32_t previous = 0;
+            for (uint32_t id : ids) {
+                appendVarint(postings, id - previous);
+                previous = id;
+            }
+            postingStart.push_back(static_cast<uint32_t>(postings.size()));
+            postingCount.push_back(static_cast<uint32_t>(ids.size()));
+        }
+        postings.shrink_to_fit();
+        indexedNames = names.size();
+    }
 
-        GetSystemTimeAsFileTime(&ftime);
-        memcpy(&lastCPU, &ftime, sizeof(FILETIME));
+    // Candidate IDs for names containing every literal. Returns false when no literal is
+    // long enough to form a gram, in which case the index can't narrow the search.
+    bool candidates(const std::vector<std::wstring>& literals, std::vector<uint32_t>& out) const {
+        const uint16_t* table = caseFoldTable();
+        std::vector<uint64_t> queryGrams;
+        for (const auto& literal : literals) {
+            std::wstring folded = literal;
+            for (auto& c : folded) {
+                c = foldCase(c, table);
+            }
+            for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+                queryGrams.push_back(packGram(folded.data() + i));
+            }
+        }
+        out.clear();
+        if (queryGrams.empty()) return false;
+        std::sort(queryGrams.begin(), queryGrams.end());
+        queryGrams.erase(std::unique(queryGrams.begin(), queryGrams.end()), queryGrams.end());
 
-        processHandle = GetCurrentProcess();
-        GetProcessTimes(processHandle, &ftime, &ftime, &fsys, &fuser);
-        memcpy(&lastSysCPU, &fsys, sizeof(FILETIME));
-        memcpy(&lastUserCPU, &fuser, sizeof(FILETIME));
+        std::vector<ptrdiff_t> found;
+        for (uint64_t gram : queryGrams) {
+            ptrdiff_t index = findGram(gram);
+            if (index < 0) return true;  // A gram no name contains: no candidates
+            found.push_back(index);
+        }
+        // Start from the shortest list so every later step only shrinks the set
+        std::sort(found.begin(), found.end(), [&](ptrdiff_t a, ptrdiff_t b) {
+            return postingCount[a] < postingCount[b];
+        });
+
+        const uint8_t* p = postings.data() + postingStart[found[0]];
+        uint32_t id = 0;
+        for (uint32_t i = 0; i < postingCount[found[0]]; ++i) {
+            id += readVarint(p);
+            out.push_back(id);
+        }
+        for (size_t g = 1; g < found.size() && !out.empty(); ++g) {
+            const uint8_t* q = postings.data() + postingStart[found[g]];
+            uint32_t remaining = postingCount[found[g]];
+            uint32_t current = remaining > 0 ? readVarint(q) : 0;
+            size_t kept = 0;
+            for (uint32_t candidate : out) {
+                while (remaining > 0 && current < candidate) {
+                    if (--remaining > 0) current += readVarint(q);
+                }
+                if (remaining == 0) break;
+                if (current == candidate) out[kept++] = candidate;
+            }
+            out.resize(kept);
+        }
+        return true;
     }
 
-    double GetCPUUsage() {
-        FILETIME ftime, fsys, fuser;
-        ULARGE_INTEGER now, sys, user;
-        double percent;
+    size_t gramCount() const { return grams.size(); }
+    size_t memoryBytes() const {
+        return grams.capacity() * sizeof(uint64_t) + postingStart.capacity() * sizeof(uint32_t) +
+            postingCount.capacity() * sizeof(uint32_t) + postings.capacity();
+    }
+};
 
-        GetSystemTimeAsFileTime(&ftime);
-        memcpy(&now, &ftime, sizeof(FILETIME));
+// Literal runs every match of a pattern must contain, for narrowing by TrigramIndex.
+// Regex support is conservative: groups, classes and optional atoms end a run, and a
+// top-level alternation yields no literals at all.
+std::vector<std::wstring> requiredLiterals(const std::wstring& pattern, bool useRegex) {
+    if (!useRegex) return { pattern };
 
-        GetProcessTimes(processHandle, &ftime, &ftime, &fsys, &fuser);
-        memcpy(&sys, &fsys, sizeof(FILETIME));
-        memcpy(&user, &fuser, sizeof(FILETIME));
-        percent = (sys.QuadPart - lastSysCPU.QuadPart) +
-            (user.QuadPart - lastUserCPU.QuadPart);
-        percent /= (now.QuadPart - lastCPU.QuadPart);
-        percent /= numProcessors;
-        lastCPU = now;
-        lastUserCPU = user;
-        lastSysCPU = sys;
+    std::vector<std::wstring> literals;
+    std::wstring run;
+    auto endRun = [&]() {
+        if (!run.empty()) literals.push_back(run);
+        run.clear();
+    };
+    size_t i = 0;
+    while (i < pattern.size()) {
+        wchar_t c = pattern[i];
+        bool atomIsLiteral = false;
+        wchar_t literal = 0;
+        if (c == L'|') {
+            return {};
+        } else if (c == L'\\' && i + 1 < pattern.size()) {
+            wchar_t escaped = pattern[i + 1];
+            i += 2;
+            // Class escapes, anchors, control and numeric escapes aren't plain characters
+            if (wcschr(L"dDwWsSbBcxuk0123456789fnrtv", escaped) == nullptr) {
+                atomIsLiteral = true;
+                literal = escaped;
+            }
+        } else if (c == L'[') {
+            ++i;
+            if (i < pattern.size() && pattern[i] == L']') ++i;
+            while (i < pattern.size() && pattern[i] != L']') {
+                i += (pattern[i] == L'\\') ? 2 : 1;
+            }
+            ++i;
+        } else if (c == L'(') {
+            int depth = 0;
+            while (i < pattern.size()) {
+                if (pattern[i] == L'\\') { i += 2; continue; }
+                if (pattern[i] == L'(') ++depth;
+                if (pattern[i] == L')' && --depth == 0) { ++i; break; }
+                ++i;
+            }
+        } else if (c == L'.' || c == L'^' || c == L'$') {
+            ++i;
+        } else {
+            atomIsLiteral = true;
+            literal = c;
+            ++i;
+        }
 
-        return percent;
-    }
+        // A quantifier decides whether the atom is required
+        bool optional = false;
+        bool repeated = false;
+        if (i < pattern.size()) {
+            wchar_t q = pattern[i];
+            if (q == L'*' || q == L'?') {
+                optional = true;
+                ++i;
+            } else if (q == L'+') {
+                repeated = true;
+                ++i;
+            } else if (q == L'{') {
+                optional = true;
+                while (i < pattern.size() && pattern[i] != L'}') ++i;
+                ++i;
+            }
+            if ((optional || repeated) && i < pattern.size() && pattern[i] == L'?') ++i;  // Lazy
+        }
 
-    float SmoothValue(const std::vector<float>& history, size_t currentIndex) {
-        float sum = 0.0f;
-        int count = 0;
-        for (size_t i = 0; i < SMOOTHING_WINDOW && i <= currentIndex; i++) {
-            sum += history[currentIndex - i];
-            count++;
+        if (atomIsLiteral && !optional) {
+            run += literal;
+            if (repeated) endRun();
+        } else {
+            endRun();
         }
-        return sum / count;
     }
+    endRun();
+    return literals;
+}
 
-public:
-    PerformanceMonitor() : cpuHistory(MAX_SAMPLES, 0.0f), ramHistory(MAX_SAMPLES, 0.0f) {
-        processHandle = GetCurrentProcess();
-        InitCPUMonitor();
+// Storage behind a mount point, which decides how many concurrent directory reads pay off
+enum class StorageKind {
+    SolidState,
+    Rotational,
+    Network,
+    Unknown
+};
+
+const char* storageKindName(StorageKind kind) {
+    switch (kind) {
+    case StorageKind::SolidState: return "SSD";
+    case StorageKind::Rotational: return "HDD";
+    case StorageKind::Network: return "Network";
+    default: return "Unknown";
     }
+}
 
-    ~PerformanceMonitor() {
-        CloseHandle(processHandle);
+// Mount point ("C:\", "C:\mnt\data\", "\\server\share\") containing a path
+std::wstring volumePathOf(const std::wstring& path) {
+    wchar_t buffer[MAX_PATH];
+    if (GetVolumePathNameW(path.c_str(), buffer, MAX_PATH)) {
+        return buffer;
     }
+    return path;
+}
 
-    void Update() {
-        // Update CPU usage with smoothing
-        float rawCpuUsage = GetCPUUsage();
-        cpuHistory.erase(cpuHistory.begin());
-        cpuHistory.push_back(rawCpuUsage);
-        
-        // Update RAM usage
-        PROCESS_MEMORY_COUNTERS_EX pmc;
-        GetProcessMemoryInfo(processHandle, (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc));
-        float ramUsage = static_cast<float>(pmc.WorkingSetSize) / (1024.0f * 1024.0f); // Convert to MB
+StorageKind detectStorageKind(const std::wstring& mountPoint) {
+    UINT driveType = GetDriveTypeW(mountPoint.c_str());
+    if (driveType == DRIVE_REMOTE) return StorageKind::Network;
+    if (driveType == DRIVE_RAMDISK) return StorageKind::SolidState;
 
-        ramHistory.erase(ramHistory.begin());
+    // Ask the volume's device whether it incurs a seek penalty
+    wchar_t volumeName[MAX_PATH];
+    if (!GetVolumeNameForVolumeMountPointW(mountPoint.c_str(), volumeName, MAX_PATH)) {
+        return StorageKind::Unknown;
+    }
+    std::wstring device = volumeName;
+    if (!device.empty() && device.back() == L'\\') {
+        device.pop_back();
+    }
+    HANDLE handle = CreateFileW(device.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, 0, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return StorageKind::Unknown;
+
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageDeviceSeekPenaltyProperty;
+    query.QueryType = PropertyStandardQuery;
+    DEVICE_SEEK_PENALTY_DESCRIPTOR penalty = {};
+    DWORD bytesReturned = 0;
+    BOOL ok = DeviceIoControl(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+        &penalty, sizeof(penalty), &bytesReturned, nullptr);
+    CloseHandle(handle);
+    if (!ok || bytesReturned < sizeof(penalty)) return StorageKind::Unknown;
+    return penalty.IncursSeekPenalty ? StorageKind::Rotational : StorageKind::SolidState;
+}
+
+// What a worker pool did during one controller interval
+struct ControllerSample {
+    double seconds;          // Since the search started
+    double intervalSeconds;
+    uint64_t entries;        // Files and directories processed during the interval
+    uint64_t directories;    // Directories completed during the interval
+    uint64_t directoryNanos; // Time spent inside those directories
+    size_t queueSize;
+};
+
+// Hill-climbing controller for the number of active workers on one mount point.
+// It keeps moving in the direction that raised throughput and reverses when throughput
+// drops, and backs off when per-directory latency climbs without a throughput gain
+// (the signature of a thrashing disk or an overloaded server).
+class ConcurrencyController {
+private:
+    static constexpr double SIGNIFICANT_CHANGE = 0.05;
+    static constexpr double LATENCY_BACKOFF = 3.0;
+
+    std::string mountPoint;
+    StorageKind kind;
+    int minWorkers;
+    int maxWorkers;
+    int current;
+    int direction = 1;
+    double lastThroughput = 0.0;
+    double baselineLatencyMs = 0.0;
+
+public:
+    ConcurrencyController(const std::wstring& mountPoint, StorageKind kind, unsigned int hardwareThreads)
+        : mountPoint(wstring_to_string(mountPoint)), kind(kind) {
+        int hw = static_cast<int>(std::max(hardwareThreads, 1u));
+        switch (kind) {
+        case StorageKind::Rotational:
+            // Concurrent reads make a spinning disk seek; start almost serial
+            minWorkers = 1;
+            current = 2;
+            maxWorkers = 4;
+            break;
+        case StorageKind::Network:
+            // Round trips dominate, so more requests in flight hide latency
+            minWorkers = 2;
+            current = std::min(2 * hw, 32);
+            maxWorkers = 64;
+            break;
+        default:
+            minWorkers = 2;
+            current = hw;
+            maxWorkers = 2 * hw;
+            break;
+        }
+        current = std::clamp(current, minWorkers, maxWorkers);
+    }
+
+    int getMinWorkers() const { return minWorkers; }
+    int getMaxWorkers() const { return maxWorkers; }
+    int getCurrentWorkers() const { return current; }
+    StorageKind getKind() const { return kind; }
+
+    std::string describe() const {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "%s [%s]: starting with %d workers (range %d-%d)",
+            mountPoint.c_str(), storageKindName(kind), current, minWorkers, maxWorkers);
+        return buffer;
+    }
+
+    // Returns true, with a log line in `decision`, when the worker count changes
+    bool update(const ControllerSample& sample, std::string& decision) {
+        if (sample.intervalSeconds <= 0.0 || sample.entries == 0) {
+            return false; // Nothing measurable happened
+        }
+
+        double throughput = sample.entries / sample.intervalSeconds;
+        double latencyMs = sample.directories > 0 ? sample.directoryNanos / 1e6 / sample.directories : 0.0;
+        if (latencyMs > 0.0 && (baselineLatencyMs == 0.0 || latencyMs < baselineLatencyMs)) {
+            baselineLatencyMs = latencyMs;
+        }
+
+        double change = lastThroughput > 0.0 ? (throughput - lastThroughput) / lastThroughput : 0.0;
+        int step = std::max(1, current / 4);
+        int target = current;
+        const char* reason = "";
+
+        if (lastThroughput == 0.0) {
+            target = current + step;
+            reason = "probing";
+        } else if (latencyMs > baselineLatencyMs * LATENCY_BACKOFF && change < SIGNIFICANT_CHANGE) {
+            direction = -1;
+            target = current - step;
+            reason = "directory latency rising without throughput gain";
+        } else if (change > SIGNIFICANT_CHANGE) {
+            target = current + direction * step;
+            reason = "throughput improved";
+        } else if (change < -SIGNIFICANT_CHANGE) {
+            direction = -direction;
+            target = current + direction * step;
+            reason = "throughput dropped";
+        }
+
+        // More workers than queued directories would only sit idle
+        if (target > current && sample.queueSize < static_cast<size_t>(current)) {
+            target = current;
+        }
+        target = std::clamp(target, minWorkers, maxWorkers);
+        double previousThroughput = lastThroughput;
+        lastThroughput = throughput;
+        if (target == current) {
+            return false;
+        }
+
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer),
+            "t=%.2fs %s [%s]: %d -> %d workers (%.0f entries/s, %+.1f%% vs %.0f, dir latency %.2f ms, queue %zu): %s",
+            sample.seconds, mountPoint.c_str(), storageKindName(kind), current, target,
+            throughput, change * 100.0, previousThroughput, latencyMs, sample.queueSize, reason);
+        decision = buffer;
+        current = target;
+        return true;
+    }
+};
+
+// Volume serial number of the device behind a mount point, 0 if unavailable
+DWORD volumeSerialOf(const std::wstring& mountPoint) {
+    DWORD serial = 0;
+    if (!GetVolumeInformationW(mountPoint.c_str(), nullptr, 0, &serial, nullptr, nullptr, nullptr, 0)) {
+        return 0;
+    }
+    return serial;
+}
+
+// Lower-cased, backslash-separated form with a trailing separator, for comparing roots
+std::wstring normalizedRootKey(const std::wstring& root) {
+    std::wstring key = foldCaseString(root);
+    std::replace(key.begin(), key.end(), L'/', L'\\');
+    if (key.empty() || key.back() != L'\\') {
+        key += L'\\';
+    }
+    return key;
+}
+
+// Search roots separated by ';'. Duplicates and roots nested inside another root are
+// dropped, since the outer root already covers them.
+std::vector<std::wstring> parseSearchRoots(const std::wstring& input) {
+    std::vector<std::wstring> roots;
+    size_t start = 0;
+    while (start <= input.size()) {
+        size_t end = input.find(L';', start);
+        if (end == std::wstring::npos) end = input.size();
+        std::wstring root = input.substr(start, end - start);
+        root.erase(0, root.find_first_not_of(L" \t"));
+        root.erase(root.find_last_not_of(L" \t") + 1);
+        if (!root.empty()) {
+            roots.push_back(root);
+        }
+        start = end + 1;
+    }
+
+    std::vector<std::wstring> unique;
+    for (size_t i = 0; i < roots.size(); ++i) {
+        std::wstring key = normalizedRootKey(roots[i]);
+        bool covered = false;
+        for (size_t j = 0; j < roots.size() && !covered; ++j) {
+            if (i == j) continue;
+            std::wstring other = normalizedRootKey(roots[j]);
+            // Nested inside another root, or an exact duplicate of an earlier one
+            covered = (key.size() > other.size() && key.compare(0, other.size(), other) == 0) ||
+                (key == other && j < i);
+        }
+        if (!covered) {
+            unique.push_back(roots[i]);
+        }
+    }
+    return unique;
+}
+
+// Everything a crawl saw, stored as columns, so later searches of the same roots can scan
+// memory instead of the disk. Entries are appended one directory batch at a time, so a
+// directory's ID is always lower than its children's.
+class FileCatalog {
+public:
+    static constexpr uint32_t NO_PARENT = 0xFFFFFFFF;
+
+    // Rows staged by one worker between appends; names are packed into one buffer
+    struct Batch {
+        struct Row {
+            uint32_t nameOffset;
+            uint32_t nameLength;
+            uint32_t parent;
+            bool isDirectory;
+            uint64_t size;
+            int64_t mtime;
+        };
+        std::wstring nameChars;
+        std::vector<Row> rows;
+
+        void add(std::wstring_view name, uint32_t parent, bool isDirectory, uint64_t size, int64_t mtime) {
+            rows.push_back({ static_cast<uint32_t>(nameChars.size()), static_cast<uint32_t>(name.size()),
+                parent, isDirectory, size, mtime });
+            nameChars.append(name.data(), name.size());
+        }
+        void clear() {
+            nameChars.clear();
+            rows.clear();
+        }
+    };
+
+private:
+    std::mutex mtx;  // Serializes appends while the crawl runs
+    NameTable names;
+    std::vector<uint32_t> nameIds;
+    std::vector<uint32_t> parentIds;
+    std::vector<uint8_t> directoryFlags;
+    std::vector<uint64_t> sizes;
+    std::vector<int64_t> mtimes;  // file_time_type ticks
+    std::vector<std::wstring> rootKeys;
+    bool followLinks;    // The link policy of the crawl that filled the catalog
+    bool oneFileSystem;
+
+    // Built on the first query, once the catalog no longer changes
+    mutable std::once_flag indexOnce;
+    mutable TrigramIndex index;
+
+public:
+    FileCatalog(const std::vector<std::wstring>& roots, bool followLinks, bool oneFileSystem)
+        : followLinks(followLinks), oneFileSystem(oneFileSystem) {
+        for (const auto& root : roots) {
+            rootKeys.push_back(normalizedRootKey(root));
+        }
+        std::sort(rootKeys.begin(), rootKeys.end());
+    }
+
+    // Roots are entries without a parent whose name is the full root path
+    uint32_t addRoot(const std::wstring& root) {
+        Batch batch;
+        batch.add(root, NO_PARENT, true, 0, 0);
+        return append(batch);
+    }
+
+    // Appends a batch under one lock and returns the ID of its first row
+    uint32_t append(const Batch& batch) {
+        std::lock_guard<std::mutex> lock(mtx);
+        uint32_t first = static_cast<uint32_t>(nameIds.size());
+        for (const auto& row : batch.rows) {
+            nameIds.push_back(names.intern(std::wstring_view(batch.nameChars).substr(row.nameOffset, row.nameLength)));
+            parentIds.push_back(row.parent);
+            directoryFlags.push_back(row.isDirectory ? 1 : 0);
+            sizes.push_back(row.size);
+            mtimes.push_back(row.mtime);
+        }
+        return first;
+    }
+
+    // Whether a crawl of roots with the same link policy would have seen the same entries
+    bool covers(const std::vector<std::wstring>& roots, bool withLinks, bool withOneFileSystem) const {
+        if (withLinks != followLinks || withOneFileSystem != oneFileSystem) return false;
+        std::vector<std::wstring> keys;
+        for (const auto& root : roots) {
+            keys.push_back(normalizedRootKey(root));
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys == rootKeys;
+    }
+
+    size_t size() const { return nameIds.size(); }
+    uint32_t nameId(uint32_t id) const { return nameIds[id]; }
+    uint32_t parent(uint32_t id) const { return parentIds[id]; }
+    bool isDirectory(uint32_t id) const { return directoryFlags[id] != 0; }
+    uint64_t fileSize(uint32_t id) const { return sizes[id]; }
+    int64_t modifiedTime(uint32_t id) const { return mtimes[id]; }
+    std::wstring_view name(uint32_t id) const { return names.name(nameIds[id]); }
+
+    // Appends name to a directory path the way std::filesystem::path::operator/ would
+    static void joinPath(std::wstring& path, std::wstring_view name) {
+        if (!path.empty() && path.back() != L'\\' && path.back() != L'/') {
+            path += static_cast<wchar_t>(std::filesystem::path::preferred_separator);
+        }
+        path.append(name.data(), name.size());
+    }
+
+    // Full path of an entry, rebuilt from its ancestors' names however deep it is
+    void pathOf(uint32_t id, std::wstring& out) const {
+        thread_local std::vector<uint32_t> chain;
+        chain.clear();
+        for (uint32_t at = id; at != NO_PARENT; at = parentIds[at]) {
+            chain.push_back(at);
+        }
+        out.clear();
+        for (size_t depth = chain.size(); depth > 0; --depth) {
+            joinPath(out, name(chain[depth - 1]));
+        }
+    }
+
+    // One flag per name ID: does the name match? Narrowed by the trigram index when the
+    // pattern has literals long enough, so each distinct name is checked at most once.
+    std::vector<uint8_t> matchingNames(const NameMatcher& matcher, const std::vector<std::wstring>& literals) const {
+        std::call_once(indexOnce, [&] { index.build(names); });
+        std::vector<uint8_t> matches(names.size(), 0);
+        std::vector<uint32_t> candidates;
+        if (index.candidates(literals, candidates)) {
+            for (uint32_t nameId : candidates) {
+                matches[nameId] = matcher.matches(names.name(nameId)) ? 1 : 0;
+            }
+        } else {
+            for (uint32_t nameId = 0; nameId < names.size(); ++nameId) {
+                matches[nameId] = matcher.matches(names.name(nameId)) ? 1 : 0;
+            }
+        }
+        return matches;
+    }
+
+    size_t memoryBytes() const {
+        return names.memoryBytes() + nameIds.capacity() * sizeof(uint32_t) + parentIds.capacity() * sizeof(uint32_t) +
+            directoryFlags.capacity() + sizes.capacity() * sizeof(uint64_t) + mtimes.capacity() * sizeof(int64_t) +
+            index.memoryBytes();
+    }
+};
+
+// One directory entry as the file system reports it, without opening the entry
+struct DirectoryEntry {
+    std::wstring_view name;
+    DWORD attributes;
+    uint64_t size;
+    int64_t mtime;    // FILETIME ticks, the same unit and epoch as file_time_type on MSVC
+    uint64_t fileId;  // Unique per volume; every hard link of a file shares it
+    DWORD reparseTag; // Only meaningful with FILE_ATTRIBUTE_REPARSE_POINT
+
+    bool isDirectory() const { return (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0; }
+    // Symlinks and junctions (which include folders a volume is mounted on). Other reparse
+    // points, such as cloud placeholders and dedup stubs, are ordinary directories.
+    bool isLink() const {
+        return (attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0 &&
+            (reparseTag == IO_REPARSE_TAG_SYMLINK || reparseTag == IO_REPARSE_TAG_MOUNT_POINT);
+    }
+};
+
+// Reads a directory in large batches with GetFileInformationByHandleEx. Each batch carries
+// the size, times and file ID of every entry, so none of them has to be opened or stat'ed.
+class DirectoryReader {
+private:
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    std::vector<uint64_t>& buffer;  // uint64_t keeps the records 8-byte aligned
+    const FILE_ID_BOTH_DIR_INFO* record = nullptr;
+    bool exhausted = false;
+    DWORD error = ERROR_SUCCESS;
+
+public:
+    static constexpr size_t BUFFER_BYTES = 64 * 1024;
+
+    explicit DirectoryReader(std::vector<uint64_t>& buffer) : buffer(buffer) {
+        buffer.resize(BUFFER_BYTES / sizeof(uint64_t));
+    }
+    ~DirectoryReader() {
+        if (handle != INVALID_HANDLE_VALUE) CloseHandle(handle);
+    }
+    DirectoryReader(const DirectoryReader&) = delete;
+    DirectoryReader& operator=(const DirectoryReader&) = delete;
+
+    bool open(const std::wstring& path) {
+        handle = CreateFileW(path.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            error = GetLastError();
+            return false;
+        }
+        return true;
+    }
+
+    // False at the end of the directory or on a read error; failed() tells them apart
+    bool next(DirectoryEntry& entry) {
+        while (true) {
+            if (record == nullptr) {
+                if (exhausted || handle == INVALID_HANDLE_VALUE) return false;
+                if (!GetFileInformationByHandleEx(handle, FileIdBothDirectoryInfo, buffer.data(),
+                        static_cast<DWORD>(buffer.size() * sizeof(uint64_t)))) {
+                    DWORD lastError = GetLastError();
+                    if (lastError != ERROR_NO_MORE_FILES) error = lastError;
+                    exhausted = true;
+                    return false;
+                }
+                record = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO*>(buffer.data());
+            }
+            const FILE_ID_BOTH_DIR_INFO* current = record;
+            record = current->NextEntryOffset == 0 ? nullptr : reinterpret_cast<const FILE_ID_BOTH_DIR_INFO*>(
+                reinterpret_cast<const uint8_t*>(current) + current->NextEntryOffset);
+
+            std::wstring_view name(current->FileName, current->FileNameLength / sizeof(WCHAR));
+            if (name == L"." || name == L"..") continue;
+            entry.name = name;
+            entry.attributes = current->FileAttributes;
+            entry.size = static_cast<uint64_t>(current->EndOfFile.QuadPart);
+            entry.mtime = current->LastWriteTime.QuadPart;
+            entry.fileId = static_cast<uint64_t>(current->FileId.QuadPart);
+            // The directory listing reports a reparse point's tag in place of its EA size
+            entry.reparseTag = current->EaSize;
+            return true;
+        }
+    }
+
+    bool failed() const { return error != ERROR_SUCCESS; }
+};
+
+// Volume serial and file ID of the directory a path leads to, following any links on the way
+bool identifyDirectory(const std::wstring& path, DWORD& volumeSerial, uint64_t& fileId) {
+    HANDLE handle = CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    BY_HANDLE_FILE_INFORMATION info;
+    bool ok = GetFileInformationByHandle(handle, &info) != FALSE;
+    CloseHandle(handle);
+    if (!ok) return false;
+    volumeSerial = info.dwVolumeSerialNumber;
+    fileId = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+    return true;
+}
+
+// (volume serial, file ID) pairs seen so far, sharded so workers rarely share a lock
+class FileIdSet {
+private:
+    struct FileKey {
+        DWORD volumeSerial;
+        uint64_t fileId;
+        bool operator==(const FileKey& other) const {
+            return volumeSerial == other.volumeSerial && fileId == other.fileId;
+        }
+    };
+    static uint64_t mix(const FileKey& key) {
+        return (key.fileId ^ (static_cast<uint64_t>(key.volumeSerial) << 32)) * 0x9E3779B97F4A7C15ull;
+    }
+    struct FileKeyHash {
+        // Folds the high bits in, which carry the mixing, for 32-bit size_t
+        size_t operator()(const FileKey& key) const {
+            uint64_t mixed = mix(key);
+            return static_cast<size_t>(mixed ^ (mixed >> 32));
+        }
+    };
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_set<FileKey, FileKeyHash> seen;
+    };
+    static constexpr size_t SHARD_COUNT = 64;
+    std::array<Shard, SHARD_COUNT> shards;
+
+public:
+    // True the first time a pair is inserted
+    bool insert(DWORD volumeSerial, uint64_t fileId) {
+        FileKey key = { volumeSerial, fileId };
+        Shard& shard = shards[static_cast<size_t>(mix(key) >> 58)];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        return shard.seen.insert(key).second;
+    }
+
+    // File systems without stable IDs report 0 (or all ones for an ID that does not fit);
+    // such entries can never be told apart, so they are never deduplicated
+    static bool isKnown(uint64_t fileId) { return fileId != 0 && fileId != ~0ull; }
+};
+
+// Allocation granularity; mapped views must start on it
+static constexpr uint64_t VIEW_ALIGNMENT = 64 * 1024;
+
+// Copies from a mapped view. A read error there (a dropped network share, a truncated
+// file) raises an in-page exception instead of failing a call, so it is caught here.
+bool copyFromView(void* destination, const void* view, size_t length) {
+    __try {
+        memcpy(destination, view, length);
+        return true;
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
+    }
+}
+
+// Runs work that reads a mapped view in place, returning false if a read error there
+// interrupted it. Frames the error unwinds through are abandoned, so work must not hold
+// locks while it reads the view; memory it owned at the time is lost.
+bool callGuarded(void (*work)(void*), void* context) {
+    __try {
+        work(context);
+        return true;
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
+    }
+}
+
+// Maps just the window around [offset, offset + length) and appends it to out
+bool readMapped(HANDLE mapping, uint64_t offset, size_t length, std::vector<uint8_t>& out) {
+    uint64_t viewStart = offset & ~(VIEW_ALIGNMENT - 1);
+    size_t lead = static_cast<size_t>(offset - viewStart);
+    const uint8_t* view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ,
+        static_cast<DWORD>(viewStart >> 32), static_cast<DWORD>(viewStart), lead + length));
+    if (view == nullptr) return false;
+    size_t at = out.size();
+    out.resize(at + length);
+    bool ok = copyFromView(out.data() + at, view + lead, length);
+    UnmapViewOfFile(view);
+    if (!ok) out.resize(at);
+    return ok;
+}
+
+// Archive formats whose member names a search can list
+enum class ArchiveKind {
+    None,
+    Zip,    // .zip, .jar: the central directory at the end of the file
+    Tar,    // .tar: a header before each member
+    TarGz   // .tar.gz, .tgz: the same headers inside one gzip stream
+};
+
+ArchiveKind archiveKindOf(std::wstring_view name) {
+    auto endsWith = [&](std::wstring_view suffix) {
+        if (name.size() <= suffix.size()) return false;
+        for (size_t i = 0; i < suffix.size(); ++i) {
+            wchar_t c = name[name.size() - suffix.size() + i];
+            if (c >= L'A' && c <= L'Z') c += L'a' - L'A';
+            if (c != suffix[i]) return false;
+        }
+        return true;
+    };
+    if (endsWith(L".zip") || endsWith(L".jar")) return ArchiveKind::Zip;
+    if (endsWith(L".tar")) return ArchiveKind::Tar;
+    if (endsWith(L".tar.gz") || endsWith(L".tgz")) return ArchiveKind::TarGz;
+    return ArchiveKind::None;
+}
+
+// The archive part of a result reported as "archive!member", empty for any other path
+std::wstring_view containingArchive(std::wstring_view path) {
+    for (size_t bang = path.find(L'!'); bang != std::wstring_view::npos; bang = path.find(L'!', bang + 1)) {
+        if (archiveKindOf(path.substr(0, bang)) != ArchiveKind::None) return path.substr(0, bang);
+    }
+    return {};
+}
+
+// A file inside an archive, as the archive's listing records it
+struct ArchiveMember {
+    std::wstring_view name;  // Path inside the archive, '/'-separated
+    uint64_t size;           // Uncompressed
+    int64_t mtime;           // FILETIME ticks, 0 if the listing has none
+};
+
+// False stops the listing
+using ArchiveVisitor = std::function<bool(const ArchiveMember&)>;
+
+// Streaming DEFLATE (RFC 1951) decoder for gzip files, so a compressed tar can be listed
+// without a compression library. Output passes through a buffer that keeps the last 32 KB
+// for back-references and is handed on whenever it fills; nothing else is kept. CRCs are
+// not checked, since only member names are wanted.
+class GzipInflater {
+public:
+    enum class Status { Done, Stopped, Corrupt };
+    // Takes the next decoded bytes; false stops decoding
+    using Consumer = std::function<bool(const uint8_t* data, size_t length)>;
+
+private:
+    static constexpr int MAX_BITS = 15;
+    static constexpr int FAST_BITS = 10;  // Codes up to this long decode with one lookup
+    static constexpr size_t WINDOW_BYTES = 32 * 1024;
+    static constexpr size_t OUTPUT_BYTES = 256 * 1024;
+    static constexpr size_t INPUT_BYTES = 256 * 1024;
+
+    static constexpr uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static constexpr uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static constexpr uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static constexpr uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    static constexpr uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    // Canonical Huffman code. fast holds symbol << 4 | length for every code of at most
+    // FAST_BITS, indexed by the next FAST_BITS input bits; longer codes walk count and symbol.
+    struct Huffman {
+        uint16_t fast[1 << FAST_BITS];
+        uint16_t count[MAX_BITS + 1];
+        uint16_t symbol[288];  // By code, i.e. by length then value
+    };
+
+    struct FixedTables {
+        Huffman literals;
+        Huffman distances;
+        FixedTables() {
+            uint8_t lengths[288];
+            std::fill(lengths, lengths + 144, uint8_t(8));
+            std::fill(lengths + 144, lengths + 256, uint8_t(9));
+            std::fill(lengths + 256, lengths + 280, uint8_t(7));
+            std::fill(lengths + 280, lengths + 288, uint8_t(8));
+            build(literals, lengths, 288);
+            std::fill(lengths, lengths + 30, uint8_t(5));
+            build(distances, lengths, 30);
+        }
+    };
+
+    // Thrown to unwind out of the decoder; caught only in run()
+    struct Abort {
+        Status status;
+    };
+
+    HANDLE file;
+    Consumer consume;
+    std::vector<uint8_t> input;
+    size_t inputPos = 0;
+    size_t inputEnd = 0;
+    uint64_t bitBuffer = 0;
+    int bitCount = 0;
+    std::vector<uint8_t> output;
+    size_t outputPos = 0;
+    size_t flushed = 0;  // output[flushed, outputPos) has not been consumed yet
+    Huffman codeLengths;
+    Huffman literals;
+    Huffman distances;
+
+    static bool build(Huffman& table, const uint8_t* lengths, int count) {
+        std::fill(std::begin(table.count), std::end(table.count), uint16_t(0));
+        for (int i = 0; i < count; ++i) {
+            table.count[lengths[i]]++;
+        }
+        table.count[0] = 0;
+        // Over-subscribed lengths are not a prefix code; incomplete ones are allowed
+        int left = 1;
+        for (int length = 1; length <= MAX_BITS; ++length) {
+            left = (left << 1) - table.count[length];
+            if (left < 0) return false;
+        }
+        uint16_t offsets[MAX_BITS + 2] = {};
+        for (int length = 1; length <= MAX_BITS; ++length) {
+            offsets[length + 1] = offsets[length] + table.count[length];
+        }
+        for (int i = 0; i < count; ++i) {
+            if (lengths[i] != 0) table.symbol[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+        }
+
+        // Input bits arrive least significant first, so the lookup index is the code reversed
+        std::fill(std::begin(table.fast), std::end(table.fast), uint16_t(0));
+        uint32_t code = 0;
+        int index = 0;
+        for (int length = 1; length <= FAST_BITS; ++length) {
+            for (int k = 0; k < table.count[length]; ++k, ++code, ++index) {
+                uint32_t reversed = 0;
+                for (int bit = 0; bit < length; ++bit) {
+                    reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+                }
+                for (uint32_t j = reversed; j < (1u << FAST_BITS); j += 1u << length) {
+                    table.fast[j] = static_cast<uint16_t>(table.symbol[index] << 4 | length);
+                }
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    static const FixedTables& fixedTables() {
+        static const FixedTables tables;
+        return tables;
+    }
+
+    [[noreturn]] static void corrupt() { throw Abort{ Status::Corrupt }; }
+
+    // Tops the bit buffer up to at least 57 bits while input lasts
+    void fill() {
+        while (bitCount <= 56) {
+            if (inputPos == inputEnd) {
+                DWORD got = 0;
+                if (!ReadFile(file, input.data(), static_cast<DWORD>(input.size()), &got, nullptr) || got == 0) return;
+                inputPos = 0;
+                inputEnd = got;
+            }
+            bitBuffer |= static_cast<uint64_t>(input[inputPos++]) << bitCount;
+            bitCount += 8;
+        }
+    }
+
+    uint32_t bits(int count) {
+        if (bitCount < count) {
+            fill();
+            if (bitCount < count) corrupt();
+        }
+        uint32_t value = static_cast<uint32_t>(bitBuffer & ((1ull << count) - 1));
+        bitBuffer >>= count;
+        bitCount -= count;
+        return value;
+    }
+
+    int decode(const Huffman& table) {
+        if (bitCount < MAX_BITS) fill();
+        uint16_t entry = table.fast[bitBuffer & ((1u << FAST_BITS) - 1)];
+        if (entry != 0) {
+            int length = entry & 15;
+            if (length > bitCount) corrupt();
+            bitBuffer >>= length;
+            bitCount -= length;
+            return entry >> 4;
+        }
+        // A longer code, one bit at a time in canonical order
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int length = 1; length <= MAX_BITS; ++length) {
+            code |= static_cast<int>(bits(1));
+            int count = table.count[length];
+            if (code - first < count) return table.symbol[index + code - first];
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        corrupt();
+    }
+
+    void flushOutput() {
+        if (outputPos > flushed && !consume(output.data() + flushed, outputPos - flushed)) throw Abort{ Status::Stopped };
+        size_t keep = std::min(outputPos, WINDOW_BYTES);
+        memmove(output.data(), output.data() + outputPos - keep, keep);
+        outputPos = flushed = keep;
+    }
+
+    void put(uint8_t byte) {
+        if (outputPos == output.size()) flushOutput();
+        output[outputPos++] = byte;
+    }
+
+    void copyMatch(size_t distance, size_t length) {
+        if (distance > outputPos) corrupt();
+        while (length > 0) {
+            if (outputPos == output.size()) flushOutput();
+            size_t n = std::min(length, output.size() - outputPos);
+            uint8_t* to = output.data() + outputPos;
+            const uint8_t* from = to - distance;
+            // Byte by byte: a match may overlap the bytes it produces
+            for (size_t i = 0; i < n; ++i) {
+                to[i] = from[i];
+            }
+            outputPos += n;
+            length -= n;
+        }
+    }
+
+    void storedBlock() {
+        bits(bitCount & 7);  // To a byte boundary
+        uint32_t length = bits(16);
+        if (bits(16) != (length ^ 0xFFFF)) corrupt();
+        while (length-- > 0) {
+            put(static_cast<uint8_t>(bits(8)));
+        }
+    }
+
+    void readDynamicTables() {
+        int literalCount = static_cast<int>(bits(5)) + 257;
+        int distanceCount = static_cast<int>(bits(5)) + 1;
+        int codeCount = static_cast<int>(bits(4)) + 4;
+        if (literalCount > 286 || distanceCount > 30) corrupt();
+        uint8_t lengths[286 + 30] = {};
+        for (int i = 0; i < codeCount; ++i) {
+            lengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(bits(3));
+        }
+        if (!build(codeLengths, lengths, 19)) corrupt();
+
+        std::fill(lengths, lengths + 19, uint8_t(0));
+        int index = 0;
+        while (index < literalCount + distanceCount) {
+            int symbol = decode(codeLengths);
+            if (symbol < 16) {
+                lengths[index++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+            uint8_t repeated = 0;
+            int times;
+            if (symbol == 16) {
+                if (index == 0) corrupt();
+                repeated = lengths[index - 1];
+                times = 3 + static_cast<int>(bits(2));
+            } else if (symbol == 17) {
+                times = 3 + static_cast<int>(bits(3));
+            } else {
+                times = 11 + static_cast<int>(bits(7));
+            }
+            if (index + times > literalCount + distanceCount) corrupt();
+            while (times-- > 0) {
+                lengths[index++] = repeated;
+            }
+        }
+        if (lengths[256] == 0 ||
+            !build(literals, lengths, literalCount) || !build(distances, lengths + literalCount, distanceCount)) {
+            corrupt();
+        }
+    }
+
+    void codes(const Huffman& literalTable, const Huffman& distanceTable) {
+        while (true) {
+            int symbol = decode(literalTable);
+            if (symbol < 256) {
+                put(static_cast<uint8_t>(symbol));
+                continue;
+            }
+            if (symbol == 256) return;
+            symbol -= 257;
+            if (symbol >= 29) corrupt();
+            size_t length = LENGTH_BASE[symbol] + bits(LENGTH_EXTRA[symbol]);
+            int distanceSymbol = decode(distanceTable);
+            if (distanceSymbol >= 30) corrupt();
+            copyMatch(DISTANCE_BASE[distanceSymbol] + bits(DISTANCE_EXTRA[distanceSymbol]), length);
+        }
+    }
+
+    void gzipHeader() {
+        if (bits(8) != 0x1F || bits(8) != 0x8B || bits(8) != 8) corrupt();
+        uint32_t flags = bits(8);
+        bits(32);  // Modification time
+        bits(16);  // Extra flags, OS
+        if (flags & 4) {
+            for (uint32_t extra = bits(16); extra > 0; --extra) bits(8);
+        }
+        if (flags & 8) {
+            while (bits(8) != 0) {}  // File name
+        }
+        if (flags & 16) {
+            while (bits(8) != 0) {}  // Comment
+        }
+        if (flags & 2) bits(16);  // Header CRC
+    }
+
+public:
+    GzipInflater(HANDLE file, Consumer consume)
+        : file(file), consume(std::move(consume)), input(INPUT_BYTES), output(OUTPUT_BYTES) {}
+
+    // Decodes every gzip member in the file, in order
+    Status run() {
+        try {
+            do {
+                gzipHeader();
+                bool last;
+                do {
+                    last = bits(1) != 0;
+                    switch (bits(2)) {
+                    case 0:
+                        storedBlock();
+                        break;
+                    case 1:
+                        codes(fixedTables().literals, fixedTables().distances);
+                        break;
+                    case 2:
+                        readDynamicTables();
+                        codes(literals, distances);
+                        break;
+                    default:
+                        corrupt();
+                    }
+                } while (!last);
+                bits(bitCount & 7);
+                bits(32);  // CRC-32
+                bits(32);  // Size
+                fill();
+            } while (bitCount >= 8);
+            if (outputPos > flushed && !consume(output.data() + flushed, outputPos - flushed)) return Status::Stopped;
+            return Status::Done;
+        }
+        catch (const Abort& abort) {
+            return abort.status;
+        }
+    }
+};
+
+// Walks the headers of a tar stream (ustar, GNU long names, pax) fed to it in pieces and
+// reports each file member. Member data is skipped; a caller that can seek reads
+// skippable() and jumps over it instead of feeding it.
+class TarReader {
+public:
+    enum class State { Reading, Ended, Corrupt, Stopped };
+
+private:
+    static constexpr size_t BLOCK_BYTES = 512;
+    static constexpr uint64_t MAX_EXTENSION_BYTES = 1024 * 1024;  // A long name or pax header
+
+    const ArchiveVisitor& visit;
+    State state = State::Reading;
+    uint8_t block[BLOCK_BYTES];
+    size_t blockFilled = 0;
+    uint64_t skip = 0;     // Data bytes still to pass over
+    uint64_t collect = 0;  // Bytes of an extension header still to gather
+    uint64_t collectPadding = 0;
+    char extensionType = 0;
+    std::string extension;
+
+    // Overrides from 'L' and 'x' headers for the member that follows them
+    std::string longName;
+    bool hasSize = false;
+    uint64_t paxSize = 0;
+    bool hasMtime = false;
+    int64_t paxMtime = 0;
+    std::wstring name;
+
+    static uint64_t padded(uint64_t size) { return (size + BLOCK_BYTES - 1) & ~uint64_t(BLOCK_BYTES - 1); }
+
+    // Octal, space or NUL terminated, or GNU base-256 when the top bit is set
+    static uint64_t number(const uint8_t* field, size_t length) {
+        uint64_t value = 0;
+        if (field[0] & 0x80) {
+            value = field[0] & 0x3F;
+            for (size_t i = 1; i < length; ++i) value = value << 8 | field[i];
+            return value;
+        }
+        size_t i = 0;
+        while (i < length && field[i] == ' ') ++i;
+        for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+            value = value * 8 + (field[i] - '0');
+        }
+        return value;
+    }
+
+    static std::string_view text(const uint8_t* field, size_t length) {
+        const char* start = reinterpret_cast<const char*>(field);
+        return std::string_view(start, std::find(start, start + length, '\0') - start);
+    }
+
+    static int64_t unixToFileTime(int64_t seconds) { return (seconds + 11644473600LL) * 10000000LL; }
+
+    // Records of the form "<length> <key>=<value>\n"
+    void applyPax() {
+        size_t at = 0;
+        while (at < extension.size()) {
+            size_t length = 0;
+            auto parsed = std::from_chars(extension.data() + at, extension.data() + extension.size(), length);
+            if (parsed.ec != std::errc() || *parsed.ptr != ' ' || length == 0 || at + length > extension.size()) return;
+            std::string_view record(parsed.ptr + 1, extension.data() + at + length - 1 - (parsed.ptr + 1));
+            size_t equals = record.find('=');
+            if (equals != std::string_view::npos) {
+                std::string_view key = record.substr(0, equals);
+                std::string_view value = record.substr(equals + 1);
+                if (key == "path") {
+                    longName.assign(value);
+                } else if (key == "size") {
+                    hasSize = std::from_chars(value.data(), value.data() + value.size(), paxSize).ec == std::errc();
+                } else if (key == "mtime") {
+                    int64_t seconds = 0;
+                    hasMtime = std::from_chars(value.data(), value.data() + value.size(), seconds).ec == std::errc();
+                    paxMtime = unixToFileTime(seconds);
+                }
+            }
+            at += length;
+        }
+    }
+
+    void finishExtension() {
+        if (extensionType == 'L') {
+            longName.assign(text(reinterpret_cast<const uint8_t*>(extension.data()), extension.size()));
+        } else {
+            applyPax();
+        }
+        skip = collectPadding;
+    }
+
+    void header() {
+        if (std::all_of(block, block + BLOCK_BYTES, [](uint8_t b) { return b == 0; })) {
+            state = State::Ended;
+            return;
+        }
+        // The checksum counts its own field as spaces; old writers summed signed bytes
+        uint64_t stored = number(block + 148, 8);
+        uint64_t sum = 0;
+        int64_t signedSum = 0;
+        for (size_t i = 0; i < BLOCK_BYTES; ++i) {
+            uint8_t b = i >= 148 && i < 156 ? uint8_t(' ') : block[i];
+            sum += b;
+            signedSum += static_cast<int8_t>(b);
+        }
+        if (stored != sum && static_cast<int64_t>(stored) != signedSum) {
+            state = State::Corrupt;
+            return;
+        }
+
+        uint64_t size = number(block + 124, 12);
+        char type = static_cast<char>(block[156]);
+        if (type == 'L' || type == 'x') {
+            if (size > MAX_EXTENSION_BYTES) {
+                state = State::Corrupt;
+                return;
+            }
+            extensionType = type;
+            extension.clear();
+            collect = size;
+            collectPadding = padded(size) - size;
+            if (collect == 0) finishExtension();
+            return;
+        }
+
+        bool isLink = type == '1' || type == '2';
+        bool isFile = type == '0' || type == '\0' || type == '7' || type == 'S' || isLink;
+        if (hasSize) size = paxSize;
+        skip = isLink ? 0 : padded(size);
+        if (isFile) {
+            std::string_view path;
+            std::string joined;
+            if (!longName.empty()) {
+                path = longName;
+            } else {
+                path = text(block, 100);
+                std::string_view prefix = text(block + 345, 155);
+                if (memcmp(block + 257, "ustar", 5) == 0 && !prefix.empty()) {
+                    joined.assign(prefix).append(1, '/').append(path);
+                    path = joined;
+                }
+            }
+            name.clear();
+            appendFromUtf8(name, path);
+            int64_t mtime = hasMtime ? paxMtime : unixToFileTime(static_cast<int64_t>(number(block + 136, 12)));
+            if (!visit({ name, isLink ? 0 : size, mtime })) state = State::Stopped;
+        }
+        longName.clear();
+        hasSize = hasMtime = false;
+    }
+
+public:
+    explicit TarReader(const ArchiveVisitor& visit) : visit(visit) {}
+
+    // Appends a tar name (UTF-8 by pax rules, and in practice) to a wide string; the reverse
+    // of the global appendUtf8
+    static void appendFromUtf8(std::wstring& out, std::string_view bytes) {
+        size_t ascii = 0;
+        while (ascii < bytes.size() && static_cast<uint8_t>(bytes[ascii]) < 0x80) ++ascii;
+        out.append(bytes.begin(), bytes.begin() + ascii);
+        if (ascii == bytes.size()) return;
+        int rest = static_cast<int>(bytes.size() - ascii);
+        size_t at = out.size();
+        out.resize(at + rest);
+        int written = MultiByteToWideChar(CP_UTF8, 0, bytes.data() + ascii, rest, &out[at], rest);
+        out.resize(at + std::max(written, 0));
+    }
+
+    // Consumes the next bytes of the stream; false once it has ended or cannot go on
+    bool feed(const uint8_t* data, size_t length) {
+        while (length > 0 && state == State::Reading) {
+            size_t n;
+            if (skip > 0) {
+                n = static_cast<size_t>(std::min<uint64_t>(skip, length));
+                skip -= n;
+            } else if (collect > 0) {
+                n = static_cast<size_t>(std::min<uint64_t>(collect, length));
+                extension.append(reinterpret_cast<const char*>(data), n);
+                collect -= n;
+                if (collect == 0) finishExtension();
+            } else {
+                n = std::min(BLOCK_BYTES - blockFilled, length);
+                memcpy(block + blockFilled, data, n);
+                blockFilled += n;
+                if (blockFilled == BLOCK_BYTES) {
+                    blockFilled = 0;
+                    header();
+                }
+            }
+            data += n;
+            length -= n;
+        }
+        return state == State::Reading;
+    }
+
+    // Called at the end of the input: a stream cut inside a header or a member is damaged,
+    // though one without the closing zero blocks is accepted
+    void finish() {
+        if (state == State::Reading && (blockFilled > 0 || collect > 0 || skip > 0)) state = State::Corrupt;
+    }
+
+    // Bytes of member data that come next and may be jumped over rather than fed
+    uint64_t skippable() const { return skip; }
+    void skipped(uint64_t bytes) { skip -= bytes; }
+    State getState() const { return state; }
+};
+
+// How listing one archive went
+enum class ArchiveStatus {
+    Listed,
+    Unreadable,  // Not the format its name claims, or damaged; members seen before that were reported
+    TooLarge,    // A compressed tar over MAX_GZIP_TAR_BYTES, which would have to be inflated in full
+    Stopped      // The visitor stopped it
+};
+
+// Lists archive members by name without extracting anything. A zip's central directory
+// is read through mapped views of the end of the file; a tar's headers are read and the
+// data between them jumped over. A gzip stream has no index, so a compressed tar is
+// inflated in full (without keeping the output), up to a size limit.
+class ArchiveLister {
+private:
+    static constexpr size_t TAR_READ_BYTES = 16 * 1024;
+    static constexpr size_t ZIP_DIRECTORY_WINDOW = 1024 * 1024;
+    static constexpr uint64_t MAX_GZIP_TAR_BYTES = 256ull * 1024 * 1024;
+    static constexpr size_t ZIP_END_BYTES = 22;
+    static constexpr size_t ZIP_ENTRY_BYTES = 46;
+    static constexpr size_t ZIP64_END_BYTES = 56;
+    static constexpr uint32_t ZIP_END_SIGNATURE = 0x06054b50;
+    static constexpr uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+    static constexpr uint32_t ZIP64_END_SIGNATURE = 0x06064b50;
+    static constexpr uint32_t ZIP_ENTRY_SIGNATURE = 0x02014b50;
+    static constexpr UINT CODE_PAGE_437 = 437;  // Zip names without the UTF-8 flag
+
+    static uint16_t le16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | p[1] << 8); }
+    static uint32_t le32(const uint8_t* p) { return le16(p) | static_cast<uint32_t>(le16(p + 2)) << 16; }
+    static uint64_t le64(const uint8_t* p) { return le32(p) | static_cast<uint64_t>(le32(p + 4)) << 32; }
+
+    // Modification time from the NTFS or Unix timestamp extra fields, else the DOS time
+    // (local time, two-second resolution)
+    static int64_t zipModifiedTime(const uint8_t* extra, size_t extraLength, uint16_t dosTime, uint16_t dosDate) {
+        for (size_t at = 0; at + 4 <= extraLength;) {
+            uint16_t id = le16(extra + at);
+            size_t length = le16(extra + at + 2);
+            const uint8_t* data = extra + at + 4;
+            if (at + 4 + length > extraLength) break;
+            if (id == 0x000A && length >= 32 && le16(data + 4) == 1 && le16(data + 6) >= 24) {
+                return static_cast<int64_t>(le64(data + 8));
+            }
+            if (id == 0x5455 && length >= 5 && (data[0] & 1)) {
+                return (static_cast<int32_t>(le32(data + 1)) + 11644473600LL) * 10000000LL;
+            }
+            at += 4 + length;
+        }
+        FILETIME local, utc;
+        if (!DosDateTimeToFileTime(dosDate, dosTime, &local) || !LocalFileTimeToFileTime(&local, &utc)) return 0;
+        return static_cast<int64_t>(static_cast<uint64_t>(utc.dwHighDateTime) << 32 | utc.dwLowDateTime);
+    }
+
+    static uint32_t crc32(const char* data, size_t length) {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> entries{};
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+            return entries;
+        }();
+        uint32_t c = ~0u;
+        for (size_t i = 0; i < length; ++i) {
+            c = table[(c ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (c >> 8);
+        }
+        return ~c;
+    }
+
+    // Info-ZIP writes UTF-8 names without the UTF-8 flag and repeats them in a Unicode Path
+    // extra field, which holds the CRC-32 of the plain name so a stale copy can be told apart
+    static bool unicodePath(const uint8_t* extra, size_t extraLength, const char* rawName, size_t nameLength,
+                            std::string_view& path) {
+        for (size_t at = 0; at + 4 <= extraLength;) {
+            size_t length = le16(extra + at + 2);
+            const uint8_t* data = extra + at + 4;
+            if (at + 4 + length > extraLength) break;
+            if (le16(extra + at) == 0x7075 && length > 5 && data[0] == 1 && le32(data + 1) == crc32(rawName, nameLength)) {
+                path = std::string_view(reinterpret_cast<const char*>(data + 5), length - 5);
+                return true;
+            }
+            at += 4 + length;
+        }
+        return false;
+    }
+
+    // A size of all ones means the real one is in the ZIP64 extra field, which lists the
+    // 64-bit values in a fixed order, uncompressed size first
+    static uint64_t zipSize(const uint8_t* extra, size_t extraLength, uint32_t size) {
+        if (size != 0xFFFFFFFF) return size;
+        for (size_t at = 0; at + 4 <= extraLength;) {
+            size_t length = le16(extra + at + 2);
+            if (at + 4 + length > extraLength) break;
+            if (le16(extra + at) == 0x0001 && length >= 8) return le64(extra + at + 4);
+            at += 4 + length;
+        }
+        return size;
+    }
+
+    static ArchiveStatus listZip(HANDLE mapping, uint64_t fileSize, const ArchiveVisitor& visit) {
+        if (fileSize < ZIP_END_BYTES) return ArchiveStatus::Unreadable;
+        // The end record closes the file, after a comment of at most 64 KB
+        size_t tailLength = static_cast<size_t>(std::min<uint64_t>(fileSize, ZIP_END_BYTES + 0xFFFF));
+        std::vector<uint8_t> tail;
+        if (!readMapped(mapping, fileSize - tailLength, tailLength, tail)) return ArchiveStatus::Unreadable;
+        size_t end = tailLength - ZIP_END_BYTES + 1;
+        do {
+            if (end-- == 0) return ArchiveStatus::Unreadable;
+        } while (le32(&tail[end]) != ZIP_END_SIGNATURE || end + ZIP_END_BYTES + le16(&tail[end + 20]) > tailLength);
+
+        uint64_t directorySize = le32(&tail[end + 12]);
+        uint64_t directoryOffset = le32(&tail[end + 16]);
+        if (le16(&tail[end + 10]) == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) {
+            // ZIP64: a locator right before the end record points at the 64-bit end record
+            if (end < 20 || le32(&tail[end - 20]) != ZIP64_LOCATOR_SIGNATURE) return ArchiveStatus::Unreadable;
+            uint64_t recordOffset = le64(&tail[end - 20 + 8]);
+            std::vector<uint8_t> record;
+            if (recordOffset > fileSize - ZIP64_END_BYTES ||
+                !readMapped(mapping, recordOffset, ZIP64_END_BYTES, record) || le32(record.data()) != ZIP64_END_SIGNATURE) {
+                return ArchiveStatus::Unreadable;
+            }
+            directorySize = le64(&record[40]);
+            directoryOffset = le64(&record[48]);
+        }
+        if (directoryOffset > fileSize || directorySize > fileSize - directoryOffset) return ArchiveStatus::Unreadable;
+
+        // The central directory, one mapped window at a time; an entry cut by the end of a
+        // window is completed from the next one
+        std::vector<uint8_t> window;
+        size_t used = 0;
+        uint64_t next = directoryOffset;
+        const uint64_t directoryEnd = directoryOffset + directorySize;
+        std::wstring name;
+        while (true) {
+            const uint8_t* entry = window.data() + used;
+            size_t available = window.size() - used;
+            size_t entryLength = available < ZIP_ENTRY_BYTES ? SIZE_MAX
+                : ZIP_ENTRY_BYTES + le16(entry + 28) + le16(entry + 30) + le16(entry + 32);
+            if (entryLength > available) {
+                if (next == directoryEnd) return available == 0 ? ArchiveStatus::Listed : ArchiveStatus::Unreadable;
+                window.erase(window.begin(), window.begin() + used);
+                used = 0;
+                size_t length = static_cast<size_t>(std::min<uint64_t>(ZIP_DIRECTORY_WINDOW, directoryEnd - next));
+                if (!readMapped(mapping, next, length, window)) return ArchiveStatus::Unreadable;
+                next += length;
+                continue;
+            }
+            if (le32(entry) != ZIP_ENTRY_SIGNATURE) return ArchiveStatus::Unreadable;
+            used += entryLength;
+
+            uint16_t flags = le16(entry + 8);
+            size_t nameLength = le16(entry + 28);
+            const char* rawName = reinterpret_cast<const char*>(entry + ZIP_ENTRY_BYTES);
+            if (nameLength == 0 || rawName[nameLength - 1] == '/' || rawName[nameLength - 1] == '\\') continue;
+            const uint8_t* extra = entry + ZIP_ENTRY_BYTES + nameLength;
+            size_t extraLength = le16(entry + 30);
+
+            name.clear();
+            std::string_view utf8Name;
+            if (flags & 0x800) {
+                TarReader::appendFromUtf8(name, std::string_view(rawName, nameLength));
+            } else if (unicodePath(extra, extraLength, rawName, nameLength, utf8Name)) {
+                TarReader::appendFromUtf8(name, utf8Name);
+            } else {
+                // Otherwise the DOS code page, unless the name is valid UTF-8, as names
+                // written on Linux and macOS are
+                int length = static_cast<int>(nameLength);
+                name.resize(nameLength);
+                int written = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, rawName, length, &name[0], length);
+                if (written <= 0) written = MultiByteToWideChar(CODE_PAGE_437, 0, rawName, length, &name[0], length);
+                name.resize(std::max(written, 0));
+            }
+            ArchiveMember member = { name, zipSize(extra, extraLength, le32(entry + 24)),
+                zipModifiedTime(extra, extraLength, le16(entry + 12), le16(entry + 14)) };
+            if (!visit(member)) return ArchiveStatus::Stopped;
+        }
+    }
+
+    static ArchiveStatus tarStatus(const TarReader& reader) {
+        switch (reader.getState()) {
+        case TarReader::State::Stopped: return ArchiveStatus::Stopped;
+        case TarReader::State::Corrupt: return ArchiveStatus::Unreadable;
+        default: return ArchiveStatus::Listed;  // Ended, or ran out without end blocks
+        }
+    }
+
+    static ArchiveStatus listTar(HANDLE file, uint64_t fileSize, const ArchiveVisitor& visit) {
+        TarReader reader(visit);
+        std::vector<uint8_t> buffer(TAR_READ_BYTES);
+        uint64_t offset = 0;
+        while (offset < fileSize) {
+            uint64_t jump = std::min(reader.skippable(), fileSize - offset);
+            reader.skipped(jump);
+            offset += jump;
+            if (offset == fileSize) break;
+            OVERLAPPED at = {};
+            at.Offset = static_cast<DWORD>(offset);
+            at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD got = 0;
+            if (!ReadFile(file, buffer.data(), static_cast<DWORD>(buffer.size()), &got, &at) || got == 0) break;
+            offset += got;
+            if (!reader.feed(buffer.data(), got)) break;
+        }
+        reader.finish();
+        return tarStatus(reader);
+    }
+
+    static ArchiveStatus listTarGz(HANDLE file, uint64_t fileSize, const ArchiveVisitor& visit) {
+        if (fileSize > MAX_GZIP_TAR_BYTES) return ArchiveStatus::TooLarge;
+        TarReader reader(visit);
+        GzipInflater inflater(file, [&](const uint8_t* data, size_t length) { return reader.feed(data, length); });
+        // The tar ends before the gzip stream does, which stops the inflater
+        if (inflater.run() == GzipInflater::Status::Corrupt && reader.getState() == TarReader::State::Reading) {
+            return ArchiveStatus::Unreadable;
+        }
+        reader.finish();
+        return tarStatus(reader);
+    }
+
+public:
+    static ArchiveStatus list(const std::wstring& path, ArchiveKind kind, const ArchiveVisitor& visit) {
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, kind == ArchiveKind::TarGz ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return ArchiveStatus::Unreadable;
+        LARGE_INTEGER size = {};
+        ArchiveStatus status = ArchiveStatus::Unreadable;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            uint64_t fileSize = static_cast<uint64_t>(size.QuadPart);
+            if (kind == ArchiveKind::Zip) {
+                HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping != nullptr) {
+                    status = listZip(mapping, fileSize, visit);
+                    CloseHandle(mapping);
+                }
+            } else if (kind == ArchiveKind::Tar) {
+                status = listTar(file, fileSize, visit);
+            } else if (kind == ArchiveKind::TarGz) {
+                status = listTarGz(file, fileSize, visit);
+            }
+        }
+        CloseHandle(file);
+        return status;
+    }
+};
+
+// du-style totals of everything below one directory
+struct DirectorySize {
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+    uint64_t directories = 0;
+};
+
+// A directory's running totals while a crawl fills them in
+struct DirectoryTotals {
+    DirectoryTotals* parent;
+    std::wstring path;
+    uint32_t depth;
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint64_t> files{ 0 };
+    std::atomic<uint64_t> directories{ 0 };
+
+    DirectoryTotals(DirectoryTotals* parent, std::wstring path)
+        : parent(parent), path(std::move(path)), depth(parent ? parent->depth + 1 : 0) {}
+};
+
+// A directory waiting to be read, with its entry ID in the catalog being built (if any)
+// and its node in the directory sizes being aggregated (if any). Archives waiting to be
+// listed travel the same queues, marked by their kind.
+struct PendingDirectory {
+    std::filesystem::path path;
+    uint32_t catalogId;
+    DirectoryTotals* totals;
+    DWORD volumeSerial;  // Of the volume the directory is on, which a followed link can change
+    ArchiveKind archive = ArchiveKind::None;
+    float relevance = 0.0f;  // Set by DirectoryRanker in a best-first crawl
+    uint16_t depth = 0;      // Below its root, likewise
+    bool estimated = false;  // Its files are part of the query's expected count
+    uint32_t pathState = 0;  // NameMatcher state after its path
+};
+
+// Where earlier searches found matches: a decayed count of matches per directory, each
+// directory counting its whole subtree, by a hash of its case-folded path. Never changed
+// once built, so a running crawl reads it without locks; each best-first crawl that found
+// matches builds the next one.
+class MatchHistory {
+private:
+    static constexpr size_t MAX_DIRECTORIES = 65536;
+    static constexpr float DECAY = 0.8f;  // Weight of what earlier searches found, per search
+    std::unordered_map<uint64_t, float> hits;
+
+public:
+    // FNV-1a over the folded path with either separator, ignoring a trailing one. The hash
+    // before each separator is the key of that ancestor, which with() relies on.
+    static uint64_t pathKey(std::wstring_view path) {
+        const uint16_t* table = caseFoldTable();
+        while (!path.empty() && (path.back() == L'\\' || path.back() == L'/')) path.remove_suffix(1);
+        uint64_t hash = 14695981039346656037ULL;
+        for (wchar_t c : path) {
+            hash = (hash ^ static_cast<uint16_t>(c == L'/' ? L'\\' : foldCase(c, table))) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    float hitsUnder(std::wstring_view path) const {
+        if (hits.empty()) return 0.0f;
+        auto it = hits.find(pathKey(path));
+        return it == hits.end() ? 0.0f : it->second;
+    }
+
+    // A copy with one more search's matches, given as (directory, matches in it), added to
+    // each directory and all its ancestors
+    std::shared_ptr<const MatchHistory> with(const std::vector<std::pair<std::wstring, uint32_t>>& found) const {
+        auto next = std::make_shared<MatchHistory>();
+        next->hits.reserve(hits.size() + found.size() * 2);
+        for (const auto& [key, count] : hits) {
+            next->hits.emplace(key, count * DECAY);
+        }
+        const uint16_t* table = caseFoldTable();
+        for (const auto& [directory, count] : found) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (wchar_t c : directory) {
+                if (c == L'\\' || c == L'/') {
+                    next->hits[hash] += static_cast<float>(count);
+                    c = L'\\';
+                } else {
+                    c = foldCase(c, table);
+                }
+                hash = (hash ^ static_cast<uint16_t>(c)) * 1099511628211ULL;
+            }
+            next->hits[pathKey(directory)] += static_cast<float>(count);
+        }
+        // Keep the directories with the most hits
+        if (next->hits.size() > MAX_DIRECTORIES) {
+            std::vector<float> counts;
+            counts.reserve(next->hits.size());
+            for (const auto& entry : next->hits) counts.push_back(entry.second);
+            std::nth_element(counts.begin(), counts.end() - MAX_DIRECTORIES, counts.end());
+            float floor = *(counts.end() - MAX_DIRECTORIES);
+            for (auto it = next->hits.begin(); it != next->hits.end();) {
+                it = it->second < floor ? next->hits.erase(it) : std::next(it);
+            }
+        }
+        return next;
+    }
+
+    size_t size() const { return hits.size(); }
+};
+
+// How many files earlier crawls found below each directory (at any depth), by the hash of
+// its path, for estimating how much of a running crawl is left. Like MatchHistory it is
+// never changed once built; each complete crawl builds the next one from the directories
+// it read, and the executor can keep it in a small file between runs.
+class CrawlEstimates {
+public:
+    static constexpr uint32_t UNKNOWN = 0xFFFFFFFF;
+
+    // One directory a crawl read and the files directly in it
+    struct Directory {
+        uint64_t key;
+        uint64_t parentKey;
+        uint32_t files;
+    };
+
+private:
+    static constexpr size_t MAX_DIRECTORIES = 65536;  // The largest subtrees; smaller ones share their parent's
+    static constexpr char MAGIC[8] = { 'F', 'S', 'E', 'S', 'T', '0', '0', '1' };
+    std::unordered_map<uint64_t, uint32_t> filesBelow;
+
+public:
+    // MatchHistory::pathKey of path, and of the directory containing it
+    static uint64_t directoryKeys(std::wstring_view path, uint64_t& parentKey) {
+        const uint16_t* table = caseFoldTable();
+        while (!path.empty() && (path.back() == L'\\' || path.back() == L'/')) path.remove_suffix(1);
+        uint64_t hash = 14695981039346656037ULL;
+        parentKey = hash;
+        for (wchar_t c : path) {
+            if (c == L'\\' || c == L'/') {
+                parentKey = hash;
+                c = L'\\';
+            }
+            hash = (hash ^ static_cast<uint16_t>(c == L'\\' ? c : foldCase(c, table))) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // The key of a subdirectory from its parent's key and its name
+    static uint64_t childKey(uint64_t parentKey, std::wstring_view name) {
+        const uint16_t* table = caseFoldTable();
+        uint64_t hash = (parentKey ^ static_cast<uint16_t>(L'\\')) * 1099511628211ULL;
+        for (wchar_t c : name) {
+            hash = (hash ^ static_cast<uint16_t>(foldCase(c, table))) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    uint32_t filesUnder(uint64_t key) const {
+        if (filesBelow.empty()) return UNKNOWN;
+        auto it = filesBelow.find(key);
+        return it == filesBelow.end() ? UNKNOWN : it->second;
+    }
+
+    // A copy updated with one complete crawl: the totals of every directory it read, added up
+    // from the leaves, replace what earlier crawls found there
+    std::shared_ptr<const CrawlEstimates> with(const std::vector<Directory>& crawled) const {
+        std::unordered_map<uint64_t, uint32_t> index;
+        index.reserve(crawled.size());
+        for (uint32_t i = 0; i < crawled.size(); ++i) {
+            index.emplace(crawled[i].key, i);
+        }
+        std::vector<uint32_t> parents(crawled.size(), UNKNOWN);
+        std::vector<uint32_t> childrenLeft(crawled.size(), 0);
+        std::vector<uint64_t> totals(crawled.size());
+        for (uint32_t i = 0; i < crawled.size(); ++i) {
+            totals[i] = crawled[i].files;
+            auto parent = index.find(crawled[i].parentKey);
+            if (parent != index.end() && parent->second != i) {
+                parents[i] = parent->second;
+                childrenLeft[parent->second]++;
+            }
+        }
+        std::vector<uint32_t> ready;
+        for (uint32_t i = 0; i < crawled.size(); ++i) {
+            if (childrenLeft[i] == 0) ready.push_back(i);
+        }
+        while (!ready.empty()) {
+            uint32_t i = ready.back();
+            ready.pop_back();
+            if (parents[i] != UNKNOWN) {
+                totals[parents[i]] += totals[i];
+                if (--childrenLeft[parents[i]] == 0) ready.push_back(parents[i]);
+            }
+        }
+
+        auto next = std::make_shared<CrawlEstimates>();
+        next->filesBelow.reserve(std::min(crawled.size(), MAX_DIRECTORIES) + filesBelow.size());
+        for (uint32_t i = 0; i < crawled.size(); ++i) {
+            next->filesBelow[crawled[i].key] = static_cast<uint32_t>(std::min<uint64_t>(totals[i], UNKNOWN - 1));
+        }
+        for (const auto& entry : filesBelow) {
+            next->filesBelow.emplace(entry);
+        }
+        // Keep the largest subtrees
+        if (next->filesBelow.size() > MAX_DIRECTORIES) {
+            std::vector<uint32_t> counts;
+            counts.reserve(next->filesBelow.size());
+            for (const auto& entry : next->filesBelow) counts.push_back(entry.second);
+            std::nth_element(counts.begin(), counts.end() - MAX_DIRECTORIES, counts.end());
+            uint32_t floor = *(counts.end() - MAX_DIRECTORIES);
+            for (auto it = next->filesBelow.begin(); it != next->filesBelow.end();) {
+                it = it->second <= floor && next->filesBelow.size() > MAX_DIRECTORIES ? next->filesBelow.erase(it) : std::next(it);
+            }
+        }
+        return next;
+    }
+
+    // The file is the magic, a u32 count, then a u64 key and u32 file count per directory
+    bool save(const std::wstring& path) const {
+        std::string bytes(MAGIC, sizeof(MAGIC));
+        auto fixed = [&](uint64_t value, int width) {
+            for (int i = 0; i < width; ++i) bytes += static_cast<char>(value >> (8 * i));
+        };
+        fixed(filesBelow.size(), 4);
+        for (const auto& [key, files] : filesBelow) {
+            fixed(key, 8);
+            fixed(files, 4);
+        }
+        std::wstring temporary = path + L".partial";
+        HANDLE file = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        DWORD written = 0;
+        bool ok = WriteFile(file, bytes.data(), static_cast<DWORD>(bytes.size()), &written, nullptr) && written == bytes.size();
+        CloseHandle(file);
+        if (!ok || !MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            DeleteFileW(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Empty estimates when the file is missing or damaged
+    static std::shared_ptr<const CrawlEstimates> load(const std::wstring& path) {
+        auto estimates = std::make_shared<CrawlEstimates>();
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return estimates;
+        std::vector<uint8_t> bytes(sizeof(MAGIC) + 4 + MAX_DIRECTORIES * 12);
+        DWORD read = 0;
+        bool ok = ReadFile(file, bytes.data(), static_cast<DWORD>(bytes.size()), &read, nullptr);
+        CloseHandle(file);
+        auto le = [&](size_t at, int width) {
+            uint64_t value = 0;
+            for (int i = width - 1; i >= 0; --i) value = value << 8 | bytes[at + i];
+            return value;
+        };
+        if (!ok || read < sizeof(MAGIC) + 4 || memcmp(bytes.data(), MAGIC, sizeof(MAGIC)) != 0) return estimates;
+        size_t count = static_cast<size_t>(le(sizeof(MAGIC), 4));
+        if (count > MAX_DIRECTORIES || read != sizeof(MAGIC) + 4 + count * 12) return estimates;
+        estimates->filesBelow.reserve(count);
+        for (size_t i = 0, at = sizeof(MAGIC) + 4; i < count; ++i, at += 12) {
+            estimates->filesBelow.emplace(le(at, 8), static_cast<uint32_t>(le(at + 8, 4)));
+        }
+        return estimates;
+    }
+
+    size_t size() const { return filesBelow.size(); }
+};
+
+// Ranks the directories of a best-first crawl. A directory's relevance is the best of how
+// much its name resembles what the query looks for and half its parent's relevance (a
+// likely folder's subfolders are likely too), plus a share for the matches earlier
+// searches found beneath it. Of two equally relevant directories the shallower goes first,
+// so with nothing to go on the crawl is breadth-first like the FIFO.
+class DirectoryRanker {
+private:
+    static constexpr float INHERITED = 0.5f;
+    static constexpr float HISTORY_WEIGHT = 0.5f;
+    static constexpr float DEPTH_PENALTY = 0.02f;  // Per level below the root
+    static constexpr float PARTIAL_WEIGHT = 0.6f;  // For a name holding only some of a literal's trigrams
+
+    std::vector<std::wstring> literals;  // Case-folded
+    bool fullPathMatches;  // Plain patterns also match the path, so a containing name means every file below matches
+    std::shared_ptr<const MatchHistory> history;
+
+    static float similarity(const std::wstring& name, const std::wstring& literal) {
+        if (name.find(literal) != std::wstring::npos) return 1.0f;
+        if (literal.size() < 3) return 0.0f;
+        size_t found = 0, total = literal.size() - 2;
+        for (size_t i = 0; i < total; ++i) {
+            if (name.find(std::wstring_view(literal).substr(i, 3)) != std::wstring::npos) ++found;
+        }
+        return PARTIAL_WEIGHT * found / total;
+    }
+
+public:
+    DirectoryRanker(const std::string& pattern, bool useRegex, std::shared_ptr<const MatchHistory> history)
+        : fullPathMatches(!useRegex), history(std::move(history)) {
+        for (const auto& literal : requiredLiterals(string_to_wstring(pattern), useRegex)) {
+            if (!literal.empty()) literals.push_back(foldCaseString(literal));
+        }
+    }
+
+    float relevance(std::wstring_view path, float parentRelevance) const {
+        float best = parentRelevance * INHERITED;
+        if (!literals.empty()) {
+            std::wstring name = foldCaseString(fileNameView(path));
+            float score = 0.0f;
+            for (const auto& literal : literals) {
+                score += similarity(name, literal);
+            }
+            score /= static_cast<float>(literals.size());
+            best = std::max(best, fullPathMatches ? score : score * PARTIAL_WEIGHT);
+        }
+        float hits = history->hitsUnder(path);
+        return best + HISTORY_WEIGHT * hits / (hits + 4.0f);
+    }
+
+    static float priority(const PendingDirectory& directory) {
+        return directory.relevance - DEPTH_PENALTY * directory.depth;
+    }
+};
+
+// A pool's shared frontier: first in, first out, or a heap on DirectoryRanker::priority
+// when the search is best-first
+class DirectoryQueue {
+private:
+    std::deque<PendingDirectory> items;
+    bool ranked = false;
+
+    static bool lowerPriority(const PendingDirectory& a, const PendingDirectory& b) {
+        return DirectoryRanker::priority(a) < DirectoryRanker::priority(b);
+    }
+
+public:
+    void setRanked(bool value) { ranked = value; }
+
+    void push(PendingDirectory directory) {
+        items.push_back(std::move(directory));
+        if (ranked) {
+            std::push_heap(items.begin(), items.end(), lowerPriority);
+        }
+    }
+
+    PendingDirectory pop() {
+        PendingDirectory next;
+        if (ranked) {
+            std::pop_heap(items.begin(), items.end(), lowerPriority);
+            next = std::move(items.back());
+            items.pop_back();
+        } else {
+            next = std::move(items.front());
+            items.pop_front();
+        }
+        return next;
+    }
+
+    bool empty() const { return items.empty(); }
+    size_t size() const { return items.size(); }
+};
+
+// Directory sizes rolled up during a crawl. A worker sums a directory's own files locally,
+// then adds the sums to the directory and each of its ancestors with relaxed atomic adds,
+// so no lock is taken on the way up and the root is touched once per directory, not per file.
+class DirectorySizes {
+private:
+    std::mutex nodesMutex;
+    std::deque<DirectoryTotals> nodes;  // A deque never moves nodes, so workers keep raw pointers
+
+    // File IDs already counted. A file with several hard links is counted in the first
+    // directory that reaches it, as du does.
+    FileIdSet counted;
+    std::atomic<uint64_t> linksSkipped{ 0 };
+
+    // Directories by normalizedRootKey(), for readers only. Workers never wait on it, and
+    // readers hold nodesMutex just to copy the pointers to the nodes added since last time.
+    std::mutex indexMutex;
+    std::unordered_map<std::wstring, const DirectoryTotals*> byKey;
+    size_t indexed = 0;  // Nodes already in byKey
+
+    // Called with indexMutex held
+    void catchUpLocked() {
+        std::vector<const DirectoryTotals*> added;
+        {
+            std::lock_guard<std::mutex> lock(nodesMutex);
+            for (size_t i = indexed; i < nodes.size(); ++i) {
+                added.push_back(&nodes[i]);
+            }
+            indexed = nodes.size();
+        }
+        // A node's path never changes once it is added
+        for (const DirectoryTotals* node : added) {
+            byKey[normalizedRootKey(node->path)] = node;
+        }
+    }
+
+public:
+    DirectoryTotals* addRoot(const std::wstring& path) {
+        std::lock_guard<std::mutex> lock(nodesMutex);
+        return &nodes.emplace_back(nullptr, path);
+    }
+
+    // Gives each staged subdirectory its own node under one lock. Until then a staged
+    // directory's totals point at its parent's node.
+    void addDirectories(std::vector<PendingDirectory>& directories) {
+        std::lock_guard<std::mutex> lock(nodesMutex);
+        for (auto& directory : directories) {
+            directory.totals = &nodes.emplace_back(directory.totals, directory.path.native());
+        }
+    }
+
+    // True the first time a file is seen; later hard links to it return false
+    bool countOnce(DWORD volumeSerial, uint64_t fileId) {
+        if (!FileIdSet::isKnown(fileId)) return true;
+        bool inserted = counted.insert(volumeSerial, fileId);
+        if (!inserted) ++linksSkipped;
+        return inserted;
+    }
+
+    // Adds one directory's own files and subdirectories to it and every ancestor
+    static void addUp(DirectoryTotals* node, uint64_t bytes, uint64_t files, uint64_t directories) {
+        for (; node != nullptr; node = node->parent) {
+            node->bytes.fetch_add(bytes, std::memory_order_relaxed);
+            node->files.fetch_add(files, std::memory_order_relaxed);
+            node->directories.fetch_add(directories, std::memory_order_relaxed);
+        }
+    }
+
+    // Totals of just the directories asked for, by normalizedRootKey() of their paths;
+    // partial while the crawl runs, and empty for directories it has not reached
+    void lookup(const std::vector<std::wstring>& keys, std::vector<std::optional<DirectorySize>>& sizes) {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        catchUpLocked();
+        sizes.assign(keys.size(), std::nullopt);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto node = byKey.find(keys[i]);
+            if (node != byKey.end()) {
+                sizes[i] = DirectorySize{ node->second->bytes.load(std::memory_order_relaxed),
+                    node->second->files.load(std::memory_order_relaxed),
+                    node->second->directories.load(std::memory_order_relaxed) };
+            }
+        }
+    }
+
+    // Calls visit(path, depth, size) for every directory at most maxDepth below a root
+    template <typename Visit>
+    void forEach(uint32_t maxDepth, Visit visit) {
+        std::lock_guard<std::mutex> lock(nodesMutex);
+        for (const auto& node : nodes) {
+            if (node.depth <= maxDepth) {
+                visit(node.path, node.depth, DirectorySize{ node.bytes.load(std::memory_order_relaxed),
+                    node.files.load(std::memory_order_relaxed), node.directories.load(std::memory_order_relaxed) });
+            }
+        }
+    }
+
+    size_t directoryCount() {
+        std::lock_guard<std::mutex> lock(nodesMutex);
+        return nodes.size();
+    }
+    uint64_t hardLinksSkipped() const { return linksSkipped.load(); }
+};
+
+// Size and last write time of a result, as the crawl or catalog saw it
+struct ResultInfo {
+    uint64_t size;
+    int64_t mtime;  // FILETIME ticks
+};
+
+// Receives a search's results as workers find them, instead of the query keeping them.
+// Called from several worker threads at once, one batch at a time.
+class ResultSink {
+public:
+    virtual ~ResultSink() = default;
+    // False stops the search, e.g. when the consumer has gone away
+    virtual bool write(const std::vector<std::wstring>& paths, const std::vector<ResultInfo>& info) = 0;
+};
+
+// Limits on how hard a crawl may work, for hosts whose own services come first. A zero
+// rate or share leaves that limit off. An entry is one record of a directory listing,
+// which carries what a stat of the file would fetch.
+struct CrawlBudget {
+    double directoriesPerSecond = 0;
+    double entriesPerSecond = 0;
+    double cpuShare = 0;              // Of all processors together, over the crawl's workers
+    bool backgroundPriority = false;  // Workers run with low CPU, I/O and memory priority
+
+    bool limited() const { return directoriesPerSecond > 0 || entriesPerSecond > 0 || cpuShare > 0; }
+};
+
+// A rate shared by every worker, kept lock-free as the time by which everything taken so
+// far is paid for. Taking tokens moves that time on by their cost; a worker whose take ends
+// more than a burst ahead of now waits for the difference.
+class TokenBucket {
+private:
+    double nanosPerToken = 0;
+    std::atomic<int64_t> paidUntil{ 0 };
+
+public:
+    static constexpr int64_t BURST_NS = 100000000;  // 100 ms of the rate may be used at once
+
+    explicit TokenBucket(double tokensPerSecond)
+        : nanosPerToken(tokensPerSecond > 0 ? 1e9 / tokensPerSecond : 0) {}
+
+    // Takes tokens at now, in nanoseconds on the caller's clock, and returns how long to wait
+    int64_t take(double tokens, int64_t now) {
+        if (nanosPerToken <= 0 || tokens <= 0) return 0;
+        const int64_t cost = static_cast<int64_t>(tokens * nanosPerToken);
+        int64_t previous = paidUntil.load(std::memory_order_relaxed);
+        int64_t next;
+        do {
+            next = std::max(previous, now) + cost;
+        } while (!paidUntil.compare_exchange_weak(previous, next, std::memory_order_relaxed));
+        return std::max<int64_t>(next - now - BURST_NS, 0);
+    }
+
+    bool enabled() const { return nanosPerToken > 0; }
+};
+
+// What a crawl's budget has charged and how long it held workers back
+struct ThrottleCounts {
+    uint64_t directories = 0;
+    uint64_t entries = 0;
+    int64_t cpuNanos = 0;     // Of the crawl's workers
+    uint64_t waits = 0;
+    int64_t waitedNanos = 0;  // Summed over workers
+};
+
+// One crawl's budget. Workers pay for each directory after reading it, so the crawl runs
+// at most a burst ahead of its budget and then follows it.
+class CrawlThrottle {
+private:
+    CrawlBudget budget;
+    TokenBucket directoryBucket;
+    TokenBucket entryBucket;
+    TokenBucket cpuBucket;  // Tokens are nanoseconds of CPU time
+    std::atomic<uint64_t> directories{ 0 };
+    std::atomic<uint64_t> entries{ 0 };
+    std::atomic<int64_t> cpuNanos{ 0 };
+    std::atomic<uint64_t> waits{ 0 };
+    std::atomic<int64_t> waitedNanos{ 0 };
+
+public:
+    explicit CrawlThrottle(const CrawlBudget& budget)
+        : budget(budget), directoryBucket(budget.directoriesPerSecond), entryBucket(budget.entriesPerSecond),
+          cpuBucket(std::min(budget.cpuShare, 1.0) * std::max(std::thread::hardware_concurrency(), 1u) * 1e9) {}
+
+    // CPU time the calling thread has used, user and kernel
+    static int64_t threadCpuNanos() {
+        FILETIME created, exited, kernel, user;
+        if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+        ULARGE_INTEGER k, u;
+        k.LowPart = kernel.dwLowDateTime;
+        k.HighPart = kernel.dwHighDateTime;
+        u.LowPart = user.dwLowDateTime;
+        u.HighPart = user.dwHighDateTime;
+        return static_cast<int64_t>((k.QuadPart + u.QuadPart) * 100);
+    }
+
+    const CrawlBudget& getBudget() const { return budget; }
+
+    // Charges one directory read with its entries and the CPU it took, and returns how
+    // long the worker must wait before the next
+    int64_t charge(uint64_t entryCount, int64_t cpu, int64_t now) {
+        directories.fetch_add(1, std::memory_order_relaxed);
+        entries.fetch_add(entryCount, std::memory_order_relaxed);
+        cpuNanos.fetch_add(cpu, std::memory_order_relaxed);
+        return std::max({ directoryBucket.take(1, now), entryBucket.take(static_cast<double>(entryCount), now),
+            cpuBucket.take(static_cast<double>(cpu), now) });
+    }
+
+    void noteWait(int64_t nanos) {
+        waits.fetch_add(1, std::memory_order_relaxed);
+        waitedNanos.fetch_add(nanos, std::memory_order_relaxed);
+    }
+
+    ThrottleCounts counts() const {
+        ThrottleCounts result;
+        result.directories = directories.load(std::memory_order_relaxed);
+        result.entries = entries.load(std::memory_order_relaxed);
+        result.cpuNanos = cpuNanos.load(std::memory_order_relaxed);
+        result.waits = waits.load(std::memory_order_relaxed);
+        result.waitedNanos = waitedNanos.load(std::memory_order_relaxed);
+        return result;
+    }
+};
+
+// How a search runs, beyond what it looks for
+struct SearchOptions {
+    bool useCatalog = true;             // Answer from the last complete crawl of the same roots, or record one
+    bool refreshCatalog = false;        // With useCatalog, crawl anyway and record a new catalog
+    bool directorySizes = false;        // Roll file sizes up to every directory; always crawls
+    std::shared_ptr<ResultSink> sink;   // Stream results here; getResults() then stays empty
+    bool followLinks = false;           // Descend into directory symlinks and junctions
+    bool oneFileSystem = false;         // Never leave the volume each root is on
+    bool boundedFrontier = false;       // Depth-first per worker (DirectoryStack) instead of one FIFO
+    bool archives = false;              // Also match the members of zip, jar and tar files, as archive!member
+    bool bestFirst = false;             // Read the directories likeliest to hold matches first; not with boundedFrontier
+    bool crawlOnly = false;             // Match nothing and ignore the pattern; for the catalog, sizes or timing only
+    CrawlBudget budget;                 // Rate and CPU limits and worker priority; none by default
+};
+
+// What a crawl's visited set and link policy kept it from reading
+struct TraversalCounts {
+    uint64_t directoriesRead = 0;
+    uint64_t revisitsSkipped = 0;      // Reached again through a link, bind or overlapping root
+    uint64_t linksSkipped = 0;         // Not followed by policy
+    uint64_t otherVolumesSkipped = 0;  // Led off the root's volume under oneFileSystem
+};
+
+// What listing archive members found, when a search lists them
+struct ArchiveCounts {
+    uint64_t listed = 0;
+    uint64_t members = 0;
+    uint64_t unreadable = 0;
+    uint64_t tooLarge = 0;
+};
+
+// A worker's own depth-first frontier when a search bounds its frontier. Each frame is a
+// directory on the worker's current path and holds the subdirectories it has yet to visit as
+// names after the frame's path, so a pending directory costs its name, not its full path.
+// The worker takes the deepest pending directory next; idle workers are handed the shallowest.
+class DirectoryStack {
+private:
+    struct Child {
+        uint32_t nameOffset;  // In names
+        uint32_t nameLength;
+        uint32_t catalogId;
+        DWORD volumeSerial;
+        DirectoryTotals* totals;
+        bool estimated;
+        uint32_t pathState;
+    };
+    struct Frame {
+        uint32_t pathOffset;  // The frame directory's own path, in names
+        uint32_t pathLength;
+        uint32_t firstChild;  // Children [nextChild, endChild) are still pending
+        uint32_t nextChild;
+        uint32_t endChild;
+    };
+    std::wstring names;
+    std::vector<Child> children;
+    std::vector<Frame> frames;
+    size_t pending = 0;
+
+    PendingDirectory take(const Frame& frame, const Child& child) {
+        std::wstring path = names.substr(frame.pathOffset, frame.pathLength);
+        FileCatalog::joinPath(path, std::wstring_view(names).substr(child.nameOffset, child.nameLength));
+        --pending;
+        PendingDirectory directory = { std::move(path), child.catalogId, child.totals, child.volumeSerial };
+        directory.estimated = child.estimated;
+        directory.pathState = child.pathState;
+        return directory;
+    }
+
+    // Drops finished frames from the top; their names are the tail of the buffer
+    void trim() {
+        while (!frames.empty() && frames.back().nextChild == frames.back().endChild) {
+            children.resize(frames.back().firstChild);
+            names.resize(frames.back().pathOffset);
+            frames.pop_back();
+        }
+    }
+
+public:
+    // Pushes the subdirectories of parentPath, each of whose paths is parentPath plus a name
+    void push(const std::wstring& parentPath, const std::vector<PendingDirectory>& directories) {
+        if (directories.empty()) return;
+        Frame frame;
+        frame.pathOffset = static_cast<uint32_t>(names.size());
+        frame.pathLength = static_cast<uint32_t>(parentPath.size());
+        frame.firstChild = frame.nextChild = static_cast<uint32_t>(children.size());
+        names += parentPath;
+        for (const auto& directory : directories) {
+            const std::wstring& path = directory.path.native();
+            size_t separator = path.find_last_of(L"\\/");
+            size_t start = separator == std::wstring::npos ? 0 : separator + 1;
+            children.push_back({ static_cast<uint32_t>(names.size()), static_cast<uint32_t>(path.size() - start),
+                directory.catalogId, directory.volumeSerial, directory.totals, directory.estimated, directory.pathState });
+            names.append(path, start, std::wstring::npos);
+        }
+        frame.endChild = static_cast<uint32_t>(children.size());
+        frames.push_back(frame);
+        pending += directories.size();
+    }
+
+    // The next directory depth first: the first pending child of the deepest frame
+    bool popDeepest(PendingDirectory& out) {
+        trim();
+        if (frames.empty()) return false;
+        Frame& frame = frames.back();
+        out = take(frame, children[frame.nextChild++]);
+        return true;
+    }
+
+    // The last pending child of the shallowest frame that has one, i.e. the biggest subtree
+    bool takeShallowest(PendingDirectory& out) {
+        for (Frame& frame : frames) {
+            if (frame.nextChild < frame.endChild) {
+                out = take(frame, children[--frame.endChild]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void clear() {
+        names.clear();
+        children.clear();
+        frames.clear();
+        pending = 0;
+    }
+
+    size_t size() const { return pending; }
+    size_t bytes() const {
+        return names.size() * sizeof(wchar_t) + children.size() * sizeof(Child) + frames.size() * sizeof(Frame);
+    }
+};
+
+// Per-worker buffers that outlive a single search, so warm workers don't reallocate
+struct WorkerScratch {
+    std::vector<std::wstring> resultBatch;  // Matches not yet published to the query's results
+    std::vector<ResultInfo> resultInfo;     // One per resultBatch entry
+    FileCatalog::Batch catalogBatch;        // Entries not yet appended to the catalog
+    std::vector<PendingDirectory> pendingDirectories;  // catalogId is a row in catalogBatch until flushed
+    std::vector<PendingDirectory> pendingArchives;     // Always shared, since any worker may list them
+    std::vector<uint64_t> directoryBuffer;             // Records read by DirectoryReader
+    std::wstring pathBuffer;
+    DirectoryStack localDirectories;                   // Only used with a bounded frontier
+    std::vector<CrawlEstimates::Directory> crawledDirectories;  // Not yet handed to the query
+    uint64_t entriesListed = 0;                        // Not yet charged to the query's budget
+};
+
+// Long-lived search executor. Worker threads are created on first use and stay parked
+// between searches; a new search preempts the running one without joining any thread.
+class FastSearch {
+private:
+    // The roots on one device. Each pool has its own queue, lock, workers and controller,
+    // so a slow device never holds up directories on a fast one.
+    struct DevicePool {
+        std::wstring mountPoint;
+        DWORD volumeSerial = 0;
+        std::vector<std::wstring> roots;
+        size_t firstThread = 0;   // Index of the pool's first worker in SearchStats
+
+        // busyWorkers and finished are guarded by mtx
+        std::mutex mtx;
+        std::condition_variable cv;
+        DirectoryQueue workQueue;
+        int busyWorkers = 0;
+        bool finished = false;
+        std::atomic<size_t> queued{ 0 };          // workQueue.size(), readable without the lock
+        std::atomic<int64_t> pendingDirectories{ 0 };  // Queued here or on a worker's own stack
+
+        std::unique_ptr<ConcurrencyController> controller;
+        std::atomic<int> workerLimit{ 0 };
+        std::atomic<uint64_t> filesProcessed{ 0 };
+        std::atomic<uint64_t> directoriesCompleted{ 0 };
+        std::atomic<uint64_t> directoryNanos{ 0 };
+
+        // Controller bookkeeping, only touched by the controller thread
+        uint64_t lastEntries = 0;
+        uint64_t lastDirectories = 0;
+        uint64_t lastNanos = 0;
+    };
+
+    // Everything that belongs to one search. Workers hold a reference while they work on
+    // it, so a preempted query stays alive until its last worker has left.
+    struct SearchQuery {
+        uint64_t generation = 0;
+        std::shared_ptr<const NameMatcher> matcher;
+        std::vector<std::unique_ptr<DevicePool>> pools;
+        std::atomic<bool> cancelled{ false };
+        std::atomic<int> poolsRemaining{ 0 };
+        int workersInside = 0;  // Guarded by executorMutex
+        std::atomic<size_t> matchesFound{ 0 };
+        std::mutex resultsMutex;
+        std::vector<std::wstring> results;
+        std::vector<ResultInfo> resultInfo;  // One per results entry
+        std::chrono::steady_clock::time_point startTime;
+        std::atomic<int64_t> firstDirectoryNs{ -1 };  // From search() to the first directory read
+        std::atomic<int64_t> firstResultNs{ -1 };     // From search() to the first published match
+        SearchStats stats;
+        std::chrono::steady_clock::time_point lastControlTick;  // Controller thread only
+        std::atomic<bool> incomplete{ false };  // Stopped or preempted before the crawl finished
+
+        // Filled by a crawl, or scanned in parallel chunks when the query is answered from it
+        std::shared_ptr<FileCatalog> catalog;
+        bool scanCatalog = false;
+        size_t scanThreads = 0;
+        std::vector<std::wstring> literals;
+        std::atomic<size_t> nextChunk{ 0 };
+        std::atomic<size_t> scanWorkersRemaining{ 0 };
+        std::atomic<uint64_t> filesScanned{ 0 };
+        std::once_flag nameMatchOnce;
+        std::vector<uint8_t> nameMatches;  // By name ID
+        std::unique_ptr<std::atomic<uint8_t>[]> directoryMatches;  // By entry ID: 0 unknown, 1 no, 2 yes
+
+        // Filled by a crawl that aggregates directory sizes
+        std::shared_ptr<DirectorySizes> sizes;
+
+        // Takes the results instead of the results vector, when set
+        std::shared_ptr<ResultSink> sink;
+
+        // Every directory queued so far, so none is read twice however it is reached
+        bool followLinks = false;
+        bool oneFileSystem = false;
+        FileIdSet visited;
+        std::atomic<uint64_t> revisitsSkipped{ 0 };
+        std::atomic<uint64_t> linksSkipped{ 0 };
+        std::atomic<uint64_t> otherVolumesSkipped{ 0 };
+
+        // Directories waiting to be read and the memory holding them, over every pool
+        bool boundedFrontier = false;
+        std::atomic<int64_t> frontierDirectories{ 0 };
+        std::atomic<int64_t> frontierBytes{ 0 };
+        std::atomic<int64_t> frontierPeakDirectories{ 0 };
+        std::atomic<int64_t> frontierPeakBytes{ 0 };
+
+        // Ranks the frontier in a best-first crawl, which also notes where it found matches
+        std::unique_ptr<DirectoryRanker> ranker;
+        std::mutex matchDirectoriesMutex;
+        std::vector<std::pair<std::wstring, uint32_t>> matchDirectories;  // Directory and its matches
+
+        // Progress of a crawl: files still expected below the queued directories that earlier
+        // crawls have counts for, and how many queued directories nothing is known about.
+        // The directories read are noted for the next estimates.
+        std::shared_ptr<const CrawlEstimates> estimates;
+        std::atomic<int64_t> expectedFiles{ 0 };
+        std::atomic<int64_t> unestimatedDirectories{ 0 };
+        int64_t initialEstimate = -1;  // Files expected below the roots, when all were known
+        std::mutex crawledMutex;
+        std::vector<CrawlEstimates::Directory> crawled;
+
+        // Read the tree without matching anything in it
+        bool crawlOnly = false;
+
+        // Archives whose members are matched along with the files
+        bool archives = false;
+        std::atomic<uint64_t> archivesListed{ 0 };
+        std::atomic<uint64_t> archiveMembers{ 0 };
+        std::atomic<uint64_t> archivesUnreadable{ 0 };
+        std::atomic<uint64_t> archivesTooLarge{ 0 };
+
+        // Holds a crawl's workers to its budget, when it has one
+        std::unique_ptr<CrawlThrottle> throttle;
+        bool backgroundPriority = false;
+
+        DevicePool* poolForSlot(size_t slot) {
+            for (auto& pool : pools) {
+                if (slot >= pool->firstThread &&
+                    slot < pool->firstThread + static_cast<size_t>(pool->controller->getMaxWorkers())) {
+                    return pool.get();
+                }
+            }
+            return nullptr;
+        }
+
+        int64_t sinceStart() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - startTime).count();
+        }
+    };
+
+    std::atomic<bool>& searchInProgress;
+    static constexpr int64_t SLOW_DIRECTORY_NS = 1000000;  // 1 ms
+    static constexpr int64_t LOCK_WAIT_SPAN_NS = 50000;    // 50 us
+    static constexpr size_t RESULT_BATCH_SIZE = 64;
+    static constexpr size_t CATALOG_BATCH_SIZE = 512;
+    static constexpr size_t DIRECTORY_BATCH_SIZE = 16;
+    static constexpr size_t SCAN_CHUNK_SIZE = 16384;
+    static constexpr size_t MATCH_DIRECTORIES_KEPT = 65536;  // Per best-first crawl, for MatchHistory
+    static constexpr size_t CRAWLED_BATCH_SIZE = 256;
+
+    // current, shutdown and SearchQuery::workersInside are guarded by executorMutex.
+    // Lock order: a pool's mtx may be held while taking executorMutex, never the reverse.
+    mutable std::mutex executorMutex;
+    std::condition_variable executorCv;  // New query or shutdown, for parked workers
+    std::condition_variable idleCv;      // A query finished or lost its last worker
+    std::shared_ptr<SearchQuery> current;
+    std::atomic<uint64_t> generation{ 0 };
+    bool shutdown = false;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerScratch>> scratch;
+    std::shared_ptr<FileCatalog> catalog;  // Last complete crawl
+    std::shared_ptr<const MatchHistory> matchHistory = std::make_shared<const MatchHistory>();  // From best-first crawls
+    std::shared_ptr<const CrawlEstimates> estimates = std::make_shared<const CrawlEstimates>();  // From complete crawls
+    std::wstring estimatesPath;  // Where estimates are kept between runs, if anywhere
+
+    // One controller thread serves every pool of the running query
+    std::thread controllerThread;
+    std::condition_variable controlCv;
+    static constexpr auto CONTROL_INTERVAL = std::chrono::milliseconds(250);
+
+    // Compiled matchers of recent queries, most recently used first
+    std::mutex matcherMutex;
+    std::list<std::pair<std::string, std::shared_ptr<const NameMatcher>>> matcherCache;
+    static constexpr size_t MATCHER_CACHE_SIZE = 16;
+
+    std::shared_ptr<const NameMatcher> compileMatcher(const std::string& pattern, bool caseSensitive, bool useRegex) {
+        std::string key = std::string(caseSensitive ? "c" : "i") + (useRegex ? "r" : "s") + pattern;
+        std::lock_guard<std::mutex> lock(matcherMutex);
+        for (auto it = matcherCache.begin(); it != matcherCache.end(); ++it) {
+            if (it->first == key) {
+                matcherCache.splice(matcherCache.begin(), matcherCache, it);
+                return matcherCache.front().second;
+            }
+        }
+        matcherCache.emplace_front(key, std::make_shared<const NameMatcher>(pattern, caseSensitive, useRegex));
+        if (matcherCache.size() > MATCHER_CACHE_SIZE) {
+            matcherCache.pop_back();
+        }
+        return matcherCache.front().second;
+    }
+
+    // Called with executorMutex held; new workers pick up the current query as they start
+    void ensureWorkersLocked(size_t count) {
+        while (workers.size() < count) {
+            scratch.push_back(std::make_unique<WorkerScratch>());
+            workers.emplace_back(&FastSearch::workerMain, this, workers.size(), scratch.back().get());
+        }
+        if (!controllerThread.joinable()) {
+            controllerThread = std::thread(&FastSearch::controllerLoop, this);
+        }
+    }
+
+    bool isStopped(const SearchQuery& query) const {
+        return query.cancelled.load() || !searchInProgress.load();
+    }
+
+    void wakePools(SearchQuery& query) {
+        for (auto& pool : query.pools) {
+            std::lock_guard<std::mutex> lock(pool->mtx);
+            pool->cv.notify_all();
+        }
+    }
+
+    // Acquire a lock, charging the time spent waiting for it to LockWait
+    std::unique_lock<std::mutex> lockTimed(std::mutex& mutex, const SearchStats& stats, ThreadStats& ts) {
+#if FASTSEARCH_INSTRUMENTATION
+        auto waitStart = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        int64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - waitStart).count();
+        ts.addPhase(SearchPhase::LockWait, waited);
+        if (waited > LOCK_WAIT_SPAN_NS) {
+            ts.addSpan("LockWait", stats.sinceOrigin(waitStart), waited);
+        }
+        return lock;
+#else
+        (void)stats;
+        (void)ts;
+        return std::unique_lock<std::mutex>(mutex);
+#endif
+    }
+
+    void recordDirectorySpan(const SearchStats& stats, ThreadStats& ts, const std::filesystem::path& dir,
+                             std::chrono::steady_clock::time_point dirStart) {
+        int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - dirStart).count();
+        // Only slow directories carry their path, to keep the trace small
+        std::string detail;
+        if (duration > SLOW_DIRECTORY_NS) {
+            detail = wstring_to_string(dir.wstring());
+        }
+        ts.addSpan("Directory", stats.sinceOrigin(dirStart), duration, std::move(detail));
+    }
+
+    // Publishes a worker's batched matches with one lock acquisition, or hands them to the
+    // query's sink. A sink that refuses them stops the search.
+    void flushResults(SearchQuery& query, WorkerScratch& workerScratch, ThreadStats& ts) {
+        if (workerScratch.resultBatch.empty()) return;
+        if (query.sink) {
+            if (query.firstResultNs.load() < 0) {
+                int64_t unset = -1;
+                query.firstResultNs.compare_exchange_strong(unset, query.sinceStart());
+            }
+            bool accepted;
+            {
+                FS_PHASE(ts, SearchPhase::ResultAppend);
+                accepted = query.sink->write(workerScratch.resultBatch, workerScratch.resultInfo);
+            }
+            if (!accepted && !query.cancelled.exchange(true)) {
+                query.incomplete.store(true);
+                query.stats.addEvent("Result sink closed; search stopped");
+                wakePools(query);
+            }
+        } else {
+            auto lock = lockTimed(query.resultsMutex, query.stats, ts);
+            FS_PHASE(ts, SearchPhase::ResultAppend);
+            if (query.results.empty()) {
+                query.firstResultNs.store(query.sinceStart());
+            }
+            query.results.insert(query.results.end(),
+                std::make_move_iterator(workerScratch.resultBatch.begin()),
+                std::make_move_iterator(workerScratch.resultBatch.end()));
+            query.resultInfo.insert(query.resultInfo.end(), workerScratch.resultInfo.begin(), workerScratch.resultInfo.end());
+        }
+        workerScratch.resultBatch.clear();
+        workerScratch.resultInfo.clear();
+    }
+
+    static int64_t queuedBytes(const PendingDirectory& directory) {
+        return static_cast<int64_t>(sizeof(PendingDirectory) + directory.path.native().size() * sizeof(wchar_t));
+    }
+
+    static void raiseTo(std::atomic<int64_t>& peak, int64_t value) {
+        int64_t seen = peak.load(std::memory_order_relaxed);
+        while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+
+    // Counts directories entering (positive) or leaving (negative) a pool's frontier, and the
+    // bytes that hold them, keeping the query's peaks
+    void trackFrontier(SearchQuery& query, DevicePool& pool, int64_t directories, int64_t bytes) {
+        pool.pendingDirectories.fetch_add(directories, std::memory_order_relaxed);
+        raiseTo(query.frontierPeakDirectories,
+            query.frontierDirectories.fetch_add(directories, std::memory_order_relaxed) + directories);
+        raiseTo(query.frontierPeakBytes, query.frontierBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    }
+
+    // Moves pending directories from a worker's stack to the pool's queue while it holds fewer
+    // than one per active worker, shallowest first; all of them when the worker is parking
+    void shareDirectories(SearchQuery& query, DevicePool& pool, DirectoryStack& stack, bool all, ThreadStats& ts) {
+        const size_t target = static_cast<size_t>(std::max(pool.workerLimit.load(), 1));
+        if (stack.size() == 0 || (!all && pool.queued.load(std::memory_order_relaxed) >= target)) return;
+        int64_t stackBytes = static_cast<int64_t>(stack.bytes());
+        int64_t sharedBytes = 0;
+        {
+            auto lock = lockTimed(pool.mtx, query.stats, ts);
+            FS_PHASE(ts, SearchPhase::QueuePush);
+            PendingDirectory directory;
+            while ((all || pool.workQueue.size() < target) && stack.takeShallowest(directory)) {
+                sharedBytes += queuedBytes(directory);
+                pool.workQueue.push(std::move(directory));
+            }
+            pool.queued.store(pool.workQueue.size(), std::memory_order_relaxed);
+            pool.cv.notify_all();
+        }
+        if (all) stack.clear();
+        trackFrontier(query, pool, 0, sharedBytes + static_cast<int64_t>(stack.bytes()) - stackBytes);
+    }
+
+    // Moves staged directories or archives to the pool's queue under one lock
+    void queueShared(SearchQuery& query, DevicePool& pool, std::vector<PendingDirectory>& staged, ThreadStats& ts) {
+        int64_t bytes = 0;
+        {
+            auto lock = lockTimed(pool.mtx, query.stats, ts);
+            FS_PHASE(ts, SearchPhase::QueuePush);
+            for (auto& dir : staged) {
+                bytes += queuedBytes(dir);
+                pool.workQueue.push(std::move(dir));
+            }
+            pool.queued.store(pool.workQueue.size(), std::memory_order_relaxed);
+            pool.cv.notify_all();
+        }
+        trackFrontier(query, pool, static_cast<int64_t>(staged.size()), bytes);
+        staged.clear();
+    }
+
+    // Appends staged catalog rows, then queues the staged subdirectories under one lock, or
+    // pushes them on the worker's own stack when the frontier is bounded
+    void flushDirectories(SearchQuery& query, DevicePool& pool, const std::wstring& parentPath,
+                          WorkerScratch& workerScratch, ThreadStats& ts) {
+        uint32_t base = 0;
+        if (query.catalog && !workerScratch.catalogBatch.rows.empty()) {
+            base = query.catalog->append(workerScratch.catalogBatch);
+            workerScratch.catalogBatch.clear();
+        }
+        if (!workerScratch.pendingArchives.empty()) {
+            queueShared(query, pool, workerScratch.pendingArchives, ts);
+        }
+        if (workerScratch.pendingDirectories.empty()) return;
+        if (query.sizes) {
+            query.sizes->addDirectories(workerScratch.pendingDirectories);
+        }
+        if (query.catalog) {
+            for (auto& dir : workerScratch.pendingDirectories) {
+                dir.catalogId += base;
+            }
+        }
+        if (query.boundedFrontier) {
+            DirectoryStack& stack = workerScratch.localDirectories;
+            int64_t before = static_cast<int64_t>(stack.bytes());
+            stack.push(parentPath, workerScratch.pendingDirectories);
+            trackFrontier(query, pool, static_cast<int64_t>(workerScratch.pendingDirectories.size()),
+                static_cast<int64_t>(stack.bytes()) - before);
+            shareDirectories(query, pool, stack, false, ts);
+            workerScratch.pendingDirectories.clear();
+        } else {
+            queueShared(query, pool, workerScratch.pendingDirectories, ts);
+        }
+    }
+
+    // Applies the link policy and the visited set to a subdirectory about to be queued.
+    // volumeSerial receives the volume the subdirectory is on.
+    bool shouldQueue(SearchQuery& query, const PendingDirectory& parent, const DirectoryEntry& entry,
+                     const std::wstring& path, DWORD& volumeSerial) {
+        volumeSerial = parent.volumeSerial;
+        uint64_t fileId = entry.fileId;
+        if (entry.isLink()) {
+            if (!query.followLinks) {
+                ++query.linksSkipped;
+                return false;
+            }
+            // The listing has the link's own ID; only opening it reveals where it leads
+            if (!identifyDirectory(path, volumeSerial, fileId)) return false;
+            if (query.oneFileSystem && volumeSerial != parent.volumeSerial) {
+                ++query.otherVolumesSkipped;
+                return false;
+            }
+        }
+        if (FileIdSet::isKnown(fileId) && !query.visited.insert(volumeSerial, fileId)) {
+            ++query.revisitsSkipped;
+            return false;
+        }
+        return true;
+    }
+
+    // Takes a directory that has been read out of the progress estimate. An estimated
+    // directory's files were expected; if earlier crawls know it and all its subdirectories,
+    // the difference from what they counted below it is settled now too, so a tree that
+    // shrank or grew corrects the estimate at once. An unestimated directory hands over to
+    // its subdirectories: those earlier crawls know add their counts, the rest are unknown.
+    void settleEstimate(SearchQuery& query, const PendingDirectory& directory, uint64_t key, uint32_t files,
+                        uint64_t expectedBelow, uint32_t unknownSubdirectories) {
+        if (directory.estimated) {
+            int64_t settled = files;
+            uint32_t expected = query.estimates->filesUnder(key);
+            if (expected != CrawlEstimates::UNKNOWN && unknownSubdirectories == 0) {
+                settled = static_cast<int64_t>(expected) - static_cast<int64_t>(expectedBelow);
+            }
+            query.expectedFiles.fetch_sub(settled, std::memory_order_relaxed);
+        } else {
+            query.expectedFiles.fetch_add(static_cast<int64_t>(expectedBelow), std::memory_order_relaxed);
+            query.unestimatedDirectories.fetch_add(static_cast<int64_t>(unknownSubdirectories) - 1, std::memory_order_relaxed);
+        }
+    }
+
+    // Hands the directories a worker has read to the query, for the next estimates
+    void flushCrawled(SearchQuery& query, WorkerScratch& workerScratch, ThreadStats& ts) {
+        if (workerScratch.crawledDirectories.empty()) return;
+        {
+            auto lock = lockTimed(query.crawledMutex, query.stats, ts);
+            query.crawled.insert(query.crawled.end(), workerScratch.crawledDirectories.begin(),
+                workerScratch.crawledDirectories.end());
+        }
+        workerScratch.crawledDirectories.clear();
+    }
+
+    void processDirectory(SearchQuery& query, DevicePool& pool, const PendingDirectory& directory,
+                          WorkerScratch& workerScratch, ThreadStats& ts) {
+        const std::wstring& currentPath = directory.path.native();
+        FileCatalog* catalog = query.catalog.get();
+        const CrawlEstimates& estimates = *query.estimates;
+        const bool haveEstimates = estimates.size() > 0;
+        uint64_t parentKey;
+        const uint64_t key = CrawlEstimates::directoryKeys(currentPath, parentKey);
+        DirectoryReader reader(workerScratch.directoryBuffer);
+        bool opened;
+        {
+            FS_PHASE(ts, SearchPhase::DirOpen);
+            opened = reader.open(currentPath);
+        }
+        if (!opened) {
+            // Skip inaccessible directories
+            FS_COUNT(ts, errors);
+            settleEstimate(query, directory, key, 0, 0, 0);
+            return;
+        }
+
+        // Entry paths are built in place after the directory's own path
+        std::wstring& fullPath = workerScratch.pathBuffer;
+        fullPath = currentPath;
+        FileCatalog::joinPath(fullPath, std::wstring_view());
+        const size_t baseLength = fullPath.size();
+
+        // Entries resume matching from the state after the directory's path and separator
+        const NameMatcher& matcher = *query.matcher;
+        const uint32_t baseState = matcher.advance(directory.pathState,
+            std::wstring_view(fullPath).substr(currentPath.size()));
+        uint64_t ownBytes = 0;
+        uint64_t ownFiles = 0;
+        uint64_t ownDirectories = 0;
+        uint32_t ownMatches = 0;
+        uint32_t filesHere = 0;
+        uint64_t expectedBelow = 0;   // Files earlier crawls found below the subdirectories they know
+        uint32_t unknownSubdirectories = 0;
+        DirectoryEntry entry;
+        while (true) {
+            {
+                FS_PHASE(ts, SearchPhase::DirEnumerate);
+                if (!reader.next(entry)) break;
+            }
+            if (isStopped(query)) break;
+            ++workerScratch.entriesListed;
+
+            fullPath.resize(baseLength);
+            fullPath.append(entry.name.data(), entry.name.size());
+            bool isDirectory = entry.isDirectory();
+            if (catalog) {
+                workerScratch.catalogBatch.add(entry.name, directory.catalogId,
+                    isDirectory, isDirectory ? 0 : entry.size, entry.mtime);
+            }
+
+            if (isDirectory) {
+                uint32_t row = catalog ? static_cast<uint32_t>(workerScratch.catalogBatch.rows.size() - 1)
+                                       : FileCatalog::NO_PARENT;
+                DWORD volumeSerial;
+                if (shouldQueue(query, directory, entry, fullPath, volumeSerial)) {
+                    workerScratch.pendingDirectories.push_back({ fullPath, row, directory.totals, volumeSerial });
+                    PendingDirectory& queued = workerScratch.pendingDirectories.back();
+                    queued.pathState = matcher.advance(baseState, entry.name);
+                    if (query.ranker) {
+                        queued.relevance = query.ranker->relevance(fullPath, directory.relevance);
+                        queued.depth = static_cast<uint16_t>(directory.depth + 1);
+                    }
+                    uint32_t expected = haveEstimates ? estimates.filesUnder(CrawlEstimates::childKey(key, entry.name))
+                                                      : CrawlEstimates::UNKNOWN;
+                    if (expected != CrawlEstimates::UNKNOWN) {
+                        queued.estimated = true;
+                        expectedBelow += expected;
+                    } else {
+                        queued.estimated = directory.estimated;
+                        ++unknownSubdirectories;
+                    }
+                    ++ownDirectories;
+                }
+            } else {
+                if (query.sizes && query.sizes->countOnce(directory.volumeSerial, entry.fileId)) {
+                    ownBytes += entry.size;
+                    ++ownFiles;
+                }
+
+                // A regex matches the filename; a plain pattern the full path, which contains it
+                bool matches = false;
+                uint32_t state = baseState;
+                if (!query.crawlOnly) {
+                    FS_PHASE(ts, SearchPhase::Match);
+                    if (matcher.isRegex()) {
+                        matches = matcher.matches(entry.name);
+                    } else {
+                        state = matcher.advance(baseState, entry.name);
+                        matches = state == NameMatcher::MATCHED;
+                    }
+                }
+
+                if (matches) {
+                    ++query.matchesFound;
+                    ++ownMatches;
+                    FS_COUNT(ts, matches);
+                    workerScratch.resultBatch.push_back(fullPath);
+                    workerScratch.resultInfo.push_back({ entry.size, entry.mtime });
+                    if (workerScratch.resultBatch.size() >= RESULT_BATCH_SIZE) {
+                        flushResults(query, workerScratch, ts);
+                    }
+                }
+                ++pool.filesProcessed;
+                ++filesHere;
+                FS_COUNT(ts, files);
+
+                ArchiveKind archive = query.archives && entry.size > 0 ? archiveKindOf(entry.name) : ArchiveKind::None;
+                if (archive != ArchiveKind::None) {
+                    workerScratch.pendingArchives.push_back({ fullPath, FileCatalog::NO_PARENT, nullptr, directory.volumeSerial, archive,
+                        directory.relevance, static_cast<uint16_t>(directory.depth + 1) });
+                    workerScratch.pendingArchives.back().pathState = state;
+                }
+            }
+            if (workerScratch.catalogBatch.rows.size() >= CATALOG_BATCH_SIZE ||
+                workerScratch.pendingDirectories.size() >= DIRECTORY_BATCH_SIZE ||
+                workerScratch.pendingArchives.size() >= DIRECTORY_BATCH_SIZE) {
+                flushDirectories(query, pool, currentPath, workerScratch, ts);
+            }
+        }
+        if (reader.failed()) {
+            FS_COUNT(ts, errors);
+        }
+        settleEstimate(query, directory, key, filesHere, expectedBelow, unknownSubdirectories);
+        workerScratch.crawledDirectories.push_back({ key, parentKey, filesHere });
+        if (directory.totals) {
+            DirectorySizes::addUp(directory.totals, ownBytes, ownFiles, ownDirectories);
+        }
+        if (query.ranker && ownMatches > 0) {
+            std::lock_guard<std::mutex> lock(query.matchDirectoriesMutex);
+            if (query.matchDirectories.size() < MATCH_DIRECTORIES_KEPT) {
+                query.matchDirectories.emplace_back(currentPath, ownMatches);
+            }
+        }
+    }
+
+    // Lists an archive and matches its members the way processDirectory matches files,
+    // reporting each match as the archive's path, '!', and the member's path inside it
+    void processArchive(SearchQuery& query, DevicePool& pool, const PendingDirectory& archive,
+                        WorkerScratch& workerScratch, ThreadStats& ts) {
+        const std::wstring& archivePath = archive.path.native();
+        std::wstring& fullPath = workerScratch.pathBuffer;
+        fullPath = archivePath;
+        fullPath += L'!';
+        const size_t baseLength = fullPath.size();
+
+        const NameMatcher& matcher = *query.matcher;
+        const uint32_t baseState = matcher.advance(archive.pathState, L"!");
+        uint64_t members = 0;
+        ArchiveStatus status = ArchiveLister::list(archivePath, archive.archive, [&](const ArchiveMember& member) {
+            if (isStopped(query)) return false;
+            fullPath.resize(baseLength);
+            fullPath.append(member.name.data(), member.name.size());
+            bool matches = false;
+            if (!query.crawlOnly) {
+                FS_PHASE(ts, SearchPhase::Match);
+                matches = matcher.isRegex() ? matcher.matches(fileNameView(member.name))
+                                            : matcher.advance(baseState, member.name) == NameMatcher::MATCHED;
+            }
+            if (matches) {
+                ++query.matchesFound;
+                FS_COUNT(ts, matches);
+                workerScratch.resultBatch.push_back(fullPath);
+                workerScratch.resultInfo.push_back({ member.size, member.mtime });
+                if (workerScratch.resultBatch.size() >= RESULT_BATCH_SIZE) {
+                    flushResults(query, workerScratch, ts);
+                }
+            }
+            ++members;
+            ++workerScratch.entriesListed;
+            ++pool.filesProcessed;
+            FS_COUNT(ts, files);
+            return true;
+        });
+
+        query.archiveMembers += members;
+        if (status == ArchiveStatus::Listed) {
+            ++query.archivesListed;
+        } else if (status == ArchiveStatus::Unreadable) {
+            ++query.archivesUnreadable;
+            FS_COUNT(ts, errors);
+        } else if (status == ArchiveStatus::TooLarge) {
+            ++query.archivesTooLarge;
+        }
+    }
+
+    // Called with pool.mtx held once the pool's queue is drained or the search is stopped
+    void finishPoolLocked(SearchQuery& query, DevicePool& pool) {
+        if (pool.finished) return;
+        pool.finished = true;
+        pool.cv.notify_all();
+        if (--query.poolsRemaining == 0) {
+            finishQuery(query);
+        }
+    }
+
+    // Called once the last pool, or the last catalog scan worker, of a query is done
+    void finishQuery(SearchQuery& query) {
+        query.stats.markFinished();
+        query.stats.addEvent("First directory after " + formatLatency(query.firstDirectoryNs.load()) +
+            ", first result after " + formatLatency(query.firstResultNs.load()) +
+            (query.cancelled.load() ? " (preempted)" : ""));
+        char line[256];
+        if (query.scanCatalog) {
+            double seconds = std::chrono::duration<double>(query.stats.getFinish() - query.startTime).count();
+            double perCore = query.catalog->size() / std::max(seconds, 1e-9) / query.scanThreads;
+            snprintf(line, sizeof(line), "Catalog scan: %zu entries in %.2f ms on %zu workers (%.2f M entries/s per core)",
+                query.catalog->size(), seconds * 1e3, query.scanThreads, perCore / 1e6);
+            query.stats.addEvent(line);
+        } else if (query.catalog && !query.incomplete.load()) {
+            size_t entries = std::max<size_t>(query.catalog->size(), 1);
+            snprintf(line, sizeof(line), "Catalog: %zu entries, %.1f bytes/entry",
+                query.catalog->size(), static_cast<double>(query.catalog->memoryBytes()) / entries);
+            query.stats.addEvent(line);
+        }
+
+        if (!query.scanCatalog) {
+            snprintf(line, sizeof(line), "Frontier peak (%s): %lld directories pending in %.1f KB",
+                query.ranker ? "best first" : query.boundedFrontier ? "depth-first per worker" : "shared FIFO",
+                static_cast<long long>(query.frontierPeakDirectories.load()), query.frontierPeakBytes.load() / 1024.0);
+            query.stats.addEvent(line);
+        }
+
+        if (query.revisitsSkipped.load() + query.linksSkipped.load() + query.otherVolumesSkipped.load() > 0) {
+            snprintf(line, sizeof(line), "Skipped %llu directories already visited, %llu links not followed, %llu on other volumes",
+                static_cast<unsigned long long>(query.revisitsSkipped.load()),
+                static_cast<unsigned long long>(query.linksSkipped.load()),
+                static_cast<unsigned long long>(query.otherVolumesSkipped.load()));
+            query.stats.addEvent(line);
+        }
+
+        if (query.archives) {
+            snprintf(line, sizeof(line), "Archives: %llu listed with %llu members, %llu unreadable, %llu compressed tars too large to inflate",
+                static_cast<unsigned long long>(query.archivesListed.load()),
+                static_cast<unsigned long long>(query.archiveMembers.load()),
+                static_cast<unsigned long long>(query.archivesUnreadable.load()),
+                static_cast<unsigned long long>(query.archivesTooLarge.load()));
+            query.stats.addEvent(line);
+        }
+
+        if (query.throttle) {
+            const CrawlBudget& budget = query.throttle->getBudget();
+            ThrottleCounts counts = query.throttle->counts();
+            double seconds = std::max(query.sinceStart() / 1e9, 1e-3);
+            double cpuShare = counts.cpuNanos / 1e9 / seconds / std::max(std::thread::hardware_concurrency(), 1u);
+            snprintf(line, sizeof(line), "Budget: %.0f directories/s (limit %.0f), %.0f entries/s (limit %.0f), CPU %.1f%% (limit %.1f%%); workers waited %.2f s in %llu pauses",
+                counts.directories / seconds, budget.directoriesPerSecond, counts.entries / seconds, budget.entriesPerSecond,
+                100 * cpuShare, 100 * budget.cpuShare, counts.waitedNanos / 1e9, static_cast<unsigned long long>(counts.waits));
+            query.stats.addEvent(line);
+        }
+
+        if (query.sizes) {
+            snprintf(line, sizeof(line), "Directory sizes: %zu directories, %llu hard links counted once",
+                query.sizes->directoryCount(), static_cast<unsigned long long>(query.sizes->hardLinksSkipped()));
+            query.stats.addEvent(line);
+        }
+
+        // Later best-first crawls look where this one found matches. A preempted crawl still
+        // counts; a directory it reached first is as telling as in a complete one.
+        std::shared_ptr<const MatchHistory> history;
+        if (query.ranker) {
+            std::lock_guard<std::mutex> lock(query.matchDirectoriesMutex);
+            if (!query.matchDirectories.empty()) {
+                std::shared_ptr<const MatchHistory> previous;
+                {
+                    std::lock_guard<std::mutex> executorLock(executorMutex);
+                    previous = matchHistory;
+                }
+                history = previous->with(query.matchDirectories);
+                snprintf(line, sizeof(line), "Best first: matches in %zu directories; history now covers %zu",
+                    query.matchDirectories.size(), history->size());
+                query.stats.addEvent(line);
+            }
+        }
+
+        // Later crawls estimate their progress from the counts of a complete one
+        std::shared_ptr<const CrawlEstimates> nextEstimates;
+        if (!query.scanCatalog && !query.incomplete.load()) {
+            std::lock_guard<std::mutex> lock(query.crawledMutex);
+            nextEstimates = query.estimates->with(query.crawled);
+            uint64_t files = 0;
+            for (const auto& directory : query.crawled) {
+                files += directory.files;
+            }
+            if (query.initialEstimate >= 0) {
+                snprintf(line, sizeof(line), "Progress estimate: %lld files expected, %llu found (%+.1f%%); counts for %zu directories",
+                    static_cast<long long>(query.initialEstimate), static_cast<unsigned long long>(files),
+                    100.0 * (static_cast<double>(query.initialEstimate) - files) / std::max<uint64_t>(files, 1), nextEstimates->size());
+            } else {
+                snprintf(line, sizeof(line), "Progress estimate: no earlier counts for these folders; counts for %zu directories",
+                    nextEstimates->size());
+            }
+            query.stats.addEvent(line);
+        }
+
+        std::unique_lock<std::mutex> lock(executorMutex);
+        if (history) {
+            matchHistory = history;
+        }
+        if (nextEstimates) {
+            estimates = nextEstimates;
+        }
+        // Only a crawl that saw everything may answer later searches
+        if (query.catalog && !query.scanCatalog && !query.incomplete.load()) {
+            catalog = query.catalog;
+        }
+        std::wstring saveTo = nextEstimates ? estimatesPath : std::wstring();
+        // A preempted query must not clear the flag of the one that replaced it
+        if (query.generation == generation.load()) {
+            searchInProgress.store(false);
+        }
+        idleCv.notify_all();
+        controlCv.notify_all();
+        lock.unlock();
+        if (!saveTo.empty()) {
+            nextEstimates->save(saveTo);
+        }
+    }
+
+    static std::string formatLatency(int64_t nanos) {
+        if (nanos < 0) return "n/a";
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.2f ms", nanos / 1e6);
+        return buffer;
+    }
+
+    // Pays for the directory a worker has just read out of the query's budget, and holds
+    // the worker back while the budget is overdrawn. Stopping or preempting the query ends
+    // the wait early. cpuMark is the worker's CPU time when it last paid.
+    void throttleWorker(SearchQuery& query, DevicePool& pool, WorkerScratch& workerScratch, int64_t& cpuMark) {
+        CrawlThrottle& throttle = *query.throttle;
+        int64_t cpuNow = CrawlThrottle::threadCpuNanos();
+        int64_t cpu = cpuNow - cpuMark;
+        cpuMark = cpuNow;
+        int64_t wait = throttle.charge(workerScratch.entriesListed, cpu, query.sinceStart());
+        workerScratch.entriesListed = 0;
+        if (wait <= 0) return;
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::unique_lock<std::mutex> lock(pool.mtx);
+            pool.cv.wait_for(lock, std::chrono::nanoseconds(wait), [&] { return isStopped(query); });
+        }
+        throttle.noteWait(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    // Works one pool of a query until it drains, is preempted, or is stopped
+    void runPool(SearchQuery& query, DevicePool& pool, size_t threadIndex, WorkerScratch& workerScratch) {
+        ThreadStats& ts = query.stats.forThread(threadIndex);
+        const int index = static_cast<int>(threadIndex - pool.firstThread);
+        int64_t cpuMark = query.throttle ? CrawlThrottle::threadCpuNanos() : 0;
+        workerScratch.entriesListed = 0;
+
+        while (true) {
+            PendingDirectory current;
+            {
+                auto lock = lockTimed(pool.mtx, query.stats, ts);
+                // Workers above the controller's limit stay parked here
+                pool.cv.wait(lock, [&] {
+                    return pool.finished || isStopped(query) ||
+                        (index < pool.workerLimit.load() && (!pool.workQueue.empty() || pool.busyWorkers == 0));
+                });
+                if (pool.finished) break;
+                if (isStopped(query) || (pool.workQueue.empty() && pool.busyWorkers == 0)) {
+                    if (isStopped(query)) query.incomplete.store(true);
+                    finishPoolLocked(query, pool);
+                    break;
+                }
+
+                FS_PHASE(ts, SearchPhase::QueuePop);
+                current = pool.workQueue.pop();
+                pool.queued.store(pool.workQueue.size(), std::memory_order_relaxed);
+                pool.busyWorkers++;
+            }
+            trackFrontier(query, pool, -1, -queuedBytes(current));
+
+            // With a bounded frontier the worker stays busy until its own stack is empty
+            DirectoryStack& stack = workerScratch.localDirectories;
+            while (true) {
+                if (query.firstDirectoryNs.load() < 0) {
+                    int64_t unset = -1;
+                    query.firstDirectoryNs.compare_exchange_strong(unset, query.sinceStart());
+                }
+                FS_COUNT(ts, directories);
+                auto dirStart = std::chrono::steady_clock::now();
+                try {
+                    if (current.archive != ArchiveKind::None) {
+                        processArchive(query, pool, current, workerScratch, ts);
+                    } else {
+                        processDirectory(query, pool, current, workerScratch, ts);
+                    }
+                }
+                catch (const std::exception&) {
+                    // Skip directories that fail part way through
+                    FS_COUNT(ts, errors);
+                }
+                flushDirectories(query, pool, current.path.native(), workerScratch, ts);
+                flushResults(query, workerScratch, ts);
+                if (workerScratch.crawledDirectories.size() >= CRAWLED_BATCH_SIZE) {
+                    flushCrawled(query, workerScratch, ts);
+                }
+                pool.directoryNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - dirStart).count();
+                ++pool.directoriesCompleted;
+#if FASTSEARCH_INSTRUMENTATION
+                recordDirectorySpan(query.stats, ts, current.path, dirStart);
+#endif
+                if (query.throttle) {
+                    throttleWorker(query, pool, workerScratch, cpuMark);
+                }
+                if (!query.boundedFrontier) break;
+                if (isStopped(query)) {
+                    trackFrontier(query, pool, -static_cast<int64_t>(stack.size()), -static_cast<int64_t>(stack.bytes()));
+                    stack.clear();
+                    break;
+                }
+                // A worker the controller parks hands everything back before it goes
+                if (index >= pool.workerLimit.load()) {
+                    shareDirectories(query, pool, stack, true, ts);
+                }
+                int64_t before = static_cast<int64_t>(stack.bytes());
+                if (!stack.popDeepest(current)) break;
+                trackFrontier(query, pool, -1, static_cast<int64_t>(stack.bytes()) - before);
+            }
+            // Before the pool can see this worker idle and finish the query
+            flushCrawled(query, workerScratch, ts);
+
+            auto lock = lockTimed(pool.mtx, query.stats, ts);
+            if (--pool.busyWorkers == 0 && pool.workQueue.empty()) {
+                pool.cv.notify_all();
+            }
+        }
+    }
+
+    // Whether any component of a directory's path matches, memoized per entry. Parents are
+    // resolved first; racing workers may both compute a flag, but always the same value.
+    bool directoryPathMatches(SearchQuery& query, uint32_t id) {
+        uint8_t state = query.directoryMatches[id].load(std::memory_order_relaxed);
+        if (state != 0) return state == 2;
+        uint32_t parent = query.catalog->parent(id);
+        bool matches = query.nameMatches[query.catalog->nameId(id)] != 0 ||
+            (parent != FileCatalog::NO_PARENT && directoryPathMatches(query, parent));
+        query.directoryMatches[id].store(matches ? 2 : 1, std::memory_order_relaxed);
+        return matches;
+    }
+
+    // Answers a query from the catalog: each worker claims chunks of entries and checks
+    // them against per-name and per-directory flags instead of matching strings
+    void runScan(SearchQuery& query, size_t threadIndex, WorkerScratch& workerScratch) {
+        ThreadStats& ts = query.stats.forThread(threadIndex);
+        const FileCatalog& catalog = *query.catalog;
+        const NameMatcher& matcher = *query.matcher;
+        std::call_once(query.nameMatchOnce, [&] {
+            FS_PHASE(ts, SearchPhase::Match);
+            query.nameMatches = catalog.matchingNames(matcher, query.literals);
+            query.directoryMatches = std::make_unique<std::atomic<uint8_t>[]>(catalog.size());
+        });
+        if (query.firstDirectoryNs.load() < 0) {
+            int64_t unset = -1;
+            query.firstDirectoryNs.compare_exchange_strong(unset, query.sinceStart());
+        }
+
+        // Like the crawl, plain patterns also match against the full path. Without a
+        // separator in the pattern that means matching any single path component.
+        const bool matchPath = !matcher.isRegex();
+        bool patternHasSeparator = false;
+        for (const auto& literal : query.literals) {
+            patternHasSeparator |= literal.find_first_of(L"\\/") != std::wstring::npos;
+        }
+
+        std::wstring& path = workerScratch.pathBuffer;
+        std::wstring parentPath;
+        uint32_t cachedParent = FileCatalog::NO_PARENT;
+        auto buildPath = [&](uint32_t id) {
+            uint32_t parent = catalog.parent(id);
+            if (parent != cachedParent) {
+                catalog.pathOf(parent, parentPath);
+                cachedParent = parent;
+            }
+            path = parentPath;
+            FileCatalog::joinPath(path, catalog.name(id));
+        };
+
+        while (!isStopped(query)) {
+            size_t begin = query.nextChunk.fetch_add(1) * SCAN_CHUNK_SIZE;
+            if (begin >= catalog.size()) break;
+            size_t end = std::min(begin + SCAN_CHUNK_SIZE, catalog.size());
+            uint64_t files = 0;
+            for (uint32_t id = static_cast<uint32_t>(begin); id < end; ++id) {
+                if (catalog.isDirectory(id)) continue;
+                files++;
+                bool matches = query.nameMatches[catalog.nameId(id)] != 0;
+                if (!matches && matchPath) {
+                    FS_PHASE(ts, SearchPhase::Match);
+                    if (patternHasSeparator) {
+                        buildPath(id);
+                        matches = matcher.matches(path);
+                    } else {
+                        matches = directoryPathMatches(query, catalog.parent(id));
+                    }
+                }
+                if (matches) {
+                    ++query.matchesFound;
+                    FS_COUNT(ts, matches);
+                    buildPath(id);
+                    workerScratch.resultBatch.push_back(path);
+                    workerScratch.resultInfo.push_back({ catalog.fileSize(id), catalog.modifiedTime(id) });
+                    if (workerScratch.resultBatch.size() >= RESULT_BATCH_SIZE) {
+                        flushResults(query, workerScratch, ts);
+                    }
+                }
+            }
+#if FASTSEARCH_INSTRUMENTATION
+            ts.files += files;
+#endif
+            query.filesScanned += files;
+            flushResults(query, workerScratch, ts);
+        }
+        flushResults(query, workerScratch, ts);
+
+        if (--query.scanWorkersRemaining == 0) {
+            if (isStopped(query)) query.incomplete.store(true);
+            --query.poolsRemaining;
+            finishQuery(query);
+        }
+    }
+
+    // Body of every warm worker: wait for a new query, work this slot's pool, repeat
+    void workerMain(size_t slot, WorkerScratch* workerScratch) {
+        uint64_t seenGeneration = 0;
+        while (true) {
+            std::shared_ptr<SearchQuery> query;
+            DevicePool* pool = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(executorMutex);
+                executorCv.wait(lock, [&] { return shutdown || generation.load() != seenGeneration; });
+                if (shutdown) return;
+                seenGeneration = generation.load();
+                // Queries that already finished, or have no work for this slot, are skipped
+                if (current->poolsRemaining.load() == 0) continue;
+                if (current->scanCatalog) {
+                    if (slot >= current->scanThreads) continue;
+                } else {
+                    pool = current->poolForSlot(slot);
+                    if (pool == nullptr) continue;
+                }
+                query = current;
+                query->workersInside++;
+            }
+
+            // Background mode lowers the thread's CPU, I/O and memory priority together
+            if (query->backgroundPriority) {
+                SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+            }
+            if (pool != nullptr) {
+                runPool(*query, *pool, slot, *workerScratch);
+            } else {
+                runScan(*query, slot, *workerScratch);
+            }
+            if (query->backgroundPriority) {
+                SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+            }
+
+            std::lock_guard<std::mutex> lock(executorMutex);
+            if (--query->workersInside == 0) {
+                idleCv.notify_all();
+            }
+        }
+    }
+
+    // Samples each pool's throughput and directory latency and adjusts its workerLimit
+    void controlTick(SearchQuery& query) {
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - query.startTime).count();
+        double intervalSeconds = std::chrono::duration<double>(now - query.lastControlTick).count();
+        query.lastControlTick = now;
+
+        for (auto& poolPtr : query.pools) {
+            DevicePool& pool = *poolPtr;
+            std::unique_lock<std::mutex> lock(pool.mtx);
+            if (pool.finished) continue;
+            // Stop requests from the UI don't notify; parked workers are released here
+            if (isStopped(query)) {
+                query.incomplete.store(true);
+                finishPoolLocked(query, pool);
+                continue;
+            }
+            // Directories on workers' own stacks are as much a backlog as queued ones
+            size_t queueSize = static_cast<size_t>(std::max<int64_t>(pool.pendingDirectories.load(), 0));
+            lock.unlock();
+
+            uint64_t directories = pool.directoriesCompleted.load();
+            uint64_t entries = pool.filesProcessed.load() + directories;
+            uint64_t nanos = pool.directoryNanos.load();
+
+            ControllerSample sample;
+            sample.seconds = seconds;
+            sample.intervalSeconds = intervalSeconds;
+            sample.entries = entries - pool.lastEntries;
+            sample.directories = directories - pool.lastDirectories;
+            sample.directoryNanos = nanos - pool.lastNanos;
+            sample.queueSize = queueSize;
+            pool.lastEntries = entries;
+            pool.lastDirectories = directories;
+            pool.lastNanos = nanos;
+
+            std::string decision;
+            if (pool.controller->update(sample, decision)) {
+                query.stats.addEvent(decision);
+                lock.lock();
+                pool.workerLimit.store(pool.controller->getCurrentWorkers());
+                pool.cv.notify_all();
+            }
+        }
+    }
+
+    void controllerLoop() {
+        std::unique_lock<std::mutex> lock(executorMutex);
+        while (true) {
+            // Sleep until a query is running
+            controlCv.wait(lock, [&] { return shutdown || (current && current->poolsRemaining.load() > 0); });
+            if (shutdown) return;
+            std::shared_ptr<SearchQuery> query = current;
+            bool interrupted = controlCv.wait_for(lock, CONTROL_INTERVAL, [&] {
+                return shutdown || current != query || query->poolsRemaining.load() == 0;
+            });
+            if (interrupted) continue;
+            lock.unlock();
+            controlTick(*query);
+            lock.lock();
+        }
+    }
+
+    // Publishes a prepared query to the workers, preempting the one before it
+    void launch(const std::shared_ptr<SearchQuery>& query, size_t threadCount) {
+        std::shared_ptr<SearchQuery> previous;
+        {
+            std::lock_guard<std::mutex> lock(executorMutex);
+            previous = std::move(current);
+            if (previous) {
+                previous->cancelled.store(true);
+            }
+            ensureWorkersLocked(threadCount);
+            query->generation = generation.load() + 1;
+            current = query;
+            // Set before any worker sees the query, so none of them mistakes it for stopped
+            searchInProgress.store(query->poolsRemaining.load() > 0);
+            generation.store(query->generation);
+        }
+        executorCv.notify_all();
+        controlCv.notify_all();
+        if (previous) {
+            wakePools(*previous);
+        }
+    }
+
+    std::shared_ptr<SearchQuery> currentQuery() const {
+        std::lock_guard<std::mutex> lock(executorMutex);
+        return current;
+    }
+
+public:
+    // Live view of one device pool for the UI
+    struct PoolStatus {
+        std::string mountPoint;
+        StorageKind kind;
+        int activeWorkers;
+        int minWorkers;
+        int maxWorkers;
+        size_t queueSize;
+        size_t rootCount;
+    };
+
+    explicit FastSearch(std::atomic<bool>& searchInProgress)
+        : searchInProgress(searchInProgress) {}
+
+    ~FastSearch() {
+        cancel();
+        {
+            std::lock_guard<std::mutex> lock(executorMutex);
+            shutdown = true;
+        }
+        executorCv.notify_all();
+        controlCv.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (controllerThread.joinable()) {
+            controllerThread.join();
+        }
+    }
+
+    // Searches several roots at once. Roots are grouped by device, each device gets its
+    // own I/O pool, and all pools append to the same result list. A search that is still
+    // running is preempted; its workers move over as soon as they notice.
+    // With useCatalog, a search of the same roots as the last complete crawl scans that
+    // crawl's catalog instead of the disk, and a crawl records a catalog for later searches;
+    // refreshCatalog skips the scan so the crawl replaces a catalog that has gone stale.
+    // With directorySizes, the search always crawls and rolls every file's size up to each
+    // of its ancestors, counting hard links once; see getDirectorySizes().
+    // With archives, it also crawls, and each zip, jar or tar found is listed by any free
+    // worker of its pool; members that match are reported as "archive!member".
+    // With crawlOnly, the pattern is ignored and nothing matches; the crawl still records
+    // the catalog and the sizes it was asked for.
+    void search(const std::string& pattern, bool caseSensitive, bool useRegex, const std::vector<std::wstring>& roots,
+                const SearchOptions& options = SearchOptions()) {
+        const bool useCatalog = options.useCatalog;
+        const bool directorySizes = options.directorySizes;
+        auto query = std::make_shared<SearchQuery>();
+        query->sink = options.sink;
+        query->followLinks = options.followLinks;
+        query->oneFileSystem = options.oneFileSystem;
+        query->boundedFrontier = options.boundedFrontier;
+        query->archives = options.archives;
+        query->crawlOnly = options.crawlOnly;
+        query->backgroundPriority = options.budget.backgroundPriority;
+        query->startTime = std::chrono::steady_clock::now();
+        query->lastControlTick = query->startTime;
+        query->matcher = compileMatcher(pattern, caseSensitive, useRegex);
+
+        std::shared_ptr<FileCatalog> existing;
+        std::shared_ptr<const MatchHistory> history;
+        {
+            std::lock_guard<std::mutex> lock(executorMutex);
+            existing = catalog;
+            history = matchHistory;
+            query->estimates = estimates;
+        }
+        // A bounded frontier is depth-first per worker, which leaves nothing to rank
+        if (options.bestFirst && !options.boundedFrontier && !options.crawlOnly) {
+            query->ranker = std::make_unique<DirectoryRanker>(pattern, useRegex, std::move(history));
+        }
+        // The catalog has no file IDs, so sizes that count hard links once need a crawl, and
+        // no archive members either; a crawl-only search always reads the tree
+        if (useCatalog && !options.refreshCatalog && !options.crawlOnly && !directorySizes && !options.archives && existing && !roots.empty() && existing->covers(roots, options.followLinks, options.oneFileSystem)) {
+            query->catalog = existing;
+            query->scanCatalog = true;
+            query->literals = requiredLiterals(string_to_wstring(pattern), useRegex);
+            query->scanThreads = std::max(1u, std::thread::hardware_concurrency());
+            query->scanWorkersRemaining.store(query->scanThreads);
+            query->poolsRemaining.store(1);
+            query->stats.reset(query->scanThreads, query->startTime);
+            launch(query, query->scanThreads);
+            return;
+        }
+        if (useCatalog) {
+            query->catalog = std::make_shared<FileCatalog>(roots, options.followLinks, options.oneFileSystem);
+        }
+        // A catalog scan reads no directories and is over in moments, so only crawls are throttled
+        if (options.budget.limited()) {
+            query->throttle = std::make_unique<CrawlThrottle>(options.budget);
+        }
+        if (directorySizes) {
+            query->sizes = std::make_shared<DirectorySizes>();
+        }
+
+        for (const auto& root : roots) {
+            std::wstring mountPoint = volumePathOf(root);
+            DWORD serial = volumeSerialOf(mountPoint);
+            auto it = std::find_if(query->pools.begin(), query->pools.end(), [&](const std::unique_ptr<DevicePool>& pool) {
+                return serial != 0 ? pool->volumeSerial == serial
+                                   : normalizedRootKey(pool->mountPoint) == normalizedRootKey(mountPoint);
+            });
+            if (it == query->pools.end()) {
+                auto pool = std::make_unique<DevicePool>();
+                pool->mountPoint = mountPoint;
+                pool->volumeSerial = serial;
+                pool->workQueue.setRanked(query->ranker != nullptr);
+                query->pools.push_back(std::move(pool));
+                it = query->pools.end() - 1;
+            }
+            (*it)->roots.push_back(root);
+        }
+
+        // Size each pool for its storage; the controller moves the active worker count
+        // within that range while the search runs
+        size_t threadCount = 0;
+        for (auto& pool : query->pools) {
+            pool->controller = std::make_unique<ConcurrencyController>(
+                pool->mountPoint, detectStorageKind(pool->mountPoint), std::thread::hardware_concurrency());
+            pool->firstThread = threadCount;
+            pool->workerLimit.store(pool->controller->getCurrentWorkers());
+            for (const auto& root : pool->roots) {
+                // A root that is, or lies inside, one already queued is read only once
+                DWORD volume = pool->volumeSerial;
+                uint64_t fileId = 0;
+                if (identifyDirectory(root, volume, fileId) && FileIdSet::isKnown(fileId) &&
+                        !query->visited.insert(volume, fileId)) {
+                    ++query->revisitsSkipped;
+                    continue;
+                }
+                uint32_t id = query->catalog ? query->catalog->addRoot(root) : FileCatalog::NO_PARENT;
+                DirectoryTotals* totals = query->sizes ? query->sizes->addRoot(root) : nullptr;
+                PendingDirectory directory = { root, id, totals, volume };
+                if (query->ranker) {
+                    directory.relevance = query->ranker->relevance(root, 0.0f);
+                }
+                directory.pathState = query->matcher->advance(0, root);
+                uint64_t parentKey;
+                uint32_t expected = query->estimates->filesUnder(CrawlEstimates::directoryKeys(root, parentKey));
+                if (expected != CrawlEstimates::UNKNOWN) {
+                    directory.estimated = true;
+                    query->expectedFiles += expected;
+                } else {
+                    query->unestimatedDirectories++;
+                }
+                trackFrontier(*query, *pool, 1, queuedBytes(directory));
+                pool->workQueue.push(std::move(directory));
+            }
+            pool->queued.store(pool->workQueue.size());
+            threadCount += static_cast<size_t>(pool->controller->getMaxWorkers());
+        }
+
+        if (query->unestimatedDirectories.load() == 0) {
+            query->initialEstimate = query->expectedFiles.load();
+        }
+        query->stats.reset(threadCount, query->startTime);
+        for (auto& pool : query->pools) {
+            query->stats.addEvent(pool->controller->describe() + " for " + std::to_string(pool->roots.size()) + " root(s)");
+        }
+        query->poolsRemaining.store(static_cast<int>(query->pools.size()));
+        if (query->pools.empty()) {
+            query->stats.markFinished();
+        }
+        launch(query, threadCount);
+    }
+
+    // Stops the running search; workers park again once they notice
+    void cancel() {
+        std::shared_ptr<SearchQuery> query;
+        {
+            std::lock_guard<std::mutex> lock(executorMutex);
+            query = current;
+            if (!query) return;
+            query->cancelled.store(true);
+            searchInProgress.store(false);
+        }
+        wakePools(*query);
+    }
+
+    // Blocks until every worker has left the current query, so its stats are stable
+    void waitForCompletion() {
+        std::unique_lock<std::mutex> lock(executorMutex);
+        std::shared_ptr<SearchQuery> query = current;
+        if (!query) return;
+        idleCv.wait(lock, [&] { return query->poolsRemaining.load() == 0 && query->workersInside == 0; });
+    }
+
+    // Getters for UI
+    bool hasQuery() const { return currentQuery() != nullptr; }
+    size_t getFilesProcessed() const {
+        size_t total = 0;
+        if (auto query = currentQuery()) {
+            for (const auto& pool : query->pools) {
+                total += pool->filesProcessed.load();
+            }
+            total += query->filesScanned.load();
+        }
+        return total;
+    }
+    size_t getMatchesFound() const {
+        auto query = currentQuery();
+        return query ? query->matchesFound.load() : 0;
+    }
+
+    struct ProgressEstimate {
+        uint64_t filesProcessed = 0;
+        uint64_t filesRemaining = 0;  // Estimated
+        bool fromCounts = false;      // Every queued directory is known from earlier crawls
+    };
+    // Files left below the queued directories: what earlier crawls counted there, and for
+    // directories they never saw, the files per directory read so far. A catalog scan knows
+    // how many entries are left, of which the same share as so far are files.
+    ProgressEstimate getProgress() const {
+        ProgressEstimate progress;
+        auto query = currentQuery();
+        if (!query) return progress;
+        progress.filesProcessed = getFilesProcessed();
+        if (query->scanCatalog) {
+            uint64_t entries = query->catalog->size();
+            uint64_t claimed = std::min<uint64_t>(query->nextChunk.load() * SCAN_CHUNK_SIZE, entries);
+            double filesPerEntry = claimed > 0 ? static_cast<double>(progress.filesProcessed) / claimed : 1.0;
+            progress.filesRemaining = static_cast<uint64_t>((entries - claimed) * filesPerEntry);
+            progress.fromCounts = true;
+            return progress;
+        }
+        uint64_t directories = 0;
+        for (const auto& pool : query->pools) {
+            directories += pool->directoriesCompleted.load();
+        }
+        int64_t unestimated = std::max<int64_t>(query->unestimatedDirectories.load(), 0);
+        double filesPerDirectory = directories > 0 ? static_cast<double>(progress.filesProcessed) / directories : 1.0;
+        progress.filesRemaining = static_cast<uint64_t>(std::max<int64_t>(query->expectedFiles.load(), 0)) +
+            static_cast<uint64_t>(unestimated * filesPerDirectory);
+        progress.fromCounts = unestimated == 0;
+        return progress;
+    }
+
+    // Keeps the progress estimates in a file between runs: loads it now and rewrites it
+    // after every complete crawl
+    void setEstimatesFile(const std::wstring& path) {
+        auto loaded = CrawlEstimates::load(path);
+        std::lock_guard<std::mutex> lock(executorMutex);
+        estimates = loaded;
+        estimatesPath = path;
+    }
+    size_t getEstimatedDirectories() const {
+        std::lock_guard<std::mutex> lock(executorMutex);
+        return estimates->size();
+    }
+    bool isSearching() const { return searchInProgress; }
+    std::vector<std::wstring> getResults() const {
+        auto query = currentQuery();
+        if (!query) return {};
+        std::lock_guard<std::mutex> lock(query->resultsMutex);
+        return query->results;
+    }
+    // Appends the results published after the first `from` (and their size and time) and
+    // returns the new total, so a poller only copies what is new
+    size_t getResultsSince(size_t from, std::vector<std::wstring>& paths, std::vector<ResultInfo>& info) const {
+        auto query = currentQuery();
+        if (!query) return 0;
+        std::lock_guard<std::mutex> lock(query->resultsMutex);
+        if (from < query->results.size()) {
+            paths.insert(paths.end(), query->results.begin() + from, query->results.end());
+            info.insert(info.end(), query->resultInfo.begin() + from, query->resultInfo.end());
+        }
+        return query->results.size();
+    }
+    // The current query's stats once every worker has left it, or null while any still
+    // writes them. The pointer keeps the query alive, so a later search() cannot free them.
+    std::shared_ptr<const SearchStats> getStats() const {
+        std::lock_guard<std::mutex> lock(executorMutex);
+        if (!current || current->poolsRemaining.load() != 0 || current->workersInside != 0) return nullptr;
+        return std::shared_ptr<const SearchStats>(current, &current->stats);
+    }
+    // Controller decisions so far; safe while the query runs
+    std::vector<std::string> getEvents() const {
+        auto query = currentQuery();
+        return query ? query->stats.getEvents() : std::vector<std::string>();
+    }
+    std::chrono::steady_clock::time_point getStartTime() const {
+        auto query = currentQuery();
+        return query ? query->startTime : std::chrono::steady_clock::time_point();
+    }
+    // Startup latencies of the current query in nanoseconds, or -1 if not reached yet
+    int64_t getFirstDirectoryNs() const {
+        auto query = currentQuery();
+        return query ? query->firstDirectoryNs.load() : -1;
+    }
+    int64_t getFirstResultNs() const {
+        auto query = currentQuery();
+        return query ? query->firstResultNs.load() : -1;
+    }
+    // du-style totals of the directories with these normalizedRootKey()s, all empty unless
+    // the current query aggregates sizes; partial while it runs
+    void getDirectorySizes(const std::vector<std::wstring>& keys, std::vector<std::optional<DirectorySize>>& sizes) const {
+        auto query = currentQuery();
+        if (query && query->sizes) {
+            query->sizes->lookup(keys, sizes);
+        } else {
+            sizes.assign(keys.size(), std::nullopt);
+        }
+    }
+    // Calls visit(path, depth, size) for each aggregated directory at most maxDepth below a root
+    template <typename Visit>
+    void forEachDirectorySize(uint32_t maxDepth, Visit visit) const {
+        auto query = currentQuery();
+        if (query && query->sizes) {
+            query->sizes->forEach(maxDepth, visit);
+        }
+    }
+    // Most directories that were waiting to be read at once, and the bytes holding them
+    std::pair<int64_t, int64_t> getFrontierPeak() const {
+        auto query = currentQuery();
+        return query ? std::make_pair(query->frontierPeakDirectories.load(), query->frontierPeakBytes.load())
+                     : std::make_pair<int64_t, int64_t>(0, 0);
+    }
+    TraversalCounts getTraversalCounts() const {
+        TraversalCounts counts;
+        if (auto query = currentQuery()) {
+            for (const auto& pool : query->pools) {
+                counts.directoriesRead += pool->directoriesCompleted.load();
+            }
+            counts.revisitsSkipped = query->revisitsSkipped.load();
+            counts.linksSkipped = query->linksSkipped.load();
+            counts.otherVolumesSkipped = query->otherVolumesSkipped.load();
+        }
+        return counts;
+    }
+    ThrottleCounts getThrottleCounts() const {
+        auto query = currentQuery();
+        return query && query->throttle ? query->throttle->counts() : ThrottleCounts();
+    }
+    ArchiveCounts getArchiveCounts() const {
+        ArchiveCounts counts;
+        if (auto query = currentQuery()) {
+            counts.listed = query->archivesListed.load();
+            counts.members = query->archiveMembers.load();
+            counts.unreadable = query->archivesUnreadable.load();
+            counts.tooLarge = query->archivesTooLarge.load();
+        }
+        return counts;
+    }
+    uint64_t getHardLinksSkipped() const {
+        auto query = currentQuery();
+        return query && query->sizes ? query->sizes->hardLinksSkipped() : 0;
+    }
+    // Whether the current query is answered from the catalog rather than the disk
+    bool isCatalogScan() const {
+        auto query = currentQuery();
+        return query && query->scanCatalog;
+    }
+    // The last complete crawl, or nullptr; it no longer changes once published
+    std::shared_ptr<const FileCatalog> getCatalog() const {
+        std::lock_guard<std::mutex> lock(executorMutex);
+        return catalog;
+    }
+    size_t getCatalogEntries() const {
+        std::lock_guard<std::mutex> lock(executorMutex);
+        return catalog ? catalog->size() : 0;
+    }
+    size_t getCatalogBytes() const {
+        std::lock_guard<std::mutex> lock(executorMutex);
+        return catalog ? catalog->memoryBytes() : 0;
+    }
+    size_t getWorkerCount() const {
+        std::lock_guard<std::mutex> lock(executorMutex);
+        return workers.size();
+    }
+    size_t getQueueSize() const {
+        size_t total = 0;
+        if (auto query = currentQuery()) {
+            for (const auto& pool : query->pools) {
+                total += static_cast<size_t>(std::max<int64_t>(pool->pendingDirectories.load(), 0));
+            }
+        }
+        return total;
+    }
+    std::vector<PoolStatus> getPoolStatus() const {
+        std::vector<PoolStatus> status;
+        if (auto query = currentQuery()) {
+            for (const auto& pool : query->pools) {
+                std::lock_guard<std::mutex> lock(pool->mtx);
+                status.push_back({ wstring_to_string(pool->mountPoint), pool->controller->getKind(),
+                    pool->workerLimit.load(), pool->controller->getMinWorkers(), pool->controller->getMaxWorkers(),
+                    static_cast<size_t>(std::max<int64_t>(pool->pendingDirectories.load(), 0)), pool->roots.size() });
+            }
+        }
+        return status;
+    }
+};
+
+// XXH64 (xxHash, 64-bit). Streaming, so a large file can be hashed one mapped window at
+// a time. Reads words in host order, which is little-endian on every Windows target.
+class XxHash64 {
+private:
+    static constexpr uint64_t P1 = 11400714785074694791ULL;
+    static constexpr uint64_t P2 = 14029467366897019727ULL;
+    static constexpr uint64_t P3 = 1609587929392839161ULL;
+    static constexpr uint64_t P4 = 9650029242287828579ULL;
+    static constexpr uint64_t P5 = 2870177450012600261ULL;
+
+    uint64_t seed;
+    uint64_t v[4];
+    uint8_t buffer[32];
+    size_t buffered = 0;
+    uint64_t total = 0;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t read64(const uint8_t* p) { uint64_t value; memcpy(&value, p, 8); return value; }
+    static uint32_t read32(const uint8_t* p) { uint32_t value; memcpy(&value, p, 4); return value; }
+
+    static uint64_t round(uint64_t acc, uint64_t input) {
+        acc += input * P2;
+        return rotl(acc, 31) * P1;
+    }
+
+    static uint64_t mergeRound(uint64_t acc, uint64_t value) {
+        acc ^= round(0, value);
+        return acc * P1 + P4;
+    }
+
+    void consume(const uint8_t* p) {
+        v[0] = round(v[0], read64(p));
+        v[1] = round(v[1], read64(p + 8));
+        v[2] = round(v[2], read64(p + 16));
+        v[3] = round(v[3], read64(p + 24));
+    }
+
+public:
+    explicit XxHash64(uint64_t seed = 0) : seed(seed) {
+        v[0] = seed + P1 + P2;
+        v[1] = seed + P2;
+        v[2] = seed;
+        v[3] = seed - P1;
+    }
+
+    void update(const void* data, size_t length) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total += length;
+        if (buffered + length < 32) {
+            memcpy(buffer + buffered, p, length);
+            buffered += length;
+            return;
+        }
+        if (buffered > 0) {
+            size_t fill = 32 - buffered;
+            memcpy(buffer + buffered, p, fill);
+            consume(buffer);
+            p += fill;
+            length -= fill;
+            buffered = 0;
+        }
+        for (; length >= 32; p += 32, length -= 32) {
+            consume(p);
+        }
+        memcpy(buffer, p, length);
+        buffered = length;
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (total >= 32) {
+            h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+            for (uint64_t lane : v) {
+                h = mergeRound(h, lane);
+            }
+        } else {
+            h = seed + P5;
+        }
+        h += total;
+
+        const uint8_t* p = buffer;
+        size_t length = buffered;
+        for (; length >= 8; p += 8, length -= 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * P1 + P4;
+        }
+        if (length >= 4) {
+            h ^= static_cast<uint64_t>(read32(p)) * P1;
+            h = rotl(h, 23) * P2 + P3;
+            p += 4;
+            length -= 4;
+        }
+        for (; length > 0; ++p, --length) {
+            h ^= *p * P5;
+            h = rotl(h, 11) * P1;
+        }
+
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    static uint64_t hash(const void* data, size_t length, uint64_t seed = 0) {
+        XxHash64 hasher(seed);
+        hasher.update(data, length);
+        return hasher.digest();
+    }
+};
+
+// Finds files with identical content in staged parallel passes. Each stage only touches
+// the files that survived the one before: same size, then the same first and last few
+// KB, then the same XXH64 over the whole file read through mapped views.
+class DuplicateFinder {
+public:
+    struct Stage {
+        std::string name;
+        size_t filesIn = 0;
+        size_t filesOut = 0;
+        uint64_t bytesRead = 0;
+        double seconds = 0;
+    };
+
+    struct Group {
+        uint64_t size = 0;
+        std::vector<std::wstring> paths;
+    };
+
+    struct Report {
+        std::vector<Stage> stages;
+        std::vector<Group> groups;  // Largest waste first
+        size_t files = 0;
+        uint64_t totalBytes = 0;   // Size of every candidate file
+        uint64_t bytesRead = 0;    // What the stages actually read
+        uint64_t wastedBytes = 0;  // Everything but one copy of each group
+        size_t hardLinksSkipped = 0;
+        size_t errors = 0;
+        bool cancelled = false;
+    };
+
+private:
+    struct Candidate {
+        std::wstring path;
+        uint64_t size = 0;
+        uint64_t volume = 0;
+        uint64_t fileIndex = 0;
+        uint64_t hash = 0;
+        bool fullyHashed = false;  // Small enough that the edge pass read all of it
+        bool valid = true;
+    };
+
+    static constexpr DWORD EDGE_BYTES = 4096;
+    static constexpr uint64_t MAP_WINDOW = 64ULL << 20;  // A multiple of the allocation granularity
+
+    std::thread runner;
+    std::atomic<bool> running{ false };
+    std::atomic<bool> cancelRequested{ false };
+    mutable std::mutex reportMutex;
+    Report report;
+
+    // Runs body(i) for every i on a few threads; I/O bound, so more threads than cores
+    void parallelFor(size_t count, const std::function<void(size_t)>& body) {
+        std::atomic<size_t> next{ 0 };
+        auto work = [&] {
+            for (size_t i = next++; i < count && !cancelRequested.load(); i = next++) {
+                body(i);
+            }
+        };
+        size_t threadCount = std::min<size_t>(count, std::max(4u, 2 * std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < threadCount; ++t) {
+            threads.emplace_back(work);
+        }
+        work();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Keeps the candidates that share (size, hash) with at least one other
+    static void keepGroups(std::vector<Candidate>& candidates) {
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+            [](const Candidate& c) { return !c.valid; }), candidates.end());
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+            return a.size != b.size ? a.size < b.size : a.hash < b.hash;
+        });
+        std::vector<Candidate> kept;
+        for (size_t i = 0; i < candidates.size();) {
+            size_t j = i + 1;
+            while (j < candidates.size() && candidates[j].size == candidates[i].size &&
+                   candidates[j].hash == candidates[i].hash) {
+                ++j;
+            }
+            if (j - i > 1) {
+                for (size_t k = i; k < j; ++k) {
+                    kept.push_back(std::move(candidates[k]));
+                }
+            }
+            i = j;
+        }
+        candidates = std::move(kept);
+    }
+
+    void publishStage(Stage stage) {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        report.bytesRead += stage.bytesRead;
+        report.stages.push_back(std::move(stage));
+    }
+
+    // Hashes the first and last EDGE_BYTES, and records the file's identity for hard links
+    bool hashEdges(Candidate& candidate, std::atomic<uint64_t>& bytesRead) {
+        HANDLE file = CreateFileW(candidate.path.c_str(), GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        bool ok = false;
+        BY_HANDLE_FILE_INFORMATION info = {};
+        if (GetFileInformationByHandle(file, &info) &&
+            ((static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow) == candidate.size) {
+            candidate.volume = info.dwVolumeSerialNumber;
+            candidate.fileIndex = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+
+            uint8_t head[EDGE_BYTES * 2];
+            DWORD wanted = static_cast<DWORD>(std::min<uint64_t>(candidate.size, sizeof(head)));
+            DWORD got = 0;
+            if (candidate.size <= sizeof(head)) {
+                // The whole file fits: this hash is already the full-content hash
+                ok = ReadFile(file, head, wanted, &got, nullptr) && got == wanted;
+                candidate.fullyHashed = true;
+            } else {
+                DWORD tailGot = 0;
+                OVERLAPPED tailAt = {};
+                uint64_t tailOffset = candidate.size - EDGE_BYTES;
+                tailAt.Offset = static_cast<DWORD>(tailOffset);
+                tailAt.OffsetHigh = static_cast<DWORD>(tailOffset >> 32);
+                ok = ReadFile(file, head, EDGE_BYTES, &got, nullptr) && got == EDGE_BYTES &&
+                    ReadFile(file, head + EDGE_BYTES, EDGE_BYTES, &tailGot, &tailAt) && tailGot == EDGE_BYTES;
+                got += tailGot;
+            }
+            bytesRead += got;
+            if (ok) {
+                candidate.hash = XxHash64::hash(head, got);
+            }
+        }
+        CloseHandle(file);
+        return ok;
+    }
+
+    // XXH64 of the whole file, one mapped window at a time
+    bool hashContents(Candidate& candidate, std::atomic<uint64_t>& bytesRead) {
+        HANDLE file = CreateFileW(candidate.path.c_str(), GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr) {
+            CloseHandle(file);
+            return false;
+        }
+
+        XxHash64 hasher;
+        bool ok = true;
+        for (uint64_t offset = 0; offset < candidate.size && ok && !cancelRequested.load(); offset += MAP_WINDOW) {
+            size_t length = static_cast<size_t>(std::min(MAP_WINDOW, candidate.size - offset));
+            const void* view = MapViewOfFile(mapping, FILE_MAP_READ,
+                static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), length);
+            if (view == nullptr) {
+                ok = false;
+                break;
+            }
+            // A file truncated or a share lost under the view faults here; that file fails
+            struct Window {
+                XxHash64* hasher;
+                const void* view;
+                size_t length;
+            } window = { &hasher, view, length };
+            ok = callGuarded([](void* context) {
+                auto* window = static_cast<Window*>(context);
+                window->hasher->update(window->view, window->length);
+            }, &window);
+            UnmapViewOfFile(view);
+            bytesRead += length;
+        }
+        CloseHandle(mapping);
+        CloseHandle(file);
+        candidate.hash = hasher.digest();
+        return ok && !cancelRequested.load();
+    }
+
+    void run(std::vector<std::wstring> paths) {
+        std::vector<Candidate> candidates(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            candidates[i].path = std::move(paths[i]);
+        }
+        std::atomic<size_t> errors{ 0 };
+
+        // Stage 1: sizes, from metadata only
+        Stage sizeStage{ "Size" };
+        sizeStage.filesIn = candidates.size();
+        auto start = std::chrono::steady_clock::now();
+        parallelFor(candidates.size(), [&](size_t i) {
+            WIN32_FILE_ATTRIBUTE_DATA data;
+            if (GetFileAttributesExW(candidates[i].path.c_str(), GetFileExInfoStandard, &data)) {
+                candidates[i].size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+            } else {
+                ++errors;
+                candidates[i].valid = false;
+            }
+        });
+        uint64_t totalBytes = 0;
+        for (auto& candidate : candidates) {
+            totalBytes += candidate.size;
+            // Empty files are trivially identical and waste nothing
+            if (candidate.size == 0) candidate.valid = false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            report.files = candidates.size();
+            report.totalBytes = totalBytes;
+        }
+        keepGroups(candidates);
+        sizeStage.filesOut = candidates.size();
+        sizeStage.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        publishStage(sizeStage);
+
+        // Stage 2: first and last EDGE_BYTES; hard links to one file count once
+        Stage edgeStage{ "Head/tail" };
+        edgeStage.filesIn = candidates.size();
+        std::atomic<uint64_t> edgeBytes{ 0 };
+        start = std::chrono::steady_clock::now();
+        parallelFor(candidates.size(), [&](size_t i) {
+            if (!hashEdges(candidates[i], edgeBytes)) {
+                ++errors;
+                candidates[i].valid = false;
+            }
+        });
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+            return a.volume != b.volume ? a.volume < b.volume : a.fileIndex < b.fileIndex;
+        });
+        size_t hardLinks = 0;
+        for (size_t i = 1; i < candidates.size(); ++i) {
+            if (candidates[i].valid && candidates[i - 1].valid && candidates[i].fileIndex != 0 &&
+                candidates[i].volume == candidates[i - 1].volume && candidates[i].fileIndex == candidates[i - 1].fileIndex) {
+                candidates[i - 1].valid = false;
+                hardLinks++;
+            }
+        }
+        keepGroups(candidates);
+        edgeStage.filesOut = candidates.size();
+        edgeStage.bytesRead = edgeBytes.load();
+        edgeStage.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        publishStage(edgeStage);
+
+        // Stage 3: full contents, for files the edge pass didn't already read entirely
+        Stage fullStage{ "Full hash" };
+        fullStage.filesIn = candidates.size();
+        std::atomic<uint64_t> fullBytes{ 0 };
+        start = std::chrono::steady_clock::now();
+        parallelFor(candidates.size(), [&](size_t i) {
+            if (!candidates[i].fullyHashed && !hashContents(candidates[i], fullBytes)) {
+                ++errors;
+                candidates[i].valid = false;
+            }
+        });
+        keepGroups(candidates);
+        fullStage.filesOut = candidates.size();
+        fullStage.bytesRead = fullBytes.load();
+        fullStage.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        publishStage(fullStage);
+
+        std::vector<Group> groups;
+        for (size_t i = 0; i < candidates.size();) {
+            Group group;
+            group.size = candidates[i].size;
+            size_t j = i;
+            for (; j < candidates.size() && candidates[j].size == candidates[i].size &&
+                   candidates[j].hash == candidates[i].hash; ++j) {
+                group.paths.push_back(candidates[j].path);
+            }
+            groups.push_back(std::move(group));
+            i = j;
+        }
+        std::sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) {
+            return a.size * (a.paths.size() - 1) > b.size * (b.paths.size() - 1);
+        });
+
+        std::lock_guard<std::mutex> lock(reportMutex);
+        for (const auto& group : groups) {
+            report.wastedBytes += group.size * (group.paths.size() - 1);
+        }
+        report.groups = std::move(groups);
+        report.hardLinksSkipped = hardLinks;
+        report.errors = errors.load();
+        report.cancelled = cancelRequested.load();
+    }
+
+public:
+    ~DuplicateFinder() {
+        cancel();
+        wait();
+    }
+
+    // Starts looking for duplicates among paths in the background
+    void start(std::vector<std::wstring> paths) {
+        cancel();
+        wait();
+        cancelRequested = false;
+        {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            report = Report();
+        }
+        running = true;
+        runner = std::thread([this, paths = std::move(paths)]() mutable {
+            run(std::move(paths));
+            running = false;
+        });
+    }
+
+    void cancel() { cancelRequested = true; }
+
+    void wait() {
+        if (runner.joinable()) {
+            runner.join();
+        }
+    }
+
+    bool isRunning() const { return running; }
+
+    // Stages appear as they finish; groups once the last stage is done
+    Report getReport() const {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        return report;
+    }
+};
+
+// Loads file previews on a background thread, so a click on a file on a slow mount never
+// stalls the UI. A preview is one page of the file read through a mapped view: text pages
+// from the head or the tail, or a hex dump of any page. Recent pages are kept in an LRU.
+class PreviewService {
+public:
+    enum class Mode { Text, Hex };
+    enum class Encoding { Empty, Ascii, Utf8, Utf16LE, Utf16BE, Ansi, Binary };
+
+    static constexpr uint64_t LAST_PAGE = UINT64_MAX;  // Resolved to the file's last page (tail)
+    static constexpr uint64_t TEXT_PAGE_BYTES = 16 * 1024;
+    static constexpr uint64_t HEX_PAGE_BYTES = 4 * 1024;
+    static constexpr size_t CACHE_SIZE = 32;  // Pages
+
+    struct Preview {
+        std::wstring path;
+        Mode mode = Mode::Text;
+        uint64_t page = 0;
+        uint64_t pageCount = 1;
+        uint64_t offset = 0;  // First byte shown
+        uint64_t fileSize = 0;
+        Encoding encoding = Encoding::Empty;
+        std::string text;   // UTF-8 for ImGui; a hex dump for Hex mode and binary files
+        std::string error;  // Set when the file couldn't be opened or read
+        double loadMs = 0;  // Time spent reading and decoding, without queueing
+    };
+
+    // From each show() to its page being ready, for pages that had to be loaded
+    struct LatencyReport {
+        size_t loads = 0;
+        size_t cacheHits = 0;
+        double p50Ms = 0;
+        double p90Ms = 0;
+        double p99Ms = 0;
+        double maxMs = 0;
+    };
+
+private:
+    struct Key {
+        std::wstring path;
+        Mode mode;
+        uint64_t page;
+        bool operator==(const Key& other) const {
+            return page == other.page && mode == other.mode && path == other.path;
+        }
+    };
+
+    static constexpr uint64_t SAMPLE_BYTES = 4096;  // Read from the head to detect the encoding
+    static constexpr size_t LATENCY_SAMPLES = 1024;
+
+    // Everything below is guarded by mtx
+    mutable std::mutex mtx;
+    std::condition_variable requestCv;      // A page to load, or shutdown
+    mutable std::condition_variable readyCv;  // A load finished
+    std::optional<Key> wanted;    // The page the UI shows
+    std::optional<Key> pending;   // Waiting for the loader; a newer show() replaces it
+    std::optional<Key> inFlight;  // Being loaded right now
+    std::chrono::steady_clock::time_point pendingSince;
+    std::shared_ptr<const Preview> current;  // Loaded page of wanted, if ready
+    std::list<std::pair<Key, std::shared_ptr<const Preview>>> cache;  // Most recently used first
+    std::vector<double> latencies;  // Ring of the last LATENCY_SAMPLES loads
+    size_t loads = 0;
+    size_t cacheHits = 0;
+    bool shutdown = false;
+    std::thread loader;
+
+    static bool isValidUtf8(const uint8_t* data, size_t length) {
+        size_t i = 0;
+        while (i < length) {
+            uint8_t lead = data[i];
+            size_t extra = lead < 0x80 ? 0 : (lead >> 5) == 0x6 ? 1 : (lead >> 4) == 0xE ? 2 : (lead >> 3) == 0x1E ? 3 : 4;
+            if (extra == 4 || (extra == 1 && lead < 0xC2)) return false;  // Stray continuation or overlong
+            // A sequence cut by the end of the sample is fine
+            for (size_t k = 1; k <= extra && i + k < length; ++k) {
+                if ((data[i + k] & 0xC0) != 0x80) return false;
+            }
+            i += extra + 1;
+        }
+        return true;
+    }
+
+public:
+    // Byte order mark first, then a NUL pattern for UTF-16 without one, then control bytes
+    // for binary; what's left is ASCII, valid UTF-8, or the ANSI code page
+    static Encoding detectEncoding(const uint8_t* data, size_t length) {
+        if (length == 0) return Encoding::Empty;
+        if (length >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF) return Encoding::Utf8;
+        if (length >= 2 && data[0] == 0xFF && data[1] == 0xFE) return Encoding::Utf16LE;
+        if (length >= 2 && data[0] == 0xFE && data[1] == 0xFF) return Encoding::Utf16BE;
+
+        size_t evenZeros = 0, oddZeros = 0, controls = 0;
+        bool ascii = true;
+        for (size_t i = 0; i < length; ++i) {
+            uint8_t c = data[i];
+            if (c == 0) {
+                (i % 2 == 0 ? evenZeros : oddZeros)++;
+            } else if (c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != 0x1B) {
+                controls++;
+            }
+            ascii &= c < 0x80;
+        }
+        // Mostly-Latin UTF-16 has a zero in every other byte and none in the others
+        size_t pairs = length / 2;
+        if (pairs > 0 && oddZeros * 10 >= pairs * 3 && evenZeros == 0) return Encoding::Utf16LE;
+        if (pairs > 0 && evenZeros * 10 >= pairs * 3 && oddZeros == 0) return Encoding::Utf16BE;
+        if (evenZeros + oddZeros > 0 || controls * 10 > length) return Encoding::Binary;
+        if (ascii) return Encoding::Ascii;
+        return isValidUtf8(data, length) ? Encoding::Utf8 : Encoding::Ansi;
+    }
+
+    static const char* encodingName(Encoding encoding) {
+        switch (encoding) {
+        case Encoding::Empty: return "Empty";
+        case Encoding::Ascii: return "ASCII";
+        case Encoding::Utf8: return "UTF-8";
+        case Encoding::Utf16LE: return "UTF-16 LE";
+        case Encoding::Utf16BE: return "UTF-16 BE";
+        case Encoding::Ansi: return "ANSI";
+        case Encoding::Binary: return "Binary";
+        }
+        return "";
+    }
+
+    // 16 bytes per line: offset, hex bytes, printable ASCII
+    static void appendHexDump(std::string& out, const uint8_t* data, size_t length, uint64_t offset) {
+        char line[96];
+        for (size_t row = 0; row < length; row += 16) {
+            int n = snprintf(line, sizeof(line), "%010llx  ", static_cast<unsigned long long>(offset + row));
+            for (size_t i = 0; i < 16; ++i) {
+                if (row + i < length) {
+                    n += snprintf(line + n, sizeof(line) - n, "%02x ", data[row + i]);
+                } else {
+                    n += snprintf(line + n, sizeof(line) - n, "   ");
+                }
+                if (i == 7) line[n++] = ' ';
+            }
+            line[n++] = ' ';
+            for (size_t i = 0; i < 16 && row + i < length; ++i) {
+                uint8_t c = data[row + i];
+                line[n++] = (c >= 0x20 && c < 0x7F) ? static_cast<char>(c) : '.';
+            }
+            line[n++] = '\n';
+            out.append(line, n);
+        }
+    }
+
+    // Decodes one page to UTF-8. A page that starts mid-file drops the partial character and
+    // line it starts in; one that ends mid-file drops a character cut at its end.
+    static std::string decodeText(const uint8_t* data, size_t length, Encoding encoding, bool cutStart, bool cutEnd) {
+        std::wstring wide;
+        if (encoding == Encoding::Utf16LE || encoding == Encoding::Utf16BE) {
+            bool littleEndian = encoding == Encoding::Utf16LE;
+            for (size_t i = 0; i + 1 < length; i += 2) {
+                wide.push_back(static_cast<wchar_t>(littleEndian ? data[i] | (data[i + 1] << 8) : (data[i] << 8) | data[i + 1]));
+            }
+            if (cutStart && !wide.empty() && wide.front() >= 0xDC00 && wide.front() <= 0xDFFF) wide.erase(0, 1);
+            if (cutEnd && !wide.empty() && wide.back() >= 0xD800 && wide.back() <= 0xDBFF) wide.pop_back();
+        } else if (encoding == Encoding::Ansi) {
+            int count = MultiByteToWideChar(CP_ACP, 0, reinterpret_cast<const char*>(data), static_cast<int>(length), nullptr, 0);
+            wide.resize(count);
+            MultiByteToWideChar(CP_ACP, 0, reinterpret_cast<const char*>(data), static_cast<int>(length), &wide[0], count);
+        } else {
+            size_t begin = 0, end = length;
+            if (cutStart) {
+                while (begin < end && begin < 3 && (data[begin] & 0xC0) == 0x80) begin++;
+            }
+            if (cutEnd) {
+                // Back up to the last lead byte and drop its sequence if it is incomplete
+                size_t lead = end;
+                while (lead > begin && end - lead < 4 && (data[lead - 1] & 0xC0) == 0x80) lead--;
+                if (lead > begin && data[lead - 1] >= 0xC0) {
+                    uint8_t c = data[lead - 1];
+                    size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+                    if (end - (lead - 1) < need) end = lead - 1;
+                }
+            }
+            std::string text(reinterpret_cast<const char*>(data) + begin, end - begin);
+            if (!cutStart && text.compare(0, 3, "\xEF\xBB\xBF") == 0) text.erase(0, 3);
+            if (cutStart) {
+                size_t newline = text.find('\n');
+                if (newline != std::string::npos) text.erase(0, newline + 1);
+            }
+            return text;
+        }
+
+        if (!cutStart && !wide.empty() && wide.front() == 0xFEFF) wide.erase(0, 1);
+        if (cutStart) {
+            size_t newline = wide.find(L'\n');
+            if (newline != std::wstring::npos) wide.erase(0, newline + 1);
+        }
+        return wide.empty() ? std::string() : wstring_to_string(wide);
+    }
+
+    // Reads and decodes one page; runs on the loader thread, or directly for benchmarks
+    static Preview load(const std::wstring& path, Mode mode, uint64_t page) {
+        auto start = std::chrono::steady_clock::now();
+        Preview preview;
+        preview.path = path;
+        preview.mode = mode;
+
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            preview.error = "Cannot open file";
+            return preview;
+        }
+        LARGE_INTEGER size = {};
+        GetFileSizeEx(file, &size);
+        preview.fileSize = static_cast<uint64_t>(size.QuadPart);
+
+        const uint64_t pageBytes = mode == Mode::Hex ? HEX_PAGE_BYTES : TEXT_PAGE_BYTES;
+        preview.pageCount = std::max<uint64_t>(1, (preview.fileSize + pageBytes - 1) / pageBytes);
+        preview.page = std::min(page, preview.pageCount - 1);
+        preview.offset = preview.page * pageBytes;
+
+        std::vector<uint8_t> sample;
+        std::vector<uint8_t> bytes;
+        bool ok = true;
+        // Empty files can't be mapped, and have nothing to show anyway
+        if (preview.fileSize > 0) {
+            HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            size_t length = static_cast<size_t>(std::min(pageBytes, preview.fileSize - preview.offset));
+            ok = mapping != nullptr &&
+                readMapped(mapping, 0, static_cast<size_t>(std::min(SAMPLE_BYTES, preview.fileSize)), sample) &&
+                readMapped(mapping, preview.offset, length, bytes);
+            if (mapping != nullptr) CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        if (!ok) {
+            preview.error = "Cannot read file";
+            return preview;
+        }
+
+        preview.encoding = detectEncoding(sample.data(), sample.size());
+        if (mode == Mode::Hex || preview.encoding == Encoding::Binary) {
+            preview.text.reserve(bytes.size() / 16 * 80 + 80);
+            appendHexDump(preview.text, bytes.data(), bytes.size(), preview.offset);
+        } else {
+            preview.text = decodeText(bytes.data(), bytes.size(), preview.encoding,
+                preview.offset > 0, preview.offset + bytes.size() < preview.fileSize);
+        }
+        preview.loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return preview;
+    }
+
+private:
+    void loaderMain() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            requestCv.wait(lock, [&] { return shutdown || pending.has_value(); });
+            if (shutdown) return;
+            Key key = std::move(*pending);
+            pending.reset();
+            inFlight = key;
+            auto requested = pendingSince;
+            lock.unlock();
+
+            auto preview = std::make_shared<const Preview>(load(key.path, key.mode, key.page));
+
+            lock.lock();
+            inFlight.reset();
+            cache.emplace_front(key, preview);
+            if (cache.size() > CACHE_SIZE) {
+                cache.pop_back();
+            }
+            double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - requested).count();
+            if (latencies.size() < LATENCY_SAMPLES) {
+                latencies.push_back(latency);
+            } else {
+                latencies[loads % LATENCY_SAMPLES] = latency;
+            }
+            loads++;
+            // A page the UI moved away from still lands in the cache for later
+            if (wanted && *wanted == key) {
+                current = preview;
+            }
+            readyCv.notify_all();
+        }
+    }
+
+public:
+    PreviewService() : loader(&PreviewService::loaderMain, this) {}
+
+    ~PreviewService() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            shutdown = true;
+        }
+        requestCv.notify_all();
+        loader.join();
+    }
+
+    PreviewService(const PreviewService&) = delete;
+    PreviewService& operator=(const PreviewService&) = delete;
+
+    // Makes a page the one to show. A cached page is ready at once; otherwise it is queued
+    // for the loader, replacing any page still waiting. reload drops the cached copy.
+    void show(const std::wstring& path, Mode mode, uint64_t page, bool reload = false) {
+        std::lock_guard<std::mutex> lock(mtx);
+        Key key{ path, mode, page };
+        wanted = key;
+        current.reset();
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->first == key) {
+                if (reload) {
+                    cache.erase(it);
+                } else {
+                    cache.splice(cache.begin(), cache, it);
+                    current = cache.front().second;
+                    cacheHits++;
+                    return;
+                }
+                break;
+            }
+        }
+        if (inFlight && *inFlight == key && !reload) {
+            pending.reset();  // Already loading; it becomes current when done
+            return;
+        }
+        pending = std::move(key);
+        pendingSince = std::chrono::steady_clock::now();
+        requestCv.notify_one();
+    }
+
+    // The page last asked for by show(), or nullptr while it loads
+    std::shared_ptr<const Preview> get() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return current;
+    }
+
+    // Blocks until the page last asked for by show() is ready
+    std::shared_ptr<const Preview> wait() const {
+        std::unique_lock<std::mutex> lock(mtx);
+        readyCv.wait(lock, [&] { return current != nullptr || !wanted; });
+        return current;
+    }
+
+    LatencyReport latency() const {
+        std::vector<double> sorted;
+        LatencyReport report;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            sorted = latencies;
+            report.loads = loads;
+            report.cacheHits = cacheHits;
+        }
+        if (sorted.empty()) return report;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p) {
+            size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+            return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+        };
+        report.p50Ms = percentile(0.50);
+        report.p90Ms = percentile(0.90);
+        report.p99Ms = percentile(0.99);
+        report.maxMs = sorted.back();
+        return report;
+    }
+};
+
+// Appends text to out as UTF-8
+void appendUtf8(std::string& out, const std::wstring& text) {
+    if (text.empty()) return;
+    size_t at = out.size();
+    // Most paths are plain ASCII and skip the conversion call
+    if (std::all_of(text.begin(), text.end(), [](wchar_t c) { return c < 0x80; })) {
+        out.resize(at + text.size());
+        std::transform(text.begin(), text.end(), out.begin() + at, [](wchar_t c) { return static_cast<char>(c); });
+        return;
+    }
+    out.resize(at + text.size() * 3);
+    int written = WideCharToMultiByte(CP_UTF8, 0, text.data(), static_cast<int>(text.size()),
+        &out[at], static_cast<int>(text.size() * 3), nullptr, nullptr);
+    out.resize(at + std::max(written, 0));
+}
+
+// What the exporters write: NUL-separated (for xargs -0), one per line, JSON Lines or CSV.
+// Results take any of them; changes and shard matches take lines or JSON Lines.
+enum class ExportFormat { Nul, Lines, Jsonl, Csv };
+
+bool parseExportFormat(const std::wstring& name, ExportFormat& format, bool linesOrJsonl = false) {
+    if (name == L"lines") format = ExportFormat::Lines;
+    else if (name == L"jsonl") format = ExportFormat::Jsonl;
+    else if (name == L"nul" && !linesOrJsonl) format = ExportFormat::Nul;
+    else if (name == L"csv" && !linesOrJsonl) format = ExportFormat::Csv;
+    else return false;
+    return true;
+}
+
+// The exporters' output. Callers format a batch outside the lock, in formatBuffer(), and
+// append it to a 1 MB buffer that leaves in large writes, so memory stays flat however much
+// is written. Once a write fails (the reader closed the pipe), every later append is refused.
+class BufferedOutput {
+private:
+    static constexpr size_t BUFFER_BYTES = 1 << 20;
+
+    HANDLE output;
+    std::mutex mtx;  // Guards buffer and the output handle
+    std::string buffer;
+    std::atomic<bool> broken{ false };
+    std::atomic<DWORD> error{ ERROR_SUCCESS };
+    std::atomic<uint64_t> bytes{ 0 };
+
+    // Called with mtx held
+    bool writeBufferLocked() {
+        size_t offset = 0;
+        while (offset < buffer.size() && !broken.load()) {
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(buffer.size() - offset, 1u << 30));
+            DWORD written = 0;
+            if (!WriteFile(output, buffer.data() + offset, chunk, &written, nullptr)) {
+                // ERROR_BROKEN_PIPE or ERROR_NO_DATA when the reader has exited
+                error.store(GetLastError());
+                broken.store(true);
+                break;
+            }
+            offset += written;
+            bytes += written;
+        }
+        buffer.clear();
+        return !broken.load();
+    }
+
+public:
+    explicit BufferedOutput(HANDLE output) : output(output) {
+        buffer.reserve(BUFFER_BYTES + 64 * 1024);
+    }
+    ~BufferedOutput() {
+        flush();
+    }
+    BufferedOutput(const BufferedOutput&) = delete;
+    BufferedOutput& operator=(const BufferedOutput&) = delete;
+
+    // This thread's scratch for formatting a batch, emptied
+    static std::string& formatBuffer() {
+        thread_local std::string formatted;
+        formatted.clear();
+        return formatted;
+    }
+
+    // False once the output has failed
+    bool append(const std::string& formatted) {
+        if (broken.load()) return false;
+        std::lock_guard<std::mutex> lock(mtx);
+        buffer += formatted;
+        return buffer.size() < BUFFER_BYTES || writeBufferLocked();
+    }
+
+    // Writes out whatever is buffered; false once the output has failed
+    bool flush() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return writeBufferLocked();
+    }
+
+    uint64_t bytesWritten() const { return bytes.load(); }
+    bool isBroken() const { return broken.load(); }
+    DWORD lastError() const { return error.load(); }
+};
+
+// Streams results to a file or pipe for other tools, in any ExportFormat, all UTF-8, with
+// optional size and modified time. Once the output fails every later batch is refused,
+// which stops the search.
+class ResultExporter : public ResultSink {
+private:
+    static constexpr int64_t UNIX_EPOCH_TICKS = 116444736000000000LL;  // 1970-01-01 in FILETIME ticks
+
+    BufferedOutput output;
+    ExportFormat format;
+    bool withSize;
+    bool withMtime;
+    std::atomic<uint64_t> results{ 0 };
+
+    static void quoteCsv(std::string& out, size_t start) {
+        if (out.find_first_of(",\"\r\n", start) == std::string::npos) return;
+        std::string raw = out.substr(start);
+        out.resize(start);
+        out += '"';
+        for (char c : raw) {
+            if (c == '"') out += '"';
+            out += c;
+        }
+        out += '"';
+    }
+
+    void appendRecord(std::string& out, const std::wstring& path, const ResultInfo& info) const {
+        size_t start;
+        switch (format) {
+        case ExportFormat::Nul:
+        case ExportFormat::Lines:
+            appendUtf8(out, path);
+            if (withSize) {
+                out += '\t';
+                appendNumber(out, static_cast<long long>(info.size));
+            }
+            if (withMtime) {
+                out += '\t';
+                appendNumber(out, unixSeconds(info.mtime));
+            }
+            out += format == ExportFormat::Nul ? '\0' : '\n';
+            break;
+        case ExportFormat::Jsonl:
+            out += "{\"path\":\"";
+            start = out.size();
+            appendUtf8(out, path);
+            escapeJson(out, start);
+            out += '"';
+            if (withSize) {
+                out += ",\"size\":";
+                appendNumber(out, static_cast<long long>(info.size));
+            }
+            if (withMtime) {
+                out += ",\"mtime\":";
+                appendNumber(out, unixSeconds(info.mtime));
+            }
+            out += "}\n";
+            break;
+        case ExportFormat::Csv:
+            start = out.size();
+            appendUtf8(out, path);
+            quoteCsv(out, start);
+            if (withSize) {
+                out += ',';
+                appendNumber(out, static_cast<long long>(info.size));
+            }
+            if (withMtime) {
+                out += ',';
+                appendNumber(out, unixSeconds(info.mtime));
+            }
+            out += '\n';
+            break;
+        }
+    }
+
+public:
+    ResultExporter(HANDLE handle, ExportFormat format, bool withSize, bool withMtime)
+        : output(handle), format(format), withSize(withSize), withMtime(withMtime) {
+        if (format == ExportFormat::Csv) {
+            std::string header = "path";
+            if (withSize) header += ",size";
+            if (withMtime) header += ",mtime";
+            header += '\n';
+            output.append(header);
+        }
+    }
+
+    bool write(const std::vector<std::wstring>& paths, const std::vector<ResultInfo>& info) override {
+        if (output.isBroken()) return false;
+        std::string& formatted = BufferedOutput::formatBuffer();
+        for (size_t i = 0; i < paths.size(); ++i) {
+            appendRecord(formatted, paths[i], i < info.size() ? info[i] : ResultInfo{ 0, 0 });
+        }
+        results += paths.size();
+        return output.append(formatted);
+    }
+
+    // Writes out whatever is buffered; false once the output has failed
+    bool flush() { return output.flush(); }
+
+    static void appendNumber(std::string& out, long long value) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, result.ptr);
+    }
+
+    // Escapes the UTF-8 appended since start in place, for a JSON string or a CSV field
+    static void escapeJson(std::string& out, size_t start) {
+        bool plain = std::none_of(out.begin() + start, out.end(), [](char c) {
+            return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+        });
+        if (plain) return;
+        std::string raw = out.substr(start);
+        out.resize(start);
+        for (char c : raw) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+    }
+    // FILETIME ticks as seconds since 1970, or 0 when unknown
+    static long long unixSeconds(int64_t ticks) {
+        return ticks > 0 ? (ticks - UNIX_EPOCH_TICKS) / 10000000 : 0;
+    }
+
+    uint64_t resultsWritten() const { return results.load(); }
+    uint64_t bytesWritten() const { return output.bytesWritten(); }
+    bool isBroken() const { return output.isBroken(); }
+    DWORD lastError() const { return output.lastError(); }
+};
+
+// Counts a search's results and adds up their sizes instead of keeping them, in total or per
+// group: per extension, or per folder a given number of levels below the root the result
+// is under. Each thread that hands over batches fills its own partial table without
+// locking, and the partials are merged when the groups are read, so memory grows with the
+// number of groups, not of results.
+class ResultAggregator : public ResultSink {
+public:
+    enum class Grouping { None, Extension, Directory };
+
+    struct Totals {
+        uint64_t files = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct Group {
+        std::wstring key;  // Extension folded to lower case with its dot, or a folder path
+        Totals totals;
+    };
+
+private:
+    struct Partial {
+        std::unordered_map<std::wstring, Totals> groups;
+        Totals totals;
+        uint64_t pathChars = 0;  // What the results would have held, for comparison
+        std::wstring key;        // Scratch
+    };
+
+    Grouping grouping;
+    uint32_t depth;
+    std::vector<std::wstring> roots;  // Longest first, so nested roots find the nearest
+    const uint64_t serial;            // Tells this aggregator's partials from an earlier one's
+
+    std::mutex mtx;  // Guards partials; each partial is written by its own thread only
+    std::vector<std::unique_ptr<Partial>> partials;
+
+    static uint64_t nextSerial() {
+        static std::atomic<uint64_t> counter{ 0 };
+        return ++counter;
+    }
+
+    Partial& threadPartial() {
+        thread_local uint64_t cachedSerial = 0;
+        thread_local Partial* cached = nullptr;
+        if (cachedSerial != serial) {
+            std::lock_guard<std::mutex> lock(mtx);
+            partials.push_back(std::make_unique<Partial>());
+            cached = partials.back().get();
+            cachedSerial = serial;
+        }
+        return *cached;
+    }
+
+    static bool isSeparator(wchar_t c) { return c == L'\\' || c == L'/'; }
+
+    void groupKey(const std::wstring& path, std::wstring& key) const {
+        key.clear();
+        if (grouping == Grouping::Extension) {
+            // The last dot of the last name; archive members end after the '!'
+            size_t nameStart = path.find_last_of(L"\\/!");
+            nameStart = nameStart == std::wstring::npos ? 0 : nameStart + 1;
+            size_t dot = path.rfind(L'.');
+            if (dot == std::wstring::npos || dot <= nameStart) return;
+            const uint16_t* table = caseFoldTable();
+            for (size_t i = dot; i < path.size(); ++i) {
+                key += foldCase(path[i], table);
+            }
+            return;
+        }
+        size_t rootLength = 0;
+        for (const auto& root : roots) {
+            if (path.compare(0, root.size(), root) == 0 && (path.size() == root.size() ||
+                    isSeparator(path[root.size()]) || (!root.empty() && isSeparator(root.back())))) {
+                rootLength = root.size();
+                break;
+            }
+        }
+        // Take up to depth folders below the root, never the result's own name
+        size_t end = rootLength;
+        size_t lastSeparator = path.find_last_of(L"\\/");
+        for (uint32_t level = 0; level < depth; ++level) {
+            size_t start = end < path.size() && isSeparator(path[end]) ? end + 1 : end;
+            size_t next = path.find_first_of(L"\\/", start);
+            if (next == std::wstring::npos || lastSeparator == std::wstring::npos || next > lastSeparator) break;
+            end = next;
+        }
+        key.assign(path, 0, end);
+    }
+
+public:
+    ResultAggregator(Grouping grouping, uint32_t depth, std::vector<std::wstring> searchRoots)
+        : grouping(grouping), depth(depth), roots(std::move(searchRoots)), serial(nextSerial()) {
+        std::sort(roots.begin(), roots.end(), [](const std::wstring& a, const std::wstring& b) {
+            return a.size() > b.size();
+        });
+    }
+
+    bool write(const std::vector<std::wstring>& paths, const std::vector<ResultInfo>& info) override {
+        Partial& partial = threadPartial();
+        for (size_t i = 0; i < paths.size(); ++i) {
+            partial.totals.files++;
+            partial.totals.bytes += info[i].size;
+            partial.pathChars += paths[i].size();
+            if (grouping == Grouping::None) continue;
+            groupKey(paths[i], partial.key);
+            Totals& group = partial.groups[partial.key];
+            group.files++;
+            group.bytes += info[i].size;
+        }
+        return true;
+    }
+
+    // Merges the partials; call once the search is complete. Groups come largest first, by
+    // bytes or by files, ties in key order.
+    std::vector<Group> groups(bool byFiles) {
+        std::unordered_map<std::wstring, Totals> merged;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const auto& partial : partials) {
+                for (const auto& [key, totals] : partial->groups) {
+                    Totals& group = merged[key];
+                    group.files += totals.files;
+                    group.bytes += totals.bytes;
+                }
+            }
+        }
+        std::vector<Group> result;
+        result.reserve(merged.size());
+        for (auto& [key, totals] : merged) {
+            result.push_back({ key, totals });
+        }
+        std::sort(result.begin(), result.end(), [byFiles](const Group& a, const Group& b) {
+            uint64_t left = byFiles ? a.totals.files : a.totals.bytes;
+            uint64_t right = byFiles ? b.totals.files : b.totals.bytes;
+            return left != right ? left > right : a.key < b.key;
+        });
+        return result;
+    }
+
+    Totals totals() {
+        std::lock_guard<std::mutex> lock(mtx);
+        Totals result;
+        for (const auto& partial : partials) {
+            result.files += partial->totals.files;
+            result.bytes += partial->totals.bytes;
+        }
+        return result;
+    }
+
+    size_t partialCount() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return partials.size();
+    }
+
+    // Memory the partial tables hold, and what keeping every result's path would have
+    size_t memoryBytes() {
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t bytes = 0;
+        for (const auto& partial : partials) {
+            bytes += sizeof(Partial) + partial->groups.bucket_count() * sizeof(void*);
+            for (const auto& [key, totals] : partial->groups) {
+                bytes += sizeof(std::pair<const std::wstring, Totals>) + 2 * sizeof(void*) + key.capacity() * sizeof(wchar_t);
+            }
+        }
+        return bytes;
+    }
+    uint64_t materializedBytes() {
+        std::lock_guard<std::mutex> lock(mtx);
+        uint64_t bytes = 0;
+        for (const auto& partial : partials) {
+            bytes += partial->pathChars * sizeof(wchar_t) +
+                partial->totals.files * (sizeof(std::wstring) + sizeof(ResultInfo));
+        }
+        return bytes;
+    }
+
+    static bool parseGrouping(const std::wstring& name, Grouping& grouping) {
+        if (name == L"none") grouping = Grouping::None;
+        else if (name == L"ext") grouping = Grouping::Extension;
+        else if (name == L"dir") grouping = Grouping::Directory;
+        else return false;
+        return true;
+    }
+};
+
+// Writes a file under a temporary name beside it and moves it into place once complete, so
+// a failed write leaves any earlier file intact. Values are buffered and little-endian.
+class AtomicFileWriter {
+private:
+    static constexpr size_t BUFFER_BYTES = 1 << 20;
+
+    std::wstring path;
+    std::wstring temporary;
+    const char* kind;  // What the file is, for errors
+    HANDLE output = INVALID_HANDLE_VALUE;
+    std::string buffer;
+    uint64_t flushed = 0;  // Bytes already written out
+    bool failed = false;
+
+    void flushBuffer() {
+        size_t at = 0;
+        while (at < buffer.size() && !failed) {
+            DWORD written = 0;
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(buffer.size() - at, 1u << 30));
+            if (!WriteFile(output, buffer.data() + at, chunk, &written, nullptr) || written == 0) {
+                failed = true;
+            }
+            at += written;
+        }
+        flushed += at;
+        buffer.clear();
+    }
+    void appended() {
+        if (buffer.size() >= BUFFER_BYTES) flushBuffer();
+    }
+
+public:
+    AtomicFileWriter(const std::wstring& path, const char* kind)
+        : path(path), temporary(path + L".partial"), kind(kind) {
+        buffer.reserve(BUFFER_BYTES + 64 * 1024);
+    }
+    // Without a commit the temporary file is dropped
+    ~AtomicFileWriter() {
+        if (output != INVALID_HANDLE_VALUE) {
+            CloseHandle(output);
+            DeleteFileW(temporary.c_str());
+        }
+    }
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+
+    bool create(std::string& error) {
+        output = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (output == INVALID_HANDLE_VALUE) {
+            error = std::string("Cannot create the ") + kind + " file";
+            return false;
+        }
+        return true;
+    }
+
+    void raw(const void* data, size_t length) {
+        buffer.append(static_cast<const char*>(data), length);
+        appended();
+    }
+    void byte(uint8_t value) {
+        buffer += static_cast<char>(value);
+        appended();
+    }
+    void fixed(uint64_t value, int width) {
+        for (int i = 0; i < width; ++i) {
+            buffer += static_cast<char>(value >> (8 * i));
+        }
+        appended();
+    }
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        buffer += static_cast<char>(value);
+        appended();
+    }
+    // Zeros up to an offset
+    void pad(uint64_t to) {
+        while (offset() < to) buffer += '\0';
+        appended();
+    }
+
+    uint64_t offset() const { return flushed + buffer.size(); }
+    bool hasFailed() const { return failed; }
+
+    // Writes out the rest and moves the file into place
+    bool commit(std::string& error) {
+        flushBuffer();
+        CloseHandle(output);
+        output = INVALID_HANDLE_VALUE;
+        if (failed) {
+            DeleteFileW(temporary.c_str());
+            error = std::string("Cannot write the ") + kind + " file (disk full?)";
+            return false;
+        }
+        if (!MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            DeleteFileW(temporary.c_str());
+            error = "Cannot replace " + wstring_to_string(path);
+            return false;
+        }
+        return true;
+    }
+};
+
+// Crawl snapshots: every entry of a catalog, sorted by full path and written to a file, so
+// that two crawls of the same folders can be compared later without either being in
+// memory. Paths are UTF-8 in snapshot order (see compareSnapshotPaths) and front-coded:
+// an entry stores only what its path adds to the previous one, except every
+// RESTART_INTERVAL-th entry, which stores its whole path so decoding can start there.
+//   Header   magic "FSSNAP01", root count u32, then each root as u32 byte count and UTF-8
+//   Entries  shared prefix varint, suffix length varint, suffix, directory u8, size varint, mtime i64
+//   Index    offset u64 of every restart entry
+//   Footer   entry count u64, restart count u64, entries offset u64, index offset u64,
+//            created FILETIME i64, magic "FSSNAP01"
+static constexpr char SNAPSHOT_MAGIC[8] = { 'F', 'S', 'S', 'N', 'A', 'P', '0', '1' };
+static constexpr uint32_t SNAPSHOT_RESTART_INTERVAL = 1024;
+static constexpr size_t SNAPSHOT_FOOTER_BYTES = 48;
+static constexpr size_t SNAPSHOT_MAX_PATH_BYTES = 3 * 32767;  // The longest Windows path in UTF-8
+
+// Byte order with separators before every other byte, so "a\z" sorts before "a-b". A
+// depth-first walk that visits each directory's names in byte order produces exactly this
+// order, which is how the writer sorts a catalog without sorting whole paths.
+int compareSnapshotPaths(std::string_view a, std::string_view b) {
+    auto rank = [](char c) {
+        return c == '\\' || c == '/' ? 0u : static_cast<unsigned>(static_cast<uint8_t>(c)) + 1;
+    };
+    size_t common = std::min(a.size(), b.size());
+    for (size_t i = 0; i < common; ++i) {
+        unsigned left = rank(a[i]), right = rank(b[i]);
+        if (left != right) return left < right ? -1 : 1;
+    }
+    return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+}
+
+// One snapshot entry; path points into the cursor that decoded it
+struct SnapshotRecord {
+    std::string_view path;
+    bool isDirectory;
+    uint64_t size;
+    int64_t mtime;
+};
+
+class SnapshotWriter {
+public:
+    struct Summary {
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+        uint64_t skipped = 0;  // Entries also reached under an earlier root
+    };
+
+private:
+    AtomicFileWriter& file;
+    std::vector<uint64_t> restarts;
+    std::string previous;
+    Summary summary;
+
+    explicit SnapshotWriter(AtomicFileWriter& file) : file(file) {}
+
+    void add(const std::string& path, bool isDirectory, uint64_t size, int64_t mtime) {
+        // Walking in snapshot order makes every path larger than the last, unless a folder
+        // was also reached from an overlapping root; the merge join needs it written once
+        if (summary.entries > 0 && compareSnapshotPaths(path, previous) <= 0) {
+            summary.skipped++;
+            return;
+        }
+        size_t shared = 0;
+        if (summary.entries % SNAPSHOT_RESTART_INTERVAL == 0) {
+            restarts.push_back(file.offset());
+        } else {
+            size_t limit = std::min(path.size(), previous.size());
+            while (shared < limit && path[shared] == previous[shared]) ++shared;
+        }
+        file.varint(shared);
+        file.varint(path.size() - shared);
+        file.raw(path.data() + shared, path.size() - shared);
+        file.byte(isDirectory ? 1 : 0);
+        file.varint(size);
+        file.fixed(static_cast<uint64_t>(mtime), 8);
+        previous = path;
+        summary.entries++;
+    }
+
+    // Names of the given entries in UTF-8, in snapshot order
+    static void sortedNames(const FileCatalog& catalog, const uint32_t* begin, const uint32_t* end,
+            std::vector<std::pair<std::string, uint32_t>>& out) {
+        std::wstring name;
+        for (const uint32_t* id = begin; id != end; ++id) {
+            name.assign(catalog.name(*id));
+            std::string utf8;
+            appendUtf8(utf8, name);
+            out.emplace_back(std::move(utf8), *id);
+        }
+        std::sort(out.begin(), out.end(), [](const auto& a, const auto& b) {
+            return compareSnapshotPaths(a.first, b.first) < 0;
+        });
+    }
+
+    void writeCatalog(const FileCatalog& catalog) {
+        // Children of each entry from one pass over the parent column, in ID ranges
+        size_t count = catalog.size();
+        std::vector<uint32_t> roots;
+        std::vector<uint32_t> firstChild(count + 1, 0);
+        for (uint32_t id = 0; id < count; ++id) {
+            uint32_t parent = catalog.parent(id);
+            if (parent == FileCatalog::NO_PARENT) {
+                roots.push_back(id);
+            } else {
+                firstChild[parent + 1]++;
+            }
+        }
+        for (size_t id = 0; id < count; ++id) {
+            firstChild[id + 1] += firstChild[id];
+        }
+        std::vector<uint32_t> children(count - roots.size());
+        std::vector<uint32_t> filled(firstChild.begin(), firstChild.end() - 1);
+        for (uint32_t id = 0; id < count; ++id) {
+            uint32_t parent = catalog.parent(id);
+            if (parent != FileCatalog::NO_PARENT) {
+                children[filled[parent]++] = id;
+            }
+        }
+
+        struct Level {
+            std::vector<std::pair<std::string, uint32_t>> names;
+            size_t next = 0;
+            size_t pathLength = 0;
+        };
+        std::vector<Level> stack(1);
+        sortedNames(catalog, roots.data(), roots.data() + roots.size(), stack[0].names);
+        file.raw(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        file.fixed(stack[0].names.size(), 4);
+        for (const auto& root : stack[0].names) {
+            file.fixed(root.first.size(), 4);
+            file.raw(root.first.data(), root.first.size());
+        }
+
+        std::string path;
+        while (!stack.empty() && !file.hasFailed()) {
+            Level& level = stack.back();
+            if (level.next == level.names.size()) {
+                stack.pop_back();
+                continue;
+            }
+            auto& [name, id] = level.names[level.next++];
+            path.resize(level.pathLength);
+            if (!path.empty() && path.back() != '\\' && path.back() != '/') {
+                path += static_cast<char>(std::filesystem::path::preferred_separator);
+            }
+            path += name;
+            if (path.size() > SNAPSHOT_MAX_PATH_BYTES) continue;
+            add(path, catalog.isDirectory(id), catalog.fileSize(id), catalog.modifiedTime(id));
+            if (firstChild[id + 1] > firstChild[id]) {
+                Level below;
+                below.pathLength = path.size();
+                sortedNames(catalog, children.data() + firstChild[id], children.data() + firstChild[id + 1], below.names);
+                stack.push_back(std::move(below));  // Invalidates level
+            }
+        }
+
+        uint64_t indexOffset = file.offset();
+        for (uint64_t restart : restarts) {
+            file.fixed(restart, 8);
+        }
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        file.fixed(summary.entries, 8);
+        file.fixed(restarts.size(), 8);
+        file.fixed(restarts.empty() ? indexOffset : restarts.front(), 8);
+        file.fixed(indexOffset, 8);
+        file.fixed(static_cast<uint64_t>(now.dwHighDateTime) << 32 | now.dwLowDateTime, 8);
+        file.raw(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        summary.bytes = file.offset();
+    }
+
+public:
+    // Writes the catalog's snapshot to path, leaving any earlier snapshot intact on failure
+    static bool write(const FileCatalog& catalog, const std::wstring& path, Summary& summary, std::string& error) {
+        AtomicFileWriter file(path, "snapshot");
+        if (!file.create(error)) return false;
+        SnapshotWriter writer(file);
+        writer.writeCatalog(catalog);
+        summary = writer.summary;
+        return file.commit(error);
+    }
+};
+
+// A snapshot opened for reading. Only the footer, the roots and the restart index (8 bytes
+// per SNAPSHOT_RESTART_INTERVAL entries) are loaded; entries are decoded by cursors through
+// windows copied from mapped views, so a snapshot may be far larger than memory.
+class SnapshotReader {
+public:
+    // Where a cursor starts: an entry's offset and the path of the entry before it
+    struct Position {
+        uint64_t offset;
+        std::string previous;
+    };
+
+    // Decodes the entries from a position up to an end offset, in order
+    class Cursor {
+    public:
+        static constexpr size_t WINDOW_BYTES = 1 << 20;
+
+    private:
+        const SnapshotReader& snapshot;
+        uint64_t end;
+        size_t chunkBytes;
+        std::vector<uint8_t> window;
+        uint64_t windowOffset;  // File offset of window[0]
+        size_t at = 0;
+        std::string path;
+        bool failed = false;
+
+        // Moves the unread bytes to the front and appends the next chunk of the range
+        void refill() {
+            window.erase(window.begin(), window.begin() + at);
+            windowOffset += at;
+            at = 0;
+            uint64_t loaded = windowOffset + window.size();
+            size_t length = static_cast<size_t>(std::min<uint64_t>(chunkBytes, end - loaded));
+            if (!readMapped(snapshot.mapping, loaded, length, window)) failed = true;
+        }
+
+        // Decodes the entry at 'at'; false if the window ends inside it (or, with failed
+        // set, if it is not an entry at all)
+        bool decode(SnapshotRecord& record) {
+            size_t read = at;
+            auto varint = [&](uint64_t& value) {
+                value = 0;
+                for (int shift = 0; shift < 64 && read < window.size(); shift += 7) {
+                    uint8_t byte = window[read++];
+                    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                    if ((byte & 0x80) == 0) return true;
+                }
+                return false;
+            };
+            uint64_t shared, suffix, size;
+            if (!varint(shared) || !varint(suffix)) return false;
+            if (shared > path.size() || suffix > SNAPSHOT_MAX_PATH_BYTES) {
+                failed = true;
+                return false;
+            }
+            if (suffix > window.size() - read) return false;
+            size_t suffixAt = read;
+            read += static_cast<size_t>(suffix);
+            if (read == window.size()) return false;
+            bool isDirectory = window[read++] != 0;
+            if (!varint(size) || window.size() - read < 8) return false;
+            int64_t mtime = static_cast<int64_t>(le64(&window[read]));
+            at = read + 8;
+            path.resize(static_cast<size_t>(shared));
+            path.append(reinterpret_cast<const char*>(&window[suffixAt]), static_cast<size_t>(suffix));
+            record = { path, isDirectory, size, mtime };
+            return true;
+        }
+
+    public:
+        Cursor(const SnapshotReader& snapshot, Position start, uint64_t end, size_t chunkBytes = WINDOW_BYTES)
+            : snapshot(snapshot), end(end), chunkBytes(chunkBytes), windowOffset(start.offset),
+              path(std::move(start.previous)) {}
+
+        // The next entry, valid until the following call; false at the end of the range or
+        // once the snapshot turns out to be unreadable
+        bool next(SnapshotRecord& record) {
+            while (!failed) {
+                if (decode(record)) return true;
+                if (failed) break;
+                if (windowOffset + window.size() >= end) {
+                    failed = at < window.size();  // An entry cut off by the end of the range
+                    break;
+                }
+                refill();
+            }
+            return false;
+        }
+
+        // Where the next entry starts, for resuming with a new cursor
+        Position position() const { return { windowOffset + at, path }; }
+        bool hasFailed() const { return failed; }
+    };
+
+private:
+    static constexpr size_t PROBE_BYTES = 4096;  // Cursor chunk for reading single entries
+
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    uint64_t entryCount = 0;
+    uint64_t entriesOffset = 0;
+    uint64_t indexOffset = 0;
+    int64_t created = 0;
+    std::vector<std::string> roots;
+    std::vector<uint64_t> restarts;
+
+    static uint64_t le64(const uint8_t* p) {
+        uint64_t value = 0;
+        for (int i = 7; i >= 0; --i) {
+            value = value << 8 | p[i];
+        }
+        return value;
+    }
+    static uint32_t le32(const uint8_t* p) {
+        return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+    }
+
+    bool load(uint64_t fileSize) {
+        std::vector<uint8_t> bytes;
+        if (fileSize < sizeof(SNAPSHOT_MAGIC) + 4 + SNAPSHOT_FOOTER_BYTES ||
+                !readMapped(mapping, fileSize - SNAPSHOT_FOOTER_BYTES, SNAPSHOT_FOOTER_BYTES, bytes) ||
+                memcmp(bytes.data() + 40, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+            return false;
+        }
+        entryCount = le64(bytes.data());
+        uint64_t restartCount = le64(bytes.data() + 8);
+        entriesOffset = le64(bytes.data() + 16);
+        indexOffset = le64(bytes.data() + 24);
+        created = static_cast<int64_t>(le64(bytes.data() + 32));
+        // The entries follow at least the magic and the root count
+        if (entriesOffset < sizeof(SNAPSHOT_MAGIC) + 4 ||
+                entriesOffset > indexOffset || indexOffset > fileSize - SNAPSHOT_FOOTER_BYTES ||
+                restartCount != (fileSize - SNAPSHOT_FOOTER_BYTES - indexOffset) / 8 ||
+                restartCount != (entryCount + SNAPSHOT_RESTART_INTERVAL - 1) / SNAPSHOT_RESTART_INTERVAL) {
+            return false;
+        }
+        bytes.clear();
+        if (!readMapped(mapping, indexOffset, static_cast<size_t>(restartCount * 8), bytes)) return false;
+        for (uint64_t i = 0; i < restartCount; ++i) {
+            restarts.push_back(le64(bytes.data() + i * 8));
+        }
+        if (!restarts.empty() && restarts.front() != entriesOffset) return false;
+
+        bytes.clear();
+        if (!readMapped(mapping, 0, static_cast<size_t>(entriesOffset), bytes) ||
+                memcmp(bytes.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+            return false;
+        }
+        size_t at = sizeof(SNAPSHOT_MAGIC);
+        uint32_t rootCount = le32(bytes.data() + at);
+        at += 4;
+        for (uint32_t i = 0; i < rootCount; ++i) {
+            if (bytes.size() - at < 4) return false;
+            uint32_t length = le32(bytes.data() + at);
+            at += 4;
+            if (bytes.size() - at < length) return false;
+            roots.emplace_back(reinterpret_cast<const char*>(bytes.data() + at), length);
+            at += length;
+        }
+        return true;
+    }
+
+public:
+    SnapshotReader() = default;
+    ~SnapshotReader() {
+        if (mapping != nullptr) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    }
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    bool open(const std::wstring& path, std::string& error) {
+        file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            error = "Cannot open " + wstring_to_string(path);
+            return false;
+        }
+        LARGE_INTEGER size = {};
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        if (mapping == nullptr || !load(static_cast<uint64_t>(size.QuadPart))) {
+            error = wstring_to_string(path) + " is not a snapshot";
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t entries() const { return entryCount; }
+    size_t restartCount() const { return restarts.size(); }
+    int64_t createdTime() const { return created; }
+    const std::vector<std::string>& getRoots() const { return roots; }
+
+    Position begin() const { return { entriesOffset, {} }; }
+    Position end() const { return { indexOffset, {} }; }
+    Position restart(size_t index) const { return { restarts[index], {} }; }
+
+    // The path of a restart entry, read without its neighbours
+    std::string restartKey(size_t index) const {
+        Cursor cursor(*this, restart(index), index + 1 < restarts.size() ? restarts[index + 1] : indexOffset, PROBE_BYTES);
+        SnapshotRecord record;
+        return cursor.next(record) ? std::string(record.path) : std::string();
+    }
+
+    // The position of the first entry whose path is not before key
+    Position lowerBound(std::string_view key) const {
+        // Restarts before 'low' start with a path before key; the entry sought is in the
+        // block of the last of them
+        size_t low = 0, high = restarts.size();
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (compareSnapshotPaths(restartKey(middle), key) < 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (low == 0) return begin();
+        Cursor cursor(*this, restart(low - 1), low < restarts.size() ? restarts[low] : indexOffset, PROBE_BYTES);
+        SnapshotRecord record;
+        for (;;) {
+            Position before = cursor.position();
+            if (!cursor.next(record) || compareSnapshotPaths(record.path, key) >= 0) return before;
+        }
+    }
+};
+
+// One difference between two snapshots. Sizes and times of the side an entry is missing
+// from are zero.
+struct SnapshotChange {
+    enum class Kind : uint8_t { Added, Removed, Modified };
+    Kind kind;
+    std::string path;  // UTF-8
+    bool isDirectory;
+    uint64_t oldSize;
+    uint64_t newSize;
+    int64_t oldMtime;
+    int64_t newMtime;
+};
+
+// Receives a diff's changes in batches, from several threads at once. Each batch is in path
+// order, but batches from different partitions interleave. Returning false stops the diff.
+class ChangeSink {
+public:
+    virtual ~ChangeSink() = default;
+    virtual bool write(const std::vector<SnapshotChange>& changes) = 0;
+};
+
+// Compares two snapshots with a merge join of their sorted entries. The larger snapshot is
+// cut into partitions at its restart points, the other one at the same paths found by
+// binary search over its restart index, and threads join whole partitions, so nothing but
+// each cursor's window is held in memory. A file is modified if its size or modified time
+// changed; a directory's own time changes with its contents, which show up as changes of
+// their own, so it is not compared. An entry that turned from file into directory or back
+// counts as removed and added.
+class SnapshotDiff {
+public:
+    struct Summary {
+        uint64_t added = 0;
+        uint64_t removed = 0;
+        uint64_t modified = 0;
+        uint64_t unchanged = 0;
+        size_t partitions = 0;
+        bool stopped = false;  // The sink refused a batch
+        bool failed = false;   // A snapshot turned out to be unreadable
+    };
+
+private:
+    static constexpr size_t PARTITIONS_PER_THREAD = 4;
+    static constexpr size_t BATCH_CHANGES = 1024;
+
+public:
+    static Summary run(const SnapshotReader& before, const SnapshotReader& after, ChangeSink& sink, size_t threads) {
+        threads = std::max<size_t>(threads, 1);
+        bool afterDrives = after.entries() >= before.entries();
+        const SnapshotReader& driver = afterDrives ? after : before;
+        const SnapshotReader& other = afterDrives ? before : after;
+
+        // Partition k covers [bounds[k], bounds[k + 1]) of each snapshot
+        size_t partitions = std::max<size_t>(1, std::min(driver.restartCount(), threads * PARTITIONS_PER_THREAD));
+        std::vector<SnapshotReader::Position> driverBounds{ driver.begin() }, otherBounds{ other.begin() };
+        for (size_t k = 1; k < partitions; ++k) {
+            size_t restart = k * driver.restartCount() / partitions;
+            driverBounds.push_back(driver.restart(restart));
+            otherBounds.push_back(other.lowerBound(driver.restartKey(restart)));
+        }
+        driverBounds.push_back(driver.end());
+        otherBounds.push_back(other.end());
+        const auto& beforeBounds = afterDrives ? otherBounds : driverBounds;
+        const auto& afterBounds = afterDrives ? driverBounds : otherBounds;
+
+        std::atomic<size_t> nextPartition{ 0 };
+        std::atomic<bool> stop{ false };
+        std::atomic<bool> failed{ false };
+        std::atomic<uint64_t> added{ 0 }, removed{ 0 }, modified{ 0 }, unchanged{ 0 };
+        auto join = [&] {
+            std::vector<SnapshotChange> batch;
+            uint64_t addedHere = 0, removedHere = 0, modifiedHere = 0, unchangedHere = 0;
+            auto emit = [&](SnapshotChange::Kind kind, const SnapshotRecord* old, const SnapshotRecord* now) {
+                const SnapshotRecord& record = now ? *now : *old;
+                batch.push_back({ kind, std::string(record.path), record.isDirectory, old ? old->size : 0,
+                    now ? now->size : 0, old ? old->mtime : 0, now ? now->mtime : 0 });
+            };
+            for (size_t k = nextPartition++; k < partitions && !stop.load(); k = nextPartition++) {
+                SnapshotReader::Cursor oldCursor(before, beforeBounds[k], beforeBounds[k + 1].offset);
+                SnapshotReader::Cursor newCursor(after, afterBounds[k], afterBounds[k + 1].offset);
+                SnapshotRecord old, now;
+                bool hasOld = oldCursor.next(old);
+                bool hasNew = newCursor.next(now);
+                while ((hasOld || hasNew) && !stop.load(std::memory_order_relaxed)) {
+                    int order = !hasOld ? 1 : !hasNew ? -1 : compareSnapshotPaths(old.path, now.path);
+                    if (order < 0) {
+                        emit(SnapshotChange::Kind::Removed, &old, nullptr);
+                        removedHere++;
+                        hasOld = oldCursor.next(old);
+                    } else if (order > 0) {
+                        emit(SnapshotChange::Kind::Added, nullptr, &now);
+                        addedHere++;
+                        hasNew = newCursor.next(now);
+                    } else {
+                        if (old.isDirectory != now.isDirectory) {
+                            emit(SnapshotChange::Kind::Removed, &old, nullptr);
+                            emit(SnapshotChange::Kind::Added, nullptr, &now);
+                            removedHere++;
+                            addedHere++;
+                        } else if (!now.isDirectory && (old.size != now.size || old.mtime != now.mtime)) {
+                            emit(SnapshotChange::Kind::Modified, &old, &now);
+                            modifiedHere++;
+                        } else {
+                            unchangedHere++;
+                        }
+                        hasOld = oldCursor.next(old);
+                        hasNew = newCursor.next(now);
+                    }
+                    if (batch.size() >= BATCH_CHANGES) {
+                        if (!sink.write(batch)) stop.store(true);
+                        batch.clear();
+                    }
+                }
+                if (oldCursor.hasFailed() || newCursor.hasFailed()) {
+                    failed.store(true);
+                    stop.store(true);
+                }
+            }
+            if (!batch.empty() && !stop.load() && !sink.write(batch)) stop.store(true);
+            added += addedHere;
+            removed += removedHere;
+            modified += modifiedHere;
+            unchanged += unchangedHere;
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(threads, partitions); ++i) {
+            workers.emplace_back(join);
+        }
+        join();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        Summary summary;
+        summary.added = added.load();
+        summary.removed = removed.load();
+        summary.modified = modified.load();
+        summary.unchanged = unchanged.load();
+        summary.partitions = partitions;
+        summary.failed = failed.load();
+        summary.stopped = stop.load() && !summary.failed;
+        return summary;
+    }
+};
+
+// Writes a diff's changes for other tools: one line per change ("+ path", "- path",
+// "~ path") or JSON Lines with the sizes and modified times. A failed write refuses every
+// later batch, which stops the diff.
+class ChangeExporter : public ChangeSink {
+private:
+    BufferedOutput output;
+    ExportFormat format;  // Lines or Jsonl
+
+    void appendChange(std::string& out, const SnapshotChange& change) const {
+        static const char* const KIND_NAMES[] = { "added", "removed", "modified" };
+        if (format == ExportFormat::Lines) {
+            out += "+-~"[static_cast<int>(change.kind)];
+            out += ' ';
+            out += change.path;
+            out += '\n';
+            return;
+        }
+        out += "{\"change\":\"";
+        out += KIND_NAMES[static_cast<int>(change.kind)];
+        out += "\",\"path\":\"";
+        size_t start = out.size();
+        out += change.path;
+        ResultExporter::escapeJson(out, start);
+        out += change.isDirectory ? "\",\"dir\":true" : "\",\"dir\":false";
+        if (change.kind == SnapshotChange::Kind::Modified) {
+            out += ",\"oldSize\":";
+            ResultExporter::appendNumber(out, static_cast<long long>(change.oldSize));
+            out += ",\"oldMtime\":";
+            ResultExporter::appendNumber(out, ResultExporter::unixSeconds(change.oldMtime));
+        }
+        bool removed = change.kind == SnapshotChange::Kind::Removed;
+        out += ",\"size\":";
+        ResultExporter::appendNumber(out, static_cast<long long>(removed ? change.oldSize : change.newSize));
+        out += ",\"mtime\":";
+        ResultExporter::appendNumber(out, ResultExporter::unixSeconds(removed ? change.oldMtime : change.newMtime));
+        out += "}\n";
+    }
+
+public:
+    ChangeExporter(HANDLE handle, ExportFormat format) : output(handle), format(format) {}
+
+    bool write(const std::vector<SnapshotChange>& changes) override {
+        if (output.isBroken()) return false;
+        std::string& formatted = BufferedOutput::formatBuffer();
+        for (const auto& change : changes) {
+            appendChange(formatted, change);
+        }
+        return output.append(formatted);
+    }
+
+    bool flush() { return output.flush(); }
+
+    uint64_t bytesWritten() const { return output.bytesWritten(); }
+    bool isBroken() const { return output.isBroken(); }
+    DWORD lastError() const { return output.lastError(); }
+};
+
+// Index shards: the catalog of one host or root in a file, so that one query can span many
+// machines. A shard is mapped whole and queried in place; opening it reads only the header
+// and manifest. Integers are little-endian and sections start 8-byte aligned.
+//   Header    magic "FSSHARD1", name count u32, entry count u32, then the offsets u64 of
+//             the manifest, the name offsets, the name characters and the entries
+//   Manifest  host, u32 root count and the roots, each a u32 byte count and UTF-8; created
+//             FILETIME i64, files u64, directories u64, bytes u64, filter bits u32, and the
+//             filter: one bit per hashed case-folded trigram found in any name
+//   Names     u32 offset of each distinct name in the characters, and an end offset
+//   Chars     UTF-16 names
+//   Entries   ShardEntry records. A parent comes before its children; a root has no parent
+//             and its full path as its name, as in FileCatalog.
+static constexpr char SHARD_MAGIC[8] = { 'F', 'S', 'S', 'H', 'A', 'R', 'D', '1' };
+static constexpr uint32_t SHARD_DIRECTORY_BIT = 0x80000000;  // In ShardEntry::name
+static constexpr uint32_t SHARD_MIN_FILTER_BITS = 1 << 12;
+static constexpr uint32_t SHARD_MAX_FILTER_BITS = 1 << 24;   // 2 MB
+static constexpr uint32_t SHARD_FILTER_BITS_PER_NAME = 16;
+
+struct ShardHeader {
+    char magic[8];
+    uint32_t nameCount;
+    uint32_t entryCount;
+    uint64_t manifestOffset;
+    uint64_t namesOffset;
+    uint64_t charsOffset;
+    uint64_t entriesOffset;
+};
+static_assert(sizeof(ShardHeader) == 48, "Shard header layout");
+
+struct ShardEntry {
+    uint32_t parent;  // FileCatalog::NO_PARENT for a root
+    uint32_t name;    // Name ID, with SHARD_DIRECTORY_BIT set for a directory
+    uint64_t size;
+    int64_t mtime;    // FILETIME ticks
+};
+static_assert(sizeof(ShardEntry) == 24, "Shard entry layout");
+
+// The filter bit of the case-folded trigram at units
+inline uint32_t shardFilterBit(const wchar_t* units, uint32_t filterBits) {
+    uint64_t gram = (static_cast<uint64_t>(static_cast<uint16_t>(units[0])) << 32) |
+        (static_cast<uint64_t>(static_cast<uint16_t>(units[1])) << 16) |
+        static_cast<uint64_t>(static_cast<uint16_t>(units[2]));
+    return static_cast<uint32_t>((gram * 0x9E3779B97F4A7C15ULL) >> 32) & (filterBits - 1);
+}
+
+class ShardWriter {
+public:
+    struct Summary {
+        uint64_t entries = 0;
+        uint64_t names = 0;
+        uint64_t bytes = 0;
+        uint32_t filterBits = 0;
+    };
+
+private:
+    AtomicFileWriter& file;
+
+    explicit ShardWriter(AtomicFileWriter& file) : file(file) {}
+
+    void text(const std::string& utf8) {
+        file.fixed(utf8.size(), 4);
+        file.raw(utf8.data(), utf8.size());
+    }
+
+    static uint64_t aligned(uint64_t offset) { return (offset + 7) & ~7ULL; }
+
+    void writeCatalog(const FileCatalog& catalog, const std::wstring& host, Summary& summary) {
+        // Names are renumbered by first use, so a shard holds only the names it uses
+        NameTable names;
+        std::vector<uint32_t> entryNames(catalog.size());
+        std::vector<std::string> roots;
+        uint64_t files = 0, directories = 0, bytes = 0;
+        for (uint32_t id = 0; id < catalog.size(); ++id) {
+            entryNames[id] = names.intern(catalog.name(id));
+            if (catalog.parent(id) == FileCatalog::NO_PARENT) {
+                roots.emplace_back();
+                appendUtf8(roots.back(), std::wstring(catalog.name(id)));
+            } else if (catalog.isDirectory(id)) {
+                directories++;
+            } else {
+                files++;
+                bytes += catalog.fileSize(id);
+            }
+        }
+
+        uint32_t filterBits = SHARD_MIN_FILTER_BITS;
+        while (filterBits < SHARD_MAX_FILTER_BITS && filterBits < names.size() * SHARD_FILTER_BITS_PER_NAME) {
+            filterBits *= 2;
+        }
+        std::vector<uint8_t> filter(filterBits / 8, 0);
+        const uint16_t* table = caseFoldTable();
+        std::wstring folded;
+        for (uint32_t nameId = 0; nameId < names.size(); ++nameId) {
+            std::wstring_view name = names.name(nameId);
+            folded.assign(name.begin(), name.end());
+            for (auto& c : folded) {
+                c = foldCase(c, table);
+            }
+            for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+                uint32_t bit = shardFilterBit(folded.data() + i, filterBits);
+                filter[bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+            }
+        }
+
+        std::string hostUtf8;
+        appendUtf8(hostUtf8, host);
+        uint64_t manifestBytes = 4 + hostUtf8.size() + 4 + 8 * 4 + 4 + filter.size();
+        for (const auto& root : roots) {
+            manifestBytes += 4 + root.size();
+        }
+        uint64_t nameChars = 0;
+        for (uint32_t nameId = 0; nameId < names.size(); ++nameId) {
+            nameChars += names.name(nameId).size();
+        }
+
+        ShardHeader header = {};
+        memcpy(header.magic, SHARD_MAGIC, sizeof(SHARD_MAGIC));
+        header.nameCount = static_cast<uint32_t>(names.size());
+        header.entryCount = static_cast<uint32_t>(catalog.size());
+        header.manifestOffset = sizeof(ShardHeader);
+        header.namesOffset = aligned(header.manifestOffset + manifestBytes);
+        header.charsOffset = aligned(header.namesOffset + (names.size() + 1) * 4);
+        header.entriesOffset = aligned(header.charsOffset + nameChars * sizeof(wchar_t));
+        file.raw(&header, sizeof(header));
+
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        text(hostUtf8);
+        file.fixed(roots.size(), 4);
+        for (const auto& root : roots) {
+            text(root);
+        }
+        file.fixed(static_cast<uint64_t>(now.dwHighDateTime) << 32 | now.dwLowDateTime, 8);
+        file.fixed(files, 8);
+        file.fixed(directories, 8);
+        file.fixed(bytes, 8);
+        file.fixed(filterBits, 4);
+        file.raw(filter.data(), filter.size());
+
+        file.pad(header.namesOffset);
+        uint32_t charOffset = 0;
+        file.fixed(charOffset, 4);
+        for (uint32_t nameId = 0; nameId < names.size(); ++nameId) {
+            charOffset += static_cast<uint32_t>(names.name(nameId).size());
+            file.fixed(charOffset, 4);
+        }
+        file.pad(header.charsOffset);
+        for (uint32_t nameId = 0; nameId < names.size(); ++nameId) {
+            std::wstring_view name = names.name(nameId);
+            file.raw(name.data(), name.size() * sizeof(wchar_t));
+        }
+        file.pad(header.entriesOffset);
+        for (uint32_t id = 0; id < catalog.size(); ++id) {
+            ShardEntry entry = { catalog.parent(id), entryNames[id] | (catalog.isDirectory(id) ? SHARD_DIRECTORY_BIT : 0),
+                catalog.fileSize(id), catalog.modifiedTime(id) };
+            file.raw(&entry, sizeof(entry));
+        }
+
+        summary.entries = catalog.size();
+        summary.names = names.size();
+        summary.bytes = file.offset();
+        summary.filterBits = filterBits;
+    }
+
+public:
+    // Writes the catalog as host's shard to path, leaving any earlier shard intact on failure
+    static bool write(const FileCatalog& catalog, const std::wstring& host, const std::wstring& path,
+                      Summary& summary, std::string& error) {
+        for (uint32_t id = 0; id < catalog.size(); ++id) {
+            uint32_t parent = catalog.parent(id);
+            if (parent != FileCatalog::NO_PARENT && parent >= id) {
+                error = "The catalog lists an entry before its folder";
+                return false;
+            }
+        }
+        AtomicFileWriter file(path, "shard");
+        if (!file.create(error)) return false;
+        ShardWriter writer(file);
+        writer.writeCatalog(catalog, host, summary);
+        return file.commit(error);
+    }
+};
+
+// A shard mapped for querying. The header and manifest are checked and copied on open;
+// names and entries are read from the view as a query needs them, and each is checked
+// there, so a damaged shard yields fewer matches rather than a crash.
+class ShardIndex {
+private:
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    const uint8_t* view = nullptr;
+    uint32_t nameCount = 0;
+    uint32_t entryCount = 0;
+    uint64_t charCount = 0;
+    const uint8_t* nameOffsets = nullptr;
+    const wchar_t* chars = nullptr;
+    const uint8_t* entries = nullptr;
+
+    std::wstring host;
+    std::vector<std::wstring> roots;
+    int64_t created = 0;
+    uint64_t files = 0;
+    uint64_t directories = 0;
+    uint64_t bytes = 0;
+    uint32_t filterBits = 0;
+    std::vector<uint8_t> filter;
+
+    bool load(uint64_t fileSize) {
+        ShardHeader header;
+        if (fileSize < sizeof(header) || !copyFromView(&header, view, sizeof(header)) ||
+                memcmp(header.magic, SHARD_MAGIC, sizeof(SHARD_MAGIC)) != 0) {
+            return false;
+        }
+        // Each section starts inside the file and after the one before, checked before any
+        // arithmetic on the offsets so a damaged header can't wrap around
+        if (header.manifestOffset != sizeof(header) ||
+                header.namesOffset < header.manifestOffset || header.namesOffset > fileSize ||
+                header.charsOffset < header.namesOffset || header.charsOffset > fileSize ||
+                header.entriesOffset < header.charsOffset || header.entriesOffset > fileSize ||
+                header.entriesOffset % 8 != 0) {
+            return false;
+        }
+        if ((header.charsOffset - header.namesOffset) / 4 < static_cast<uint64_t>(header.nameCount) + 1 ||
+                header.entryCount != (fileSize - header.entriesOffset) / sizeof(ShardEntry) ||
+                (fileSize - header.entriesOffset) % sizeof(ShardEntry) != 0) {
+            return false;
+        }
+
+        std::vector<uint8_t> manifest(static_cast<size_t>(header.namesOffset - header.manifestOffset));
+        if (!copyFromView(manifest.data(), view + header.manifestOffset, manifest.size())) return false;
+        size_t at = 0;
+        auto number = [&](int width, uint64_t& value) {
+            if (manifest.size() - at < static_cast<size_t>(width)) return false;
+            value = 0;
+            for (int i = width - 1; i >= 0; --i) {
+                value = value << 8 | manifest[at + i];
+            }
+            at += width;
+            return true;
+        };
+        auto text = [&](std::wstring& value) {
+            uint64_t length;
+            if (!number(4, length) || manifest.size() - at < length) return false;
+            value = string_to_wstring(std::string(reinterpret_cast<const char*>(manifest.data() + at), static_cast<size_t>(length)));
+            at += static_cast<size_t>(length);
+            return true;
+        };
+        uint64_t rootCount, createdTime, bits;
+        if (!text(host) || !number(4, rootCount)) return false;
+        for (uint64_t i = 0; i < rootCount; ++i) {
+            roots.emplace_back();
+            if (!text(roots.back())) return false;
+        }
+        if (!number(8, createdTime) || !number(8, files) || !number(8, directories) || !number(8, bytes) ||
+                !number(4, bits) || bits < SHARD_MIN_FILTER_BITS || bits > SHARD_MAX_FILTER_BITS ||
+                (bits & (bits - 1)) != 0 || manifest.size() - at < bits / 8) {
+            return false;
+        }
+        created = static_cast<int64_t>(createdTime);
+        filterBits = static_cast<uint32_t>(bits);
+        filter.assign(manifest.begin() + at, manifest.begin() + at + filterBits / 8);
+
+        nameCount = header.nameCount;
+        entryCount = header.entryCount;
+        charCount = (header.entriesOffset - header.charsOffset) / sizeof(wchar_t);
+        nameOffsets = view + header.namesOffset;
+        chars = reinterpret_cast<const wchar_t*>(view + header.charsOffset);
+        entries = view + header.entriesOffset;
+        return true;
+    }
+
+public:
+    ShardIndex() = default;
+    ~ShardIndex() {
+        if (view != nullptr) UnmapViewOfFile(view);
+        if (mapping != nullptr) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    }
+    ShardIndex(const ShardIndex&) = delete;
+    ShardIndex& operator=(const ShardIndex&) = delete;
+
+    bool open(const std::wstring& path, std::string& error) {
+        file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            error = "Cannot open " + wstring_to_string(path);
+            return false;
+        }
+        LARGE_INTEGER size = {};
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && static_cast<uint64_t>(size.QuadPart) <= SIZE_MAX) {
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        if (mapping != nullptr) {
+            view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(size.QuadPart)));
+        }
+        if (view == nullptr || !load(static_cast<uint64_t>(size.QuadPart))) {
+            error = wstring_to_string(path) + " is not a shard";
+            return false;
+        }
+        return true;
+    }
+
+    // False when some literal has a trigram no name in the shard has, so nothing in it can
+    // match. Grams across a separator are left out: they may span two names of a path.
+    bool mayMatch(const std::vector<std::wstring>& literals) const {
+        const uint16_t* table = caseFoldTable();
+        std::wstring folded;
+        for (const auto& literal : literals) {
+            folded = literal;
+            for (auto& c : folded) {
+                c = foldCase(c, table);
+            }
+            for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+                if (std::wstring_view(folded).substr(i, 3).find_first_of(L"\\/") != std::wstring_view::npos) continue;
+                uint32_t bit = shardFilterBit(folded.data() + i, filterBits);
+                if ((filter[bit / 8] & (1u << (bit % 8))) == 0) return false;
+            }
+        }
+        return true;
+    }
+
+    // Reads the view; callers run under callGuarded
+    std::wstring_view name(uint32_t nameId) const {
+        if (nameId >= nameCount) return {};
+        uint32_t begin, end;
+        memcpy(&begin, nameOffsets + static_cast<size_t>(nameId) * 4, 4);
+        memcpy(&end, nameOffsets + static_cast<size_t>(nameId) * 4 + 4, 4);
+        if (begin > end || end > charCount) return {};
+        return std::wstring_view(chars + begin, end - begin);
+    }
+    ShardEntry entry(uint32_t id) const {
+        ShardEntry result;
+        memcpy(&result, entries + static_cast<size_t>(id) * sizeof(ShardEntry), sizeof(ShardEntry));
+        return result;
+    }
+
+    // Full path of an entry, rebuilt from its ancestors' names like FileCatalog::pathOf. A
+    // damaged shard may link entries in a loop, so the walk stops after entryCount steps.
+    void pathOf(uint32_t id, std::wstring& out) const {
+        thread_local std::vector<uint32_t> chain;
+        chain.clear();
+        for (uint32_t at = id; at < entryCount && chain.size() < entryCount; at = entry(at).parent) {
+            chain.push_back(at);
+        }
+        out.clear();
+        for (size_t depth = chain.size(); depth > 0; --depth) {
+            FileCatalog::joinPath(out, name(entry(chain[depth - 1]).name & ~SHARD_DIRECTORY_BIT));
+        }
+    }
+
+    // Calls emit(id, entry) for each file that matches, in ID order, until emit returns
+    // false. Plain patterns match the full path, like a crawl: with a separator in the
+    // pattern, each directory's matcher state is carried to its children; without one, a
+    // directory whose path matches passes that on. Entries whose name or parent is out of
+    // range are counted in damaged and skipped. states and nameMatches are scratch.
+    template <typename Emit>
+    void scan(const NameMatcher& matcher, bool matchSeparators, std::vector<uint32_t>& states,
+              std::vector<uint8_t>& nameMatches, uint64_t& damaged, Emit&& emit) const {
+        const bool regex = matcher.isRegex();
+        const bool resume = !regex && matchSeparators;
+        if (!resume) {
+            nameMatches.assign(nameCount, 0);
+            for (uint32_t nameId = 0; nameId < nameCount; ++nameId) {
+                nameMatches[nameId] = matcher.matches(name(nameId)) ? 1 : 0;
+            }
+        }
+        // Per directory: the state after its path and a separator, or just whether it matched
+        states.assign(entryCount, 0);
+        const wchar_t separator = static_cast<wchar_t>(std::filesystem::path::preferred_separator);
+        for (uint32_t id = 0; id < entryCount; ++id) {
+            ShardEntry record = entry(id);
+            uint32_t nameId = record.name & ~SHARD_DIRECTORY_BIT;
+            bool isDirectory = (record.name & SHARD_DIRECTORY_BIT) != 0;
+            bool hasParent = record.parent != FileCatalog::NO_PARENT;
+            if (nameId >= nameCount || (hasParent && record.parent >= id)) {
+                damaged++;
+                continue;
+            }
+            uint32_t parentState = hasParent ? states[record.parent] : 0;
+            bool matches;
+            uint32_t state;
+            if (resume) {
+                std::wstring_view entryName = name(nameId);
+                state = matcher.advance(parentState, entryName);
+                matches = state == NameMatcher::MATCHED;
+                if (isDirectory && !entryName.empty() && entryName.back() != L'\\' && entryName.back() != L'/') {
+                    state = matcher.advance(state, std::wstring_view(&separator, 1));
+                }
+            } else {
+                matches = nameMatches[nameId] != 0 || (!regex && parentState == NameMatcher::MATCHED);
+                state = matches && !regex ? NameMatcher::MATCHED : 0;
+            }
+            if (isDirectory) {
+                states[id] = state;
+            } else if (matches && !emit(id, record)) {
+                return;
+            }
+        }
+    }
+
+    const std::wstring& getHost() const { return host; }
+    const std::vector<std::wstring>& getRoots() const { return roots; }
+    int64_t createdTime() const { return created; }
+    uint32_t size() const { return entryCount; }
+    uint64_t fileCount() const { return files; }
+    uint64_t directoryCount() const { return directories; }
+    uint64_t totalBytes() const { return bytes; }
+};
+
+// Receives a federated query's matches in batches, from several threads at once. All
+// paths of a batch come from one shard.
+class ShardMatchSink {
+public:
+    virtual ~ShardMatchSink() = default;
+    // False stops the query, e.g. when the consumer has gone away
+    virtual bool write(const ShardIndex& shard, const std::vector<std::wstring>& paths, const std::vector<ResultInfo>& info) = 0;
+};
+
+// One query over many shards. Threads take whole shards, largest first, and skip those
+// whose manifest rules out a match. Matches either stream to a sink as each shard finds
+// them, or each shard keeps its top matches by size or time and those are merged.
+class FederatedSearch {
+public:
+    enum class Order { Largest, Newest };
+
+    struct Query {
+        std::string pattern;
+        bool caseSensitive = false;
+        bool useRegex = false;
+        size_t threads = 1;
+        size_t top = 0;  // Keep only the first top matches in order; 0 streams every match
+        Order order = Order::Largest;
+    };
+
+    struct Match {
+        const ShardIndex* shard;
+        std::wstring path;
+        ResultInfo info;
+    };
+
+    struct Summary {
+        size_t shards = 0;
+        size_t skipped = 0;      // Ruled out by their manifest
+        size_t unreadable = 0;   // A read of the mapped shard failed part way
+        uint64_t entries = 0;    // In the shards scanned
+        uint64_t matches = 0;
+        uint64_t damaged = 0;    // Entries skipped as out of range
+        bool invalid = false;    // The pattern did not compile
+        bool stopped = false;    // The sink asked to stop
+    };
+
+private:
+    static constexpr size_t BATCH_SIZE = 256;
+
+    // Sort key of a match for top queries, largest first
+    static uint64_t rank(const ShardEntry& entry, Order order) {
+        return order == Order::Largest ? entry.size : static_cast<uint64_t>(entry.mtime) ^ (1ULL << 63);
+    }
+
+public:
+    // Runs query over shards. Without query.top every match goes to sink; with it, top
+    // receives the best matches over all shards, ties going to the shard's earlier entry.
+    static Summary run(const std::vector<std::unique_ptr<ShardIndex>>& shards, const Query& query,
+                       ShardMatchSink* sink, std::vector<Match>& top) {
+        Summary summary;
+        summary.shards = shards.size();
+        NameMatcher matcher(query.pattern, query.caseSensitive, query.useRegex);
+        if (!matcher.isValid()) {
+            summary.invalid = true;
+            return summary;
+        }
+        std::vector<std::wstring> literals = requiredLiterals(string_to_wstring(query.pattern), query.useRegex);
+        bool matchSeparators = false;
+        for (const auto& literal : literals) {
+            matchSeparators |= literal.find_first_of(L"\\/") != std::wstring::npos;
+        }
+
+        std::vector<size_t> order(shards.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return shards[a]->size() > shards[b]->size();
+        });
+
+        std::atomic<size_t> next{ 0 };
+        std::atomic<bool> stopped{ false };
+        std::atomic<size_t> skipped{ 0 }, unreadable{ 0 };
+        std::atomic<uint64_t> entries{ 0 }, matches{ 0 }, damaged{ 0 };
+        std::mutex topMutex;
+        std::vector<std::pair<uint64_t, Match>> merged;
+
+        auto worker = [&] {
+            std::vector<uint32_t> states;
+            std::vector<uint8_t> nameMatches;
+            std::vector<std::wstring> paths;
+            std::vector<ResultInfo> info;
+            std::vector<std::pair<uint64_t, uint32_t>> best;  // Min-heap of rank and entry ID
+            std::wstring path;
+            while (!stopped.load()) {
+                size_t index = next.fetch_add(1);
+                if (index >= order.size()) break;
+                const ShardIndex& shard = *shards[order[index]];
+                if (!shard.mayMatch(literals)) {
+                    ++skipped;
+                    continue;
+                }
+                uint64_t shardMatches = 0, shardDamaged = 0;
+                paths.clear();
+                info.clear();
+                best.clear();
+                auto flush = [&] {
+                    if (!paths.empty() && !sink->write(shard, paths, info)) stopped.store(true);
+                    paths.clear();
+                    info.clear();
+                };
+                auto scanShard = [&] {
+                    shard.scan(matcher, matchSeparators, states, nameMatches, shardDamaged, [&](uint32_t id, const ShardEntry& entry) {
+                        shardMatches++;
+                        if (query.top > 0) {
+                            std::pair<uint64_t, uint32_t> candidate(rank(entry, query.order), id);
+                            auto later = [](const auto& a, const auto& b) {
+                                return a.first != b.first ? a.first > b.first : a.second < b.second;
+                            };
+                            if (best.size() < query.top) {
+                                best.push_back(candidate);
+                                std::push_heap(best.begin(), best.end(), later);
+                            } else if (later(candidate, best.front())) {
+                                std::pop_heap(best.begin(), best.end(), later);
+                                best.back() = candidate;
+                                std::push_heap(best.begin(), best.end(), later);
+                            }
+                            return true;
+                        }
+                        shard.pathOf(id, path);
+                        paths.push_back(path);
+                        info.push_back({ entry.size, entry.mtime });
+                        if (paths.size() >= BATCH_SIZE) flush();
+                        return !stopped.load();
+                    });
+                    if (query.top == 0) {
+                        flush();
+                    } else {
+                        std::vector<std::pair<uint64_t, Match>> found;
+                        for (const auto& [key, id] : best) {
+                            ShardEntry entry = shard.entry(id);
+                            shard.pathOf(id, path);
+                            found.push_back({ key, { &shard, path, { entry.size, entry.mtime } } });
+                        }
+                        std::lock_guard<std::mutex> lock(topMutex);
+                        for (auto& match : found) {
+                            merged.push_back(std::move(match));
+                        }
+                    }
+                };
+                if (!callGuarded([](void* context) { (*static_cast<decltype(scanShard)*>(context))(); }, &scanShard)) {
+                    ++unreadable;
+                    continue;
+                }
+                entries += shard.size();
+                matches += shardMatches;
+                damaged += shardDamaged;
+            }
+        };
+
+        size_t threadCount = std::max<size_t>(1, std::min(query.threads, shards.size()));
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < threadCount; ++t) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        // Merge the shards' top matches; their order does not depend on thread timing
+        std::sort(merged.begin(), merged.end(), [](const auto& a, const auto& b) {
+            if (a.first != b.first) return a.first > b.first;
+            if (a.second.shard->getHost() != b.second.shard->getHost()) return a.second.shard->getHost() < b.second.shard->getHost();
+            return a.second.path < b.second.path;
+        });
+        top.clear();
+        for (size_t i = 0; i < merged.size() && i < query.top; ++i) {
+            top.push_back(std::move(merged[i].second));
+        }
+
+        summary.skipped = skipped.load();
+        summary.unreadable = unreadable.load();
+        summary.entries = entries.load();
+        summary.matches = matches.load();
+        summary.damaged = damaged.load();
+        summary.stopped = stopped.load();
+        return summary;
+    }
+};
+
+// Writes federated matches as "host<TAB>path" lines or JSON lines with the size and time
+class ShardMatchExporter : public ShardMatchSink {
+private:
+    BufferedOutput output;
+    ExportFormat format;  // Lines or Jsonl
+    std::atomic<uint64_t> results{ 0 };
+
+    void appendMatch(std::string& out, const std::string& host, const std::wstring& path, const ResultInfo& info) const {
+        if (format == ExportFormat::Lines) {
+            out += host;
+            out += '\t';
+            appendUtf8(out, path);
+            out += '\n';
+            return;
+        }
+        out += "{\"host\":\"";
+        size_t start = out.size();
+        out += host;
+        ResultExporter::escapeJson(out, start);
+        out += "\",\"path\":\"";
+        start = out.size();
+        appendUtf8(out, path);
+        ResultExporter::escapeJson(out, start);
+        out += "\",\"size\":";
+        ResultExporter::appendNumber(out, static_cast<long long>(info.size));
+        out += ",\"mtime\":";
+        ResultExporter::appendNumber(out, ResultExporter::unixSeconds(info.mtime));
+        out += "}\n";
+    }
+
+public:
+    ShardMatchExporter(HANDLE handle, ExportFormat format) : output(handle), format(format) {}
+
+    bool write(const ShardIndex& shard, const std::vector<std::wstring>& paths, const std::vector<ResultInfo>& info) override {
+        if (output.isBroken()) return false;
+        std::string& formatted = BufferedOutput::formatBuffer();
+        std::string host = wstring_to_string(shard.getHost());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            appendMatch(formatted, host, paths[i], info[i]);
+        }
+        results += paths.size();
+        return output.append(formatted);
+    }
+
+    bool flush() { return output.flush(); }
+
+    uint64_t resultsWritten() const { return results.load(); }
+    bool isBroken() const { return output.isBroken(); }
+    DWORD lastError() const { return output.lastError(); }
+};
+
+// The search daemon's protocol over a local (AF_UNIX) stream socket. Every frame is a
+// little-endian u32 byte count, then a type byte and the frame's fields. Strings and result
+// counts inside a frame are LEB128 varints, so a typical path costs one length byte. A
+// client sends Query frames and may Cancel them by ID; the daemon answers each query with
+// any number of Results frames and then exactly one Done frame.
+//   Query    queryId u32, flags u8, pattern str, roots str (';'-separated; empty for the daemon's)
+//   Cancel   queryId u32
+//   Results  queryId u32, count varint, count x (path str [size varint, mtime i64 with QUERY_WITH_INFO])
+//   Done     queryId u32, status u8, matches varint, running time in microseconds varint
+enum class DaemonFrame : uint8_t { Query = 1, Cancel = 2, Results = 0x81, Done = 0x82 };
+enum class DaemonStatus : uint8_t { Complete = 0, Cancelled = 1, Failed = 2 };  // Failed: bad regex or queue full
+static constexpr uint8_t QUERY_CASE_SENSITIVE = 1;
+static constexpr uint8_t QUERY_REGEX = 2;
+static constexpr uint8_t QUERY_ARCHIVES = 4;
+static constexpr uint8_t QUERY_REFRESH = 8;     // Crawl again and replace the catalog
+static constexpr uint8_t QUERY_WITH_INFO = 16;  // Send each result's size and modified time
+static constexpr uint32_t MAX_FRAME_BYTES = 1 << 20;
+
+class FrameWriter {
+private:
+    std::string bytes;
+
+    void fixed(uint64_t value, int width) {
+        for (int i = 0; i < width; ++i) {
+            bytes += static_cast<char>(value >> (8 * i));
+        }
+    }
+
+public:
+    explicit FrameWriter(DaemonFrame type) : bytes(4, '\0') {
+        bytes += static_cast<char>(type);
+    }
+
+    void u8(uint8_t value) { bytes += static_cast<char>(value); }
+    void u32(uint32_t value) { fixed(value, 4); }
+    void u64(uint64_t value) { fixed(value, 8); }
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            bytes += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        bytes += static_cast<char>(value);
+    }
+    void str(std::string_view text) {
+        varint(text.size());
+        bytes.append(text.data(), text.size());
+    }
+
+    size_t size() const { return bytes.size(); }
+
+    // The frame with its length filled in
+    const std::string& finish() {
+        uint32_t length = static_cast<uint32_t>(bytes.size() - 4);
+        for (int i = 0; i < 4; ++i) {
+            bytes[i] = static_cast<char>(length >> (8 * i));
+        }
+        return bytes;
+    }
+};
+
+// Reads a frame's fields in order. A field that runs past the end reads as zero and
+// leaves good() false, so callers check once after reading everything.
+class FrameReader {
+private:
+    std::string_view rest;
+    bool ok = true;
+
+    uint64_t fixed(size_t width) {
+        if (rest.size() < width) {
+            ok = false;
+            rest = {};
+            return 0;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < width; ++i) {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(rest[i])) << (8 * i);
+        }
+        rest.remove_prefix(width);
+        return value;
+    }
+
+public:
+    explicit FrameReader(std::string_view frame) : rest(frame) {}
+
+    uint8_t u8() { return static_cast<uint8_t>(fixed(1)); }
+    uint32_t u32() { return static_cast<uint32_t>(fixed(4)); }
+    uint64_t u64() { return fixed(8); }
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64 && ok; shift += 7) {
+            uint8_t byte = u8();
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        ok = false;
+        return 0;
+    }
+    std::string_view str() {
+        uint64_t length = varint();
+        if (!ok || length > rest.size()) {
+            ok = false;
+            return {};
+        }
+        std::string_view text = rest.substr(0, static_cast<size_t>(length));
+        rest.remove_prefix(static_cast<size_t>(length));
+        return text;
+    }
+
+    bool good() const { return ok; }
+};
+
+bool sendAll(SOCKET socket, const std::string& bytes) {
+    size_t offset = 0;
+    while (offset < bytes.size()) {
+        int chunk = static_cast<int>(std::min<size_t>(bytes.size() - offset, 1 << 20));
+        int sent = send(socket, bytes.data() + offset, chunk, 0);
+        if (sent <= 0) return false;
+        offset += static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool receiveAll(SOCKET socket, char* data, size_t length) {
+    while (length > 0) {
+        int received = recv(socket, data, static_cast<int>(std::min<size_t>(length, 1 << 20)), 0);
+        if (received <= 0) return false;
+        data += received;
+        length -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Reads the next frame, type byte first, into frame; false once the peer has closed the
+// connection or sent a length no frame of this protocol can have
+bool receiveFrame(SOCKET socket, std::string& frame) {
+    uint8_t header[4];
+    if (!receiveAll(socket, reinterpret_cast<char*>(header), sizeof(header))) return false;
+    uint32_t length = header[0] | header[1] << 8 | header[2] << 16 | static_cast<uint32_t>(header[3]) << 24;
+    if (length == 0 || length > MAX_FRAME_BYTES) return false;
+    frame.resize(length);
+    return receiveAll(socket, &frame[0], length);
+}
+
+// Fills address for a socket file path; false if the path does not fit
+bool unixSocketAddress(const std::wstring& path, sockaddr_un& address) {
+    std::string utf8;
+    appendUtf8(utf8, path);
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (utf8.empty() || utf8.size() >= sizeof(address.sun_path)) return false;
+    memcpy(address.sun_path, utf8.data(), utf8.size());
+    return true;
+}
+
+// Lets only this user and SYSTEM open the socket file, whatever its folder grants. Clients
+// connect through the file, so its DACL decides who may connect.
+bool restrictToCurrentUser(const std::wstring& path) {
+    HANDLE token = nullptr;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) return false;
+    DWORD length = 0;
+    GetTokenInformation(token, TokenUser, nullptr, 0, &length);
+    std::vector<uint8_t> user(length);
+    bool ok = length > 0 && GetTokenInformation(token, TokenUser, user.data(), length, &length);
+    CloseHandle(token);
+    LPWSTR sid = nullptr;
+    if (!ok || !ConvertSidToStringSidW(reinterpret_cast<TOKEN_USER*>(user.data())->User.Sid, &sid)) return false;
+    // Protected, so nothing is inherited from the folder
+    std::wstring sddl = L"D:P(A;;GA;;;" + std::wstring(sid) + L")(A;;GA;;;SY)";
+    LocalFree(sid);
+    PSECURITY_DESCRIPTOR descriptor = nullptr;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(sddl.c_str(), SDDL_REVISION_1, &descriptor, nullptr)) {
+        return false;
+    }
+    BOOL present = FALSE, defaulted = FALSE;
+    PACL dacl = nullptr;
+    ok = GetSecurityDescriptorDacl(descriptor, &present, &dacl, &defaulted) &&
+        SetNamedSecurityInfoW(const_cast<LPWSTR>(path.c_str()), SE_FILE_OBJECT,
+            DACL_SECURITY_INFORMATION | PROTECTED_DACL_SECURITY_INFORMATION, nullptr, nullptr, dacl, nullptr) == ERROR_SUCCESS;
+    LocalFree(descriptor);
+    return ok;
+}
+
+SOCKET connectUnixSocket(const std::wstring& path) {
+    sockaddr_un address;
+    if (!unixSocketAddress(path, address)) return INVALID_SOCKET;
+    SOCKET socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket == INVALID_SOCKET) return INVALID_SOCKET;
+    if (connect(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR) {
+        closesocket(socket);
+        return INVALID_SOCKET;
+    }
+    return socket;
+}
+
+// Keeps one executor, its worker pool and the catalog of a set of roots resident, and
+// answers queries from any number of local clients over a Unix domain socket. Every client
+// has a thread reading its frames; their queries join one queue and run one at a time,
+// since a catalog scan already spreads over every core. Results stream back as workers
+// find them. Cancelling a queued query drops it, cancelling the running one stops the
+// executor, and a client that disconnects has its queries cancelled the same way.
+// Only the user running the daemon may connect: the socket file gets a DACL for that user
+// and SYSTEM alone. Clients are otherwise trusted to search any folder the daemon can read,
+// but each may have only MAX_QUEUED_PER_CLIENT queries waiting; more are answered Failed.
+class SearchDaemon {
+private:
+    static constexpr size_t RESULTS_FRAME_BYTES = 64 * 1024;
+    static constexpr size_t MAX_QUEUED_PER_CLIENT = 64;
+    static constexpr DWORD SEND_TIMEOUT_MS = 10000;  // A client that stops reading is dropped
+    static constexpr long ACCEPT_POLL_US = 200000;
+
+    struct Client {
+        SOCKET socket;
+        std::mutex sendMutex;  // Frames from several workers never interleave
+        std::atomic<bool> open{ true };
+        std::atomic<bool> finished{ false };  // Its reader thread has returned
+        size_t queued = 0;                    // Its queries in the queue; guarded by the daemon's mtx
+        std::thread reader;
+
+        explicit Client(SOCKET socket) : socket(socket) {}
+        ~Client() { closesocket(socket); }
+
+        bool send(const std::string& frame) {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (open.load() && !sendAll(socket, frame)) {
+                open.store(false);
+            }
+            return open.load();
+        }
+    };
+
+    struct PendingQuery {
+        std::shared_ptr<Client> client;
+        uint32_t id = 0;
+        uint8_t flags = 0;
+        std::string pattern;
+        std::vector<std::wstring> roots;  // Empty for the daemon's own
+    };
+
+    // Encodes each batch the workers publish as Results frames for one query
+    class ClientSink : public ResultSink {
+    private:
+        std::shared_ptr<Client> client;
+        uint32_t queryId;
+        bool withInfo;
+
+    public:
+        ClientSink(std::shared_ptr<Client> client, uint32_t queryId, bool withInfo)
+            : client(std::move(client)), queryId(queryId), withInfo(withInfo) {}
+
+        bool write(const std::vector<std::wstring>& paths, const std::vector<ResultInfo>& info) override {
+            thread_local std::string utf8;
+            size_t next = 0;
+            while (next < paths.size()) {
+                if (!client->open.load()) return false;
+                // Count the records that fit in one frame first, since the count precedes them
+                FrameWriter frame(DaemonFrame::Results);
+                frame.u32(queryId);
+                size_t end = next, bytes = 0;
+                while (end < paths.size() && (end == next || bytes < RESULTS_FRAME_BYTES)) {
+                    bytes += paths[end].size() * 3 + 24;
+                    ++end;
+                }
+                frame.varint(end - next);
+                for (; next < end; ++next) {
+                    utf8.clear();
+                    appendUtf8(utf8, paths[next]);
+                    frame.str(utf8);
+                    if (withInfo) {
+                        ResultInfo item = next < info.size() ? info[next] : ResultInfo{ 0, 0 };
+                        frame.varint(item.size);
+                        frame.u64(static_cast<uint64_t>(item.mtime));
+                    }
+                }
+                if (!client->send(frame.finish())) return false;
+            }
+            return true;
+        }
+    };
+
+    std::vector<std::wstring> roots;
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor;
+    std::wstring socketPath;
+    SOCKET listener = INVALID_SOCKET;
+    bool winsockStarted = false;
+    double warmupMs = 0;
+
+    // queue, running, runningCancelled and clients are guarded by mtx.
+    // Lock order: mtx may be held while calling into the executor, never the reverse.
+    std::mutex mtx;
+    std::condition_variable queueCv;
+    std::deque<std::shared_ptr<PendingQuery>> queue;
+    std::shared_ptr<PendingQuery> running;
+    bool runningCancelled = false;
+    std::vector<std::shared_ptr<Client>> clients;
+    std::atomic<bool> stopping{ false };
+    std::thread dispatcher;
+
+    std::atomic<uint64_t> clientsAccepted{ 0 };
+    std::atomic<uint64_t> queriesAnswered{ 0 };
+    std::atomic<uint64_t> queriesCancelled{ 0 };
+
+    static void sendDone(Client& client, uint32_t id, DaemonStatus status, uint64_t matches, uint64_t micros) {
+        FrameWriter frame(DaemonFrame::Done);
+        frame.u32(id);
+        frame.u8(static_cast<uint8_t>(status));
+        frame.varint(matches);
+        frame.varint(micros);
+        client.send(frame.finish());
+    }
+
+    bool isOwnRoots(const std::vector<std::wstring>& queried) const {
+        if (queried.empty()) return true;
+        std::vector<std::wstring> a, b;
+        for (const auto& root : queried) a.push_back(normalizedRootKey(root));
+        for (const auto& root : roots) b.push_back(normalizedRootKey(root));
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        return a == b;
+    }
+
+    void dispatch() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true) {
+            queueCv.wait(lock, [&] { return stopping.load() || !queue.empty(); });
+            if (stopping.load()) break;
+            std::shared_ptr<PendingQuery> query = std::move(queue.front());
+            queue.pop_front();
+            query->client->queued--;
+            if (!query->client->open.load()) continue;
+
+            bool useRegex = (query->flags & QUERY_REGEX) != 0;
+            bool caseSensitive = (query->flags & QUERY_CASE_SENSITIVE) != 0;
+            if (useRegex && !NameMatcher(query->pattern, caseSensitive, true).isValid()) {
+                lock.unlock();
+                sendDone(*query->client, query->id, DaemonStatus::Failed, 0, 0);
+                lock.lock();
+                continue;
+            }
+
+            // Other roots are crawled without replacing the catalog the daemon holds
+            bool own = isOwnRoots(query->roots);
+            SearchOptions options;
+            options.useCatalog = own;
+            options.refreshCatalog = own && (query->flags & QUERY_REFRESH) != 0;
+            options.archives = (query->flags & QUERY_ARCHIVES) != 0;
+            options.sink = std::make_shared<ClientSink>(query->client, query->id, (query->flags & QUERY_WITH_INFO) != 0);
+            auto start = std::chrono::steady_clock::now();
+            running = query;
+            runningCancelled = false;
+            // Started under mtx, so a Cancel can never reach the query before or after this one
+            executor.search(query->pattern, caseSensitive, useRegex, own ? roots : query->roots, options);
+            lock.unlock();
+
+            executor.waitForCompletion();
+            uint64_t matches = executor.getMatchesFound();
+            uint64_t micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count());
+
+            lock.lock();
+            bool cancelled = runningCancelled;
+            running.reset();
+            lock.unlock();
+            if (cancelled) {
+                ++queriesCancelled;
+            } else {
+                ++queriesAnswered;
+            }
+            sendDone(*query->client, query->id, cancelled ? DaemonStatus::Cancelled : DaemonStatus::Complete,
+                matches, micros);
+            lock.lock();
+        }
+    }
+
+    // Drops client's queued query id (or all of them when every is set) and stops its
+    // running one; the queued ones are answered with Done here, the running one by dispatch()
+    void cancelQueries(const std::shared_ptr<Client>& client, uint32_t id, bool every) {
+        std::vector<std::shared_ptr<PendingQuery>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto it = queue.begin(); it != queue.end();) {
+                if ((*it)->client == client && (every || (*it)->id == id)) {
+                    client->queued--;
+                    dropped.push_back(std::move(*it));
+                    it = queue.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (running && running->client == client && (every || running->id == id) && !runningCancelled) {
+                runningCancelled = true;
+                executor.cancel();
+            }
+        }
+        for (const auto& query : dropped) {
+            ++queriesCancelled;
+            sendDone(*client, query->id, DaemonStatus::Cancelled, 0, 0);
+        }
+    }
+
+    void readClient(std::shared_ptr<Client> client) {
+        std::string frame;
+        while (receiveFrame(client->socket, frame)) {
+            FrameReader reader(frame);
+            DaemonFrame type = static_cast<DaemonFrame>(reader.u8());
+            if (type == DaemonFrame::Query) {
+                auto query = std::make_shared<PendingQuery>();
+                query->client = client;
+                query->id = reader.u32();
+                query->flags = reader.u8();
+                query->pattern = std::string(reader.str());
+                std::string_view queryRoots = reader.str();
+                if (!reader.good()) break;
+                if (!queryRoots.empty()) {
+                    query->roots = parseSearchRoots(string_to_wstring(std::string(queryRoots)));
+                }
+                std::unique_lock<std::mutex> lock(mtx);
+                if (client->queued >= MAX_QUEUED_PER_CLIENT) {
+                    lock.unlock();
+                    sendDone(*client, query->id, DaemonStatus::Failed, 0, 0);
+                    continue;
+                }
+                client->queued++;
+                queue.push_back(std::move(query));
+                queueCv.notify_one();
+            } else if (type == DaemonFrame::Cancel) {
+                uint32_t id = reader.u32();
+                if (!reader.good()) break;
+                cancelQueries(client, id, false);
+            } else {
+                break;  // Not this protocol; hang up rather than guess
+            }
+        }
+        client->open.store(false);
+        cancelQueries(client, 0, true);
+        shutdown(client->socket, SD_BOTH);
+        client->finished.store(true);
+    }
+
+    // Called with mtx held
+    void reapClientsLocked() {
+        for (auto it = clients.begin(); it != clients.end();) {
+            if ((*it)->finished.load()) {
+                (*it)->reader.join();
+                it = clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+public:
+    explicit SearchDaemon(std::vector<std::wstring> roots) : roots(std::move(roots)), executor(inProgress) {}
+
+    ~SearchDaemon() {
+        stop();
+        if (dispatcher.joinable()) {
+            dispatcher.join();
+        }
+        std::vector<std::shared_ptr<Client>> remaining;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            remaining.swap(clients);
+        }
+        for (auto& client : remaining) {
+            shutdown(client->socket, SD_BOTH);
+            client->reader.join();
+        }
+        executor.cancel();
+        executor.waitForCompletion();
+        if (listener != INVALID_SOCKET) {
+            closesocket(listener);
+            DeleteFileW(socketPath.c_str());
+        }
+        if (winsockStarted) {
+            WSACleanup();
+        }
+    }
+
+    // Listens on path, replacing a socket file left by a daemon that has exited, then crawls
+    // the roots once so the first query is already answered from the catalog. False with a
+    // message when the socket cannot be set up.
+    bool start(const std::wstring& path, std::string& error) {
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+            error = "Winsock is unavailable";
+            return false;
+        }
+        winsockStarted = true;
+        sockaddr_un address;
+        if (!unixSocketAddress(path, address)) {
+            error = "Socket path is empty or too long";
+            return false;
+        }
+        SOCKET existing = connectUnixSocket(path);
+        if (existing != INVALID_SOCKET) {
+            closesocket(existing);
+            error = "Another daemon is already listening on this socket";
+            return false;
+        }
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == INVALID_SOCKET) {
+            error = "Unix domain sockets need Windows 10 version 1803 or later";
+            return false;
+        }
+        DeleteFileW(path.c_str());
+        // No client can connect before listen(), so the file is restricted in time
+        if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR) {
+            error = "Cannot listen on the socket (error " + std::to_string(WSAGetLastError()) + ")";
+            closesocket(listener);
+            listener = INVALID_SOCKET;
+            return false;
+        }
+        if (!restrictToCurrentUser(path)) {
+            error = "Cannot restrict the socket to this user";
+            closesocket(listener);
+            listener = INVALID_SOCKET;
+            DeleteFileW(path.c_str());
+            return false;
+        }
+        if (listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+            error = "Cannot listen on the socket (error " + std::to_string(WSAGetLastError()) + ")";
+            closesocket(listener);
+            listener = INVALID_SOCKET;
+            DeleteFileW(path.c_str());
+            return false;
+        }
+        socketPath = path;
+
+        // Clients may connect meanwhile; their queries wait in the queue
+        auto warmupStart = std::chrono::steady_clock::now();
+        SearchOptions warmup;
+        warmup.crawlOnly = true;
+        executor.search(std::string(), false, false, roots, warmup);
+        executor.waitForCompletion();
+        warmupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - warmupStart).count();
+        dispatcher = std::thread(&SearchDaemon::dispatch, this);
+        return true;
+    }
+
+    // Accepts clients until stop()
+    void serve() {
+        while (!stopping.load()) {
+            // A bounded wait, since closing a socket does not wake a blocked accept() everywhere
+            fd_set ready;
+            FD_ZERO(&ready);
+            FD_SET(listener, &ready);
+            timeval wait = { 0, ACCEPT_POLL_US };
+            int count = select(static_cast<int>(listener + 1), &ready, nullptr, nullptr, &wait);
+            if (count == SOCKET_ERROR) break;
+            if (count == 0) continue;
+            SOCKET socket = accept(listener, nullptr, nullptr);
+            if (socket == INVALID_SOCKET) continue;
+            DWORD timeout = SEND_TIMEOUT_MS;
+            setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+            auto client = std::make_shared<Client>(socket);
+            std::lock_guard<std::mutex> lock(mtx);
+            if (stopping.load()) break;
+            reapClientsLocked();
+            client->reader = std::thread(&SearchDaemon::readClient, this, client);
+            clients.push_back(std::move(client));
+            ++clientsAccepted;
+        }
+    }
+
+    // Safe from any thread, e.g. a console control handler
+    void stop() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping.exchange(true)) return;
+        if (running) {
+            executor.cancel();
+        }
+        for (auto& client : clients) {
+            shutdown(client->socket, SD_BOTH);
+        }
+        queueCv.notify_all();
+    }
+
+    double getWarmupMs() const { return warmupMs; }
+    size_t getCatalogEntries() const { return executor.getCatalogEntries(); }
+    size_t getCatalogBytes() const { return executor.getCatalogBytes(); }
+    uint64_t getClientsAccepted() const { return clientsAccepted.load(); }
+    uint64_t getQueriesAnswered() const { return queriesAnswered.load(); }
+    uint64_t getQueriesCancelled() const { return queriesCancelled.load(); }
+};
+
+// The results as a tree whose every level is kept in the chosen sort order. Sort keys (the
+// case-folded name and where its extension starts) are computed once per node, results that
+// arrive later are merged into their level instead of re-sorting it, and large levels are
+// sorted on several threads.
+class ResultTree {
+public:
+    enum class Order { Name, Extension, Size, Modified };
+
+    struct Node {
+        std::wstring name;
+        std::wstring fullPath;
+        std::wstring foldedName;      // Case-folded name, compared code unit by code unit
+        size_t extension = 0;         // Where the extension starts in foldedName; its size if none
+        bool isFile = false;
+        bool hasFolderSize = false;   // A directory's fileSize is its Folder Sizes total
+        DirectorySize folderSize;     // The whole total, when hasFolderSize
+        bool moving = false;          // Being re-placed in its level after its key changed
+        uint64_t fileSize = 0;
+        int64_t modified = 0;         // FILETIME ticks; files only
+        size_t itemCount = 0;         // Files and directories anywhere below
+        Node* parent = nullptr;
+        std::vector<Node*> children;  // In sort order
+        std::vector<Node*> arrived;   // Added since the last merge, not yet in children
+    };
+
+private:
+    static constexpr size_t PARALLEL_SORT_MIN = 32768;  // Smaller levels sort on the calling thread
+    static constexpr size_t PARALLEL_CHUNK_MIN = 8192;
+
+    std::deque<Node> nodes;  // Stable addresses for parent and children pointers
+    Node root;
+    std::unordered_map<std::wstring, Node*> byPath;
+    std::vector<Node*> directories;          // In the order they were added
+    std::vector<std::wstring> directoryKeys; // normalizedRootKey() of each, for Folder Sizes
+    Order order = Order::Name;
+    bool descending = false;
+
+    // Negative, zero or positive as a's key sorts before, with or after b's; zero for Name
+    int compareKey(const Node* a, const Node* b) const {
+        switch (order) {
+        case Order::Extension:
+            return std::wstring_view(a->foldedName).substr(a->extension)
+                .compare(std::wstring_view(b->foldedName).substr(b->extension));
+        case Order::Size:
+            return a->fileSize < b->fileSize ? -1 : a->fileSize > b->fileSize ? 1 : 0;
+        case Order::Modified:
+            return a->modified < b->modified ? -1 : a->modified > b->modified ? 1 : 0;
+        default:
+            return 0;
+        }
+    }
+
+    // Directories first, then the key, then the name (ascending unless sorting by name)
+    bool before(const Node* a, const Node* b) const {
+        if (a->isFile != b->isFile) return !a->isFile;
+        int byKey = compareKey(a, b);
+        if (byKey != 0) return descending ? byKey > 0 : byKey < 0;
+        int byName = a->foldedName.compare(b->foldedName);
+        if (byName == 0) byName = a->name.compare(b->name);
+        return order == Order::Name && descending ? byName > 0 : byName < 0;
+    }
+
+    // Sorts runs of the level on their own threads, then merges neighbouring runs pairwise
+    void sortLevel(std::vector<Node*>& level) const {
+        auto less = [this](const Node* a, const Node* b) { return before(a, b); };
+        size_t runs = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), level.size() / PARALLEL_CHUNK_MIN);
+        if (level.size() < PARALLEL_SORT_MIN || runs < 2) {
+            std::sort(level.begin(), level.end(), less);
+            return;
+        }
+        std::vector<size_t> bounds(runs + 1);
+        for (size_t i = 0; i <= runs; ++i) {
+            bounds[i] = level.size() * i / runs;
+        }
+        auto onThreads = [](std::vector<std::function<void()>>& tasks) {
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < tasks.size(); ++i) {
+                threads.emplace_back(tasks[i]);
+            }
+            tasks[0]();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        };
+        std::vector<std::function<void()>> tasks;
+        for (size_t i = 0; i < runs; ++i) {
+            tasks.push_back([&, i] { std::sort(level.begin() + bounds[i], level.begin() + bounds[i + 1], less); });
+        }
+        onThreads(tasks);
+        for (size_t width = 1; width < runs; width *= 2) {
+            tasks.clear();
+            for (size_t i = 0; i + width < runs; i += 2 * width) {
+                auto first = level.begin() + bounds[i];
+                auto middle = level.begin() + bounds[i + width];
+                auto last = level.begin() + bounds[std::min(i + 2 * width, runs)];
+                tasks.push_back([=] { std::inplace_merge(first, middle, last, less); });
+            }
+            onThreads(tasks);
+        }
+    }
+
+    // Sorts what arrived at a level and merges it into the already sorted children
+    void mergeArrived(Node& node) {
+        auto less = [this](const Node* a, const Node* b) { return before(a, b); };
+        sortLevel(node.arrived);
+        size_t middle = node.children.size();
+        node.children.insert(node.children.end(), node.arrived.begin(), node.arrived.end());
+        // Children before the first arrival's place are already final
+        auto from = std::upper_bound(node.children.begin(), node.children.begin() + middle, node.arrived.front(), less);
+        std::inplace_merge(from, node.children.begin() + middle, node.children.end(), less);
+        node.arrived.clear();
+    }
+
+    Node& addChild(Node& parent, std::wstring name, std::wstring fullPath, bool isFile, std::vector<Node*>& touched) {
+        Node& node = nodes.emplace_back();
+        node.name = std::move(name);
+        node.fullPath = std::move(fullPath);
+        node.foldedName = foldCaseString(node.name);
+        size_t dot = node.foldedName.rfind(L'.');
+        node.extension = isFile && dot != std::wstring::npos && dot > 0 ? dot : node.foldedName.size();
+        node.isFile = isFile;
+        node.parent = &parent;
+        byPath.emplace(node.fullPath, &node);
+        if (!isFile) {
+            directories.push_back(&node);
+            directoryKeys.push_back(normalizedRootKey(node.fullPath));
+        }
+        for (Node* up = &parent; up; up = up->parent) {
+            ++up->itemCount;
+        }
+        if (parent.arrived.empty()) {
+            touched.push_back(&parent);
+        }
+        parent.arrived.push_back(&node);
+        return node;
+    }
+
+    // Splits on either separator and rejoins with '\', creating any missing directories.
+    // An archive's members hang under a "name.zip!" node, as if the archive were a folder.
+    void insert(const std::wstring& path, const ResultInfo& info, std::vector<Node*>& touched) {
+        std::wstring joined;
+        std::vector<size_t> starts;  // Where each component begins in joined
+        const size_t archiveEnd = containingArchive(path).size();
+        size_t i = 0;
+        while (i < path.size()) {
+            while (i < path.size() && (path[i] == L'\\' || path[i] == L'/')) ++i;
+            size_t end = i;
+            while (end < path.size() && path[end] != L'\\' && path[end] != L'/') ++end;
+            if (archiveEnd > 0 && i <= archiveEnd && archiveEnd + 1 < end) end = archiveEnd + 1;
+            if (end == i) break;
+            if (!joined.empty()) joined += L'\\';
+            starts.push_back(joined.size());
+            joined.append(path, i, end - i);
+            i = end;
+        }
+        if (starts.empty() || byPath.count(joined)) return;
+
+        // Results mostly land in a directory that is already in the tree
+        Node* current = &root;
+        size_t next = 0;
+        if (starts.size() > 1) {
+            auto parent = byPath.find(joined.substr(0, starts.back() - 1));
+            if (parent != byPath.end()) {
+                current = parent->second;
+                next = starts.size() - 1;
+            }
+        }
+        for (; next < starts.size(); ++next) {
+            bool last = next + 1 == starts.size();
+            size_t end = last ? joined.size() : starts[next + 1] - 1;
+            std::wstring prefix = joined.substr(0, end);
+            auto existing = byPath.find(prefix);
+            if (existing != byPath.end()) {
+                current = existing->second;
+                continue;
+            }
+            current = &addChild(*current, joined.substr(starts[next], end - starts[next]), std::move(prefix), last, touched);
+        }
+        if (current->isFile) {
+            current->fileSize = info.size;
+            current->modified = info.mtime;
+        }
+    }
+
+    void sortAll() {
+        sortLevel(root.children);
+        for (Node& node : nodes) {
+            if (!node.children.empty()) {
+                sortLevel(node.children);
+            }
+        }
+    }
+
+public:
+    ResultTree() = default;
+    ResultTree(const ResultTree&) = delete;
+    ResultTree& operator=(const ResultTree&) = delete;
+
+    // Adds a batch of results; each level they land in is merged once
+    void add(const std::vector<std::wstring>& paths, const std::vector<ResultInfo>& info) {
+        std::vector<Node*> touched;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            insert(paths[i], i < info.size() ? info[i] : ResultInfo{ 0, 0 }, touched);
+        }
+        for (Node* node : touched) {
+            mergeArrived(*node);
+        }
+    }
+
+    // normalizedRootKey() of every directory in the tree, to look their sizes up by
+    const std::vector<std::wstring>& folderKeys() const { return directoryKeys; }
+
+    // Shows each directory's Folder Sizes total, sizes[i] being that of folderKeys()[i].
+    // Ordered by size, the directories whose total changed are taken out of their levels
+    // and merged back in like arrivals; other nodes keep their places.
+    void setFolderSizes(const std::vector<std::optional<DirectorySize>>& sizes) {
+        std::vector<Node*> touched;
+        for (size_t i = 0; i < sizes.size() && i < directories.size(); ++i) {
+            Node& node = *directories[i];
+            if (!sizes[i]) continue;
+            node.folderSize = *sizes[i];
+            if (node.hasFolderSize && node.fileSize == sizes[i]->bytes) continue;
+            node.fileSize = sizes[i]->bytes;
+            node.hasFolderSize = true;
+            if (order != Order::Size) continue;
+            node.moving = true;
+            if (node.parent->arrived.empty()) {
+                touched.push_back(node.parent);
+            }
+            node.parent->arrived.push_back(&node);
+        }
+        for (Node* parent : touched) {
+            auto& children = parent->children;
+            children.erase(std::remove_if(children.begin(), children.end(), [](const Node* child) { return child->moving; }),
+                children.end());
+            for (Node* node : parent->arrived) {
+                node->moving = false;
+            }
+            mergeArrived(*parent);
+        }
+    }
+
+    void setOrder(Order newOrder, bool newDescending) {
+        if (newOrder == order && newDescending == descending) return;
+        order = newOrder;
+        descending = newDescending;
+        sortAll();
+    }
+
+    void clear() {
+        nodes.clear();
+        byPath.clear();
+        directories.clear();
+        directoryKeys.clear();
+        root.children.clear();
+        root.arrived.clear();
+        root.itemCount = 0;
+    }
+
+    Node& top() { return root; }
+    size_t size() const { return nodes.size(); }
+};
+
+// Performance monitoring class
+class PerformanceMonitor {
+private:
+    static const size_t MAX_SAMPLES = 100;
+    static const size_t SMOOTHING_WINDOW = 3;  // Number of samples to average
+    std::vector<float> cpuHistory;
+    std::vector<float> ramHistory;
+    HANDLE processHandle;
+    ULARGE_INTEGER lastCPU, lastSysCPU, lastUserCPU;
+    int numProcessors;
+    std::chrono::steady_clock::time_point lastUpdate;
+
+    void InitCPUMonitor() {
+        SYSTEM_INFO sysInfo;
+        FILETIME ftime, fsys, fuser;
+
+        GetSystemInfo(&sysInfo);
+        numProcessors = sysInfo.dwNumberOfProcessors;
+
+        GetSystemTimeAsFileTime(&ftime);
+        memcpy(&lastCPU, &ftime, sizeof(FILETIME));
+
+        processHandle = GetCurrentProcess();
+        GetProcessTimes(processHandle, &ftime, &ftime, &fsys, &fuser);
+        memcpy(&lastSysCPU, &fsys, sizeof(FILETIME));
+        memcpy(&lastUserCPU, &fuser, sizeof(FILETIME));
+    }
+
+    double GetCPUUsage() {
+        FILETIME ftime, fsys, fuser;
+        ULARGE_INTEGER now, sys, user;
+        double percent;
+
+        GetSystemTimeAsFileTime(&ftime);
+        memcpy(&now, &ftime, sizeof(FILETIME));
+
+        GetProcessTimes(processHandle, &ftime, &ftime, &fsys, &fuser);
+        memcpy(&sys, &fsys, sizeof(FILETIME));
+        memcpy(&user, &fuser, sizeof(FILETIME));
+        percent = (sys.QuadPart - lastSysCPU.QuadPart) +
+            (user.QuadPart - lastUserCPU.QuadPart);
+        percent /= (now.QuadPart - lastCPU.QuadPart);
+        percent /= numProcessors;
+        lastCPU = now;
+        lastUserCPU = user;
+        lastSysCPU = sys;
+
+        return percent;
+    }
+
+    float SmoothValue(const std::vector<float>& history, size_t currentIndex) {
+        float sum = 0.0f;
+        int count = 0;
+        for (size_t i = 0; i < SMOOTHING_WINDOW && i <= currentIndex; i++) {
+            sum += history[currentIndex - i];
+            count++;
+        }
+        return sum / count;
+    }
+
+public:
+    PerformanceMonitor() : cpuHistory(MAX_SAMPLES, 0.0f), ramHistory(MAX_SAMPLES, 0.0f) {
+        processHandle = GetCurrentProcess();
+        InitCPUMonitor();
+    }
+
+    ~PerformanceMonitor() {
+        CloseHandle(processHandle);
+    }
+
+    void Update() {
+        // Update CPU usage with smoothing
+        float rawCpuUsage = GetCPUUsage();
+        cpuHistory.erase(cpuHistory.begin());
+        cpuHistory.push_back(rawCpuUsage);
+        
+        // Update RAM usage
+        PROCESS_MEMORY_COUNTERS_EX pmc;
+        GetProcessMemoryInfo(processHandle, (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc));
+        float ramUsage = static_cast<float>(pmc.WorkingSetSize) / (1024.0f * 1024.0f); // Convert to MB
+
+        ramHistory.erase(ramHistory.begin());
         ramHistory.push_back(ramUsage);
     }
 
-    void RenderGraphs() {
-        const float PERF_WINDOW_WIDTH = 250.0f;
-        ImGui::SetNextWindowPos(ImVec2(ImGui::GetIO().DisplaySize.x - PERF_WINDOW_WIDTH, 0), ImGuiCond_Always);
-        ImGui::SetNextWindowSize(ImVec2(PERF_WINDOW_WIDTH, ImGui::GetIO().DisplaySize.y), ImGuiCond_Always);
-        ImGui::Begin("Performance", nullptr, 
-            ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize | 
-            ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoSavedSettings |
-            ImGuiWindowFlags_NoTitleBar);
+    void RenderGraphs() {
+        const float PERF_WINDOW_WIDTH = 250.0f;
+        ImGui::SetNextWindowPos(ImVec2(ImGui::GetIO().DisplaySize.x - PERF_WINDOW_WIDTH, 0), ImGuiCond_Always);
+        ImGui::SetNextWindowSize(ImVec2(PERF_WINDOW_WIDTH, ImGui::GetIO().DisplaySize.y), ImGuiCond_Always);
+        ImGui::Begin("Performance", nullptr, 
+            ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoResize | 
+            ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoSavedSettings |
+            ImGuiWindowFlags_NoTitleBar);
+
+        const float GRAPH_HEIGHT = ImGui::GetIO().DisplaySize.y * 0.4f;
+        const float GRAPH_WIDTH = PERF_WINDOW_WIDTH - 20.0f;
+
+        // Prepare smoothed CPU data for display
+        std::vector<float> smoothedCPU(cpuHistory.size());
+        for (size_t i = 0; i < cpuHistory.size(); i++) {
+            smoothedCPU[i] = SmoothValue(cpuHistory, i);
+        }
+
+        // CPU Graph with custom styling
+        ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.7f, 0.3f, 1.0f));
+        ImGui::Text("CPU Usage");
+        ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4(0.1f, 0.1f, 0.1f, 0.8f));
+        ImGui::PushStyleColor(ImGuiCol_PlotLines, ImVec4(1.0f, 0.5f, 0.0f, 1.0f));
+        ImGui::PlotLines("##cpu", smoothedCPU.data(), smoothedCPU.size(), 0,
+            nullptr, 0.0f, 1.0f, ImVec2(GRAPH_WIDTH, GRAPH_HEIGHT));
+        ImGui::PopStyleColor(2);
+        ImGui::Text("Current: %.1f%%", smoothedCPU.back() * 100.0f);
+        ImGui::PopStyleColor();
+        
+        ImGui::Spacing();
+        ImGui::Separator();
+        ImGui::Spacing();
+
+        // RAM Graph with custom styling
+        ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.3f, 1.0f, 0.5f, 1.0f));
+        ImGui::Text("RAM Usage (MB)");
+        ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4(0.1f, 0.1f, 0.1f, 0.8f));
+        ImGui::PushStyleColor(ImGuiCol_PlotLines, ImVec4(0.0f, 1.0f, 0.5f, 1.0f));
+        float maxRam = *std::max_element(ramHistory.begin(), ramHistory.end());
+        ImGui::PlotLines("##ram", ramHistory.data(), ramHistory.size(), 0,
+            nullptr, 0.0f, maxRam * 1.2f, ImVec2(GRAPH_WIDTH, GRAPH_HEIGHT));
+        ImGui::PopStyleColor(2);
+        ImGui::Text("Current: %.1f MB", ramHistory.back());
+        ImGui::PopStyleColor();
+
+        ImGui::End();
+    }
+};
+
+// Function to show folder browser dialog
+bool BrowseFolder(std::string& selected_path) {
+    IFileOpenDialog* pFileDialog;
+    HRESULT hr = CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL,
+        IID_IFileOpenDialog, reinterpret_cast<void**>(&pFileDialog));
+
+    if (SUCCEEDED(hr)) {
+        // Set options to pick folders
+        DWORD dwOptions;
+        hr = pFileDialog->GetOptions(&dwOptions);
+        if (SUCCEEDED(hr)) {
+            hr = pFileDialog->SetOptions(dwOptions | FOS_PICKFOLDERS);
+        }
+
+        // Show the dialog
+        if (SUCCEEDED(hr)) {
+            hr = pFileDialog->Show(NULL);
+            if (SUCCEEDED(hr)) {
+                IShellItem* pItem;
+                hr = pFileDialog->GetResult(&pItem);
+                if (SUCCEEDED(hr)) {
+                    PWSTR pszFilePath;
+                    hr = pItem->GetDisplayName(SIGDN_FILESYSPATH, &pszFilePath);
+                    if (SUCCEEDED(hr)) {
+                        selected_path = wstring_to_string(pszFilePath);
+                        CoTaskMemFree(pszFilePath);
+                    }
+                    pItem->Release();
+                }
+            }
+        }
+        pFileDialog->Release();
+        return SUCCEEDED(hr);
+    }
+    return false;
+}
+
+// Global state
+static ID3D11Device* g_pd3dDevice = nullptr;
+static ID3D11DeviceContext* g_pd3dDeviceContext = nullptr;
+static IDXGISwapChain* g_pSwapChain = nullptr;
+static UINT g_ResizeWidth = 0, g_ResizeHeight = 0;
+static ID3D11RenderTargetView* g_mainRenderTargetView = nullptr;
+static std::unique_ptr<PerformanceMonitor> g_perfMonitor;
+static std::deque<std::string> searchHistory;
+static const size_t MAX_HISTORY = 10;
+static bool showPreview = true;
+static float previewPanelWidth = 300.0f;
+
+// Forward declarations
+bool CreateDeviceD3D(HWND hWnd);
+void CleanupDeviceD3D();
+void CreateRenderTarget();
+void CleanupRenderTarget();
+LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+
+// Helper function to format file size
+std::wstring formatFileSize(uintmax_t bytes) {
+    const wchar_t* units[] = { L"B", L"KB", L"MB", L"GB", L"TB" };
+    int unitIndex = 0;
+    double size = static_cast<double>(bytes);
+    
+    while (size >= 1024 && unitIndex < 4) {
+        size /= 1024;
+        unitIndex++;
+    }
+    
+    wchar_t buffer[32];
+    if (unitIndex == 0) {
+        swprintf(buffer, 32, L"%d %ls", static_cast<int>(size), units[unitIndex]);
+    } else {
+        swprintf(buffer, 32, L"%.2f %ls", size, units[unitIndex]);
+    }
+    return buffer;
+}
+
+// Helper function to format last modified time, given in FILETIME ticks as the crawl records it
+std::wstring formatLastModified(int64_t fileTimeTicks) {
+    FILETIME utc, local;
+    utc.dwLowDateTime = static_cast<DWORD>(fileTimeTicks);
+    utc.dwHighDateTime = static_cast<DWORD>(fileTimeTicks >> 32);
+    SYSTEMTIME parts;
+    if (!FileTimeToLocalFileTime(&utc, &local) || !FileTimeToSystemTime(&local, &parts)) {
+        return L"";
+    }
+    wchar_t buffer[32];
+    swprintf(buffer, 32, L"%04u-%02u-%02u %02u:%02u", parts.wYear, parts.wMonth, parts.wDay, parts.wHour, parts.wMinute);
+    return buffer;
+}
+
+// Helper function to write a whole text file, used for stats exports
+bool writeTextFile(const char* path, const std::string& contents) {
+    std::ofstream file(path, std::ios::binary);
+    file << contents;
+    return static_cast<bool>(file);
+}
+
+// Helper function to save search history
+void SaveSearchHistory() {
+    std::ofstream file("search_history.txt");
+    for (const auto& search : searchHistory) {
+        file << search << std::endl;
+    }
+}
+
+// Helper function to load search history
+void LoadSearchHistory() {
+    std::ifstream file("search_history.txt");
+    std::string line;
+    while (std::getline(file, line) && searchHistory.size() < MAX_HISTORY) {
+        searchHistory.push_front(line);
+    }
+}
+
+// Helper function to add to search history
+void AddToSearchHistory(const std::string& pattern) {
+    // Remove if already exists
+    auto it = std::find(searchHistory.begin(), searchHistory.end(), pattern);
+    if (it != searchHistory.end()) {
+        searchHistory.erase(it);
+    }
+    
+    // Add to front
+    searchHistory.push_front(pattern);
+    
+    // Keep only MAX_HISTORY items
+    if (searchHistory.size() > MAX_HISTORY) {
+        searchHistory.pop_back();
+    }
+    
+    SaveSearchHistory();
+}
+
+// Command-line modes write to a redirected stdout, or to the parent console if there is one
+static HANDLE g_cliOutput = nullptr;
+
+HANDLE AttachCommandLineOutput() {
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (out == nullptr || out == INVALID_HANDLE_VALUE) {
+        if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+            out = CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+        }
+    }
+    return out;
+}
+
+void cliPrintf(const char* format, ...) {
+    if (g_cliOutput == nullptr || g_cliOutput == INVALID_HANDLE_VALUE) return;
+    va_list args;
+    va_start(args, format);
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int size = vsnprintf(nullptr, 0, format, argsCopy);
+    va_end(argsCopy);
+    if (size > 0) {
+        std::vector<char> buffer(static_cast<size_t>(size) + 1);
+        vsnprintf(buffer.data(), buffer.size(), format, args);
+        DWORD written = 0;
+        WriteFile(g_cliOutput, buffer.data(), static_cast<DWORD>(size), &written, nullptr);
+    }
+    va_end(args);
+}
+
+// Matcher correctness checks and throughput on mixed-script corpora (--bench-match)
+int RunMatcherBenchmark(size_t nameCount) {
+    struct MatchCase {
+        const wchar_t* pattern;
+        const wchar_t* text;
+        bool caseSensitive;
+        bool expected;
+        bool useRegex;  // False when left out
+    };
+    static const MatchCase cases[] = {
+        { L"readme", L"README.md", false, true },
+        { L"readme", L"README.md", true, false },
+        { L"aab", L"aaab.txt", false, true },
+        { L"\u03C3\u03AF\u03C3\u03C5\u03C6\u03BF\u03C3", L"\u03A3\u038A\u03A3\u03A5\u03A6\u039F\u03A3.txt", false, true },
+        { L"\u039F\u0394\u039F\u03A3", L"\u03BF\u03B4\u03BF\u03C2", false, true },  // Final sigma
+        { L"\u0444\u0430\u0439\u043B", L"\u0424\u0410\u0419\u041B_\u043E\u0442\u0447\u0451\u0442.doc", false, true },
+        { L"\u0451\u0436", L"\u0401\u0416", false, true },
+        { L"\u01C6", L"\u01C4", false, true },  // DZ with caron
+        { L"\u01C6", L"\u01C5", false, true },
+        { L"k", L"\u212A", false, true },  // Kelvin sign
+        { L"\uFF41\uFF42\uFF43", L"\uFF21\uFF22\uFF23", false, true },  // Fullwidth
+        { L"\u13A0", L"\uAB70", false, true },  // Cherokee
+        { L"\u0561\u0562", L"\u0531\u0532", false, true },  // Armenian
+        { L"\u00E9t\u00E9", L"\u00C9T\u00C9.jpg", false, true },
+        { L"stra\u00DFe", L"STRASSE", false, false },  // Needs full folding
+        { L"\u65E5\u672C", L"\u65E5\u672C\u8A9E.txt", false, true },
+        { L"^\u00E9t\u00E9\\.JPG$", L"\u00C9T\u00C9.jpg", false, true, true },  // Regexes fold the same way
+        { L"\u03C3\\d", L"\u03A33", false, true, true },
+        { L"^\\D\\.TXT$", L"a.txt", false, true, true },  // Escapes keep their case
+        { L"^\\D\\.TXT$", L"1.txt", false, false, true },
+        { L"README", L"readme.md", true, false, true },
+    };
+
+    int failures = 0;
+    for (const auto& c : cases) {
+        NameMatcher matcher(wstring_to_string(c.pattern), c.caseSensitive, c.useRegex);
+        bool result = matcher.matches(c.text);
+        if (result != c.expected) {
+            failures++;
+            cliPrintf("FAIL  pattern=%s text=%s expected=%d\n",
+                wstring_to_string(c.pattern).c_str(), wstring_to_string(c.text).c_str(), c.expected);
+        }
+    }
+    cliPrintf("Correctness: %zu cases, %d failures\n\n", sizeof(cases) / sizeof(cases[0]), failures);
+
+    // Build corpora from per-script alphabets, in random case
+    struct Script {
+        const char* name;
+        wchar_t upperFirst;
+        wchar_t lowerFirst;
+        int letters;
+    };
+    static const Script scripts[] = {
+        { "Latin", L'A', L'a', 26 },
+        { "Latin-1", 0x00C0, 0x00E0, 23 },
+        { "Greek", 0x0391, 0x03B1, 17 },
+        { "Cyrillic", 0x0410, 0x0430, 32 },
+        { "Armenian", 0x0531, 0x0561, 38 },
+    };
+    const size_t scriptCount = sizeof(scripts) / sizeof(scripts[0]);
+
+    std::mt19937 rng(12345);
+    auto makeWord = [&](const Script& script, size_t length) {
+        std::wstring word;
+        for (size_t i = 0; i < length; ++i) {
+            int letter = static_cast<int>(rng() % script.letters);
+            bool upper = (rng() % 3) == 0;
+            word += static_cast<wchar_t>((upper ? script.upperFirst : script.lowerFirst) + letter);
+        }
+        return word;
+    };
+
+    struct Corpus {
+        std::string name;
+        std::vector<std::wstring> names;
+    };
+    std::vector<Corpus> corpora;
+    for (size_t mixed = 0; mixed <= scriptCount; ++mixed) {
+        Corpus corpus;
+        corpus.name = mixed < scriptCount ? scripts[mixed].name : "Mixed";
+        for (size_t i = 0; i < nameCount; ++i) {
+            std::wstring name;
+            for (int w = 0; w < 3; ++w) {
+                const Script& script = mixed < scriptCount ? scripts[mixed] : scripts[rng() % scriptCount];
+                if (w > 0) name += L'_';
+                name += makeWord(script, 3 + rng() % 8);
+            }
+            name += L".dat";
+            corpus.names.push_back(std::move(name));
+        }
+        corpora.push_back(std::move(corpus));
+    }
+
+    // The previous implementation: convert to UTF-8, ::tolower the bytes, then search
+    auto legacyMatch = [](const std::wstring& name, const std::string& loweredPattern) {
+        std::string text = wstring_to_string(name);
+        std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+        return text.find(loweredPattern) != std::string::npos;
+    };
+
+    cliPrintf("%-10s %10s %12s %12s %10s %10s\n", "Corpus", "Names", "Native ns", "Legacy ns", "Native", "Legacy");
+    for (const auto& corpus : corpora) {
+        // Use a folded-case slice of one of the names as the pattern, so every corpus has hits
+        std::wstring patternWide = corpus.names[corpus.names.size() / 2].substr(1, 3);
+        std::string pattern = wstring_to_string(patternWide);
+        std::string legacyPattern = pattern;
+        std::transform(legacyPattern.begin(), legacyPattern.end(), legacyPattern.begin(), ::tolower);
+        NameMatcher matcher(pattern, false, false);
+
+        auto start = std::chrono::steady_clock::now();
+        size_t nativeHits = 0;
+        for (const auto& name : corpus.names) {
+            nativeHits += matcher.matches(name) ? 1 : 0;
+        }
+        auto mid = std::chrono::steady_clock::now();
+        size_t legacyHits = 0;
+        for (const auto& name : corpus.names) {
+            legacyHits += legacyMatch(name, legacyPattern) ? 1 : 0;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double nativeNs = std::chrono::duration<double, std::nano>(mid - start).count() / corpus.names.size();
+        double legacyNs = std::chrono::duration<double, std::nano>(end - mid).count() / corpus.names.size();
+        cliPrintf("%-10s %10zu %12.1f %12.1f %10zu %10zu\n", corpus.name.c_str(), corpus.names.size(),
+            nativeNs, legacyNs, nativeHits, legacyHits);
+    }
+
+    // Full-path matching the way the crawl does it, resuming from each directory's state,
+    // against rescanning every file's whole path. Directories are chains of Latin names,
+    // 256 files in each; a pattern that spans a separator must agree too.
+    const Corpus& latin = corpora[0];
+    const size_t filesPerDirectory = 256;
+    cliPrintf("\n%-6s %-10s %10s %12s %14s %10s\n", "Depth", "Pattern", "Files", "Rescan ns", "Resumed ns", "Matches");
+    for (size_t depth : { 2, 8, 32 }) {
+        std::wstring directory = L"C:";
+        std::vector<std::wstring> chain;
+        for (size_t d = 0; d < depth; ++d) {
+            directory += L'\\';
+            directory += latin.names[(d * 7919) % latin.names.size()].substr(0, 6);
+            chain.push_back(directory);
+        }
+        std::wstring spanning = chain.back().substr(chain.back().size() - 9, 5);
+        for (const std::wstring& patternWide : { latin.names[1].substr(2, 3), spanning }) {
+            NameMatcher matcher(wstring_to_string(patternWide), false, false);
+            size_t fileCount = 0;
+            size_t rescanHits = 0;
+            size_t resumedHits = 0;
+            std::wstring path;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t d = 0; d < depth; ++d) {
+                for (size_t f = 0; f < filesPerDirectory; ++f) {
+                    const std::wstring& name = latin.names[(d * filesPerDirectory + f) % latin.names.size()];
+                    path = chain[d];
+                    path += L'\\';
+                    path += name;
+                    rescanHits += matcher.matches(name) || matcher.matches(path) ? 1 : 0;
+                    ++fileCount;
+                }
+            }
+            auto mid = std::chrono::steady_clock::now();
+            uint32_t state = matcher.advance(0, L"C:");
+            for (size_t d = 0; d < depth; ++d) {
+                size_t offset = d == 0 ? 2 : chain[d - 1].size();
+                state = matcher.advance(state, std::wstring_view(chain[d]).substr(offset));
+                uint32_t base = matcher.advance(state, L"\\");
+                for (size_t f = 0; f < filesPerDirectory; ++f) {
+                    const std::wstring& name = latin.names[(d * filesPerDirectory + f) % latin.names.size()];
+                    resumedHits += matcher.advance(base, name) == NameMatcher::MATCHED ? 1 : 0;
+                }
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            double rescanNs = std::chrono::duration<double, std::nano>(mid - start).count() / fileCount;
+            double resumedNs = std::chrono::duration<double, std::nano>(end - mid).count() / fileCount;
+            if (rescanHits != resumedHits) failures++;
+            cliPrintf("%-6zu %-10s %10zu %12.1f %14.1f %10zu%s\n", depth, wstring_to_string(patternWide).c_str(),
+                fileCount, rescanNs, resumedNs, resumedHits,
+                rescanHits == resumedHits ? "" : "  MISMATCH");
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// Trigram index footprint and query latency against a brute-force scan of the same
+// names (--bench-trigram). Queries prefixed with "re:" are regular expressions.
+int RunTrigramBenchmark(const std::wstring& root, std::vector<std::string> queries) {
+    if (queries.empty()) {
+        queries = { "exe", "setup", "config", "a", "re:^api-ms-win-.*\\.dll$", "re:(readme|license)" };
+    }
+
+    NameTable names;
+    auto crawlStart = std::chrono::steady_clock::now();
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator it(root,
+        std::filesystem::directory_options::skip_permission_denied, ec);
+    for (const std::filesystem::recursive_directory_iterator end; !ec && it != end; it.increment(ec)) {
+        names.intern(fileNameView(it->path().native()));
+    }
+    double crawlSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - crawlStart).count();
+
+    TrigramIndex index;
+    auto buildStart = std::chrono::steady_clock::now();
+    index.build(names);
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+
+    size_t count = std::max<size_t>(names.size(), 1);
+    cliPrintf("Distinct names: %zu (crawl %.2f s)\n", names.size(), crawlSeconds);
+    cliPrintf("Name table:     %zu bytes (%.1f bytes/name)\n", names.memoryBytes(),
+        static_cast<double>(names.memoryBytes()) / count);
+    cliPrintf("Trigram index:  %zu bytes (%.1f bytes/name), %zu grams, built in %.1f ms\n\n",
+        index.memoryBytes(), static_cast<double>(index.memoryBytes()) / count, index.gramCount(), buildMs);
+
+    const int repeats = 5;
+    int mismatches = 0;
+    cliPrintf("%-28s %10s %10s %12s %12s %9s\n", "Query", "Candidates", "Matches", "Scan us", "Index us", "Speedup");
+    for (const auto& query : queries) {
+        bool useRegex = query.rfind("re:", 0) == 0;
+        std::string pattern = useRegex ? query.substr(3) : query;
+        NameMatcher matcher(pattern, false, useRegex);
+        if (!matcher.isValid()) {
+            cliPrintf("%-28s invalid pattern\n", query.c_str());
+            continue;
+        }
+
+        // Best of several runs for each side
+        std::vector<uint32_t> scanHits;
+        double scanUs = 1e30;
+        for (int r = 0; r < repeats; ++r) {
+            auto start = std::chrono::steady_clock::now();
+            scanHits.clear();
+            for (uint32_t id = 0; id < names.size(); ++id) {
+                if (matcher.matches(names.name(id))) scanHits.push_back(id);
+            }
+            scanUs = std::min(scanUs, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> indexHits;
+        double indexUs = 1e30;
+        for (int r = 0; r < repeats; ++r) {
+            auto start = std::chrono::steady_clock::now();
+            indexHits.clear();
+            if (index.candidates(requiredLiterals(string_to_wstring(pattern), useRegex), candidates)) {
+                for (uint32_t id : candidates) {
+                    if (matcher.matches(names.name(id))) indexHits.push_back(id);
+                }
+            } else {
+                // Nothing to narrow by; fall back to the scan
+                candidates.clear();
+                for (uint32_t id = 0; id < names.size(); ++id) {
+                    candidates.push_back(id);
+                    if (matcher.matches(names.name(id))) indexHits.push_back(id);
+                }
+            }
+            indexUs = std::min(indexUs, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        bool same = scanHits == indexHits;
+        mismatches += same ? 0 : 1;
+        cliPrintf("%-28s %10zu %10zu %12.1f %12.1f %8.1fx%s\n", query.c_str(), candidates.size(), indexHits.size(),
+            scanUs, indexUs, scanUs / std::max(indexUs, 0.001), same ? "" : "  MISMATCH");
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+// Crawl once into the catalog, then answer the same query from memory
+// (--bench-catalog): catalog bytes per entry and scan throughput per core
+int RunCatalogBenchmark(const std::wstring& root, const std::string& pattern) {
+    const std::vector<std::wstring> roots = parseSearchRoots(root);
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    auto runQuery = [&](bool useCatalog) {
+        auto start = std::chrono::steady_clock::now();
+        SearchOptions options;
+        options.useCatalog = useCatalog;
+        executor.search(pattern, false, false, roots, options);
+        executor.waitForCompletion();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    double crawlMs = runQuery(true);
+    size_t crawlMatches = executor.getMatchesFound();
+    size_t entries = executor.getCatalogEntries();
+    if (entries == 0) {
+        cliPrintf("Crawl did not complete; no catalog\n");
+        return 1;
+    }
+    cliPrintf("Crawl:   %.1f ms, %zu matches\n", crawlMs, crawlMatches);
+    cliPrintf("Catalog: %zu entries, %zu bytes (%.1f bytes/entry)\n\n", entries, executor.getCatalogBytes(),
+        static_cast<double>(executor.getCatalogBytes()) / entries);
+
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    bool consistent = true;
+    for (int run = 0; run < 5; ++run) {
+        double scanMs = runQuery(true);
+        consistent &= executor.isCatalogScan() && executor.getMatchesFound() == crawlMatches;
+        cliPrintf("Scan %d:  %.2f ms, %zu matches, %.2f M entries/s per core (%u cores)\n", run + 1, scanMs,
+            executor.getMatchesFound(), entries / (scanMs / 1e3) / cores / 1e6, cores);
+    }
+    if (!consistent) {
+        cliPrintf("MISMATCH between crawl and catalog results\n");
+    }
+    return consistent ? 0 : 1;
+}
+
+// Back-to-back queries as typed one character at a time: startup-to-first-result latency
+// of the persistent executor against a fresh executor per query (--bench-requery)
+int RunRequeryBenchmark(const std::wstring& root, const std::string& word) {
+    const std::vector<std::wstring> roots = parseSearchRoots(root);
+    std::vector<std::string> queries;
+    for (size_t length = 1; length <= word.size(); ++length) {
+        queries.push_back(word.substr(0, length));
+    }
+
+    struct Sample {
+        int64_t firstDirectoryNs;
+        int64_t firstResultNs;
+        int64_t teardownNs;
+    };
+    auto nanosSince = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+    // Each query runs until its first result (or the end of the search), then the next preempts it
+    auto waitForFirstResult = [](FastSearch& executor) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (executor.getFirstResultNs() < 0 && executor.isSearching() &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    };
+
+    SearchOptions crawlOnly;
+    crawlOnly.useCatalog = false;
+    std::atomic<bool> warmInProgress{ false };
+    std::vector<Sample> warm;
+    {
+        FastSearch executor(warmInProgress);
+        for (const auto& query : queries) {
+            executor.search(query, false, false, roots, crawlOnly);
+            waitForFirstResult(executor);
+            warm.push_back({ executor.getFirstDirectoryNs(), executor.getFirstResultNs(), 0 });
+        }
+        executor.cancel();
+        executor.waitForCompletion();
+    }
+
+    std::vector<Sample> cold;
+    for (const auto& query : queries) {
+        std::atomic<bool> coldInProgress{ false };
+        auto executor = std::make_unique<FastSearch>(coldInProgress);
+        executor->search(query, false, false, roots, crawlOnly);
+        waitForFirstResult(*executor);
+        Sample sample = { executor->getFirstDirectoryNs(), executor->getFirstResultNs(), 0 };
+        auto teardownStart = std::chrono::steady_clock::now();
+        executor.reset();
+        sample.teardownNs = nanosSince(teardownStart);
+        cold.push_back(sample);
+    }
+
+    auto ms = [](int64_t nanos) { return nanos < 0 ? -1.0 : nanos / 1e6; };
+    cliPrintf("%-20s %14s %14s %14s %14s %14s\n", "Query", "Warm dir ms", "Warm first ms",
+        "Cold dir ms", "Cold first ms", "Cold join ms");
+    for (size_t i = 0; i < queries.size(); ++i) {
+        cliPrintf("%-20s %14.3f %14.3f %14.3f %14.3f %14.3f\n", queries[i].c_str(),
+            ms(warm[i].firstDirectoryNs), ms(warm[i].firstResultNs),
+            ms(cold[i].firstDirectoryNs), ms(cold[i].firstResultNs), ms(cold[i].teardownNs));
+    }
+
+    // Medians over the queries that produced a result
+    auto median = [](std::vector<int64_t> values) {
+        values.erase(std::remove_if(values.begin(), values.end(), [](int64_t v) { return v < 0; }), values.end());
+        if (values.empty()) return -1.0;
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2] / 1e6;
+    };
+    std::vector<int64_t> warmFirst, coldFirst, coldTeardown;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        warmFirst.push_back(warm[i].firstResultNs);
+        coldFirst.push_back(cold[i].firstResultNs);
+        coldTeardown.push_back(cold[i].teardownNs);
+    }
+    cliPrintf("\nMedian first result: warm %.3f ms, cold %.3f ms (cold join %.3f ms per query)\n",
+        median(warmFirst), median(coldFirst), median(coldTeardown));
+    return 0;
+}
+
+// Duplicate files under a folder (--duplicates), optionally only among names matching a
+// pattern; prints each stage's cost and the groups, largest waste first
+int RunDuplicateFinder(const std::wstring& root, const std::string& pattern) {
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    // An empty regex matches every file
+    SearchOptions options;
+    options.useCatalog = false;
+    executor.search(pattern, false, pattern.empty(), parseSearchRoots(root), options);
+    executor.waitForCompletion();
+
+    DuplicateFinder finder;
+    finder.start(executor.getResults());
+    finder.wait();
+    DuplicateFinder::Report report = finder.getReport();
+
+    cliPrintf("%-10s %10s %10s %14s %10s %10s\n", "Stage", "Files in", "Files out", "Bytes read", "ms", "MB/s");
+    for (const auto& stage : report.stages) {
+        cliPrintf("%-10s %10zu %10zu %14llu %10.1f %10.1f\n", stage.name.c_str(), stage.filesIn, stage.filesOut,
+            static_cast<unsigned long long>(stage.bytesRead), stage.seconds * 1e3,
+            stage.bytesRead / 1e6 / std::max(stage.seconds, 1e-9));
+    }
+    cliPrintf("\n%zu files, %llu bytes total, %llu bytes read (%.1f%%), %zu errors, %zu hard links counted once\n",
+        report.files, static_cast<unsigned long long>(report.totalBytes), static_cast<unsigned long long>(report.bytesRead),
+        report.totalBytes ? 100.0 * report.bytesRead / report.totalBytes : 0.0, report.errors, report.hardLinksSkipped);
+    cliPrintf("%zu duplicate groups, %llu bytes wasted\n\n", report.groups.size(),
+        static_cast<unsigned long long>(report.wastedBytes));
+    for (const auto& group : report.groups) {
+        cliPrintf("%zu x %llu bytes\n", group.paths.size(), static_cast<unsigned long long>(group.size));
+        for (const auto& path : group.paths) {
+            cliPrintf("  %s\n", wstring_to_string(path).c_str());
+        }
+    }
+    return 0;
+}
+
+// du-style sizes of a folder's directories down to a depth (--du), largest first, timed
+// against a single-threaded walk that visits one entry at a time the way du does
+int RunDirectorySizes(const std::wstring& root, uint32_t maxDepth) {
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    auto start = std::chrono::steady_clock::now();
+    SearchOptions options;
+    options.useCatalog = false;
+    options.directorySizes = true;
+    options.crawlOnly = true;
+    executor.search(std::string(), false, false, parseSearchRoots(root), options);
+    executor.waitForCompletion();
+    double parallelMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    struct Row {
+        std::wstring path;
+        uint32_t depth;
+        DirectorySize size;
+    };
+    std::vector<Row> rows;
+    executor.forEachDirectorySize(maxDepth, [&](const std::wstring& path, uint32_t depth, const DirectorySize& size) {
+        rows.push_back({ path, depth, size });
+    });
+    // Roots first, then each level by size
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.depth != b.depth ? a.depth < b.depth : a.size.bytes > b.size.bytes;
+    });
+    cliPrintf("%16s %12s %10s  %s\n", "Bytes", "Files", "Folders", "Path");
+    uint64_t parallelBytes = 0;
+    for (const auto& row : rows) {
+        if (row.depth == 0) parallelBytes += row.size.bytes;
+        cliPrintf("%16llu %12llu %10llu  %s\n", static_cast<unsigned long long>(row.size.bytes),
+            static_cast<unsigned long long>(row.size.files), static_cast<unsigned long long>(row.size.directories),
+            wstring_to_string(row.path).c_str());
+    }
+
+    start = std::chrono::steady_clock::now();
+    uint64_t sequentialBytes = 0;
+    std::error_code ec;
+    for (const auto& folder : parseSearchRoots(root)) {
+        auto it = std::filesystem::recursive_directory_iterator(folder,
+            std::filesystem::directory_options::skip_permission_denied, ec);
+        for (const std::filesystem::recursive_directory_iterator end; !ec && it != end; it.increment(ec)) {
+            std::error_code sizeEc;
+            if (it->is_regular_file(sizeEc)) {
+                uint64_t size = it->file_size(sizeEc);
+                if (!sizeEc) sequentialBytes += size;
+            }
+        }
+    }
+    double sequentialMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    cliPrintf("\nParallel:   %.1f ms, %llu bytes (%llu hard links counted once)\n", parallelMs,
+        static_cast<unsigned long long>(parallelBytes), static_cast<unsigned long long>(executor.getHardLinksSkipped()));
+    cliPrintf("Sequential: %.1f ms, %llu bytes (every link counted)\n", sequentialMs,
+        static_cast<unsigned long long>(sequentialBytes));
+    cliPrintf("Speedup:    %.2fx\n", sequentialMs / std::max(parallelMs, 1e-3));
+    return 0;
+}
+
+// Time to the first, 10th, 100th and 1000th match and to the end of a crawl (--bench-first)
+// in FIFO order, best first on a fresh executor, and best first again once the executor
+// remembers where the earlier runs found matches; medians of three runs each
+int RunBestFirstBenchmark(const std::wstring& root, const std::vector<std::string>& patterns) {
+    static constexpr uint64_t MILESTONES[] = { 1, 10, 100, 1000 };
+    static constexpr size_t MILESTONE_COUNT = sizeof(MILESTONES) / sizeof(MILESTONES[0]);
+    static constexpr int RUNS = 3;
+
+    // Notes when the results streamed in passed each milestone
+    class MilestoneSink : public ResultSink {
+    private:
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::atomic<uint64_t> count{ 0 };
+
+    public:
+        std::array<std::atomic<int64_t>, MILESTONE_COUNT> reachedNs;
+
+        MilestoneSink() {
+            for (auto& reached : reachedNs) reached.store(-1);
+        }
+
+        bool write(const std::vector<std::wstring>& paths, const std::vector<ResultInfo>&) override {
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            uint64_t before = count.fetch_add(paths.size());
+            for (size_t i = 0; i < MILESTONE_COUNT; ++i) {
+                if (before < MILESTONES[i] && before + paths.size() >= MILESTONES[i]) {
+                    reachedNs[i].store(now);
+                }
+            }
+            return true;
+        }
+        uint64_t results() const { return count.load(); }
+    };
+
+    const std::vector<std::wstring> roots = parseSearchRoots(root);
+    std::atomic<bool> inProgress{ false };
+    {
+        // Read the tree once so every mode finds it in the OS cache
+        FastSearch warmup(inProgress);
+        SearchOptions crawl;
+        crawl.useCatalog = false;
+        crawl.crawlOnly = true;
+        warmup.search(std::string(), false, false, roots, crawl);
+        warmup.waitForCompletion();
+    }
+
+    cliPrintf("%-16s %-14s %10s %10s %10s %10s %10s %10s\n", "Pattern", "Order", "1st ms", "10th ms",
+        "100th ms", "1000th ms", "All ms", "Matches");
+    for (const auto& pattern : patterns) {
+        FastSearch fifo(inProgress);
+        FastSearch ranked(inProgress);  // Keeps its match history across the runs below
+        struct Mode {
+            const char* name;
+            FastSearch* executor;
+            bool bestFirst;
+        };
+        const Mode modes[] = {
+            { "FIFO", &fifo, false },
+            { "best first", &ranked, true },
+            { "+ history", &ranked, true },
+        };
+        for (const Mode& mode : modes) {
+            std::array<std::vector<int64_t>, MILESTONE_COUNT + 1> samples;
+            uint64_t matches = 0;
+            for (int run = 0; run < RUNS; ++run) {
+                auto sink = std::make_shared<MilestoneSink>();
+                SearchOptions options;
+                options.useCatalog = false;
+                options.bestFirst = mode.bestFirst;
+                options.sink = sink;
+                auto start = std::chrono::steady_clock::now();
+                mode.executor->search(pattern, false, false, roots, options);
+                mode.executor->waitForCompletion();
+                for (size_t i = 0; i < MILESTONE_COUNT; ++i) {
+                    samples[i].push_back(sink->reachedNs[i].load());
+                }
+                samples[MILESTONE_COUNT].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+                matches = sink->results();
+            }
+            cliPrintf("%-16s %-14s", pattern.c_str(), mode.name);
+            for (auto& values : samples) {
+                std::sort(values.begin(), values.end());
+                int64_t median = values[values.size() / 2];
+                if (median < 0) {
+                    cliPrintf(" %10s", "-");
+                } else {
+                    cliPrintf(" %10.2f", median / 1e6);
+                }
+            }
+            cliPrintf(" %10llu\n", static_cast<unsigned long long>(matches));
+        }
+    }
+    return 0;
+}
+
+// Crawls a folder under each link policy (--bench-links) and reports how many directories the
+// visited set and the policy kept from being read again or at all
+int RunTraversalBenchmark(const std::wstring& root) {
+    struct Mode {
+        const char* name;
+        bool followLinks;
+        bool oneFileSystem;
+    };
+    const Mode modes[] = {
+        { "skip links", false, false },
+        { "follow links", true, false },
+        { "follow, one volume", true, true },
+    };
+    cliPrintf("%-20s %10s %12s %12s %10s %10s %10s\n", "Policy", "ms", "Directories", "Entries", "Revisits", "Links", "Volumes");
+    for (const Mode& mode : modes) {
+        std::atomic<bool> inProgress{ false };
+        FastSearch executor(inProgress);
+        SearchOptions options;
+        options.useCatalog = false;
+        options.followLinks = mode.followLinks;
+        options.oneFileSystem = mode.oneFileSystem;
+        options.crawlOnly = true;
+        auto start = std::chrono::steady_clock::now();
+        executor.search(std::string(), false, false, parseSearchRoots(root), options);
+        executor.waitForCompletion();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        TraversalCounts counts = executor.getTraversalCounts();
+        cliPrintf("%-20s %10.1f %12llu %12zu %10llu %10llu %10llu\n", mode.name, ms,
+            static_cast<unsigned long long>(counts.directoriesRead), executor.getFilesProcessed(),
+            static_cast<unsigned long long>(counts.revisitsSkipped), static_cast<unsigned long long>(counts.linksSkipped),
+            static_cast<unsigned long long>(counts.otherVolumesSkipped));
+        if (counts.revisitsSkipped > 0) {
+            cliPrintf("%-20s %.1f%% of the directories reached were already read; each skip saves its whole subtree"
+                " (without the visited set a link loop never ends)\n", "",
+                100.0 * counts.revisitsSkipped / (counts.directoriesRead + counts.revisitsSkipped));
+        }
+    }
+    return 0;
+}
 
-        const float GRAPH_HEIGHT = ImGui::GetIO().DisplaySize.y * 0.4f;
-        const float GRAPH_WIDTH = PERF_WINDOW_WIDTH - 20.0f;
+// Previews of the first files under a folder (--bench-preview): head and tail page of each
+// through the preview thread, then the most recent heads again from its cache; prints the latency
+// percentiles and the encodings detected
+int RunPreviewBenchmark(const std::wstring& root, const std::string& pattern, size_t limit) {
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    // An empty regex matches every file
+    SearchOptions options;
+    options.useCatalog = false;
+    executor.search(pattern, false, pattern.empty(), parseSearchRoots(root), options);
+    executor.waitForCompletion();
+    std::vector<std::wstring> files = executor.getResults();
+    if (files.size() > limit) files.resize(limit);
 
-        // Prepare smoothed CPU data for display
-        std::vector<float> smoothedCPU(cpuHistory.size());
-        for (size_t i = 0; i < cpuHistory.size(); i++) {
-            smoothedCPU[i] = SmoothValue(cpuHistory, i);
+    PreviewService previews;
+    std::map<std::string, size_t> encodings;
+    size_t errors = 0;
+    for (const auto& file : files) {
+        previews.show(file, PreviewService::Mode::Text, 0);
+        auto head = previews.wait();
+        if (!head->error.empty()) {
+            errors++;
+            continue;
         }
+        encodings[PreviewService::encodingName(head->encoding)]++;
+        previews.show(file, PreviewService::Mode::Text, PreviewService::LAST_PAGE);
+        previews.wait();
+    }
+    PreviewService::LatencyReport cold = previews.latency();
+    // Head and tail of the last files visited are still cached
+    size_t repeats = std::min(files.size(), PreviewService::CACHE_SIZE / 2);
+    for (size_t i = files.size() - repeats; i < files.size(); ++i) {
+        previews.show(files[i], PreviewService::Mode::Text, 0);
+        previews.wait();
+    }
+    PreviewService::LatencyReport warm = previews.latency();
 
-        // CPU Graph with custom styling
-        ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.7f, 0.3f, 1.0f));
-        ImGui::Text("CPU Usage");
-        ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4(0.1f, 0.1f, 0.1f, 0.8f));
-        ImGui::PushStyleColor(ImGuiCol_PlotLines, ImVec4(1.0f, 0.5f, 0.0f, 1.0f));
-        ImGui::PlotLines("##cpu", smoothedCPU.data(), smoothedCPU.size(), 0,
-            nullptr, 0.0f, 1.0f, ImVec2(GRAPH_WIDTH, GRAPH_HEIGHT));
-        ImGui::PopStyleColor(2);
-        ImGui::Text("Current: %.1f%%", smoothedCPU.back() * 100.0f);
-        ImGui::PopStyleColor();
-        
-        ImGui::Spacing();
-        ImGui::Separator();
-        ImGui::Spacing();
+    cliPrintf("%zu files, %zu unreadable\n", files.size(), errors);
+    for (const auto& [name, count] : encodings) {
+        cliPrintf("  %-10s %zu\n", name.c_str(), count);
+    }
+    cliPrintf("\nLoads:  %zu, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        cold.loads, cold.p50Ms, cold.p90Ms, cold.p99Ms, cold.maxMs);
+    cliPrintf("Repeat: %zu of %zu heads from the cache, %zu loaded again\n",
+        warm.cacheHits - cold.cacheHits, repeats, warm.loads - cold.loads);
+    return 0;
+}
 
-        // RAM Graph with custom styling
-        ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0.3f, 1.0f, 0.5f, 1.0f));
-        ImGui::Text("RAM Usage (MB)");
-        ImGui::PushStyleColor(ImGuiCol_FrameBg, ImVec4(0.1f, 0.1f, 0.1f, 0.8f));
-        ImGui::PushStyleColor(ImGuiCol_PlotLines, ImVec4(0.0f, 1.0f, 0.5f, 1.0f));
-        float maxRam = *std::max_element(ramHistory.begin(), ramHistory.end());
-        ImGui::PlotLines("##ram", ramHistory.data(), ramHistory.size(), 0,
-            nullptr, 0.0f, maxRam * 1.2f, ImVec2(GRAPH_WIDTH, GRAPH_HEIGHT));
-        ImGui::PopStyleColor(2);
-        ImGui::Text("Current: %.1f MB", ramHistory.back());
-        ImGui::PopStyleColor();
+// Reads the crawl budget option at args[i], if it is one, and moves i past its value
+bool parseBudgetOption(const std::vector<std::wstring>& args, size_t& i, CrawlBudget& budget) {
+    const bool hasValue = i + 1 < args.size();
+    if (args[i] == L"--max-dirs" && hasValue) {
+        budget.directoriesPerSecond = std::wcstod(args[++i].c_str(), nullptr);
+    } else if (args[i] == L"--max-entries" && hasValue) {
+        budget.entriesPerSecond = std::wcstod(args[++i].c_str(), nullptr);
+    } else if (args[i] == L"--max-cpu" && hasValue) {
+        budget.cpuShare = std::wcstod(args[++i].c_str(), nullptr);
+    } else if (args[i] == L"--background") {
+        budget.backgroundPriority = true;
+    } else {
+        return false;
+    }
+    return true;
+}
 
-        ImGui::End();
+// Streams the results of one search to stdout or a file (--export) as they are found;
+// a summary goes to stderr so it never mixes with the results
+int RunExport(const std::vector<std::wstring>& args) {
+    std::wstring root = args[1];
+    std::string pattern = wstring_to_string(args[2]);
+    ExportFormat format = ExportFormat::Lines;
+    bool withSize = false, withMtime = false, caseSensitive = false, useRegex = false, archives = false;
+    CrawlBudget budget;
+    std::wstring outputPath;
+    for (size_t i = 3; i < args.size(); ++i) {
+        if (args[i] == L"--format" && i + 1 < args.size()) {
+            if (!parseExportFormat(args[++i], format)) {
+                cliPrintf("Unknown format; use nul, lines, jsonl or csv\n");
+                return 2;
+            }
+        } else if (args[i] == L"--size") {
+            withSize = true;
+        } else if (args[i] == L"--mtime") {
+            withMtime = true;
+        } else if (args[i] == L"--case") {
+            caseSensitive = true;
+        } else if (args[i] == L"--regex") {
+            useRegex = true;
+        } else if (args[i] == L"--archives") {
+            archives = true;
+        } else if (args[i] == L"--out" && i + 1 < args.size()) {
+            outputPath = args[++i];
+        } else if (!parseBudgetOption(args, i, budget)) {
+            cliPrintf("Unknown export option: %s\n", wstring_to_string(args[i]).c_str());
+            return 2;
+        }
+    }
+
+    HANDLE output = g_cliOutput;
+    if (!outputPath.empty()) {
+        output = CreateFileW(outputPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+    if (output == nullptr || output == INVALID_HANDLE_VALUE) {
+        cliPrintf("Cannot open output\n");
+        return 1;
+    }
+
+    auto exporter = std::make_shared<ResultExporter>(output, format, withSize, withMtime);
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    SearchOptions options;
+    options.useCatalog = false;
+    options.sink = exporter;
+    options.archives = archives;
+    options.budget = budget;
+    auto start = std::chrono::steady_clock::now();
+    executor.search(pattern, caseSensitive, useRegex, parseSearchRoots(root), options);
+    executor.waitForCompletion();
+    exporter->flush();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!outputPath.empty()) {
+        CloseHandle(output);
+    }
+
+    HANDLE errorOutput = GetStdHandle(STD_ERROR_HANDLE);
+    if (errorOutput != nullptr && errorOutput != INVALID_HANDLE_VALUE) {
+        char summary[400];
+        int length = snprintf(summary, sizeof(summary), "%llu results, %llu bytes in %.1f ms (%.2f M results/s)%s\n",
+            static_cast<unsigned long long>(exporter->resultsWritten()),
+            static_cast<unsigned long long>(exporter->bytesWritten()), seconds * 1e3,
+            exporter->resultsWritten() / std::max(seconds, 1e-9) / 1e6,
+            exporter->isBroken() ? "; output closed, search stopped" : "");
+        if (archives) {
+            ArchiveCounts counts = executor.getArchiveCounts();
+            length += snprintf(summary + length, sizeof(summary) - length,
+                "%llu archives listed (%llu members), %llu unreadable, %llu too large to inflate\n",
+                static_cast<unsigned long long>(counts.listed), static_cast<unsigned long long>(counts.members),
+                static_cast<unsigned long long>(counts.unreadable), static_cast<unsigned long long>(counts.tooLarge));
+        }
+        DWORD written = 0;
+        WriteFile(errorOutput, summary, static_cast<DWORD>(length), &written, nullptr);
+    }
+    // A reader that stops early (head, a failed CI check) is not an error here
+    DWORD error = exporter->lastError();
+    return !exporter->isBroken() || error == ERROR_BROKEN_PIPE || error == ERROR_NO_DATA ? 0 : 1;
+}
+
+// Counts the matches and adds up their sizes (--aggregate), in total or per extension or
+// folder, without keeping any result. Groups print largest first; a summary goes to stderr.
+int RunAggregate(const std::vector<std::wstring>& args) {
+    std::wstring root = args[1];
+    std::string pattern = wstring_to_string(args[2]);
+    ResultAggregator::Grouping grouping = ResultAggregator::Grouping::None;
+    uint32_t depth = 1;
+    bool byFiles = false, jsonl = false;
+    bool caseSensitive = false, useRegex = false, archives = false;
+    for (size_t i = 3; i < args.size(); ++i) {
+        if (args[i] == L"--by" && i + 1 < args.size()) {
+            if (!ResultAggregator::parseGrouping(args[++i], grouping)) {
+                cliPrintf("Unknown grouping; use none, ext or dir\n");
+                return 2;
+            }
+        } else if (args[i] == L"--depth" && i + 1 < args.size()) {
+            depth = static_cast<uint32_t>(std::wcstoul(args[++i].c_str(), nullptr, 10));
+        } else if (args[i] == L"--sort" && i + 1 < args.size()) {
+            const std::wstring& key = args[++i];
+            if (key == L"files") byFiles = true;
+            else if (key == L"bytes") byFiles = false;
+            else {
+                cliPrintf("Unknown sort; use files or bytes\n");
+                return 2;
+            }
+        } else if (args[i] == L"--format" && i + 1 < args.size()) {
+            const std::wstring& format = args[++i];
+            if (format == L"jsonl") jsonl = true;
+            else if (format == L"lines") jsonl = false;
+            else {
+                cliPrintf("Unknown format; use lines or jsonl\n");
+                return 2;
+            }
+        } else if (args[i] == L"--case") {
+            caseSensitive = true;
+        } else if (args[i] == L"--regex") {
+            useRegex = true;
+        } else if (args[i] == L"--archives") {
+            archives = true;
+        } else {
+            cliPrintf("Unknown aggregate option: %s\n", wstring_to_string(args[i]).c_str());
+            return 2;
+        }
+    }
+
+    std::vector<std::wstring> roots = parseSearchRoots(root);
+    auto aggregator = std::make_shared<ResultAggregator>(grouping, depth, roots);
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    SearchOptions options;
+    options.useCatalog = false;
+    options.sink = aggregator;
+    options.archives = archives;
+    auto start = std::chrono::steady_clock::now();
+    executor.search(pattern, caseSensitive, useRegex, roots, options);
+    executor.waitForCompletion();
+    double searchMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    std::vector<ResultAggregator::Group> groups = aggregator->groups(byFiles);
+    double mergeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    ResultAggregator::Totals totals = aggregator->totals();
+
+    std::string out;
+    auto appendRow = [&](const std::wstring& key, const ResultAggregator::Totals& row, bool isTotal) {
+        if (jsonl) {
+            out += isTotal ? "{\"total\":true" : "{\"group\":\"";
+            if (!isTotal) {
+                size_t keyStart = out.size();
+                appendUtf8(out, key);
+                ResultExporter::escapeJson(out, keyStart);
+                out += '"';
+            }
+            out += ",\"files\":";
+            ResultExporter::appendNumber(out, static_cast<long long>(row.files));
+            out += ",\"bytes\":";
+            ResultExporter::appendNumber(out, static_cast<long long>(row.bytes));
+            out += "}\n";
+        } else {
+            ResultExporter::appendNumber(out, static_cast<long long>(row.files));
+            out += '\t';
+            ResultExporter::appendNumber(out, static_cast<long long>(row.bytes));
+            out += '\t';
+            if (isTotal) out += "(total)";
+            else if (key.empty()) out += "(none)";
+            else appendUtf8(out, key);
+            out += '\n';
+        }
+    };
+    for (const auto& group : groups) {
+        appendRow(group.key, group.totals, false);
+    }
+    appendRow(std::wstring(), totals, true);
+    DWORD written = 0;
+    for (size_t at = 0; at < out.size(); at += written) {
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(out.size() - at, 1u << 30));
+        if (!WriteFile(g_cliOutput, out.data() + at, chunk, &written, nullptr) || written == 0) break;
+    }
+
+    HANDLE errorOutput = GetStdHandle(STD_ERROR_HANDLE);
+    if (errorOutput != nullptr && errorOutput != INVALID_HANDLE_VALUE) {
+        char summary[400];
+        int length = snprintf(summary, sizeof(summary),
+            "%llu matches in %zu groups: searched in %.1f ms, %zu per-thread partials merged in %.2f ms; "
+            "%.1f KB held vs %.1f MB to keep every result\n",
+            static_cast<unsigned long long>(totals.files), groups.size(), searchMs, aggregator->partialCount(), mergeMs,
+            aggregator->memoryBytes() / 1024.0, aggregator->materializedBytes() / 1048576.0);
+        WriteFile(errorOutput, summary, static_cast<DWORD>(length), &written, nullptr);
+    }
+    return 0;
+}
+
+static std::atomic<SearchDaemon*> g_daemon{ nullptr };
+
+BOOL WINAPI StopDaemon(DWORD) {
+    if (SearchDaemon* daemon = g_daemon.load()) {
+        daemon->stop();
+    }
+    return TRUE;
+}
+
+// Resident search daemon (--daemon): keeps the catalog of the roots and a warm worker pool
+// in memory and answers queries on a Unix domain socket until Ctrl+C
+int RunDaemon(const std::wstring& socketPath, const std::wstring& root) {
+    SearchDaemon daemon(parseSearchRoots(root));
+    std::string error;
+    if (!daemon.start(socketPath, error)) {
+        cliPrintf("%s\n", error.c_str());
+        return 1;
     }
+    cliPrintf("Catalog of %zu entries (%.1f MB) ready in %.1f ms; listening on %s\n", daemon.getCatalogEntries(),
+        daemon.getCatalogBytes() / 1048576.0, daemon.getWarmupMs(), wstring_to_string(socketPath).c_str());
+    g_daemon.store(&daemon);
+    SetConsoleCtrlHandler(StopDaemon, TRUE);
+    daemon.serve();
+    SetConsoleCtrlHandler(StopDaemon, FALSE);
+    g_daemon.store(nullptr);
+    cliPrintf("%llu clients, %llu queries answered, %llu cancelled\n",
+        static_cast<unsigned long long>(daemon.getClientsAccepted()),
+        static_cast<unsigned long long>(daemon.getQueriesAnswered()),
+        static_cast<unsigned long long>(daemon.getQueriesCancelled()));
+    return 0;
+}
+
+// How a daemon answered one query, as a client saw it
+struct DaemonReply {
+    DaemonStatus status = DaemonStatus::Failed;
+    uint64_t matches = 0;
+    uint64_t received = 0;
+    double firstResultMs = -1;
+    double totalMs = 0;
 };
 
-// Function to show folder browser dialog
-bool BrowseFolder(std::string& selected_path) {
-    IFileOpenDialog* pFileDialog;
-    HRESULT hr = CoCreateInstance(CLSID_FileOpenDialog, NULL, CLSCTX_ALL,
-        IID_IFileOpenDialog, reinterpret_cast<void**>(&pFileDialog));
+bool sendDaemonQuery(SOCKET socket, uint32_t id, uint8_t flags, const std::string& pattern, const std::string& roots) {
+    FrameWriter frame(DaemonFrame::Query);
+    frame.u32(id);
+    frame.u8(flags);
+    frame.str(pattern);
+    frame.str(roots);
+    return sendAll(socket, frame.finish());
+}
 
-    if (SUCCEEDED(hr)) {
-        // Set options to pick folders
-        DWORD dwOptions;
-        hr = pFileDialog->GetOptions(&dwOptions);
-        if (SUCCEEDED(hr)) {
-            hr = pFileDialog->SetOptions(dwOptions | FOS_PICKFOLDERS);
+bool sendDaemonCancel(SOCKET socket, uint32_t id) {
+    FrameWriter frame(DaemonFrame::Cancel);
+    frame.u32(id);
+    return sendAll(socket, frame.finish());
+}
+
+// Reads frames until query id is Done. onResults sees each Results frame's reader
+// positioned at its first record, with the record count; the first frame received (after
+// frames of other queries are skipped) also fires firstResults once, when given.
+bool awaitDaemonReply(SOCKET socket, uint32_t id, std::chrono::steady_clock::time_point sent, DaemonReply& reply,
+                      const std::function<void(FrameReader&, uint64_t)>& onResults,
+                      const std::function<void()>& firstResults = nullptr) {
+    std::string frame;
+    while (receiveFrame(socket, frame)) {
+        FrameReader reader(frame);
+        DaemonFrame type = static_cast<DaemonFrame>(reader.u8());
+        if (reader.u32() != id) continue;
+        if (type == DaemonFrame::Results) {
+            uint64_t count = reader.varint();
+            if (reply.received == 0 && count > 0) {
+                reply.firstResultMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count();
+                if (firstResults) firstResults();
+            }
+            reply.received += count;
+            if (onResults) onResults(reader, count);
+        } else if (type == DaemonFrame::Done) {
+            reply.status = static_cast<DaemonStatus>(reader.u8());
+            reply.matches = reader.varint();
+            reply.totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count();
+            return reader.good();
         }
+    }
+    return false;
+}
 
-        // Show the dialog
-        if (SUCCEEDED(hr)) {
-            hr = pFileDialog->Show(NULL);
-            if (SUCCEEDED(hr)) {
-                IShellItem* pItem;
-                hr = pFileDialog->GetResult(&pItem);
-                if (SUCCEEDED(hr)) {
-                    PWSTR pszFilePath;
-                    hr = pItem->GetDisplayName(SIGDN_FILESYSPATH, &pszFilePath);
-                    if (SUCCEEDED(hr)) {
-                        selected_path = wstring_to_string(pszFilePath);
-                        CoTaskMemFree(pszFilePath);
-                    }
-                    pItem->Release();
+// Runs one query on a daemon (--query) and prints its results as they stream in
+int RunDaemonQuery(const std::vector<std::wstring>& args) {
+    std::wstring socketPath = args[1];
+    std::string pattern = wstring_to_string(args[2]);
+    std::string roots;
+    uint8_t flags = 0;
+    for (size_t i = 3; i < args.size(); ++i) {
+        if (args[i] == L"--case") {
+            flags |= QUERY_CASE_SENSITIVE;
+        } else if (args[i] == L"--regex") {
+            flags |= QUERY_REGEX;
+        } else if (args[i] == L"--archives") {
+            flags |= QUERY_ARCHIVES;
+        } else if (args[i] == L"--refresh") {
+            flags |= QUERY_REFRESH;
+        } else if (args[i] == L"--info") {
+            flags |= QUERY_WITH_INFO;
+        } else if (args[i] == L"--in" && i + 1 < args.size()) {
+            roots = wstring_to_string(args[++i]);
+        } else {
+            cliPrintf("Unknown query option: %s\n", wstring_to_string(args[i]).c_str());
+            return 2;
+        }
+    }
+
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) return 1;
+    SOCKET socket = connectUnixSocket(socketPath);
+    if (socket == INVALID_SOCKET) {
+        cliPrintf("No daemon is listening on %s\n", wstring_to_string(socketPath).c_str());
+        WSACleanup();
+        return 1;
+    }
+    auto sent = std::chrono::steady_clock::now();
+    DaemonReply reply;
+    std::string lines;
+    bool answered = sendDaemonQuery(socket, 1, flags, pattern, roots) &&
+        awaitDaemonReply(socket, 1, sent, reply, [&](FrameReader& reader, uint64_t count) {
+            lines.clear();
+            for (uint64_t i = 0; i < count && reader.good(); ++i) {
+                std::string_view path = reader.str();
+                lines.append(path.data(), path.size());
+                if (flags & QUERY_WITH_INFO) {
+                    uint64_t size = reader.varint();
+                    int64_t mtime = static_cast<int64_t>(reader.u64());
+                    lines += '\t' + std::to_string(size) + '\t' + std::to_string(ResultExporter::unixSeconds(mtime));
                 }
+                lines += '\n';
+            }
+            DWORD written = 0;
+            WriteFile(g_cliOutput, lines.data(), static_cast<DWORD>(lines.size()), &written, nullptr);
+        });
+    closesocket(socket);
+    WSACleanup();
+
+    HANDLE errorOutput = GetStdHandle(STD_ERROR_HANDLE);
+    if (errorOutput != nullptr && errorOutput != INVALID_HANDLE_VALUE) {
+        static const char* const STATUS_NAMES[] = { "complete", "cancelled", "failed" };
+        char summary[200];
+        int length = answered
+            ? snprintf(summary, sizeof(summary), "%llu results in %.2f ms (first after %.2f ms), %s\n",
+                static_cast<unsigned long long>(reply.received), reply.totalMs, reply.firstResultMs,
+                STATUS_NAMES[std::min<size_t>(static_cast<size_t>(reply.status), 2)])
+            : snprintf(summary, sizeof(summary), "The daemon closed the connection\n");
+        DWORD written = 0;
+        WriteFile(errorOutput, summary, static_cast<DWORD>(length), &written, nullptr);
+    }
+    return answered && reply.status == DaemonStatus::Complete ? 0 : 1;
+}
+
+// Load test of a daemon (--loadtest): each client connection runs its queries back to
+// back, so clients queries are in flight at once. Prints end-to-end and first-result
+// latency percentiles, throughput, and with cancelEvery, how fast a Cancel sent after a
+// query's first results is answered.
+int RunDaemonLoadTest(const std::vector<std::wstring>& args) {
+    std::wstring socketPath = args[1];
+    size_t clientCount = 8, queriesPerClient = 50, cancelEvery = 0, positional = 0;
+    std::vector<std::string> patterns;
+    for (size_t i = 2; i < args.size(); ++i) {
+        bool number = !args[i].empty() && std::all_of(args[i].begin(), args[i].end(), iswdigit);
+        if (args[i] == L"--cancel-every" && i + 1 < args.size()) {
+            cancelEvery = std::wcstoul(args[++i].c_str(), nullptr, 10);
+        } else if (number && positional < 2 && patterns.empty()) {
+            size_t value = std::max<size_t>(std::wcstoul(args[i].c_str(), nullptr, 10), 1);
+            if (positional++ == 0) {
+                clientCount = value;
+            } else {
+                queriesPerClient = value;
             }
+        } else {
+            patterns.push_back(wstring_to_string(args[i]));
         }
-        pFileDialog->Release();
-        return SUCCEEDED(hr);
     }
-    return false;
+    if (patterns.empty()) {
+        patterns = { "e", "main", ".txt", "read", "log", "config", ".dll", "2024" };
+    }
+
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) return 1;
+    std::mutex samplesMutex;
+    std::vector<double> totalMs, firstMs, cancelMs;
+    uint64_t results = 0, failed = 0, cancelled = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t c = 0; c < clientCount; ++c) {
+        clients.emplace_back([&, c] {
+            SOCKET socket = connectUnixSocket(socketPath);
+            if (socket == INVALID_SOCKET) {
+                std::lock_guard<std::mutex> lock(samplesMutex);
+                failed += queriesPerClient;
+                return;
+            }
+            for (size_t q = 0; q < queriesPerClient; ++q) {
+                uint32_t id = static_cast<uint32_t>(q + 1);
+                bool cancel = cancelEvery > 0 && (c * queriesPerClient + q) % cancelEvery == cancelEvery - 1;
+                std::chrono::steady_clock::time_point cancelSent;
+                auto sent = std::chrono::steady_clock::now();
+                DaemonReply reply;
+                bool answered = sendDaemonQuery(socket, id, 0, patterns[(c + q) % patterns.size()], std::string()) &&
+                    awaitDaemonReply(socket, id, sent, reply, nullptr, [&] {
+                        if (cancel) {
+                            cancelSent = std::chrono::steady_clock::now();
+                            sendDaemonCancel(socket, id);
+                        }
+                    });
+                std::lock_guard<std::mutex> lock(samplesMutex);
+                if (!answered || reply.status == DaemonStatus::Failed) {
+                    ++failed;
+                    if (!answered) break;
+                    continue;
+                }
+                results += reply.received;
+                if (reply.status == DaemonStatus::Cancelled) {
+                    ++cancelled;
+                    cancelMs.push_back(std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - cancelSent).count());
+                    continue;
+                }
+                totalMs.push_back(reply.totalMs);
+                if (reply.firstResultMs >= 0) {
+                    firstMs.push_back(reply.firstResultMs);
+                }
+            }
+            closesocket(socket);
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    WSACleanup();
+
+    auto report = [](const char* label, std::vector<double> samples) {
+        if (samples.empty()) {
+            cliPrintf("%-14s %10s\n", label, "-");
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&](double p) {
+            size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+            return samples[std::min(samples.size() - 1, rank > 0 ? rank - 1 : 0)];
+        };
+        cliPrintf("%-14s %10.3f %10.3f %10.3f %10.3f %8zu\n", label, percentile(0.50), percentile(0.90),
+            percentile(0.99), samples.back(), samples.size());
+    };
+    cliPrintf("%zu clients x %zu queries over %zu patterns in %.2f s: %.1f queries/s, %llu results\n",
+        clientCount, queriesPerClient, patterns.size(), seconds, (totalMs.size() + cancelled) / std::max(seconds, 1e-9),
+        static_cast<unsigned long long>(results));
+    cliPrintf("%llu completed, %llu cancelled, %llu failed\n\n", static_cast<unsigned long long>(totalMs.size()),
+        static_cast<unsigned long long>(cancelled), static_cast<unsigned long long>(failed));
+    cliPrintf("%-14s %10s %10s %10s %10s %8s\n", "Latency ms", "p50", "p90", "p99", "max", "count");
+    report("query", totalMs);
+    report("first result", firstMs);
+    if (cancelEvery > 0) {
+        report("cancel", cancelMs);
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+// Crawls the folders and writes their snapshot (--snapshot) for a later --diff
+int RunSnapshot(const std::wstring& root, const std::wstring& path) {
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    SearchOptions options;
+    options.crawlOnly = true;
+    auto start = std::chrono::steady_clock::now();
+    executor.search(std::string(), false, false, parseSearchRoots(root), options);
+    executor.waitForCompletion();
+    double crawlMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    auto catalog = executor.getCatalog();
+    if (!catalog) {
+        cliPrintf("The crawl did not complete\n");
+        return 1;
+    }
+
+    start = std::chrono::steady_clock::now();
+    SnapshotWriter::Summary summary;
+    std::string error;
+    if (!SnapshotWriter::write(*catalog, path, summary, error)) {
+        cliPrintf("%s\n", error.c_str());
+        return 1;
+    }
+    double writeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cliPrintf("Crawled %zu entries in %.1f ms\n", catalog->size(), crawlMs);
+    cliPrintf("Wrote %llu entries, %.1f MB (%.1f bytes/entry) in %.1f ms\n",
+        static_cast<unsigned long long>(summary.entries), summary.bytes / 1048576.0,
+        summary.bytes / static_cast<double>(std::max<uint64_t>(summary.entries, 1)), writeMs);
+    if (summary.skipped > 0) {
+        cliPrintf("%llu entries reached under two roots written once\n", static_cast<unsigned long long>(summary.skipped));
+    }
+    return 0;
+}
+
+// Streams what changed between two snapshots (--diff) to stdout or a file; a summary goes
+// to stderr
+int RunSnapshotDiff(const std::vector<std::wstring>& args) {
+    ExportFormat format = ExportFormat::Lines;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::wstring outputPath;
+    for (size_t i = 3; i < args.size(); ++i) {
+        if (args[i] == L"--format" && i + 1 < args.size()) {
+            if (!parseExportFormat(args[++i], format, true)) {
+                cliPrintf("Unknown format; use lines or jsonl\n");
+                return 2;
+            }
+        } else if (args[i] == L"--threads" && i + 1 < args.size()) {
+            threads = std::max<size_t>(std::wcstoul(args[++i].c_str(), nullptr, 10), 1);
+        } else if (args[i] == L"--out" && i + 1 < args.size()) {
+            outputPath = args[++i];
+        } else {
+            cliPrintf("Unknown diff option: %s\n", wstring_to_string(args[i]).c_str());
+            return 2;
+        }
+    }
+
+    SnapshotReader before, after;
+    std::string error;
+    if (!before.open(args[1], error) || !after.open(args[2], error)) {
+        cliPrintf("%s\n", error.c_str());
+        return 1;
+    }
+    if (before.getRoots() != after.getRoots()) {
+        cliPrintf("Warning: the snapshots are of different folders\n");
+    }
+
+    HANDLE output = g_cliOutput;
+    if (!outputPath.empty()) {
+        output = CreateFileW(outputPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+    if (output == nullptr || output == INVALID_HANDLE_VALUE) {
+        cliPrintf("Cannot open output\n");
+        return 1;
+    }
+
+    ChangeExporter exporter(output, format);
+    auto start = std::chrono::steady_clock::now();
+    SnapshotDiff::Summary summary = SnapshotDiff::run(before, after, exporter, threads);
+    exporter.flush();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!outputPath.empty()) {
+        CloseHandle(output);
+    }
+
+    HANDLE errorOutput = GetStdHandle(STD_ERROR_HANDLE);
+    if (errorOutput != nullptr && errorOutput != INVALID_HANDLE_VALUE) {
+        uint64_t compared = before.entries() + after.entries();
+        char text[400];
+        int length = snprintf(text, sizeof(text),
+            "%llu added, %llu removed, %llu modified, %llu unchanged; %llu entries compared in %.1f ms "
+            "(%.1f M entries/s, %zu partitions on %zu threads)%s\n",
+            static_cast<unsigned long long>(summary.added), static_cast<unsigned long long>(summary.removed),
+            static_cast<unsigned long long>(summary.modified), static_cast<unsigned long long>(summary.unchanged),
+            static_cast<unsigned long long>(compared), seconds * 1e3, compared / std::max(seconds, 1e-9) / 1e6,
+            summary.partitions, std::min(threads, summary.partitions),
+            summary.failed ? "; a snapshot is damaged, diff incomplete" :
+            summary.stopped ? "; output closed, diff stopped" : "");
+        DWORD written = 0;
+        WriteFile(errorOutput, text, static_cast<DWORD>(length), &written, nullptr);
+    }
+    if (summary.failed) return 1;
+    DWORD lastError = exporter.lastError();
+    return !exporter.isBroken() || lastError == ERROR_BROKEN_PIPE || lastError == ERROR_NO_DATA ? 0 : 1;
+}
+
+// Crawls a folder several times (--bench-estimate) and compares the progress and ETA shown
+// while each crawl runs with what turned out to be true, for the estimate from earlier
+// crawls' counts and for the old one from the number of queued directories
+int RunEstimateBenchmark(const std::vector<std::wstring>& args) {
+    std::wstring root = args[1];
+    size_t runs = 3;
+    double pauseSeconds = 0;
+    std::wstring cachePath;
+    for (size_t i = 2; i < args.size(); ++i) {
+        if (args[i] == L"--pause" && i + 1 < args.size()) {
+            pauseSeconds = std::wcstod(args[++i].c_str(), nullptr);
+        } else if (args[i] == L"--cache" && i + 1 < args.size()) {
+            cachePath = args[++i];
+        } else {
+            runs = std::max<size_t>(std::wcstoul(args[i].c_str(), nullptr, 10), 1);
+        }
+    }
+
+    struct Sample {
+        double seconds;
+        uint64_t processed;
+        uint64_t remaining;
+        size_t queued;
+    };
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    if (!cachePath.empty()) {
+        executor.setEstimatesFile(cachePath);
+        cliPrintf("Loaded counts for %zu directories from %s\n", executor.getEstimatedDirectories(),
+            wstring_to_string(cachePath).c_str());
+    }
+    SearchOptions options;
+    options.useCatalog = false;
+    options.crawlOnly = true;
+    cliPrintf("%-4s %10s %9s %10s %22s %22s\n", "run", "files", "ms", "expected", "progress err new/old", "ETA err new/old");
+    for (size_t run = 1; run <= runs; ++run) {
+        std::vector<Sample> samples;
+        auto start = std::chrono::steady_clock::now();
+        executor.search(std::string(), false, false, parseSearchRoots(root), options);
+        FastSearch::ProgressEstimate first = executor.getProgress();
+        uint64_t expected = first.filesProcessed + first.filesRemaining;
+        while (inProgress.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            FastSearch::ProgressEstimate progress = executor.getProgress();
+            samples.push_back({ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+                progress.filesProcessed, progress.filesRemaining, executor.getQueueSize() });
+        }
+        executor.waitForCompletion();
+        double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t files = executor.getFilesProcessed();
+
+        // Mean absolute error of the fraction shown, in points, and of the ETA, as a share
+        // of the whole crawl's time, over the samples taken once files were coming in
+        double progressNew = 0, progressOld = 0, etaNew = 0, etaOld = 0;
+        size_t counted = 0;
+        for (const auto& sample : samples) {
+            if (sample.processed == 0 || sample.seconds >= total) continue;
+            double truth = static_cast<double>(sample.processed) / std::max<uint64_t>(files, 1);
+            double rate = sample.processed / sample.seconds;
+            progressNew += std::abs(static_cast<double>(sample.processed) / (sample.processed + sample.remaining) - truth);
+            progressOld += std::abs(static_cast<double>(sample.processed) / (sample.processed + sample.queued) - truth);
+            etaNew += std::abs(sample.remaining / rate - (total - sample.seconds));
+            etaOld += std::abs(sample.queued / rate - (total - sample.seconds));
+            counted++;
+        }
+        counted = std::max<size_t>(counted, 1);
+        char progressText[32], etaText[32];
+        snprintf(progressText, sizeof(progressText), "%.1f / %.1f pts", 100 * progressNew / counted, 100 * progressOld / counted);
+        snprintf(etaText, sizeof(etaText), "%.1f%% / %.1f%%", 100 * etaNew / counted / total, 100 * etaOld / counted / total);
+        cliPrintf("%-4zu %10llu %9.1f %10llu %22s %22s\n", run, static_cast<unsigned long long>(files), total * 1e3,
+            static_cast<unsigned long long>(expected), progressText, etaText);
+        if (run < runs && pauseSeconds > 0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(pauseSeconds));
+        }
+    }
+    cliPrintf("Counts now cover %zu directories\n", executor.getEstimatedDirectories());
+    return 0;
+}
+
+// Crawls a folder without a budget, then with one (--bench-budget), and reports the rates
+// and CPU share each second and over the whole crawl against the limits
+int RunBudgetBenchmark(const std::vector<std::wstring>& args) {
+    std::wstring root = args[1];
+    CrawlBudget budget;
+    for (size_t i = 2; i < args.size(); ++i) {
+        if (!parseBudgetOption(args, i, budget)) {
+            cliPrintf("Unknown budget option: %s\n", wstring_to_string(args[i]).c_str());
+            return 2;
+        }
+    }
+    const double processors = std::max(std::thread::hardware_concurrency(), 1u);
+    auto processCpuNanos = [] {
+        FILETIME created, exited, kernel, user;
+        GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+        ULARGE_INTEGER k, u;
+        k.LowPart = kernel.dwLowDateTime;
+        k.HighPart = kernel.dwHighDateTime;
+        u.LowPart = user.dwLowDateTime;
+        u.HighPart = user.dwHighDateTime;
+        return static_cast<double>(k.QuadPart + u.QuadPart) * 100;
+    };
+
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    for (int run = 0; run < 2; ++run) {
+        SearchOptions options;
+        options.useCatalog = false;
+        options.crawlOnly = true;
+        if (run == 1) options.budget = budget;
+        cliPrintf("%s\n%6s %12s %12s %8s\n", run == 0 ? "No budget" : "With budget", "second", "dirs/s", "entries/s", "CPU");
+
+        auto start = std::chrono::steady_clock::now();
+        double cpuStart = processCpuNanos();
+        executor.search(std::string(), false, false, parseSearchRoots(root), options);
+        auto tick = start;
+        double cpuTick = cpuStart;
+        uint64_t directoriesTick = 0, entriesTick = 0;
+        int second = 0;
+        while (inProgress.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double>(now - tick).count();
+            if (elapsed < 1.0 && inProgress.load()) continue;
+            uint64_t directories = executor.getTraversalCounts().directoriesRead;
+            uint64_t entries = executor.getFilesProcessed() + directories;
+            double cpu = processCpuNanos();
+            cliPrintf("%6d %12.0f %12.0f %7.1f%%\n", ++second, (directories - directoriesTick) / elapsed,
+                (entries - entriesTick) / elapsed, 100 * (cpu - cpuTick) / 1e9 / elapsed / processors);
+            tick = now;
+            cpuTick = cpu;
+            directoriesTick = directories;
+            entriesTick = entries;
+        }
+        executor.waitForCompletion();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t directories = executor.getTraversalCounts().directoriesRead;
+        uint64_t entries = executor.getFilesProcessed() + directories;
+        cliPrintf("%6s %12.0f %12.0f %7.1f%%   %.2f s\n", "all", directories / seconds, entries / seconds,
+            100 * (processCpuNanos() - cpuStart) / 1e9 / seconds / processors, seconds);
+        if (run == 1) {
+            ThrottleCounts counts = executor.getThrottleCounts();
+            cliPrintf("%6s %12.0f %12.0f %7.1f%%\n", "limit", budget.directoriesPerSecond, budget.entriesPerSecond,
+                100 * budget.cpuShare);
+            cliPrintf("Workers waited %.2f s in %llu pauses%s\n", counts.waitedNanos / 1e9,
+                static_cast<unsigned long long>(counts.waits), budget.backgroundPriority ? "; background priority" : "");
+        }
+        cliPrintf("\n");
+    }
+    return 0;
+}
+
+// Crawls the folders and writes them as one host's index shard (--shard) for --federate
+int RunShard(const std::vector<std::wstring>& args) {
+    std::wstring host;
+    for (size_t i = 3; i < args.size(); ++i) {
+        if (args[i] == L"--host" && i + 1 < args.size()) {
+            host = args[++i];
+        } else {
+            cliPrintf("Unknown shard option: %s\n", wstring_to_string(args[i]).c_str());
+            return 2;
+        }
+    }
+    if (host.empty()) {
+        wchar_t computer[256];
+        DWORD length = GetEnvironmentVariableW(L"COMPUTERNAME", computer, 256);
+        host = length > 0 && length < 256 ? std::wstring(computer, length) : L"localhost";
+    }
+
+    std::atomic<bool> inProgress{ false };
+    FastSearch executor(inProgress);
+    SearchOptions options;
+    options.crawlOnly = true;
+    auto start = std::chrono::steady_clock::now();
+    executor.search(std::string(), false, false, parseSearchRoots(args[1]), options);
+    executor.waitForCompletion();
+    double crawlMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    auto catalog = executor.getCatalog();
+    if (!catalog) {
+        cliPrintf("The crawl did not complete\n");
+        return 1;
+    }
+
+    start = std::chrono::steady_clock::now();
+    ShardWriter::Summary summary;
+    std::string error;
+    if (!ShardWriter::write(*catalog, host, args[2], summary, error)) {
+        cliPrintf("%s\n", error.c_str());
+        return 1;
+    }
+    double writeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    cliPrintf("Crawled %zu entries in %.1f ms\n", catalog->size(), crawlMs);
+    cliPrintf("Wrote %s's shard: %llu entries, %llu names, %.1f MB (%.1f bytes/entry, %u filter bits) in %.1f ms\n",
+        wstring_to_string(host).c_str(), static_cast<unsigned long long>(summary.entries),
+        static_cast<unsigned long long>(summary.names), summary.bytes / 1048576.0,
+        summary.bytes / static_cast<double>(std::max<uint64_t>(summary.entries, 1)), summary.filterBits, writeMs);
+    return 0;
+}
+
+// Opens each shard file, and each *.shard file of a folder argument
+bool openShards(const std::vector<std::wstring>& paths, std::vector<std::unique_ptr<ShardIndex>>& shards) {
+    std::vector<std::wstring> files;
+    for (const auto& path : paths) {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(path, ec)) {
+            files.push_back(path);
+            continue;
+        }
+        std::vector<std::wstring> found;
+        for (std::filesystem::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->path().extension() == L".shard") found.push_back(it->path().wstring());
+        }
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    for (const auto& file : files) {
+        auto shard = std::make_unique<ShardIndex>();
+        std::string error;
+        if (!shard->open(file, error)) {
+            cliPrintf("%s\n", error.c_str());
+            return false;
+        }
+        shards.push_back(std::move(shard));
+    }
+    return true;
+}
+
+// Runs one query over many hosts' shards (--federate). Every match streams to stdout or a
+// file, or with --top only the largest or newest; a summary goes to stderr.
+int RunFederatedQuery(const std::vector<std::wstring>& args) {
+    FederatedSearch::Query query;
+    query.pattern = wstring_to_string(args[1]);
+    query.threads = std::max(1u, std::thread::hardware_concurrency());
+    ExportFormat format = ExportFormat::Lines;
+    std::wstring outputPath;
+    std::vector<std::wstring> paths;
+    for (size_t i = 2; i < args.size(); ++i) {
+        if (args[i] == L"--case") {
+            query.caseSensitive = true;
+        } else if (args[i] == L"--regex") {
+            query.useRegex = true;
+        } else if (args[i] == L"--top" && i + 1 < args.size()) {
+            query.top = std::max<size_t>(std::wcstoul(args[++i].c_str(), nullptr, 10), 1);
+        } else if (args[i] == L"--by" && i + 1 < args.size()) {
+            const std::wstring& order = args[++i];
+            if (order == L"size") query.order = FederatedSearch::Order::Largest;
+            else if (order == L"mtime") query.order = FederatedSearch::Order::Newest;
+            else {
+                cliPrintf("Unknown order; use size or mtime\n");
+                return 2;
+            }
+        } else if (args[i] == L"--threads" && i + 1 < args.size()) {
+            query.threads = std::max<size_t>(std::wcstoul(args[++i].c_str(), nullptr, 10), 1);
+        } else if (args[i] == L"--format" && i + 1 < args.size()) {
+            if (!parseExportFormat(args[++i], format, true)) {
+                cliPrintf("Unknown format; use lines or jsonl\n");
+                return 2;
+            }
+        } else if (args[i] == L"--out" && i + 1 < args.size()) {
+            outputPath = args[++i];
+        } else if (args[i].rfind(L"--", 0) == 0) {
+            cliPrintf("Unknown federate option: %s\n", wstring_to_string(args[i]).c_str());
+            return 2;
+        } else {
+            paths.push_back(args[i]);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<ShardIndex>> shards;
+    if (!openShards(paths, shards)) return 1;
+    if (shards.empty()) {
+        cliPrintf("No shards to query\n");
+        return 2;
+    }
+    double openMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    HANDLE output = g_cliOutput;
+    if (!outputPath.empty()) {
+        output = CreateFileW(outputPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+    if (output == nullptr || output == INVALID_HANDLE_VALUE) {
+        cliPrintf("Cannot open output\n");
+        return 1;
+    }
+
+    ShardMatchExporter exporter(output, format);
+    std::vector<FederatedSearch::Match> top;
+    start = std::chrono::steady_clock::now();
+    FederatedSearch::Summary summary = FederatedSearch::run(shards, query, &exporter, top);
+    double queryMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (summary.invalid) {
+        cliPrintf("Invalid regex\n");
+        return 2;
+    }
+    std::vector<std::wstring> topPaths(1);
+    std::vector<ResultInfo> topInfo(1);
+    for (const auto& match : top) {
+        topPaths[0] = match.path;
+        topInfo[0] = match.info;
+        if (!exporter.write(*match.shard, topPaths, topInfo)) break;
+    }
+    exporter.flush();
+    if (!outputPath.empty()) {
+        CloseHandle(output);
+    }
+
+    HANDLE errorOutput = GetStdHandle(STD_ERROR_HANDLE);
+    if (errorOutput != nullptr && errorOutput != INVALID_HANDLE_VALUE) {
+        char text[400];
+        int length = snprintf(text, sizeof(text),
+            "%llu matches in %zu shards (%zu skipped by their manifest); %llu entries scanned in %.1f ms, "
+            "shards opened in %.1f ms%s%s\n",
+            static_cast<unsigned long long>(summary.matches), summary.shards, summary.skipped,
+            static_cast<unsigned long long>(summary.entries), queryMs, openMs,
+            summary.unreadable > 0 || summary.damaged > 0 ? "; some shards are damaged, results incomplete" : "",
+            summary.stopped ? "; output closed, query stopped" : "");
+        DWORD written = 0;
+        WriteFile(errorOutput, text, static_cast<DWORD>(length), &written, nullptr);
+    }
+    if (summary.unreadable > 0 || summary.damaged > 0) return 1;
+    DWORD lastError = exporter.lastError();
+    return !exporter.isBroken() || lastError == ERROR_BROKEN_PIPE || lastError == ERROR_NO_DATA ? 0 : 1;
 }
 
-// Global state
-static ID3D11Device* g_pd3dDevice = nullptr;
-static ID3D11DeviceContext* g_pd3dDeviceContext = nullptr;
-static IDXGISwapChain* g_pSwapChain = nullptr;
-static UINT g_ResizeWidth = 0, g_ResizeHeight = 0;
-static ID3D11RenderTargetView* g_mainRenderTargetView = nullptr;
-static std::unique_ptr<PerformanceMonitor> g_perfMonitor;
-static std::deque<std::string> searchHistory;
-static const size_t MAX_HISTORY = 10;
-static char previewBuffer[4096];
-static bool showPreview = true;
-static float previewPanelWidth = 300.0f;
+// Writes shards of synthetic hosts (--bench-shards) into a folder and checks federated
+// queries over them against a scan of every path, reporting how many shards the manifests
+// skipped and how long each query took
+int RunShardBenchmark(const std::vector<std::wstring>& args) {
+    std::wstring folder = args[1];
+    size_t hostCount = args.size() > 2 ? std::max<size_t>(std::wcstoul(args[2].c_str(), nullptr, 10), 1) : 16;
+    size_t entryCount = args.size() > 3 ? std::max<size_t>(std::wcstoul(args[3].c_str(), nullptr, 10), 16) : 200000;
+    std::error_code ec;
+    std::filesystem::create_directories(folder, ec);
 
-// Forward declarations
-bool CreateDeviceD3D(HWND hWnd);
-void CleanupDeviceD3D();
-void CreateRenderTarget();
-void CleanupRenderTarget();
-LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
+    // Every host shares the common words; each also has words no other host uses
+    static const wchar_t* const COMMON[] = { L"report", L"budget", L"photo", L"backup", L"invoice", L"notes",
+        L"project", L"draft", L"final", L"archive", L"music", L"readme", L"setup", L"config", L"summary", L"data" };
+    static const wchar_t* const EXTENSIONS[] = { L".txt", L".docx", L".jpg", L".log", L".pdf", L".dat", L".xml", L".zip" };
+    const size_t commonCount = sizeof(COMMON) / sizeof(COMMON[0]);
+    const size_t extensionCount = sizeof(EXTENSIONS) / sizeof(EXTENSIONS[0]);
+    const wchar_t separator = static_cast<wchar_t>(std::filesystem::path::preferred_separator);
+    auto hostName = [](size_t host) {
+        wchar_t name[32];
+        swprintf(name, 32, L"host%03zu", host);
+        return std::wstring(name);
+    };
 
-// Helper function to split path into components
-std::vector<std::wstring> splitPath(const std::wstring& path) {
-    std::vector<std::wstring> components;
-    std::wstring current;
-    
-    for (wchar_t c : path) {
-        if (c == L'\\' || c == L'/') {
-            if (!current.empty()) {
-                components.push_back(current);
-                current.clear();
+    std::vector<std::unique_ptr<FileCatalog>> catalogs;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    auto next = [&seed](uint64_t range) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (seed >> 33) % range;
+    };
+    auto start = std::chrono::steady_clock::now();
+    uint64_t shardBytes = 0;
+    std::vector<std::wstring> shardPaths;
+    for (size_t host = 0; host < hostCount; ++host) {
+        std::wstring root = std::wstring(2, separator) + hostName(host) + separator + L"share";
+        auto catalog = std::make_unique<FileCatalog>(std::vector<std::wstring>{ root }, false, false);
+        std::vector<uint32_t> directories{ catalog->addRoot(root) };
+        wchar_t unique[32];
+        swprintf(unique, 32, L"zq%03zuxk", host);
+        // Each directory gets a few subdirectories and files until the host has its entries
+        for (size_t at = 0; at < directories.size() && catalog->size() < entryCount; ++at) {
+            FileCatalog::Batch batch;
+            size_t subdirectories = directories.size() < entryCount / 16 ? 2 + next(3) : 0;
+            for (size_t i = 0; i < subdirectories; ++i) {
+                std::wstring name = std::wstring(COMMON[next(commonCount)]) + std::to_wstring(next(100));
+                batch.add(name, directories[at], true, 0, 0);
+            }
+            size_t files = 4 + next(12);
+            for (size_t i = 0; i < files; ++i) {
+                std::wstring name = next(64) == 0 ? std::wstring(unique) : std::wstring(COMMON[next(commonCount)]);
+                name += L"_" + std::to_wstring(next(1000)) + EXTENSIONS[next(extensionCount)];
+                batch.add(name, directories[at], false, next(1ULL << 30), 130000000000000000LL + static_cast<int64_t>(next(1ULL << 40)));
+            }
+            uint32_t first = catalog->append(batch);
+            for (size_t i = 0; i < subdirectories; ++i) {
+                directories.push_back(first + static_cast<uint32_t>(i));
             }
-        } else {
-            current += c;
         }
+        ShardWriter::Summary summary;
+        std::string error;
+        shardPaths.push_back(folder + separator + hostName(host) + L".shard");
+        if (!ShardWriter::write(*catalog, hostName(host), shardPaths.back(), summary, error)) {
+            cliPrintf("%s\n", error.c_str());
+            return 1;
+        }
+        shardBytes += summary.bytes;
+        catalogs.push_back(std::move(catalog));
     }
-    if (!current.empty()) {
-        components.push_back(current);
+    double writeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uint64_t totalEntries = 0;
+    for (const auto& catalog : catalogs) {
+        totalEntries += catalog->size();
     }
-    return components;
-}
+    cliPrintf("Wrote %zu shards, %llu entries, %.1f MB (%.1f bytes/entry) in %.1f ms\n", hostCount,
+        static_cast<unsigned long long>(totalEntries), shardBytes / 1048576.0,
+        shardBytes / static_cast<double>(std::max<uint64_t>(totalEntries, 1)), writeMs);
 
-// Helper function to format file size
-std::wstring formatFileSize(uintmax_t bytes) {
-    const wchar_t* units[] = { L"B", L"KB", L"MB", L"GB", L"TB" };
-    int unitIndex = 0;
-    double size = static_cast<double>(bytes);
-    
-    while (size >= 1024 && unitIndex < 4) {
-        size /= 1024;
-        unitIndex++;
-    }
-    
-    wchar_t buffer[32];
-    if (unitIndex == 0) {
-        swprintf(buffer, 32, L"%d %ls", static_cast<int>(size), units[unitIndex]);
-    } else {
-        swprintf(buffer, 32, L"%.2f %ls", size, units[unitIndex]);
+    start = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<ShardIndex>> shards;
+    if (!openShards(shardPaths, shards)) return 1;
+    cliPrintf("Opened them in %.1f ms\n\n", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    // Collects every match as "host<TAB>path" to compare with the reference
+    class CollectingSink : public ShardMatchSink {
+    public:
+        std::mutex mtx;
+        std::vector<std::wstring> lines;
+        bool write(const ShardIndex& shard, const std::vector<std::wstring>& paths, const std::vector<ResultInfo>&) override {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const auto& path : paths) {
+                lines.push_back(shard.getHost() + L"\t" + path);
+            }
+            return true;
+        }
+    };
+
+    struct Case {
+        std::wstring pattern;
+        bool useRegex;
+    };
+    std::vector<Case> cases = { { L"report", false }, { L"zq001xk", false }, { L"zq" + std::to_wstring(hostCount + 7) + L"xk", false },
+        { std::wstring(L"0") + separator + L"photo", false }, { L"share" + std::wstring(1, separator) + L"data", false },
+        { L"^final_9\\d\\d\\.pdf$", true }, { L"SETUP_1", false } };
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    bool allMatch = true;
+    cliPrintf("%-22s %9s %8s %10s %10s %10s  %s\n", "Query", "matches", "skipped", "federated", "1 thread", "scan", "check");
+    std::wstring path;
+    for (const auto& test : cases) {
+        std::string pattern = wstring_to_string(test.pattern);
+        NameMatcher matcher(pattern, false, test.useRegex);
+
+        // Reference: the crawl's rule applied to every whole path
+        auto scanStart = std::chrono::steady_clock::now();
+        std::vector<std::wstring> expected;
+        std::vector<uint64_t> expectedSizes;
+        for (size_t host = 0; host < catalogs.size(); ++host) {
+            const FileCatalog& catalog = *catalogs[host];
+            for (uint32_t id = 0; id < catalog.size(); ++id) {
+                if (catalog.isDirectory(id)) continue;
+                catalog.pathOf(id, path);
+                if (matcher.matches(test.useRegex ? std::wstring(catalog.name(id)) : path)) {
+                    expected.push_back(hostName(host) + L"\t" + path);
+                    expectedSizes.push_back(catalog.fileSize(id));
+                }
+            }
+        }
+        double scanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - scanStart).count();
+
+        FederatedSearch::Query query;
+        query.pattern = pattern;
+        query.useRegex = test.useRegex;
+        query.threads = threads;
+        CollectingSink sink;
+        std::vector<FederatedSearch::Match> top;
+        auto queryStart = std::chrono::steady_clock::now();
+        FederatedSearch::Summary summary = FederatedSearch::run(shards, query, &sink, top);
+        double federatedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - queryStart).count();
+
+        CollectingSink single;
+        query.threads = 1;
+        queryStart = std::chrono::steady_clock::now();
+        FederatedSearch::run(shards, query, &single, top);
+        double singleMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - queryStart).count();
+
+        // The top 10 by size must have the reference's 10 largest sizes
+        query.top = 10;
+        FederatedSearch::run(shards, query, nullptr, top);
+        std::sort(expectedSizes.begin(), expectedSizes.end(), std::greater<uint64_t>());
+        expectedSizes.resize(std::min<size_t>(expectedSizes.size(), 10));
+        std::vector<uint64_t> topSizes;
+        for (const auto& match : top) {
+            topSizes.push_back(match.info.size);
+        }
+
+        std::sort(expected.begin(), expected.end());
+        std::sort(sink.lines.begin(), sink.lines.end());
+        bool same = sink.lines == expected && topSizes == expectedSizes && summary.damaged == 0;
+        allMatch &= same;
+        cliPrintf("%-22s %9llu %8zu %8.1fms %8.1fms %8.1fms  %s\n", pattern.c_str(),
+            static_cast<unsigned long long>(summary.matches), summary.skipped, federatedMs, singleMs, scanMs,
+            same ? "OK" : "MISMATCH");
     }
-    return buffer;
+    cliPrintf("\n%s (federated on %zu threads; the scan rebuilds every path in memory)\n",
+        allMatch ? "All queries match the reference" : "Some queries differ from the reference", threads);
+    return allMatch ? 0 : 1;
 }
 
-// Helper function to format last modified time
-std::wstring formatLastModified(const std::filesystem::file_time_type& time) {
-    auto sctp = std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-        time - std::filesystem::file_time_type::clock::now() + std::chrono::system_clock::now());
-    std::time_t tt = std::chrono::system_clock::to_time_t(sctp);
-    std::tm tm;
-    localtime_s(&tm, &tt);
-    wchar_t buffer[32];
-    wcsftime(buffer, 32, L"%Y-%m-%d %H:%M", &tm);
-    return buffer;
+void PrintCommandLineUsage() {
+    cliPrintf(
+        "Usage: FastSearch_Windows.exe [option]\n"
+        "  (no options)            Start the GUI\n"
+        "  --duplicates <folder> [pattern]\n"
+        "                          Find files with identical content (optionally only\n"
+        "                          among names matching pattern)\n"
+        "  --export <folder> <pattern> [--format nul|lines|jsonl|csv] [--size] [--mtime]\n"
+        "           [--case] [--regex] [--archives] [--out <file>] [--max-dirs <n>]\n"
+        "           [--max-entries <n>] [--max-cpu <share>] [--background]\n"
+        "                          Stream results to stdout or a file as they are found\n"
+        "  --aggregate <folder> <pattern> [--by none|ext|dir] [--depth <n>] [--sort files|bytes]\n"
+        "              [--format lines|jsonl] [--case] [--regex] [--archives]\n"
+        "                          Count the matches and their bytes, in total or per\n"
+        "                          extension or folder, without keeping the results\n"
+        "  --daemon <socket> <folder>\n"
+        "                          Keep the folder's catalog in memory and answer queries\n"
+        "                          on a Unix domain socket until Ctrl+C\n"
+        "  --query <socket> <pattern> [--case] [--regex] [--archives] [--refresh] [--info]\n"
+        "          [--in <folders>]\n"
+        "                          Ask a running daemon; results print as they arrive\n"
+        "  --loadtest <socket> [clients] [queries] [--cancel-every <n>] [pattern ...]\n"
+        "                          Concurrent clients each run queries back to back;\n"
+        "                          latency percentiles and queries/s\n"
+        "  --snapshot <folder> <file>\n"
+        "                          Crawl the folder and write a sorted snapshot of it\n"
+        "  --diff <old> <new> [--format lines|jsonl] [--threads <n>] [--out <file>]\n"
+        "                          Stream the entries added, removed or modified between\n"
+        "                          two snapshots\n"
+        "  --shard <folder> <file> [--host <name>]\n"
+        "                          Crawl the folder and write it as one host's index shard\n"
+        "  --federate <pattern> <shard|folder> ... [--case] [--regex] [--top <k>]\n"
+        "             [--by size|mtime] [--threads <n>] [--format lines|jsonl] [--out <file>]\n"
+        "                          Query many hosts' shards at once, skipping shards that\n"
+        "                          cannot match; all matches, or the k largest or newest\n"
+        "  --du <folder> [depth]   Directory sizes down to depth (default 1), hard links\n"
+        "                          counted once, timed against a sequential walk\n"
+        "  --bench-first <folder> <pattern ...>\n"
+        "                          Time to the first, 10th, 100th and 1000th match in FIFO\n"
+        "                          order vs best first, without and with match history\n"
+        "  --bench-estimate <folder> [runs] [--pause <seconds>] [--cache <file>]\n"
+        "                          Progress and ETA error of repeated crawls, estimated from\n"
+        "                          earlier crawls' counts vs from the directory queue\n"
+        "  --bench-budget <folder> [--max-dirs <n>] [--max-entries <n>] [--max-cpu <share>]\n"
+        "                 [--background]\n"
+        "                          Crawl rates and CPU share each second, without and with\n"
+        "                          a budget\n"
+        "  --bench-shards <folder> [hosts] [entries]\n"
+        "                          Write synthetic hosts' shards and check federated queries\n"
+        "                          over them against a scan of every path\n"
+        "  --bench-links <folder>  Directories read and skipped under each link policy\n"
+        "  --bench-match [names]   Matcher correctness checks and mixed-script benchmark\n"
+        "  --bench-preview <folder> [pattern] [count]\n"
+        "                          Preview latency percentiles over the first count files\n"
+        "                          (default 200) and the encodings detected\n"
+        "  --bench-requery <folder> <word>\n"
+        "                          Startup-to-first-result latency of back-to-back queries\n"
+        "                          (each prefix of word), warm executor vs a fresh one\n"
+        "  --bench-trigram <folder> [query ...]\n"
+        "                          Trigram index size and query latency vs a full scan of\n"
+        "                          the folder's names; prefix regex queries with re:\n"
+        "  --bench-catalog <folder> <pattern>\n"
+        "                          Crawl once, then repeat the query from the in-memory\n"
+        "                          catalog: bytes per entry and entries/s per core\n");
 }
 
-// Helper function to load file preview
-void LoadFilePreview(const std::wstring& path) {
-    std::ifstream file(path, std::ios::binary);
-    if (file) {
-        file.read(previewBuffer, sizeof(previewBuffer) - 1);
-        size_t bytesRead = file.gcount();
-        previewBuffer[bytesRead] = '\0';
-    } else {
-        strcpy(previewBuffer, "Cannot load preview for this file type");
-    }
-}
+// Runs a command-line mode if one was requested; returns -1 to start the GUI instead
+int RunCommandLine() {
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (argv == nullptr) return -1;
+    std::vector<std::wstring> args(argv + 1, argv + argc);
+    LocalFree(argv);
 
-// Helper function to save search history
-void SaveSearchHistory() {
-    std::ofstream file("search_history.txt");
-    for (const auto& search : searchHistory) {
-        file << search << std::endl;
+    if (args.empty() || args[0].rfind(L"--", 0) != 0) {
+        return -1;
     }
-}
+    g_cliOutput = AttachCommandLineOutput();
 
-// Helper function to load search history
-void LoadSearchHistory() {
-    std::ifstream file("search_history.txt");
-    std::string line;
-    while (std::getline(file, line) && searchHistory.size() < MAX_HISTORY) {
-        searchHistory.push_front(line);
+    if (args[0] == L"--duplicates" && args.size() > 1) {
+        return RunDuplicateFinder(args[1], args.size() > 2 ? wstring_to_string(args[2]) : std::string());
+    }
+    if (args[0] == L"--export" && args.size() > 2) {
+        return RunExport(args);
+    }
+    if (args[0] == L"--aggregate" && args.size() > 2) {
+        return RunAggregate(args);
+    }
+    if (args[0] == L"--daemon" && args.size() > 2) {
+        return RunDaemon(args[1], args[2]);
+    }
+    if (args[0] == L"--query" && args.size() > 2) {
+        return RunDaemonQuery(args);
+    }
+    if (args[0] == L"--loadtest" && args.size() > 1) {
+        return RunDaemonLoadTest(args);
+    }
+    if (args[0] == L"--snapshot" && args.size() > 2) {
+        return RunSnapshot(args[1], args[2]);
+    }
+    if (args[0] == L"--diff" && args.size() > 2) {
+        return RunSnapshotDiff(args);
+    }
+    if (args[0] == L"--shard" && args.size() > 2) {
+        return RunShard(args);
+    }
+    if (args[0] == L"--federate" && args.size() > 2) {
+        return RunFederatedQuery(args);
+    }
+    if (args[0] == L"--bench-shards" && args.size() > 1) {
+        return RunShardBenchmark(args);
+    }
+    if (args[0] == L"--bench-first" && args.size() > 2) {
+        std::vector<std::string> patterns;
+        for (size_t i = 2; i < args.size(); ++i) {
+            patterns.push_back(wstring_to_string(args[i]));
+        }
+        return RunBestFirstBenchmark(args[1], patterns);
+    }
+    if (args[0] == L"--bench-estimate" && args.size() > 1) {
+        return RunEstimateBenchmark(args);
+    }
+    if (args[0] == L"--bench-budget" && args.size() > 1) {
+        return RunBudgetBenchmark(args);
+    }
+    if (args[0] == L"--bench-links" && args.size() > 1) {
+        return RunTraversalBenchmark(args[1]);
+    }
+    if (args[0] == L"--du" && args.size() > 1) {
+        uint32_t depth = args.size() > 2 ? static_cast<uint32_t>(std::wcstoul(args[2].c_str(), nullptr, 10)) : 1;
+        return RunDirectorySizes(args[1], depth);
+    }
+    if (args[0] == L"--bench-match") {
+        size_t count = args.size() > 1 ? std::wcstoul(args[1].c_str(), nullptr, 10) : 200000;
+        return RunMatcherBenchmark(std::max<size_t>(count, 1));
+    }
+    if (args[0] == L"--bench-preview" && args.size() > 1) {
+        size_t count = args.size() > 3 ? std::wcstoul(args[3].c_str(), nullptr, 10) : 200;
+        return RunPreviewBenchmark(args[1], args.size() > 2 ? wstring_to_string(args[2]) : std::string(),
+            std::max<size_t>(count, 1));
+    }
+    if (args[0] == L"--bench-requery" && args.size() > 2) {
+        return RunRequeryBenchmark(args[1], wstring_to_string(args[2]));
     }
+    if (args[0] == L"--bench-catalog" && args.size() > 2) {
+        return RunCatalogBenchmark(args[1], wstring_to_string(args[2]));
+    }
+    if (args[0] == L"--bench-trigram" && args.size() > 1) {
+        std::vector<std::string> queries;
+        for (size_t i = 2; i < args.size(); ++i) {
+            queries.push_back(wstring_to_string(args[i]));
+        }
+        return RunTrigramBenchmark(args[1], queries);
+    }
+
+    PrintCommandLineUsage();
+    return 2;
 }
 
-// Helper function to add to search history
-void AddToSearchHistory(const std::string& pattern) {
-    // Remove if already exists
-    auto it = std::find(searchHistory.begin(), searchHistory.end(), pattern);
-    if (it != searchHistory.end()) {
-        searchHistory.erase(it);
-    }
-    
-    // Add to front
-    searchHistory.push_front(pattern);
-    
-    // Keep only MAX_HISTORY items
-    if (searchHistory.size() > MAX_HISTORY) {
-        searchHistory.pop_back();
+// Where the GUI keeps its progress estimates between runs
+std::wstring defaultEstimatesPath() {
+    wchar_t base[MAX_PATH];
+    DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", base, MAX_PATH);
+    std::wstring directory;
+    if (length > 0 && length < MAX_PATH) {
+        directory.assign(base, length);
+        FileCatalog::joinPath(directory, L"FastSearch");
+        CreateDirectoryW(directory.c_str(), nullptr);
+    } else {
+        length = GetTempPathW(MAX_PATH, base);
+        directory.assign(base, length);
     }
-    
-    SaveSearchHistory();
+    FileCatalog::joinPath(directory, L"crawl_estimates.bin");
+    return directory;
 }
 
 // Main code
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow) {
+    // Command-line modes run headless and never create the window
+    int cliResult = RunCommandLine();
+    if (cliResult >= 0) {
+        return cliResult;
+    }
+
     // Initialize COM for the folder browser
     CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
     
@@ -605,17 +10113,57 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 
     // State
     std::atomic<bool> searchInProgress{ false };
-    std::unique_ptr<FastSearch> searcher;
+    // One executor for the whole session, so its workers stay warm between searches
+    std::unique_ptr<FastSearch> searcher = std::make_unique<FastSearch>(searchInProgress);
+    searcher->setEstimatesFile(defaultEstimatesPath());
     static char searchPattern[256] = "";
     static char folderPath[1024] = "C:\\";
     static bool caseSensitive = false;
     static bool useRegex = false;
+    static bool searchAsYouType = false;
+    static bool useCatalog = true;
+    static bool folderSizes = false;
+    static bool followLinks = false;
+    static bool oneFileSystem = false;
+    static bool boundedFrontier = false;
+    static bool searchArchives = false;
+    static bool bestFirst = true;
+    DuplicateFinder duplicateFinder;
+    bool showDuplicates = false;
     std::vector<std::wstring> currentResults;
+    ResultTree resultTree;  // currentResults as the sorted tree the table shows
+    std::vector<std::optional<DirectorySize>> currentFolderSizes;  // Of resultTree.folderKeys()
     float progress = 0.0f;
     bool needsUpdate = false;
     std::wstring selectedPath;
     bool showPreview = true;
     float previewPanelWidth = 300.0f;
+    PreviewService previewService;
+    std::wstring previewPath;  // The file shown in the preview panel
+    PreviewService::Mode previewMode = PreviewService::Mode::Text;
+    uint64_t previewPage = 0;
+    auto showPreviewPage = [&](PreviewService::Mode mode, uint64_t page, bool reload = false) {
+        previewMode = mode;
+        previewPage = page;
+        previewService.show(previewPath, mode, page, reload);
+    };
+
+    auto startSearch = [&]() {
+        SearchOptions options;
+        options.useCatalog = useCatalog;
+        options.directorySizes = folderSizes;
+        options.followLinks = followLinks;
+        options.oneFileSystem = oneFileSystem;
+        options.boundedFrontier = boundedFrontier;
+        options.archives = searchArchives;
+        options.bestFirst = bestFirst;
+        searcher->search(searchPattern, caseSensitive, useRegex, parseSearchRoots(string_to_wstring(folderPath)), options);
+        progress = 0.0f;
+        currentResults.clear();
+        resultTree.clear();
+        currentFolderSizes.clear();
+        needsUpdate = true;
+    };
 
     // Main loop
     bool done = false;
@@ -668,8 +10216,11 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
             ImGui::SetTooltip("View recent searches");
         }
 
-        ImGui::InputText("Search Pattern", searchPattern, IM_ARRAYSIZE(searchPattern));
+        bool patternEdited = ImGui::InputText("Search Pattern", searchPattern, IM_ARRAYSIZE(searchPattern));
         ImGui::InputText("Folder Path", folderPath, IM_ARRAYSIZE(folderPath));
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Separate several folders with ';' to search them at once");
+        }
         ImGui::SameLine();
         if (ImGui::Button("Browse")) {
             std::string selected_path;
@@ -677,6 +10228,20 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                 strncpy_s(folderPath, selected_path.c_str(), sizeof(folderPath) - 1);
             }
         }
+        ImGui::SameLine();
+        if (ImGui::Button("Add")) {
+            // Append another root instead of replacing the current one
+            std::string selected_path;
+            if (BrowseFolder(selected_path)) {
+                std::string combined = folderPath;
+                if (!combined.empty()) combined += ";";
+                combined += selected_path;
+                strncpy_s(folderPath, combined.c_str(), sizeof(folderPath) - 1);
+            }
+        }
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Add another folder to search");
+        }
 
         ImGui::Checkbox("Case Sensitive", &caseSensitive);
         if (ImGui::IsItemHovered()) {
@@ -689,34 +10254,135 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
             ImGui::SetTooltip("Use regular expressions in search pattern");
         }
 
+        ImGui::SameLine();
+        ImGui::Checkbox("Search As You Type", &searchAsYouType);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Restart the search on every edit of the pattern");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Use Catalog", &useCatalog);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Answer repeat searches of the same folders from memory (%zu entries cached)",
+                searcher->getCatalogEntries());
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Folder Sizes", &folderSizes);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Total every folder's size on disk while searching (hard links counted once)");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Follow Links", &followLinks);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Search inside symlinked and junctioned folders; a folder reached twice is still read once");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("One Volume", &oneFileSystem);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Never leave the volume each search folder is on");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Bounded Memory", &boundedFrontier);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Each thread crawls depth-first and only hands spare folders to idle threads, so very wide trees keep few folders pending");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Archives", &searchArchives);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Also match the files inside .zip, .jar, .tar and .tar.gz archives, shown as archive!member");
+        }
+
+        ImGui::SameLine();
+        ImGui::Checkbox("Likely First", &bestFirst);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Read folders whose names resemble the search, or where earlier searches found matches, before the rest; the search still covers everything");
+        }
+        if (searchAsYouType && patternEdited && strlen(folderPath) > 0 && strlen(searchPattern) > 0) {
+            startSearch();
+        }
+
         // Search button and progress
         if (!searchInProgress) {
             if (ImGui::Button("Search")) {
                 if (strlen(folderPath) > 0 && strlen(searchPattern) > 0) {
                     AddToSearchHistory(std::string(searchPattern));
-                    searcher = std::make_unique<FastSearch>(searchPattern, caseSensitive, useRegex, searchInProgress);
-                    searcher->search(string_to_wstring(folderPath));
-                    searchInProgress = true;
-                    progress = 0.0f;
-                    currentResults.clear();
-                    needsUpdate = true;
+                    startSearch();
+                }
+            }
+#if FASTSEARCH_INSTRUMENTATION
+            if (searcher->hasQuery()) {
+                // Workers may still be leaving a stopped search; its stats are read once they have
+                std::shared_ptr<const SearchStats> stats = searcher->getStats();
+                ImGui::SameLine();
+                ImGui::BeginDisabled(!stats);
+                if (ImGui::Button("Export Stats")) {
+                    writeTextFile("search_stats.json", stats->toJson());
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Write per-thread counters and phase timings to search_stats.json");
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Export Trace")) {
+                    writeTextFile("search_trace.json", stats->toChromeTrace());
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Write per-thread spans to search_trace.json (open in chrome://tracing)");
+                }
+                ImGui::EndDisabled();
+
+                if (ImGui::CollapsingHeader("Search Statistics")) {
+                    if (stats) {
+                        ThreadStats totals = stats->totals();
+                        ImGui::Text("Workers: %zu | Directories: %llu | Files: %llu | Errors: %llu",
+                            stats->threadCount(),
+                            static_cast<unsigned long long>(totals.directories),
+                            static_cast<unsigned long long>(totals.files),
+                            static_cast<unsigned long long>(totals.errors));
+                        for (size_t p = 0; p < ThreadStats::PHASE_COUNT; ++p) {
+                            ImGui::BulletText("%-12s %10.1f ms  (%llu calls)",
+                                searchPhaseName(static_cast<SearchPhase>(p)),
+                                totals.phaseNanos[p] / 1e6,
+                                static_cast<unsigned long long>(totals.phaseCalls[p]));
+                        }
+                    } else {
+                        // Live counters until the workers are done with the per-thread ones
+                        ImGui::Text("Directories: %llu | Files: %zu | Matches: %zu (workers finishing)",
+                            static_cast<unsigned long long>(searcher->getTraversalCounts().directoriesRead),
+                            searcher->getFilesProcessed(), searcher->getMatchesFound());
+                    }
+                }
+            }
+#endif
+            if (!currentResults.empty()) {
+                ImGui::SameLine();
+                if (ImGui::Button("Find Duplicates")) {
+                    duplicateFinder.start(currentResults);
+                    showDuplicates = true;
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Look for files with identical content among the results");
                 }
             }
         } else {
             if (ImGui::Button("Stop")) {
-                searchInProgress = false;
+                searcher->cancel();
             }
             
             // Show search status and timing
-            if (searcher) {
+            if (searcher->hasQuery()) {
                 size_t filesProcessed = searcher->getFilesProcessed();
                 size_t matchesFound = searcher->getMatchesFound();
-                size_t queueSize = searcher->getQueueSize();
+                FastSearch::ProgressEstimate estimate = searcher->getProgress();
                 
-                // Calculate more accurate progress based on files processed and remaining queue
-                if (filesProcessed > 0) {
-                    float estimatedProgress = static_cast<float>(filesProcessed) / (filesProcessed + queueSize);
-                    progress = estimatedProgress;
+                // Files left are estimated from what earlier crawls counted below the queued folders
+                if (estimate.filesProcessed > 0) {
+                    progress = static_cast<float>(estimate.filesProcessed) /
+                        static_cast<float>(estimate.filesProcessed + estimate.filesRemaining);
                 }
                 
                 // Show progress bar
@@ -724,7 +10390,13 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                 
                 // Update results periodically
                 if (needsUpdate || !searcher->isSearching()) {
-                    currentResults = searcher->getResults();
+                    std::vector<std::wstring> newResults;
+                    std::vector<ResultInfo> newInfo;
+                    searcher->getResultsSince(currentResults.size(), newResults, newInfo);
+                    currentResults.insert(currentResults.end(), newResults.begin(), newResults.end());
+                    resultTree.add(newResults, newInfo);
+                    searcher->getDirectorySizes(resultTree.folderKeys(), currentFolderSizes);
+                    resultTree.setFolderSizes(currentFolderSizes);
                     needsUpdate = false;
                 }
                 
@@ -736,10 +10408,14 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                     auto elapsedSeconds = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - searcher->getStartTime()).count() / 1000.0f;
                     ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(50, 255, 50, 255));  // Green color
                     ImGui::SetWindowFontScale(1.2f);  // Make text 20% larger
-                    ImGui::Text("Search completed in %.2f seconds (%.1f files/sec)", 
-                        elapsedSeconds, filesProcessed / elapsedSeconds);
+                    ImGui::Text("Search completed in %.2f seconds (%.1f files/sec)%s", 
+                        elapsedSeconds, filesProcessed / elapsedSeconds,
+                        searcher->isCatalogScan() ? " from catalog" : "");
                     ImGui::SetWindowFontScale(1.0f);  // Reset font scale
                     ImGui::PopStyleColor();
+                    if (searcher->getFirstResultNs() >= 0) {
+                        ImGui::Text("First result after %.1f ms", searcher->getFirstResultNs() / 1e6);
+                    }
                 } else {
                     needsUpdate = (ImGui::GetFrameCount() % 30) == 0; // Update every 30 frames
                     
@@ -750,12 +10426,17 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                     
                     // Show current speed
                     ImGui::Text("Speed: %.1f files/sec", filesPerSecond);
+                    for (const auto& pool : searcher->getPoolStatus()) {
+                        ImGui::Text("%s [%s]: %d workers (%d-%d), %zu queued, %zu root(s)",
+                            pool.mountPoint.c_str(), storageKindName(pool.kind), pool.activeWorkers,
+                            pool.minWorkers, pool.maxWorkers, pool.queueSize, pool.rootCount);
+                    }
                     
-                    // Show total files discovered so far
-                    ImGui::Text("Total files discovered: %zu", filesProcessed + queueSize);
-                    
-                    // Estimate remaining time based on actual queue size
-                    float estimatedRemainingSeconds = queueSize / filesPerSecond;
+                    // Files expected in total, and the time to read the rest at the current speed
+                    ImGui::Text("Files expected: %llu%s",
+                        static_cast<unsigned long long>(estimate.filesProcessed + estimate.filesRemaining),
+                        estimate.fromCounts ? " (from earlier crawls)" : " (rough; some folders are new)");
+                    float estimatedRemainingSeconds = estimate.filesRemaining / std::max(filesPerSecond, 1.0f);
                     ImGui::Text("ETA: %.1f seconds", estimatedRemainingSeconds);
                 }
                 
@@ -764,6 +10445,50 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
             }
         }
 
+        // Duplicate groups among the results, with what each stage had to read
+        if (showDuplicates && ImGui::CollapsingHeader("Duplicates", ImGuiTreeNodeFlags_DefaultOpen)) {
+            DuplicateFinder::Report report = duplicateFinder.getReport();
+            if (duplicateFinder.isRunning()) {
+                ImGui::SameLine();
+                ImGui::Text("(stage %zu of 3...)", report.stages.size() + 1);
+                ImGui::SameLine();
+                if (ImGui::SmallButton("Cancel")) {
+                    duplicateFinder.cancel();
+                }
+            }
+            ImGui::Text("%zu files, %s total, %s read", report.files,
+                wstring_to_string(formatFileSize(report.totalBytes)).c_str(),
+                wstring_to_string(formatFileSize(report.bytesRead)).c_str());
+            for (const auto& stage : report.stages) {
+                ImGui::BulletText("%-10s %zu -> %zu files, %s read, %.1f ms (%.1f MB/s)", stage.name.c_str(),
+                    stage.filesIn, stage.filesOut, wstring_to_string(formatFileSize(stage.bytesRead)).c_str(),
+                    stage.seconds * 1e3, stage.bytesRead / 1e6 / std::max(stage.seconds, 1e-9));
+            }
+            if (!duplicateFinder.isRunning()) {
+                ImGui::Text("%zu groups, %s wasted (%zu hard links counted once)", report.groups.size(),
+                    wstring_to_string(formatFileSize(report.wastedBytes)).c_str(), report.hardLinksSkipped);
+                for (size_t i = 0; i < report.groups.size(); ++i) {
+                    const auto& group = report.groups[i];
+                    ImGui::PushID(static_cast<int>(i));
+                    if (ImGui::TreeNode("group", "%zu copies of %s", group.paths.size(),
+                            wstring_to_string(formatFileSize(group.size)).c_str())) {
+                        for (const auto& path : group.paths) {
+                            ImGui::TextUnformatted(wstring_to_string(path).c_str());
+                        }
+                        ImGui::TreePop();
+                    }
+                    ImGui::PopID();
+                }
+            }
+        }
+
+        // Worker-count decisions made by the concurrency controller
+        if (searcher->hasQuery() && ImGui::CollapsingHeader("Concurrency Controller")) {
+            for (const auto& event : searcher->getEvents()) {
+                ImGui::TextUnformatted(event.c_str());
+            }
+        }
+
         // Results list with proper styling
         if (ImGui::BeginTable("MainLayout", 2, ImGuiTableFlags_Resizable)) {
             ImGui::TableSetupColumn("Tree", ImGuiTableColumnFlags_WidthStretch);
@@ -772,148 +10497,55 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
             ImGui::TableNextColumn();
             // Original tree rendering code here
             if (ImGui::BeginChild("Results", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar)) {
-                static ImGuiTableFlags flags = ImGuiTableFlags_BordersV | ImGuiTableFlags_BordersOuterH | ImGuiTableFlags_Resizable | ImGuiTableFlags_RowBg;
+                static ImGuiTableFlags flags = ImGuiTableFlags_BordersV | ImGuiTableFlags_BordersOuterH | ImGuiTableFlags_Resizable | ImGuiTableFlags_RowBg | ImGuiTableFlags_Sortable;
                 
                 // Global expansion state map
                 static std::map<std::wstring, bool> treeExpansionState;
 
-                // Create a tree structure from paths
-                struct TreeNode {
-                    std::wstring name;
-                    std::wstring fullPath;
-                    bool isFile;
-                    uintmax_t fileSize;
-                    std::filesystem::file_time_type lastModified;
-                    std::map<std::wstring, std::unique_ptr<TreeNode>> children;
-
-                    // Recursively collapse/expand all children
-                    void setExpandState(bool expand) {
-                        if (!isFile) {
-                            treeExpansionState[fullPath] = expand;
-                            for (auto& [name, child] : children) {
-                                if (!child->isFile) {
-                                    child->setExpandState(expand);
-                                }
-                            }
-                        }
-                    }
-
-                    // Check if this node has any subdirectories
-                    bool hasSubdirectories() const {
-                        for (const auto& [name, child] : children) {
-                            if (!child->isFile) return true;
+                // Expand or collapse a directory and every directory below it
+                std::function<void(const ResultTree::Node&, bool)> setExpandState = [&](const ResultTree::Node& node, bool expand) {
+                    treeExpansionState[node.fullPath] = expand;
+                    for (const ResultTree::Node* child : node.children) {
+                        if (!child->isFile) {
+                            setExpandState(*child, expand);
                         }
-                        return false;
-                    }
-
-                    // Get expansion state
-                    bool getExpandState() const {
-                        if (isFile) return false;
-                        auto it = treeExpansionState.find(fullPath);
-                        return it != treeExpansionState.end() ? it->second : false;
                     }
                 };
-
-                // Build tree from results
-                TreeNode root;
-                root.name = L"";
-                root.isFile = false;
-
-                for (const auto& result : currentResults) {
-                    auto components = splitPath(result);
-                    TreeNode* current = &root;
-                    std::wstring currentPath;
-
-                    for (size_t i = 0; i < components.size(); ++i) {
-                        const auto& comp = components[i];
-                        if (!currentPath.empty()) {
-                            currentPath += L"\\";
-                        }
-                        currentPath += comp;
-
-                        if (current->children.find(comp) == current->children.end()) {
-                            auto newNode = std::make_unique<TreeNode>();
-                            newNode->name = comp;
-                            newNode->fullPath = currentPath;
-                            newNode->isFile = (i == components.size() - 1);
-                            
-                            // Get file info if it's a file
-                            if (newNode->isFile) {
-                                std::error_code ec;
-                                auto fileStatus = std::filesystem::status(currentPath, ec);
-                                if (!ec) {
-                                    newNode->fileSize = std::filesystem::file_size(currentPath, ec);
-                                    newNode->lastModified = std::filesystem::last_write_time(currentPath, ec);
-                                }
-                            }
-                            
-                            current->children[comp] = std::move(newNode);
-                        }
-                        current = current->children[comp].get();
-                    }
-                }
-
-                // Sort function for tree nodes
-                auto sortNodes = [](const std::pair<std::wstring, std::unique_ptr<TreeNode>>& a,
-                                  const std::pair<std::wstring, std::unique_ptr<TreeNode>>& b) {
-                    // Directories come before files
-                    if (!a.second->isFile && b.second->isFile) return true;
-                    if (a.second->isFile && !b.second->isFile) return false;
-                    
-                    // Case-insensitive string comparison
-                    return _wcsicmp(a.first.c_str(), b.first.c_str()) < 0;
+                auto getExpandState = [&](const ResultTree::Node& node) {
+                    auto it = treeExpansionState.find(node.fullPath);
+                    return it != treeExpansionState.end() && it->second;
                 };
-
-                // Function to sort tree recursively
-                std::function<void(TreeNode&)> sortTree = [&](TreeNode& node) {
-                    // Convert map to vector for sorting
-                    std::vector<std::pair<std::wstring, std::unique_ptr<TreeNode>>> sorted;
-                    for (auto& pair : node.children) {
-                        sorted.push_back(std::make_pair(pair.first, std::move(pair.second)));
-                    }
-                    node.children.clear();
-                    
-                    // Sort nodes
-                    std::sort(sorted.begin(), sorted.end(), sortNodes);
-                    
-                    // Rebuild map and recurse
-                    for (auto& pair : sorted) {
-                        // Recursively sort children
-                        sortTree(*pair.second);
-                        node.children[pair.first] = std::move(pair.second);
-                    }
+                // Directories sort first, so any subdirectory is the first child
+                auto hasSubdirectories = [](const ResultTree::Node& node) {
+                    return !node.children.empty() && !node.children.front()->isFile;
                 };
 
-                // Sort the entire tree
-                sortTree(root);
-
-                if (ImGui::BeginTable("tree_table", 4, flags)) {
-                    ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_NoHide | ImGuiTableColumnFlags_WidthStretch);
-                    ImGui::TableSetupColumn("Size", ImGuiTableColumnFlags_WidthFixed, 100.0f);
-                    ImGui::TableSetupColumn("Items", ImGuiTableColumnFlags_WidthFixed, 80.0f);
-                    ImGui::TableSetupColumn("Modified", ImGuiTableColumnFlags_WidthFixed, 150.0f);
+                if (ImGui::BeginTable("tree_table", 5, flags)) {
+                    ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_NoHide | ImGuiTableColumnFlags_WidthStretch | ImGuiTableColumnFlags_DefaultSort);
+                    ImGui::TableSetupColumn("Type", ImGuiTableColumnFlags_WidthFixed, 60.0f);
+                    ImGui::TableSetupColumn("Size", ImGuiTableColumnFlags_WidthFixed | ImGuiTableColumnFlags_PreferSortDescending, 100.0f);
+                    ImGui::TableSetupColumn("Items", ImGuiTableColumnFlags_WidthFixed | ImGuiTableColumnFlags_NoSort, 80.0f);
+                    ImGui::TableSetupColumn("Modified", ImGuiTableColumnFlags_WidthFixed | ImGuiTableColumnFlags_PreferSortDescending, 150.0f);
                     ImGui::TableHeadersRow();
 
-                    // Function to count items in a directory
-                    std::function<size_t(const TreeNode&)> countItems = [&](const TreeNode& node) {
-                        size_t count = 0;
-                        for (const auto& [name, child] : node.children) {
-                            count++;
-                            if (!child->isFile) {
-                                count += countItems(*child);
-                            }
+                    // Every level stays sorted by the clicked column; only a new column re-sorts
+                    if (const ImGuiTableSortSpecs* sortSpecs = ImGui::TableGetSortSpecs()) {
+                        if (sortSpecs->SpecsCount > 0) {
+                            static const ResultTree::Order columnOrder[] = { ResultTree::Order::Name,
+                                ResultTree::Order::Extension, ResultTree::Order::Size, ResultTree::Order::Name,
+                                ResultTree::Order::Modified };
+                            resultTree.setOrder(columnOrder[sortSpecs->Specs[0].ColumnIndex],
+                                sortSpecs->Specs[0].SortDirection == ImGuiSortDirection_Descending);
                         }
-                        return count;
-                    };
+                    }
 
                     // Function to recursively render tree
-                    std::function<void(TreeNode&, int)> renderTree;
+                    std::function<void(const ResultTree::Node&, int)> renderTree;
                     int currentRow = 0;
-                    renderTree = [&](TreeNode& node, int depth) {
+                    renderTree = [&](const ResultTree::Node& node, int depth) {
                         static int hoveredRow = -1;
-                        static std::wstring selectedPath;
                         
-                        for (auto& [name, child] : node.children) {
+                        for (const ResultTree::Node* child : node.children) {
                             ImGui::TableNextRow();
                             ImGui::TableNextColumn();
                             
@@ -947,6 +10579,10 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 
                             bool isOpen = false;
                             if (child->isFile) {
+                                // Archive members can't be opened on their own; their archive is opened instead
+                                std::wstring_view archive = containingArchive(child->fullPath);
+                                const std::wstring openPath = archive.empty() ? child->fullPath : std::wstring(archive);
+
                                 // Files are selectable but not expandable
                                 ImGui::PushStyleColor(ImGuiCol_Header, ImVec4(0.3f, 0.3f, 0.3f, 0.5f));
                                 ImGui::PushStyleColor(ImGuiCol_HeaderHovered, ImVec4(0.4f, 0.4f, 0.4f, 0.5f));
@@ -954,8 +10590,12 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                                 if (ImGui::Selectable(wstring_to_string(child->name).c_str(), isSelected, 
                                     ImGuiSelectableFlags_AllowDoubleClick | ImGuiSelectableFlags_SpanAllColumns)) {
                                     selectedPath = child->fullPath;
+                                    if (previewPath != child->fullPath) {
+                                        previewPath = child->fullPath;
+                                        showPreviewPage(previewMode, 0);
+                                    }
                                     if (ImGui::IsMouseDoubleClicked(0)) {
-                                        ShellExecuteW(NULL, L"open", child->fullPath.c_str(), NULL, NULL, SW_SHOWNORMAL);
+                                        ShellExecuteW(NULL, L"open", openPath.c_str(), NULL, NULL, SW_SHOWNORMAL);
                                     }
                                 }
                                 
@@ -963,12 +10603,12 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                                 
                                 // Context menu for files
                                 if (ImGui::BeginPopupContextItem()) {
-                                    if (ImGui::MenuItem("Open", "Double-click")) {
-                                        ShellExecuteW(NULL, L"open", child->fullPath.c_str(), NULL, NULL, SW_SHOWNORMAL);
+                                    if (ImGui::MenuItem(archive.empty() ? "Open" : "Open Archive", "Double-click")) {
+                                        ShellExecuteW(NULL, L"open", openPath.c_str(), NULL, NULL, SW_SHOWNORMAL);
                                     }
                                     if (ImGui::MenuItem("Open Containing Folder", "Enter")) {
                                         ShellExecuteW(NULL, L"open", L"explorer.exe",
-                                            (L"/select,\"" + child->fullPath + L"\"").c_str(),
+                                            (L"/select,\"" + openPath + L"\"").c_str(),
                                             NULL, SW_SHOWNORMAL);
                                     }
                                     if (ImGui::MenuItem("Copy Path", "Ctrl+C")) {
@@ -996,14 +10636,13 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                                                      ImGuiTreeNodeFlags_OpenOnDoubleClick | 
                                                      ImGuiTreeNodeFlags_SpanFullWidth;
                                 
-                                bool wasExpanded = child->getExpandState();
+                                bool wasExpanded = getExpandState(*child);
                                 if (wasExpanded) {
                                     nodeFlags |= ImGuiTreeNodeFlags_DefaultOpen;
                                 }
 
                                 // Add item count to directory name
-                                size_t itemCount = countItems(*child);
-                                std::string displayName = wstring_to_string(child->name) + " (" + std::to_string(itemCount) + ")";
+                                std::string displayName = wstring_to_string(child->name) + " (" + std::to_string(child->itemCount) + ")";
                                 
                                 isOpen = ImGui::TreeNodeEx(displayName.c_str(), nodeFlags);
                                 
@@ -1013,7 +10652,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                                 
                                 // Update expansion state only if it changed
                                 if (isOpen != wasExpanded) {
-                                    child->setExpandState(isOpen);
+                                    setExpandState(*child, isOpen);
                                 }
                                 
                                 // Context menu for directories
@@ -1030,14 +10669,14 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                                     }
                                     
                                     // Only show expand/collapse options if there are subdirectories
-                                    if (child->hasSubdirectories()) {
+                                    if (hasSubdirectories(*child)) {
                                         ImGui::Separator();
                                         if (ImGui::MenuItem("Expand All", "Ctrl+E")) {
-                                            child->setExpandState(true);
+                                            setExpandState(*child, true);
                                             ImGui::SetNextItemOpen(true);
                                         }
                                         if (ImGui::MenuItem("Collapse All", "Ctrl+W")) {
-                                            child->setExpandState(false);
+                                            setExpandState(*child, false);
                                             ImGui::SetNextItemOpen(false);
                                         }
                                     }
@@ -1046,23 +10685,33 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                             }
                             ImGui::PopStyleColor();
 
-                            // Show file size in second column
+                            // Show the extension in the second column
                             ImGui::TableNextColumn();
-                            if (child->isFile) {
+                            if (child->isFile && child->extension < child->name.size()) {
+                                ImGui::TextUnformatted(wstring_to_string(child->name.substr(child->extension + 1)).c_str());
+                            }
+
+                            // Show file size in third column
+                            ImGui::TableNextColumn();
+                            if (child->isFile || child->hasFolderSize) {
                                 ImGui::TextUnformatted(wstring_to_string(formatFileSize(child->fileSize)).c_str());
                             }
+                            if (child->hasFolderSize && ImGui::IsItemHovered()) {
+                                const DirectorySize& size = child->folderSize;
+                                ImGui::SetTooltip("%llu files in %llu folders on disk",
+                                    static_cast<unsigned long long>(size.files), static_cast<unsigned long long>(size.directories));
+                            }
 
-                            // Show item count in third column
+                            // Show item count in fourth column
                             ImGui::TableNextColumn();
                             if (!child->isFile) {
-                                size_t itemCount = countItems(*child);
-                                ImGui::Text("%zu", itemCount);
+                                ImGui::Text("%zu", child->itemCount);
                             }
 
-                            // Show last modified date in fourth column
+                            // Show last modified date in fifth column
                             ImGui::TableNextColumn();
                             if (child->isFile) {
-                                ImGui::TextUnformatted(wstring_to_string(formatLastModified(child->lastModified)).c_str());
+                                ImGui::TextUnformatted(wstring_to_string(formatLastModified(child->modified)).c_str());
                             }
 
                             if (isOpen) {
@@ -1080,28 +10729,84 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
                     };
 
                     // Render the tree
-                    renderTree(root, 0);
+                    renderTree(resultTree.top(), 0);
                     ImGui::EndTable();
                 }
 
                 ImGui::EndChild();
             }
 
-            // Add preview panel
-            // ImGui::TableNextColumn();
-            // if (showPreview) {
-            //     if (ImGui::BeginChild("Preview", ImVec2(0, 0), true)) {
-            //         if (selectedPath.empty()) {
-            //             ImGui::TextWrapped("Select a file to preview its contents");
-            //         } else {
-            //             ImGui::Text("Preview: %ls", selectedPath.c_str());
-            //             ImGui::Separator();
-            //             ImGui::TextWrapped("%s", previewBuffer);
-            //         }
-            //     }
-            //     ImGui::EndChild();
-            // }
-            
+            // Preview panel; pages load on the preview thread, so a slow file never blocks a frame
+            ImGui::TableNextColumn();
+            if (showPreview) {
+                if (ImGui::BeginChild("Preview", ImVec2(0, 0), true)) {
+                    if (previewPath.empty()) {
+                        ImGui::TextWrapped("Select a file to preview its contents");
+                    } else {
+                        std::shared_ptr<const PreviewService::Preview> preview = previewService.get();
+                        ImGui::TextWrapped("Preview: %s", wstring_to_string(previewPath).c_str());
+
+                        bool hex = previewMode == PreviewService::Mode::Hex;
+                        if (ImGui::Checkbox("Hex", &hex)) {
+                            showPreviewPage(hex ? PreviewService::Mode::Hex : PreviewService::Mode::Text, 0);
+                        }
+                        ImGui::SameLine();
+                        if (ImGui::Button("Head")) {
+                            showPreviewPage(previewMode, 0);
+                        }
+                        ImGui::SameLine();
+                        if (ImGui::Button("Tail")) {
+                            showPreviewPage(previewMode, PreviewService::LAST_PAGE);
+                        }
+                        if (preview) {
+                            ImGui::SameLine();
+                            ImGui::BeginDisabled(preview->page == 0);
+                            if (ImGui::Button("<")) {
+                                showPreviewPage(previewMode, preview->page - 1);
+                            }
+                            ImGui::EndDisabled();
+                            ImGui::SameLine();
+                            ImGui::BeginDisabled(preview->page + 1 >= preview->pageCount);
+                            if (ImGui::Button(">")) {
+                                showPreviewPage(previewMode, preview->page + 1);
+                            }
+                            ImGui::EndDisabled();
+                        }
+                        ImGui::SameLine();
+                        if (ImGui::Button("Reload")) {
+                            showPreviewPage(previewMode, previewPage, true);
+                        }
+
+                        PreviewService::LatencyReport latency = previewService.latency();
+                        ImGui::TextDisabled("Latency p50 %.1f / p90 %.1f / p99 %.1f ms (%zu loads, %zu cached)",
+                            latency.p50Ms, latency.p90Ms, latency.p99Ms, latency.loads, latency.cacheHits);
+                        ImGui::Separator();
+
+                        if (!preview) {
+                            ImGui::TextUnformatted("Loading...");
+                        } else if (!preview->error.empty()) {
+                            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", preview->error.c_str());
+                        } else {
+                            ImGui::Text("%s | %s | page %llu of %llu | %.1f ms",
+                                PreviewService::encodingName(preview->encoding),
+                                wstring_to_string(formatFileSize(preview->fileSize)).c_str(),
+                                static_cast<unsigned long long>(preview->page + 1),
+                                static_cast<unsigned long long>(preview->pageCount), preview->loadMs);
+                            if (ImGui::BeginChild("PreviewText", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar)) {
+                                // Text wraps to the panel; hex dumps keep their columns
+                                bool wrap = preview->mode == PreviewService::Mode::Text &&
+                                    preview->encoding != PreviewService::Encoding::Binary;
+                                if (wrap) ImGui::PushTextWrapPos(0.0f);
+                                ImGui::TextUnformatted(preview->text.data(), preview->text.data() + preview->text.size());
+                                if (wrap) ImGui::PopTextWrapPos();
+                            }
+                            ImGui::EndChild();
+                        }
+                    }
+                }
+                ImGui::EndChild();
+            }
+
             ImGui::EndTable();
         }
 